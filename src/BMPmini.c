@@ -6,23 +6,33 @@
 //-----------------------------------------------------------------------------
 #include "BMPminidef.h"
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
+#if defined(BMP_HAVE_MMAP)
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
 
 //-------------------------------------
 // Inline functions prototypes
 //-------------------------------------
 static long __get_file_size(FILE *);
-static uint32_t __get_bytes_per_pixel(BMPmini_header *restrict);
+static uint64_t __get_row_bytes(int32_t, uint32_t);
 static uint32_t __get_padding(BMPmini_header *restrict);
 static uint32_t __get_image_row_size_bytes(BMPmini_header *restrict);
+static uint32_t __get_abs_height(BMPmini_header *restrict);
 static uint32_t __get_image_size_bytes(BMPmini_header *restrict);
-static void BMPmini_perror(const char *restrict, bool);
+static uint32_t __get_palette_entries(BMPmini_header *restrict);
+static uint32_t __get_palette_offset(BMPmini_header *restrict);
+static bool __is_rle(BMPmini_header *restrict);
 static bool __st_overflow(size_t, size_t);
 static bool __int32_overflow(int32_t, int32_t);
 //-------------------------------------
 
 /* TODO check endianness */
-static void __parse_bytes2hdr(BMPmini_header *header, unsigned char *hdrdata)
+void __parse_bytes2hdr(BMPmini_header *header, unsigned char *hdrdata)
 {
     unsigned char *ptr = hdrdata;
     header->type             = (ptr[1] << 8) + ptr[0];
@@ -43,7 +53,7 @@ static void __parse_bytes2hdr(BMPmini_header *header, unsigned char *hdrdata)
     header->important_colors = (ptr[53] << 24) + (ptr[52] << 16) + (ptr[51] << 8) + ptr[50];
 }
 
-static void __parse_hdr2bytes(BMPmini_header header, unsigned char *hdrdata)
+void __parse_hdr2bytes(BMPmini_header header, unsigned char *hdrdata)
 {
     unsigned char *ptr = hdrdata;
     ptr[0] = (unsigned char) header.type;
@@ -102,214 +112,1127 @@ static void __parse_hdr2bytes(BMPmini_header header, unsigned char *hdrdata)
     ptr[53] = (unsigned char) (header.important_colors >> 24);
 }
 
-BMPmini_image *BMPmini_read(const char *restrict filename)
+void __init_header(BMPmini_header *header, int32_t width, int32_t height, uint16_t bitsperpixel)
 {
-    FILE *imgfp = fopen(filename, "rb");
-    if (!imgfp) {
-        BMPmini_PERROR(__func__, "[ERROR]: fopen", 1);
+    header->type             = BMP_MAGIC_VALUE;
+    header->reserved1        = 0;
+    header->reserved2        = 0;
+    header->offset           = BMP_HEADER_SIZE;
+    header->dib_header_size  = DIB_HEADER_SIZE;
+    header->width_px         = width;
+    header->height_px        = height;
+    header->num_planes       = BMP_NUM_PLANES;
+    header->bitsperpixel     = bitsperpixel;
+    header->compression      = BMP_COMPRESSION;
+    header->image_size_bytes = __get_image_size_bytes(header);
+    header->size             = BMP_HEADER_SIZE + header->image_size_bytes;
+    header->x_res_ppm        = 0;
+    header->y_res_ppm        = 0;
+    header->num_colors       = BMP_NUM_COLORS;
+    header->important_colors = BMP_IMPORTANT_COLORS;
+}
+
+void __fill_info(BMPmini_header *restrict header, BMPmini_info *info)
+{
+    info->width = header->width_px;
+    info->height = (int32_t) __get_abs_height(header);
+    info->top_down = header->height_px < 0;
+    info->bitsperpixel = header->bitsperpixel;
+    info->row_size = __get_image_row_size_bytes(header);
+}
+
+static void *__std_alloc(void *ctx, size_t size)
+{
+    (void) ctx;
+    return malloc(size);
+}
+
+static void __std_free(void *ctx, void *ptr, size_t size)
+{
+    (void) ctx;
+    (void) size;
+    free(ptr);
+}
+
+static BMPmini_allocator __default_allocator = {__std_alloc, __std_free, NULL};
+
+const BMPmini_allocator *__get_allocator(const BMPmini_allocator *allocator)
+{
+    return allocator ? allocator : &__default_allocator;
+}
+
+void BMPmini_set_allocator(const BMPmini_allocator *allocator)
+{
+    if (allocator) {
+        assert(allocator->alloc && allocator->free);
+        __default_allocator = *allocator;
+    }
+    else {
+        __default_allocator.alloc = __std_alloc;
+        __default_allocator.free = __std_free;
+        __default_allocator.ctx = NULL;
+    }
+}
+
+BMPmini_image *__alloc_image(BMPmini_header *restrict header, size_t datasz, const BMPmini_allocator *allocator)
+{
+    if (__st_overflow(sizeof(BMPmini_image) + BMP_PIXEL_ALIGN - 1, datasz)) {
         return NULL;
     }
 
-    /* Read BMP header */
-    unsigned char hdrbytes[BMP_HEADER_SIZE];
-    rewind(imgfp);
-    size_t nbytes = fread(hdrbytes, BMP_HEADER_SIZE, 1, imgfp);
-    if (nbytes != 1) {
-        BMPmini_PERROR(__func__, "[ERROR]: fread", 1);
-        goto CLEANUP_R1;
+    allocator = __get_allocator(allocator);
+    size_t size = sizeof(BMPmini_image) + BMP_PIXEL_ALIGN - 1 + datasz;
+    BMP_PHASE_START(t);
+    BMPmini_image *img = allocator->alloc(allocator->ctx, size);
+    BMP_PHASE_STOP(t, BMPmini_PHASE_ALLOC, size);
+    if (!img) {
+        return NULL;
     }
-    BMPmini_header header;
-    __parse_bytes2hdr(&header, hdrbytes);
+    /* Shift 'data' so that the pixels, not the extra header bytes, are aligned */
+    uintptr_t pixels = (uintptr_t) img->buf + (header->offset - BMP_HEADER_SIZE);
+    img->header = *header;
+    img->data = img->buf + (BMP_PIXEL_ALIGN - pixels % BMP_PIXEL_ALIGN) % BMP_PIXEL_ALIGN;
+    img->map_addr = NULL;
+    img->map_len = 0;
+    img->flags = 0;
+    img->alloc = *allocator;
+    img->alloc_size = size;
+    return img;
+}
 
-    /* Check BMP header */
-    if (!BMPmini_check_header(&header, imgfp)) {
-        BMPmini_PERROR(__func__, "[ERROR]: invalid BMP header", 0);
-        goto CLEANUP_R1;
+void __free_image(BMPmini_image *img)
+{
+    img->alloc.free(img->alloc.ctx, img, img->alloc_size);
+}
+
+static BMPmini_image *__new_image(BMPmini_header *restrict header, size_t datasz, const BMPmini_allocator *allocator)
+{
+    if (__st_overflow(sizeof(BMPmini_image), datasz)) {
+        BMPmini_PERROR(__func__, BMPmini_OVERFLOW_ERR, "[OVERFLOW]: size_t overflow encountered", 0);
+        return NULL;
+    }
+
+    BMPmini_image *img = __alloc_image(header, datasz, allocator);
+    if (!img) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+    }
+    return img;
+}
+
+static bool __trusted_input = false;
+
+void BMPmini_set_trusted_input(bool trusted)
+{
+    __trusted_input = trusted;
+}
+
+// Reads and checks the BMP header, returns a BMPmini status code
+static int __read_header(FILE *imgfp, BMPmini_header *header)
+{
+    BMP_PHASE_START(t);
+    int res = BMPmini_SUCCESS;
+    unsigned char hdrbytes[BMP_HEADER_SIZE];
+    if (fread(hdrbytes, BMP_HEADER_SIZE, 1, imgfp) != 1) {
+        res = BMPmini_FREAD_ERR;
+        goto CLEANUP_H1;
     }
+    __parse_bytes2hdr(header, hdrbytes);
 
+    /* Trusted files are not probed for their size, a truncated one
+     * still fails when its pixels are read */
+    long file_size = __trusted_input ? _BMP_SIZE_TRUSTED : __get_file_size(imgfp);
+    if (!__check_header(header, file_size)) {
+        res = BMPmini_HEADER_ERR;
+    }
     /* Account for data offset from header */
-    if (__st_overflow(header.image_size_bytes, header.offset - BMP_HEADER_SIZE)) {
-        BMPmini_PERROR(__func__, "[OVERFLOW]: size_t overflow encountered", 0);
-        goto CLEANUP_R1;
+    else if (__st_overflow(header->image_size_bytes, header->offset - BMP_HEADER_SIZE)) {
+        res = BMPmini_OVERFLOW_ERR;
+    }
+CLEANUP_H1:
+    BMP_PHASE_STOP(t, BMPmini_PHASE_HEADER, BMP_HEADER_SIZE);
+    return res;
+}
+
+// Reads the pixels of an image a band of rows at a time, adding each band to
+// 'stats' while it is still in the cache
+static int __read_pixels_stats(FILE *imgfp, BMPmini_image *img, BMPmini_stats *stats)
+{
+    uint32_t extra = img->header.offset - BMP_HEADER_SIZE;
+    if (extra != 0 && fread(img->data, extra, 1, imgfp) != 1) {
+        return BMPmini_FREAD_ERR;
     }
 
-    size_t imgszbytes_and_offset = header.image_size_bytes + (header.offset - BMP_HEADER_SIZE);
-    if (__st_overflow(sizeof(BMPmini_image), imgszbytes_and_offset)) {
-        BMPmini_PERROR(__func__, "[OVERFLOW]: size_t overflow encountered", 0);
+    BMPmini_view view, rows;
+    BMPmini_get_view(img, &view);
+    bool top_down = img->header.height_px < 0;
+    uint32_t row_size = __get_image_row_size_bytes(&img->header);
+    int32_t band = row_size < BMP_STATS_BAND_BYTES ? (int32_t) (BMP_STATS_BAND_BYTES / row_size) : 1;
+    for (int32_t i = 0; i < view.height; i += band) {
+        /* Stored rows [i, i + n), Bottom-Up files store the bottom rows first */
+        int32_t n = view.height - i < band ? view.height - i : band;
+        if (fread(BMPmini_pixels(img) + (size_t) i * row_size, (size_t) n * row_size, 1, imgfp) != 1) {
+            return BMPmini_FREAD_ERR;
+        }
+        BMPmini_crop_view(&view, 0, top_down ? i : view.height - i - n, view.width, n, &rows);
+        int res = __stats_update(stats, &rows, 0, !top_down);
+        if (res != BMPmini_SUCCESS) {
+            return res;
+        }
+    }
+    return BMPmini_SUCCESS;
+}
+
+static int __read_image_stats(const char *restrict filename, BMPmini_image **out,
+                              const BMPmini_allocator *allocator, BMPmini_stats *stats)
+{
+    *out = NULL;
+    FILE *imgfp = __open_file(filename, "rb");
+    if (!imgfp) {
+        return BMPmini_FOPEN_ERR;
+    }
+
+    BMPmini_header header;
+    int res = __read_header(imgfp, &header);
+    if (res != BMPmini_SUCCESS) {
+        goto CLEANUP_R1;
+    }
+    if (stats && header.bitsperpixel != 24 && header.bitsperpixel != 32) {
+        res = BMPmini_FORMAT_ERR;
         goto CLEANUP_R1;
     }
 
-    BMPmini_image *img = malloc(sizeof(*img) + imgszbytes_and_offset);
+    /* Compressed pixels are decoded as they are read, the image holds them decoded */
+    uint32_t stored_size = header.image_size_bytes;
+    bool rle = __is_rle(&header);
+    if (rle) {
+        __rle_decoded_header(&header);
+        if (__st_overflow(header.image_size_bytes, header.offset - BMP_HEADER_SIZE)) {
+            res = BMPmini_OVERFLOW_ERR;
+            goto CLEANUP_R1;
+        }
+    }
+
+    size_t imgszbytes_and_offset = header.image_size_bytes + (header.offset - BMP_HEADER_SIZE);
+    BMPmini_image *img = __alloc_image(&header, imgszbytes_and_offset, allocator);
     if (!img) {
-        BMPmini_PERROR(__func__, "[ERROR]: malloc", 1);
+        res = BMPmini_NOMEM_ERR;
         goto CLEANUP_R1;
     }
-    //memcpy(&img->header, &header, BMP_HEADER_SIZE);
-    img->header = header;
 
     /* Read BMP image data */
-    nbytes = fread(img->data, imgszbytes_and_offset, 1, imgfp);
-    if (nbytes != 1) {
-        BMPmini_PERROR(__func__, "[ERROR]: fread", 1);
-        goto CLEANUP_R0;
+    BMP_PHASE_START(t_read);
+    if (rle) {
+        if ((header.offset != BMP_HEADER_SIZE && fread(img->data, header.offset - BMP_HEADER_SIZE, 1, imgfp) != 1)
+            || (res = __rle_decode(imgfp, NULL, stored_size, &header, BMPmini_pixels(img))) != BMPmini_SUCCESS) {
+            __free_image(img);
+            res = res != BMPmini_SUCCESS ? res : BMPmini_FREAD_ERR;
+            goto CLEANUP_R1;
+        }
+    }
+    else if (stats) {
+        BMPmini_stats_init(stats);
+        if ((res = __read_pixels_stats(imgfp, img, stats)) != BMPmini_SUCCESS) {
+            __free_image(img);
+            goto CLEANUP_R1;
+        }
+    }
+    else if (fread(img->data, imgszbytes_and_offset, 1, imgfp) != 1) {
+        __free_image(img);
+        res = BMPmini_FREAD_ERR;
+        goto CLEANUP_R1;
+    }
+    BMP_PHASE_STOP(t_read, BMPmini_PHASE_READ, imgszbytes_and_offset);
+    *out = img;
+CLEANUP_R1:
+    __close_file(imgfp);
+    return res;
+}
+
+int __read_image(const char *restrict filename, BMPmini_image **out, const BMPmini_allocator *allocator)
+{
+    return __read_image_stats(filename, out, allocator, NULL);
+}
+
+int BMPmini_probe(const char *restrict filename, BMPmini_info *info)
+{
+    assert(info);
+
+    FILE *imgfp = __open_file(filename, "rb");
+    if (!imgfp) {
+        return BMPmini_FOPEN_ERR;
     }
 
-    if (fclose(imgfp) == EOF) {
-        BMPmini_PERROR(__func__, "[WARN]: fclose", 1);
+    /* Only the header is read, stdio buffers no more than a block */
+    BMPmini_header header;
+    int res = __read_header(imgfp, &header);
+    if (res == BMPmini_SUCCESS) {
+        __fill_info(&header, info);
+    }
+    __close_file(imgfp);
+    return res;
+}
+
+int BMPmini_read_into(const char *restrict filename, BMPmini_info *info, void *buf, size_t bufsize)
+{
+    assert(info && (buf || bufsize == 0));
+
+    FILE *imgfp = __open_file(filename, "rb");
+    if (!imgfp) {
+        return BMPmini_FOPEN_ERR;
+    }
+
+    BMPmini_header header;
+    int res = __read_header(imgfp, &header);
+    if (res != BMPmini_SUCCESS) {
+        goto CLEANUP_RI1;
+    }
+    __fill_info(&header, info);
+
+    BMPmini_header decoded = header;
+    if (__is_rle(&header)) {
+        __rle_decoded_header(&decoded);
+    }
+    if (bufsize < decoded.image_size_bytes) {
+        res = BMPmini_BUFFER_ERR;
+        goto CLEANUP_RI1;
+    }
+
+    /* Pixels go straight into the caller buffer, extra header bytes are skipped */
+    if (header.offset != BMP_HEADER_SIZE && fseek(imgfp, (long) header.offset, SEEK_SET)) {
+        res = BMPmini_FREAD_ERR;
+        goto CLEANUP_RI1;
+    }
+    BMP_PHASE_START(t);
+    if (__is_rle(&header)) {
+        res = __rle_decode(imgfp, NULL, header.image_size_bytes, &decoded, buf);
+    }
+    else if (fread(buf, header.image_size_bytes, 1, imgfp) != 1) {
+        res = BMPmini_FREAD_ERR;
+    }
+    BMP_PHASE_STOP(t, BMPmini_PHASE_READ, decoded.image_size_bytes);
+CLEANUP_RI1:
+    __close_file(imgfp);
+    return res;
+}
+
+const char *BMPmini_strerror(int status)
+{
+    switch (status) {
+    case BMPmini_SUCCESS:      return "success";
+    case BMPmini_FOPEN_ERR:    return "failed to open the file";
+    case BMPmini_FWRITE_ERR:   return "failed to write to the file";
+    case BMPmini_FREAD_ERR:    return "failed to read from the file";
+    case BMPmini_HEADER_ERR:   return "invalid BMP header";
+    case BMPmini_OVERFLOW_ERR: return "image size overflow";
+    case BMPmini_NOMEM_ERR:    return "out of memory";
+    case BMPmini_BUFFER_ERR:   return "buffer too small";
+    case BMPmini_RANGE_ERR:    return "region outside of the image";
+    case BMPmini_FORMAT_ERR:   return "unsupported pixel format";
+    default:                   return "unknown error";
+    }
+}
+
+void __report_status(const char *file, const char *func, unsigned long line, int status)
+{
+    /* Only failures of the C library leave a meaningful errno */
+    bool syserr = status == BMPmini_FOPEN_ERR || status == BMPmini_FREAD_ERR || status == BMPmini_FWRITE_ERR;
+    char msg[64];
+    snprintf(msg, sizeof(msg), "[ERROR]: %s%s", BMPmini_strerror(status), syserr ? "" : "\n");
+    __report_error(file, func, line, status, msg, syserr);
+}
+
+BMPmini_image *BMPmini_read(const char *restrict filename)
+{
+    return BMPmini_read_with(filename, NULL);
+}
+
+BMPmini_image *BMPmini_read_with(const char *restrict filename, const BMPmini_allocator *allocator)
+{
+    return BMPmini_read_stats(filename, allocator, NULL);
+}
+
+BMPmini_image *BMPmini_read_stats(const char *restrict filename, const BMPmini_allocator *allocator,
+                                  BMPmini_stats *stats)
+{
+    BMPmini_image *img;
+    int res = __read_image_stats(filename, &img, allocator, stats);
+    if (res != BMPmini_SUCCESS) {
+        __perror_status(__func__, res);
     }
     return img;
-CLEANUP_R0:
-    free(img);
-    img = NULL;
-CLEANUP_R1:
-    if (fclose(imgfp) == EOF) {
-        BMPmini_PERROR(__func__, "[WARN]: fclose", 1);
+}
+
+// Reads 'len' bytes at 'off', with pread where it exists so that a single
+// system call reads them
+static bool __read_at(FILE *imgfp, void *buf, size_t len, uint64_t off)
+{
+#if defined(BMP_HAVE_PWRITE)
+    int fd = fileno(imgfp);
+    uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, (off_t) off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= (size_t) n;
+        off += (uint64_t) n;
     }
-    return NULL;
+    return true;
+#else
+    return off <= LONG_MAX && !fseek(imgfp, (long) off, SEEK_SET) && fread(buf, len, 1, imgfp) == 1;
+#endif
+}
+
+int __read_region_into(FILE *imgfp, BMPmini_header *header, int32_t x, int32_t y, const BMPmini_view *dst,
+                       uint32_t padding)
+{
+    uint32_t row_size = __get_image_row_size_bytes(header);
+    size_t span = (size_t) __get_row_bytes(dst->width, header->bitsperpixel);
+    uint32_t rows = (uint32_t) dst->height;
+
+    /* Rows keep their order, so the region is a run of stored rows in both
+     * orientations: Bottom-Up files store the bottom rows first. They are
+     * read in file order into the rows of 'dst'. */
+    bool top_down = header->height_px < 0;
+    uint32_t first = top_down ? (uint32_t) y : __get_abs_height(header) - (uint32_t) y - rows;
+    uint32_t skip = (uint32_t) ((size_t) x * header->bitsperpixel / BMP_BITS_PER_BYTE);
+    uint64_t off = header->offset + (uint64_t) first * row_size + skip;
+    ptrdiff_t step = top_down ? dst->stride : -dst->stride;
+    uint8_t *row = top_down ? dst->base : dst->base + (ptrdiff_t) (rows - 1) * dst->stride;
+
+    int res = BMPmini_SUCCESS;
+    BMP_PHASE_START(t);
+    /* Whole rows stored alike in both are read at once */
+    if (dst->width == header->width_px && step == (ptrdiff_t) row_size) {
+        if (!__read_at(imgfp, row, (size_t) rows * row_size, off)) {
+            res = BMPmini_FREAD_ERR;
+        }
+    }
+    /* Narrow regions are read a row at a time, the rest of the rows is skipped */
+    else if (row_size - span > BMP_REGION_MAX_GAP) {
+#if defined(BMP_HAVE_PWRITE) && defined(POSIX_FADV_WILLNEED)
+        /* Rows not in the page cache are all requested before the first
+         * one is waited for */
+        for (uint32_t i = 0; i < rows; i++) {
+            posix_fadvise(fileno(imgfp), (off_t) (off + (uint64_t) i * row_size), (off_t) span, POSIX_FADV_WILLNEED);
+        }
+#endif
+        for (uint32_t i = 0; i < rows; i++, row += step, off += row_size) {
+            if (!__read_at(imgfp, row, span, off)) {
+                res = BMPmini_FREAD_ERR;
+                break;
+            }
+            memset(row + span, 0, padding);
+        }
+    }
+    /* Wide ones are read a band of rows at a time, gaps included, as reading
+     * a few more bytes costs less than a system call per row */
+    else {
+        uint32_t band = row_size < BMP_STATS_BAND_BYTES ? BMP_STATS_BAND_BYTES / row_size : 1;
+        band = band < rows ? band : rows;
+        uint8_t *buf = malloc((size_t) band * row_size);
+        if (!buf) {
+            return BMPmini_NOMEM_ERR;
+        }
+        for (uint32_t i = 0; i < rows && res == BMPmini_SUCCESS; i += band) {
+            uint32_t n = rows - i < band ? rows - i : band;
+            if (!__read_at(imgfp, buf, (size_t) (n - 1) * row_size + span, off + (uint64_t) i * row_size)) {
+                res = BMPmini_FREAD_ERR;
+                break;
+            }
+            for (uint32_t k = 0; k < n; k++, row += step) {
+                memcpy(row, buf + (size_t) k * row_size, span);
+                memset(row + span, 0, padding);
+            }
+        }
+        free(buf);
+    }
+    if (res == BMPmini_SUCCESS) {
+        BMP_PHASE_STOP(t, BMPmini_PHASE_READ, span * rows);
+    }
+    return res;
+}
+
+static int __read_region(const char *restrict filename, int32_t x, int32_t y, int32_t w, int32_t h,
+                         BMPmini_image **out, const BMPmini_allocator *allocator)
+{
+    *out = NULL;
+    FILE *imgfp = __open_file(filename, "rb");
+    if (!imgfp) {
+        return BMPmini_FOPEN_ERR;
+    }
+
+    BMPmini_header header;
+    int res = __read_header(imgfp, &header);
+    if (res != BMPmini_SUCCESS) {
+        goto CLEANUP_RR1;
+    }
+    /* Rows of RLE images have no fixed place in the file */
+    if (__is_rle(&header)) {
+        res = BMPmini_FORMAT_ERR;
+        goto CLEANUP_RR1;
+    }
+    uint32_t height = __get_abs_height(&header);
+    if (__int32_overflow(x, w) || __int32_overflow(y, h) || x+w > header.width_px || (uint32_t) (y+h) > height
+        || (size_t) x * header.bitsperpixel % BMP_BITS_PER_BYTE) {
+        res = BMPmini_RANGE_ERR;
+        goto CLEANUP_RR1;
+    }
+
+    /* Same header as BMPmini_crop gives, the color table is kept */
+    bool top_down = header.height_px < 0;
+    BMPmini_header newheader = header;
+    newheader.width_px = w;
+    newheader.height_px = top_down ? -h : h;
+    newheader.image_size_bytes = __get_image_size_bytes(&newheader);
+    size_t extra = header.offset - BMP_HEADER_SIZE;
+    size_t imgszbytes_and_offset = newheader.image_size_bytes + extra;
+    newheader.size = imgszbytes_and_offset + BMP_HEADER_SIZE;
+
+    BMPmini_image *img = __alloc_image(&newheader, imgszbytes_and_offset, allocator);
+    if (!img) {
+        res = BMPmini_NOMEM_ERR;
+        goto CLEANUP_RR1;
+    }
+
+    BMPmini_view view;
+    BMPmini_get_view(img, &view);
+    if (extra != 0 && !__read_at(imgfp, img->data, extra, BMP_HEADER_SIZE)) {
+        res = BMPmini_FREAD_ERR;
+    }
+    else {
+        res = __read_region_into(imgfp, &header, x, y, &view, __get_padding(&newheader));
+    }
+    if (res != BMPmini_SUCCESS) {
+        __free_image(img);
+        goto CLEANUP_RR1;
+    }
+    *out = img;
+CLEANUP_RR1:
+    __close_file(imgfp);
+    return res;
+}
+
+BMPmini_image *BMPmini_read_region(const char *restrict filename, int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    return BMPmini_read_region_with(filename, x, y, w, h, NULL);
+}
+
+BMPmini_image *BMPmini_read_region_with(const char *restrict filename, int32_t x, int32_t y, int32_t w, int32_t h,
+                                        const BMPmini_allocator *allocator)
+{
+    assert(x >= 0 && y >= 0 && w > 0 && h > 0);
+
+    BMPmini_image *img;
+    int res = __read_region(filename, x, y, w, h, &img, allocator);
+    if (res != BMPmini_SUCCESS) {
+        __perror_status(__func__, res);
+    }
+    return img;
+}
+
+struct __read_job {
+    const char *const *paths;
+    BMPmini_image **images;
+    int *status;
+};
+
+static void __read_band(void *arg, int32_t first, int32_t last)
+{
+    struct __read_job *job = arg;
+    for (int32_t i = first; i < last; i++) {
+        int res = __read_image(job->paths[i], &job->images[i], NULL);
+        if (job->status) {
+            job->status[i] = res;
+        }
+    }
+}
+
+size_t BMPmini_read_batch(const char *const *paths, size_t n, BMPmini_image **images, int *status, int nthreads)
+{
+    assert((paths && images) || n == 0);
+    assert(n <= INT32_MAX);
+
+    /* Files are worth a band each, whatever their size */
+    struct __read_job job = {paths, images, status};
+    __run_bands((int32_t) n, BMP_MIN_BAND_BYTES, nthreads, __read_band, &job);
+
+    size_t nread = 0;
+    for (size_t i = 0; i < n; i++) {
+        nread += images[i] != NULL;
+    }
+    return nread;
 }
 
 int BMPmini_write(const char *restrict filename, BMPmini_image *img)
+{
+    return BMPmini_write_opts(filename, img, 0);
+}
+
+int BMPmini_write_opts(const char *restrict filename, BMPmini_image *img, int flags)
 {
     assert(img);
 
-    FILE *imgfp = fopen(filename, "wb");
+    BMPmini_header header = img->header;
+    bool rle = flags & BMPmini_WRITE_RLE;
+    if (rle) {
+        if (header.bitsperpixel != 8 && header.bitsperpixel != 4) {
+            BMPmini_PERROR(__func__, BMPmini_FORMAT_ERR, "[ERROR]: only 4 and 8 bpp images can be RLE compressed\n", 0);
+            return BMPmini_FORMAT_ERR;
+        }
+        /* Sizes are known once the pixels have been encoded */
+        header.compression = header.bitsperpixel == 8 ? BMP_BI_RLE8 : BMP_BI_RLE4;
+        header.height_px = (int32_t) __get_abs_height(&header);
+    }
+
+    FILE *imgfp = __open_file(filename, "wb");
     if (!imgfp) {
-        BMPmini_PERROR(__func__, "[ERROR]: fopen", 1);
+        BMPmini_PERROR(__func__, BMPmini_FOPEN_ERR, "[ERROR]: fopen", 1);
         return BMPmini_FOPEN_ERR;
     }
 
-    rewind(imgfp);
+    int res = BMPmini_FWRITE_ERR;
+    BMP_PHASE_START(t);
     unsigned char hdrbytes[BMP_HEADER_SIZE];
-    __parse_hdr2bytes(img->header, hdrbytes);
+    __parse_hdr2bytes(header, hdrbytes);
     size_t nbytes = fwrite(hdrbytes, BMP_HEADER_SIZE, 1, imgfp);
     if (nbytes != 1) {
-        BMPmini_PERROR(__func__, "[ERROR]: fwrite", 1);
-        return BMPmini_FWRITE_ERR;
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: fwrite", 1);
+        goto CLEANUP_W1;
     }
 
-    nbytes = fwrite(img->data, img->header.image_size_bytes + (img->header.offset - BMP_HEADER_SIZE), 1, imgfp);
-    if (nbytes != 1) {
-        BMPmini_PERROR(__func__, "[ERROR]: fwrite", 1);
-        return BMPmini_FWRITE_ERR;
+    if (!rle) {
+        size_t datasz = img->header.image_size_bytes + (img->header.offset - BMP_HEADER_SIZE);
+        nbytes = fwrite(img->data, datasz, 1, imgfp);
+        if (nbytes != 1) {
+            BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: fwrite", 1);
+            goto CLEANUP_W1;
+        }
+        BMP_PHASE_STOP(t, BMPmini_PHASE_WRITE, BMP_HEADER_SIZE + datasz);
+        res = BMPmini_SUCCESS;
+        goto CLEANUP_W1;
     }
 
-    if (fclose(imgfp) == EOF) {
-        BMPmini_PERROR(__func__, "[ERROR]: fclose", 1);
+    /* Extra header bytes and palette, then the encoded pixels */
+    if (header.offset != BMP_HEADER_SIZE && fwrite(img->data, header.offset - BMP_HEADER_SIZE, 1, imgfp) != 1) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: fwrite", 1);
+        goto CLEANUP_W1;
     }
-    return BMPmini_SUCCESS;
+    res = __rle_encode(imgfp, img, &header.image_size_bytes);
+    if (res != BMPmini_SUCCESS) {
+        __perror_status(__func__, res);
+        goto CLEANUP_W1;
+    }
+    header.size = header.offset + header.image_size_bytes;
+    __parse_hdr2bytes(header, hdrbytes);
+    if (fseek(imgfp, 0, SEEK_SET) || fwrite(hdrbytes, BMP_HEADER_SIZE, 1, imgfp) != 1) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: fwrite", 1);
+        res = BMPmini_FWRITE_ERR;
+    }
+    else {
+        BMP_PHASE_STOP(t, BMPmini_PHASE_WRITE, header.size);
+    }
+CLEANUP_W1:
+    if (__close_file(imgfp) == EOF) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: fclose", 1);
+        res = BMPmini_FWRITE_ERR;
+    }
+    return res;
 }
 
-BMPmini_image *BMPmini_crop(BMPmini_image *img, int32_t x, int32_t y, int32_t w, int32_t h)
+struct __copy_job {
+    const BMPmini_view *src;
+    const BMPmini_view *dst;
+    size_t row_bytes;   // Pixel bytes per row
+    uint32_t padding;   // Bytes to be zeroed after each destination row
+};
+
+static void __copy_band(void *arg, int32_t first, int32_t last)
 {
-    assert(img);
-    assert(x >= 0 && y >= 0 && w > 0 && h > 0);
+    struct __copy_job *job = arg;
+    const BMPmini_view *src = job->src;
+    const BMPmini_view *dst = job->dst;
 
-    if (__int32_overflow(x, w) || __int32_overflow(y, h)) {
-        BMPmini_PERROR(__func__, "[OVERFLOW]: int32_t overflow encountered", 0);
-        return NULL;
+    /* Every row is one contiguous span of bytes in both views */
+    if (job->padding == 0 && src->stride == dst->stride && (size_t) src->stride == job->row_bytes) {
+        memcpy(dst->base + first * dst->stride, src->base + first * src->stride, job->row_bytes * (last - first));
+        return;
+    }
+
+    /* Walk the destination in memory order */
+    int32_t i = dst->stride < 0 ? last - 1 : first;
+    int32_t step = dst->stride < 0 ? -1 : 1;
+    for (int32_t n = first; n < last; n++, i += step) {
+        uint8_t *row = dst->base + i * dst->stride;
+        memcpy(row, src->base + i * src->stride, job->row_bytes);
+        memset(row + job->row_bytes, 0, job->padding);
     }
+}
+
+static void __copy_rows(const BMPmini_view *src, const BMPmini_view *dst, uint32_t padding, int nthreads)
+{
+    struct __copy_job job = {src, dst, (size_t) __get_row_bytes(src->width, src->bitsperpixel), padding};
+    BMP_PHASE_START(t);
+    __run_bands(src->height, job.row_bytes, nthreads, __copy_band, &job);
+    BMP_PHASE_STOP(t, BMPmini_PHASE_COPY, job.row_bytes * (size_t) src->height);
+}
+
+static BMPmini_image *__crop(BMPmini_image *img, int32_t x, int32_t y, int32_t w, int32_t h, int nthreads,
+                             const BMPmini_allocator *allocator)
+{
+    assert(img);
+    assert(x >= 0 && y >= 0 && w > 0 && h > 0);
 
-    if (x+w > img->header.width_px || y+h > img->header.height_px) {
-        BMPmini_PERROR(__func__, "[ERROR]: size of the new image greater than original", 0);
+    BMPmini_view view;
+    BMPmini_get_view(img, &view);
+    if (!BMPmini_crop_view(&view, x, y, w, h, &view)) {
         return NULL;
     }
 
-    /* Update new header size and dimensions info */
+    /* Update new header size and dimensions info, keeping the row order */
     BMPmini_header newheader = img->header;
     newheader.width_px = w;
-    newheader.height_px = h;
+    newheader.height_px = img->header.height_px < 0 ? -h : h;
     newheader.image_size_bytes = __get_image_size_bytes(&newheader);
 
     if (__st_overflow(newheader.image_size_bytes, newheader.offset - BMP_HEADER_SIZE)) {
-        BMPmini_PERROR(__func__, "[OVERFLOW]: size_t overflow encountered", 0);
+        BMPmini_PERROR(__func__, BMPmini_OVERFLOW_ERR, "[OVERFLOW]: size_t overflow encountered", 0);
         return NULL;
     }
     size_t imgszbytes_and_offset = newheader.image_size_bytes + (newheader.offset - BMP_HEADER_SIZE);
     newheader.size = imgszbytes_and_offset + BMP_HEADER_SIZE;
 
-    if (__st_overflow(sizeof(BMPmini_image), imgszbytes_and_offset)) {
-        BMPmini_PERROR(__func__, "[OVERFLOW]: size_t overflow encountered", 0);
-        return NULL;
-    }
-
-    BMPmini_image *newimg = malloc(sizeof(*newimg) + imgszbytes_and_offset);
+    BMPmini_image *newimg = __new_image(&newheader, imgszbytes_and_offset, allocator);
     if (!newimg) {
-        BMPmini_PERROR(__func__, "[ERROR]: malloc", 1);
         return NULL;
     }
-    newimg->header = newheader;
 
-    /* Get final crop positions */
-    int32_t width = x + w;
-    int32_t height = y + h;
+    /* Size of offset is allocated within data array */
+    memcpy(newimg->data, img->data, newheader.offset - BMP_HEADER_SIZE);
+
+    BMPmini_view newview;
+    BMPmini_get_view(newimg, &newview);
+    __copy_rows(&view, &newview, __get_padding(&newimg->header), nthreads);
+
+    return newimg;
+}
 
-    /* Bottom-Up DIB */
-    if (img->header.height_px > 0) {
-        y = img->header.height_px - height;
-        height = y + h;
+BMPmini_image *BMPmini_crop(BMPmini_image *img, int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    return __crop(img, x, y, w, h, 0, NULL);
+}
+
+BMPmini_image *BMPmini_crop_threads(BMPmini_image *img, int32_t x, int32_t y, int32_t w, int32_t h, int nthreads)
+{
+    return __crop(img, x, y, w, h, nthreads, NULL);
+}
+
+int BMPmini_crop_into(BMPmini_image *img, int32_t x, int32_t y, int32_t w, int32_t h,
+                      void *buf, size_t bufsize, size_t stride)
+{
+    assert(img && (buf || bufsize == 0));
+    assert(x >= 0 && y >= 0 && w > 0 && h > 0);
+
+    if (__int32_overflow(x, w) || __int32_overflow(y, h)
+        || x+w > img->header.width_px || (uint32_t) (y+h) > __get_abs_height(&img->header)
+        || (size_t) x * img->header.bitsperpixel % BMP_BITS_PER_BYTE) {
+        return BMPmini_RANGE_ERR;
     }
-    /* Top-Down DIB - nothing to do */
 
-    int32_t newidx = newimg->header.offset - BMP_HEADER_SIZE;
-    uint32_t bpp = __get_bytes_per_pixel(&img->header);
-    uint32_t width_and_padding = img->header.width_px + __get_padding(&img->header);
-    int32_t newimg_padding = __get_padding(&newimg->header);
-    /* Size of offset is allocated within data array */
-    uint8_t *data = img->data + (img->header.offset - BMP_HEADER_SIZE);
-    for (int32_t i = y; i < height; i++) {
-        for (int32_t j = x; j < width; j++) {
-            uint32_t offset = j + width_and_padding * i;
-            uint8_t *pixeloffset = data + offset * bpp;
-            for (uint8_t k = 0; k < 3; k++) {
-                newimg->data[newidx++] = pixeloffset[k];
-            }
-        }
+    size_t row_bytes = (size_t) __get_row_bytes(w, img->header.bitsperpixel);
+    if (stride == 0) {
+        stride = row_bytes;
+    }
+    /* The last row only needs 'row_bytes' */
+    if (stride < row_bytes || stride > PTRDIFF_MAX || bufsize < row_bytes
+        || (bufsize - row_bytes) / stride < (size_t) h - 1) {
+        return BMPmini_BUFFER_ERR;
+    }
+
+    BMPmini_view view, dst = {buf, (ptrdiff_t) stride, w, h, img->header.bitsperpixel};
+    BMPmini_get_view(img, &view);
+    BMPmini_crop_view(&view, x, y, w, h, &view);
+    BMPmini_copy_view(&view, &dst, 0);
+    return BMPmini_SUCCESS;
+}
+
+BMPmini_image *BMPmini_crop_with(BMPmini_image *img, int32_t x, int32_t y, int32_t w, int32_t h,
+                                 const BMPmini_allocator *allocator)
+{
+    return __crop(img, x, y, w, h, 0, allocator);
+}
 
-        memset(newimg->data + newidx, 0, newimg_padding);
-        newidx += newimg_padding;
+// Checks the pixel format and that the color table lies before the pixels
+static bool __check_format(BMPmini_header *restrict header)
+{
+    switch (header->bitsperpixel) {
+    case 1:
+    case 4:
+    case 8:
+        if (header->num_colors > 1U << header->bitsperpixel) {
+            return false;
+        }
+        /* RLE images can only be stored Bottom-Up */
+        if (header->compression != BMP_COMPRESSION
+            && !(header->compression == BMP_BI_RLE8 && header->bitsperpixel == 8 && header->height_px > 0)
+            && !(header->compression == BMP_BI_RLE4 && header->bitsperpixel == 4 && header->height_px > 0)) {
+            return false;
+        }
+        break;
+    case 24:
+        if (header->compression != BMP_COMPRESSION) {
+            return false;
+        }
+        break;
+    case 32:
+        if (header->compression != BMP_COMPRESSION && header->compression != BMP_BI_BITFIELDS) {
+            return false;
+        }
+        break;
+    default:
+        return false;
     }
 
-    return newimg;
+    uint32_t entries = __get_palette_entries(header);
+    return header->dib_header_size >= DIB_HEADER_SIZE
+    && entries <= BMP_MAX_PALETTE
+    && header->important_colors <= entries
+    && (uint64_t) __get_palette_offset(header) + entries * 4U <= header->offset;
 }
 
-bool BMPmini_check_header(BMPmini_header *restrict header, FILE *imgfp)
+bool __check_header(BMPmini_header *restrict header, long file_size)
 {
     assert(header);
     /* A BMP header is valid if:
      *   * It's magic number is 0x4d42
+     *   * The width is positive and the height is non-zero (negative  for
+     *     Top-Down DIBs)
      *   * There is only one image plane
-     *   * There is no compression
-     *   * num_colors and important_colors are both 0
-     *   * The image has BMP_BITS_PER_PIXEL bits per pixel
+     *   * The image has 1, 4 or 8 (paletted), 24 or 32 bits per pixel
+     *   * There is no compression, except for BI_BITFIELDS on 32 bpp  and
+     *     BI_RLE8/BI_RLE4 on Bottom-Up 8/4 bpp images
+     *   * num_colors fits the bits per pixel and important_colors is  not
+     *     greater than it
      *   * The 'size' and 'image_size_bytes' fields are correct in  relation
      *     to the bits, width, and height fields and in relation to the file
-     *     size
+     *     size (unless it is _BMP_SIZE_TRUSTED). RLE images only  need  a
+     *     non-zero 'image_size_bytes', their decoded size must fit 32 bits
+     *   * The masks, color table and pixel array starting at 'offset'  lie
+     *     within the file, in that order
      */
 #if defined(BMP_DEBUG)
     printf("TYPE:             Received: %"PRIu16" , expected: %d\n", header->type, BMP_MAGIC_VALUE);
     printf("NUM_PLANES:       Received: %"PRIu16" , expected: %d\n", header->num_planes, BMP_NUM_PLANES);
-    printf("COMPRESSION:      Received: %"PRIu32" , expected: %d\n", header->compression, BMP_COMPRESSION);
-    printf("NUM_COLORS:       Received: %"PRIu32" , expected: %d\n", header->num_colors, BMP_NUM_COLORS);
-    printf("IMPORTANT_COLORS: Received: %"PRIu32" , expected: %d\n", header->important_colors, BMP_IMPORTANT_COLORS);
-    printf("BITSPERPIXEL:     Received: %"PRIu16" , expected: %d\n", header->bitsperpixel, BMP_BITS_PER_PIXEL);
-    printf("SIZE:             Received: %"PRIu32" , expected: %"PRIu32"\n", header->size, __get_file_size(imgfp));
+    printf("BITSPERPIXEL:     Received: %"PRIu16" , expected: 1, 4, 8, 24 or 32\n", header->bitsperpixel);
+    printf("COMPRESSION:      Received: %"PRIu32" , expected: 0 to 3\n", header->compression);
+    printf("NUM_COLORS:       Received: %"PRIu32" , expected: at most %u\n", header->num_colors, BMP_MAX_PALETTE);
+    printf("IMPORTANT_COLORS: Received: %"PRIu32" , expected: at most %"PRIu32"\n", header->important_colors, __get_palette_entries(header));
+    printf("SIZE:             Received: %"PRIu32" , expected: %ld\n", header->size, file_size);
     printf("IMAGE_SIZE_BYTES: Received: %"PRIu32" , expected: %"PRIu32"\n", header->image_size_bytes, __get_image_size_bytes(header));
     fflush(stdout);
 #endif
     return header->type == BMP_MAGIC_VALUE
+    && header->width_px > 0
+    && header->height_px != 0
+    && header->height_px != INT32_MIN
     && header->num_planes == BMP_NUM_PLANES
-    && header->compression == BMP_COMPRESSION
-    && header->num_colors == BMP_NUM_COLORS
-    && header->important_colors == BMP_IMPORTANT_COLORS
-    && header->bitsperpixel == BMP_BITS_PER_PIXEL
-    && header->size == __get_file_size(imgfp)
-    && header->image_size_bytes == __get_image_size_bytes(header);
+    && __check_format(header)
+    && (uint64_t) __get_image_row_size_bytes(header) == ((__get_row_bytes(header->width_px, header->bitsperpixel) + 3) & ~(uint64_t) 3)
+    && (uint64_t) __get_image_row_size_bytes(header) * __get_abs_height(header) <= UINT32_MAX
+    && (uint64_t) header->offset + __get_image_size_bytes(header) <= UINT32_MAX
+    && (file_size == _BMP_SIZE_TRUSTED || header->size == file_size)
+    && (__is_rle(header) ? header->image_size_bytes > 0 : header->image_size_bytes == __get_image_size_bytes(header))
+    && header->offset >= BMP_HEADER_SIZE
+    && header->offset <= header->size
+    && header->image_size_bytes <= header->size - header->offset;
+}
+
+bool BMPmini_check_header(BMPmini_header *restrict header, FILE *imgfp)
+{
+    assert(header);
+    return __check_header(header, __get_file_size(imgfp));
+}
+
+BMPmini_image *BMPmini_map(const char *restrict filename, int flags)
+{
+#if defined(BMP_HAVE_MMAP)
+    BMP_PHASE_START(t);
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        BMPmini_PERROR(__func__, BMPmini_FOPEN_ERR, "[ERROR]: open", 1);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[ERROR]: fstat", 1);
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size < (off_t) BMP_HEADER_SIZE || (uintmax_t) st.st_size > SIZE_MAX) {
+        BMPmini_PERROR(__func__, BMPmini_HEADER_ERR, "[ERROR]: invalid BMP file size", 0);
+        close(fd);
+        return NULL;
+    }
+
+    /* A private writable mapping gives copy-on-write pages: the file is
+     * never modified and only the touched pages get duplicated */
+    bool cow = flags & BMPmini_MAP_COW;
+    int prot = cow ? PROT_READ | PROT_WRITE : PROT_READ;
+    size_t map_len = (size_t) st.st_size;
+    void *addr = mmap(NULL, map_len, prot, MAP_PRIVATE, fd, 0);
+    if (close(fd) == -1) {
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[WARN]: close", 1);
+    }
+    if (addr == MAP_FAILED) {
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[ERROR]: mmap", 1);
+        return NULL;
+    }
+    BMP_PHASE_STOP(t, BMPmini_PHASE_OPEN, 0);
+
+    BMP_PHASE_START(t_header);
+    BMPmini_header header;
+    __parse_bytes2hdr(&header, addr);
+    bool valid = __check_header(&header, (long) map_len);
+    BMP_PHASE_STOP(t_header, BMPmini_PHASE_HEADER, BMP_HEADER_SIZE);
+    if (!valid) {
+        BMPmini_PERROR(__func__, BMPmini_HEADER_ERR, "[ERROR]: invalid BMP header", 0);
+        goto CLEANUP_M1;
+    }
+
+    /* Compressed pixels cannot be used in place, they are decoded into the heap */
+    BMPmini_image *img;
+    if (__is_rle(&header)) {
+        int res = __rle_decode_image(&header, (uint8_t *) addr + BMP_HEADER_SIZE, &img, NULL);
+        if (res != BMPmini_SUCCESS) {
+            __perror_status(__func__, res);
+        }
+        if (munmap(addr, map_len) == -1) {
+            BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[WARN]: munmap", 1);
+        }
+        return img;
+    }
+
+    img = malloc(sizeof(*img));
+    if (!img) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        goto CLEANUP_M1;
+    }
+    img->header = header;
+    img->data = (uint8_t *) addr + BMP_HEADER_SIZE;
+    img->map_addr = addr;
+    img->map_len = map_len;
+    img->flags = _BMP_IMG_MAPPED | (cow ? 0 : _BMP_IMG_RDONLY);
+    return img;
+CLEANUP_M1:
+    if (munmap(addr, map_len) == -1) {
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[WARN]: munmap", 1);
+    }
+    return NULL;
+#else
+    /* No mmap available: fall back to a private heap copy */
+    (void) flags;
+    return BMPmini_read(filename);
+#endif
+}
+
+void BMPmini_unmap(BMPmini_image *img)
+{
+    if (!img) {
+        return;
+    }
+#if defined(BMP_HAVE_MMAP)
+    if (img->flags & _BMP_IMG_MAPPED) {
+        if (munmap(img->map_addr, img->map_len) == -1) {
+            BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[WARN]: munmap", 1);
+        }
+        free(img);
+        return;
+    }
+#endif
+    /* Heap copy made when mmap is not available */
+    __free_image(img);
+}
+
+void BMPmini_get_info(BMPmini_image *img, BMPmini_info *info)
+{
+    assert(img && info);
+    __fill_info(&img->header, info);
+}
+
+uint32_t BMPmini_get_palette(BMPmini_image *img, const uint8_t **palette)
+{
+    assert(img && palette);
+    *palette = img->data + (__get_palette_offset(&img->header) - BMP_HEADER_SIZE);
+    return __get_palette_entries(&img->header);
+}
+
+static uint32_t __le32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+bool BMPmini_get_masks(BMPmini_image *img, uint32_t masks[4])
+{
+    assert(img && masks);
+    if (img->header.bitsperpixel != 32) {
+        return false;
+    }
+
+    /* BI_RGB stores BGR and leaves the top byte unused */
+    if (img->header.compression != BMP_BI_BITFIELDS) {
+        masks[0] = 0x00FF0000;
+        masks[1] = 0x0000FF00;
+        masks[2] = 0x000000FF;
+        masks[3] = 0;
+        return true;
+    }
+
+    /* Masks are the first bytes after the BMP header, whatever the DIB header size */
+    masks[0] = __le32(img->data);
+    masks[1] = __le32(img->data + 4);
+    masks[2] = __le32(img->data + 8);
+    masks[3] = img->header.dib_header_size >= DIB_V3_HEADER_SIZE ? __le32(img->data + BMP_MASKS_SIZE) : 0;
+    return true;
+}
+
+void BMPmini_get_view(BMPmini_image *img, BMPmini_view *view)
+{
+    assert(img && view);
+    uint8_t *pixels = BMPmini_pixels(img);
+    uint32_t row_size = __get_image_row_size_bytes(&img->header);
+    uint32_t height = __get_abs_height(&img->header);
+
+    view->width = img->header.width_px;
+    view->height = (int32_t) height;
+    view->bitsperpixel = img->header.bitsperpixel;
+    /* Top-Down DIB */
+    if (img->header.height_px < 0) {
+        view->base = pixels;
+        view->stride = (ptrdiff_t) row_size;
+    }
+    /* Bottom-Up DIB - the top row is the last one stored */
+    else {
+        view->base = pixels + (size_t) (height - 1) * row_size;
+        view->stride = -(ptrdiff_t) row_size;
+    }
+}
+
+bool BMPmini_crop_view(const BMPmini_view *view, int32_t x, int32_t y, int32_t w, int32_t h, BMPmini_view *out)
+{
+    assert(view && out);
+    assert(x >= 0 && y >= 0 && w > 0 && h > 0);
+
+    if (__int32_overflow(x, w) || __int32_overflow(y, h)) {
+        BMPmini_PERROR(__func__, BMPmini_OVERFLOW_ERR, "[OVERFLOW]: int32_t overflow encountered", 0);
+        return false;
+    }
+
+    if (x+w > view->width || y+h > view->height) {
+        BMPmini_PERROR(__func__, BMPmini_RANGE_ERR, "[ERROR]: size of the new view greater than original", 0);
+        return false;
+    }
+
+    /* Pixels of less than a byte can only be cropped at byte boundaries */
+    size_t bits = (size_t) x * view->bitsperpixel;
+    if (bits % BMP_BITS_PER_BYTE) {
+        BMPmini_PERROR(__func__, BMPmini_RANGE_ERR, "[ERROR]: the new view does not start on a byte boundary\n", 0);
+        return false;
+    }
+
+    out->base = view->base + y * view->stride + bits / BMP_BITS_PER_BYTE;
+    out->stride = view->stride;
+    out->width = w;
+    out->height = h;
+    out->bitsperpixel = view->bitsperpixel;
+    return true;
+}
+
+BMPmini_image *BMPmini_image_from_view(const BMPmini_view *view)
+{
+    return BMPmini_image_from_view_with(view, NULL);
+}
+
+BMPmini_image *BMPmini_image_from_view_with(const BMPmini_view *view, const BMPmini_allocator *allocator)
+{
+    assert(view && view->width > 0 && view->height > 0);
+
+    /* Paletted views would need a palette to go with them */
+    if (view->bitsperpixel != BMP_BITS_PER_PIXEL && view->bitsperpixel != 32) {
+        BMPmini_PERROR(__func__, BMPmini_FORMAT_ERR, "[ERROR]: only 24 and 32 bpp views can be copied into an image\n", 0);
+        return NULL;
+    }
+
+    /* Keep the row order of the source, so rows are read sequentially */
+    BMPmini_header header;
+    __init_header(&header, view->width, view->stride < 0 ? view->height : -view->height, view->bitsperpixel);
+    BMPmini_image *img = __new_image(&header, header.image_size_bytes, allocator);
+    if (!img) {
+        return NULL;
+    }
+
+    BMPmini_view dst;
+    BMPmini_get_view(img, &dst);
+    __copy_rows(view, &dst, __get_padding(&img->header), 0);
+
+    return img;
+}
+
+void BMPmini_copy_view(const BMPmini_view *src, const BMPmini_view *dst, int nthreads)
+{
+    assert(src && dst);
+    assert(src->width == dst->width && src->height == dst->height && src->bitsperpixel == dst->bitsperpixel);
+    __copy_rows(src, dst, 0, nthreads);
+}
+
+int BMPmini_write_view(const char *restrict filename, const BMPmini_view *view)
+{
+    assert(view && view->width > 0 && view->height > 0);
+
+    if (view->bitsperpixel != BMP_BITS_PER_PIXEL) {
+        return BMPmini_FORMAT_ERR;
+    }
+
+    bool bottom_up = view->stride < 0;
+    BMPmini_writer *writer = BMPmini_writer_open(filename, view->width,
+                                                 bottom_up ? BMPmini_STREAM_BOTTOM_UP : BMPmini_STREAM_TOP_DOWN);
+    if (!writer) {
+        return BMPmini_FOPEN_ERR;
+    }
+
+    int res = BMPmini_SUCCESS;
+    if (bottom_up) {
+        /* Rows are pushed in the order they sit in memory */
+        for (int32_t i = view->height - 1; i >= 0 && res == BMPmini_SUCCESS; i--) {
+            res = BMPmini_writer_write_rows(writer, view->base + i * view->stride, 1, 0);
+        }
+    }
+    else {
+        res = BMPmini_writer_write_rows(writer, view->base, view->height, view->stride);
+    }
+
+    int close_res = BMPmini_writer_close(writer);
+    return res != BMPmini_SUCCESS ? res : close_res;
+}
+
+uint8_t *BMPmini_pixels(BMPmini_image *img)
+{
+    assert(img);
+    return img->data + (img->header.offset - BMP_HEADER_SIZE);
 }
 
 void BMPmini_free(BMPmini_image *img)
 {
     if (img) {
-        free(img);
+        if (img->flags & _BMP_IMG_MAPPED) {
+            BMPmini_unmap(img);
+            return;
+        }
+        __free_image(img);
         img = NULL;
     }
 }
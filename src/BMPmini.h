@@ -9,6 +9,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <stdbool.h>
@@ -17,14 +18,188 @@ enum {
     BMPmini_SUCCESS=0,
     BMPmini_FOPEN_ERR,
     BMPmini_FWRITE_ERR,
+    BMPmini_FREAD_ERR,
+    BMPmini_HEADER_ERR,
+    BMPmini_OVERFLOW_ERR,
+    BMPmini_NOMEM_ERR,
+    BMPmini_BUFFER_ERR,
+    BMPmini_RANGE_ERR,
+    BMPmini_FORMAT_ERR,
+};
+
+// Flags for BMPmini_map
+enum {
+    BMPmini_MAP_RDONLY=0,  // Pixels are read-only and shared with the page cache
+    BMPmini_MAP_COW=1,     // Pixels are writable, changes never reach the file
+};
+
+// Flags for BMPmini_writer_open
+enum {
+    BMPmini_STREAM_TOP_DOWN=0,   // Rows are pushed top to bottom
+    BMPmini_STREAM_BOTTOM_UP=1,  // Rows are pushed bottom to top
+};
+
+// Flags for BMPmini_write_opts, BMPmini_write_parallel and BMPmini_tile_writer_open
+enum {
+    BMPmini_WRITE_RLE=1,        // RLE8/RLE4 compression, for 8 and 4 bpp images
+    BMPmini_WRITE_DIRECT=2,     // Bypass the page cache where supported, for huge images
+    BMPmini_WRITE_BOTTOM_UP=4,  // Store rows bottom to top (tile writers are Top-Down otherwise)
+};
+
+// Pixel formats for BMPmini_convert and BMPmini_decode
+enum {
+    BMPmini_FMT_BGR24=0,     // 3 bytes per pixel, as stored in BMP files
+    BMPmini_FMT_RGBA32,      // 4 bytes per pixel, alpha is 255
+    BMPmini_FMT_GRAY8,       // 1 byte per pixel, (38 R + 75 G + 15 B + 64) / 128
+    BMPmini_FMT_PLANAR_F32,  // A plane of floats in [0, 1] for R, then G, then B
+};
+
+// Filters for BMPmini_resize
+enum {
+    BMPmini_FILTER_BOX=0,    // Average of the covered area, best for downscaling
+    BMPmini_FILTER_BILINEAR, // Linear interpolation, a triangle when downscaling
+    BMPmini_FILTER_LANCZOS,  // Lanczos with 3 lobes, sharper and slower
+};
+
+// Operations for BMPmini_transform and BMPmini_flip
+enum {
+    BMPmini_ROTATE_90=0,  // Clockwise
+    BMPmini_ROTATE_180,
+    BMPmini_ROTATE_270,   // Clockwise, that is 90 counterclockwise
+    BMPmini_FLIP_H,       // Mirrors left and right
+    BMPmini_FLIP_V,       // Mirrors top and bottom
+    BMPmini_TRANSPOSE,    // Swaps rows and columns
+};
+
+// Neighborhood operations for BMPmini_filter, and their parameter
+enum {
+    BMPmini_BLUR_BOX=0,     // Mean of the square of radius 'param' in [0, 511]
+    BMPmini_BLUR_GAUSSIAN,  // Gaussian blur, 'param' is the standard deviation in (0, 64]
+    BMPmini_SHARPEN,        // Unsharp mask: x + 'param' * (x - blur(x)), 'param' in [0, 16]
+    BMPmini_EDGES_SOBEL,    // Sobel gradient magnitude |dx| + |dy|, 'param' is unused
+};
+
+// Pixels neighborhood filters see past the edges of an image
+enum {
+    BMPmini_BORDER_CLAMP=0,  // The edge pixels repeated: aaa|abcd|ddd
+    BMPmini_BORDER_MIRROR,   // The pixels reflected about the edge ones: dcb|abcd|cba
+    BMPmini_BORDER_ZERO,     // Black pixels: 000|abcd|000
+};
+
+// Phases timed by BMPmini_set_metrics
+enum {
+    BMPmini_PHASE_OPEN=0,  // Opening, mapping and closing files
+    BMPmini_PHASE_HEADER,  // Reading and checking headers
+    BMPmini_PHASE_READ,    // Reading pixels, RLE decoding included
+    BMPmini_PHASE_ALLOC,   // Allocating images
+    BMPmini_PHASE_COPY,    // Copying pixels between images and views
+    BMPmini_PHASE_WRITE,   // Writing headers and pixels
+    BMPmini_PHASES,
 };
 
 typedef struct _BMPmini_header BMPmini_header;
 typedef struct _BMPmini_image BMPmini_image;
+typedef struct _BMPmini_reader BMPmini_reader;
+typedef struct _BMPmini_writer BMPmini_writer;
+typedef struct _BMPmini_tile_writer BMPmini_tile_writer;
+typedef struct _BMPmini_async BMPmini_async;
+typedef struct _BMPmini_pool BMPmini_pool;
+typedef struct _BMPmini_pipeline BMPmini_pipeline;
+typedef struct _BMPmini_pyramid BMPmini_pyramid;
+
+// Memory allocator for image buffers. 'free' gets the size given to 'alloc'.
+typedef struct {
+    void *(*alloc)(void *ctx, size_t size);
+    void (*free)(void *ctx, void *ptr, size_t size);
+    void *ctx;
+} BMPmini_allocator;
+
+#define BMPmini_ERROR_MSG_SIZE 96
+
+// An error, or a warning about an operation that went on, as reported
+typedef struct {
+    int status;            // BMPmini status code of the failure
+    int sys_errno;         // errno set by the failed system call, 0 if none
+    bool warning;          // The operation did not fail because of it
+    const char *file;      // Source file, function and line reporting it
+    const char *func;
+    unsigned long line;
+    char message[BMPmini_ERROR_MSG_SIZE];  // The failed call, or what is wrong
+} BMPmini_error;
+
+// Called for every error and warning, on the thread reporting it
+typedef void (*BMPmini_error_cb)(const BMPmini_error *err, void *ctx);
+
+// Counters of BMPmini_set_metrics, by BMPmini_PHASE_*
+typedef struct {
+    uint64_t count[BMPmini_PHASES];  // Times each phase ran
+    uint64_t ns[BMPmini_PHASES];     // Nanoseconds spent in each phase
+    uint64_t bytes[BMPmini_PHASES];  // Bytes read, allocated, copied or written
+    uint64_t errors;                 // Errors reported, warnings excluded
+} BMPmini_metrics;
+
+// Called once an asynchronous read completes. 'img' is NULL unless 'status'
+// is BMPmini_SUCCESS, and belongs to the callback from then on.
+typedef void (*BMPmini_async_cb)(const char *filename, BMPmini_image *img, int status, void *ctx);
+
+// Image geometry, as described by a BMP header
+typedef struct {
+    int32_t width;          // Width in pixels
+    int32_t height;         // Height in pixels (always positive)
+    bool top_down;          // Rows are stored top to bottom
+    uint16_t bitsperpixel;  // Bits per pixel: 1, 4, 8 (paletted), 24 or 32
+    uint32_t row_size;      // Bytes per stored row, padding included
+} BMPmini_info;
+
+// A rectangular region of pixels owned by an image or a caller buffer.
+// Rows go top to bottom from 'base'; a negative 'stride' means they are
+// stored bottom to top in memory (Bottom-Up DIBs).
+typedef struct {
+    uint8_t *base;          // First pixel of the top row
+    ptrdiff_t stride;       // Distance in bytes from a row to the one below it
+    int32_t width;          // Width in pixels
+    int32_t height;         // Height in pixels
+    uint16_t bitsperpixel;  // Bits per pixel
+} BMPmini_view;
+
+// Statistics of the blue, green and red channels of 24 and 32 bpp pixels,
+// in this order. The fourth byte of 32 bpp pixels is only checksummed.
+typedef struct {
+    uint64_t hist[3][256];  // Number of pixels of each value
+    uint64_t count;         // Number of pixels
+    uint64_t sum[3];        // Sums of the values
+    uint8_t min[3];         // Smallest values, 0 without pixels
+    uint8_t max[3];         // Largest values, 0 without pixels
+    double mean[3];
+    double stddev[3];       // Population standard deviations
+    uint32_t checksum;      // Adler-32 of the pixel bytes, rows top to bottom, padding excluded
+    uint64_t bytes;         // Number of bytes checksummed
+} BMPmini_stats;
+
+// Progress of a content hash, see BMPmini_hash_update. Fields are private.
+typedef struct {
+    uint64_t acc[8];
+    uint8_t buf[64];        // Bytes not hashed yet, short of a stripe
+    uint64_t bytes;         // Number of bytes taken
+    uint64_t rows;          // Number of rows taken
+    int32_t width;          // Width and bits per pixel of the rows
+    uint16_t bitsperpixel;
+} BMPmini_hash_state;
+
+// A rectangle of pixels, empty when 'width' or 'height' is 0
+typedef struct {
+    int32_t x;              // Left column
+    int32_t y;              // Top row
+    int32_t width;
+    int32_t height;
+} BMPmini_rect;
 
 /***************************************************************
  * \brief  Reads a BMP image given its file path.
  *
+ * RLE compressed pixels are decoded as they are read, so  the
+ * image always holds uncompressed rows.
+ *
  * \param filename  the path of the BMP image
  *
  * \return  a new BMPmini_image if successful
@@ -32,6 +207,204 @@ typedef struct _BMPmini_image BMPmini_image;
  ***************************************************************/
 extern BMPmini_image *BMPmini_read(const char *restrict filename);
 
+/***************************************************************
+ * \brief  Same as BMPmini_read, allocating the image with
+ *         'allocator' (NULL for the default allocator).
+ ***************************************************************/
+extern BMPmini_image *BMPmini_read_with(const char *restrict filename, const BMPmini_allocator *allocator);
+
+/***************************************************************
+ * \brief  Same as BMPmini_read_with, also computing  statistics
+ *         of the pixels as they are read (see BMPmini_get_stats).
+ *
+ * Pixels are read a band of rows at a time and summarized while
+ * still in the cache, instead of in a second pass  over  the
+ * image.
+ *
+ * \param filename   the path of the BMP image, of 24 or 32 bpp
+ * \param allocator  the allocator, NULL for the default one
+ * \param stats      where to store the statistics,  NULL  to
+ *                   skip them
+ *
+ * \return  a new BMPmini_image if successful
+ * \return  NULL if an error occurs, or the image does not have
+ *          24 or 32 bpp while 'stats' is not NULL
+ ***************************************************************/
+extern BMPmini_image *BMPmini_read_stats(const char *restrict filename, const BMPmini_allocator *allocator,
+                                         BMPmini_stats *stats);
+
+/***************************************************************
+ * \brief  Reads the header of a BMP image without touching its
+ *         pixels. Nothing is printed on errors.
+ *
+ * \param filename  the path of the BMP image
+ * \param info      where to store the image geometry
+ *
+ * \return BMPmini_SUCCESS     if the header is valid
+ * \return other BMPmini status codes otherwise
+ ***************************************************************/
+extern int BMPmini_probe(const char *restrict filename, BMPmini_info *info);
+
+/***************************************************************
+ * \brief  Sets whether BMP files opened by path are trusted.
+ *
+ * Headers of trusted files are still checked, but  the  file
+ * size is not probed to be compared with them, saving a system
+ * call per file. A truncated trusted file  is  still  reported
+ * once its pixels fail to be read. Off by default.
+ *
+ * \param  trusted  whether input files are trusted
+ ***************************************************************/
+extern void BMPmini_set_trusted_input(bool trusted);
+
+/***************************************************************
+ * \brief  Reads the pixels of a BMP image into a buffer  owned
+ *         by the caller. Nothing is printed on errors.
+ *
+ * Rows are stored as in the file: info.row_size bytes each,
+ * padding included, bottom to top unless info.top_down.  RLE
+ * compressed pixels are decoded straight into 'buf'.
+ *
+ * \param filename  the path of the BMP image
+ * \param info      where to store the image geometry, filled  as
+ *                  soon as the header has been checked
+ * \param buf       where to store the pixels
+ * \param bufsize   the size of 'buf', at least info.row_size  *
+ *                  info.height bytes
+ *
+ * \return BMPmini_SUCCESS     if the reading is successful
+ * \return BMPmini_BUFFER_ERR  if 'buf' is too small
+ * \return other BMPmini status codes on other errors
+ ***************************************************************/
+extern int BMPmini_read_into(const char *restrict filename, BMPmini_info *info, void *buf, size_t bufsize);
+
+/***************************************************************
+ * \brief  Reads a region of a BMP image starting in (x, y) with
+ *         w width and h height, as BMPmini_crop would  crop  it
+ *         out of the whole image.
+ *
+ * Rows lie at fixed offsets in BMP files, so only those of the
+ * region are read from the file, and  only  the  part  of  each
+ * row inside the region when the rest of the row is big.
+ *
+ * \param filename  the path of the BMP image, not RLE compressed
+ * \param x         the image x coordinate from which start the region
+ * \param y         the image y coordinate from which start the region
+ * \param w         the width of the region
+ * \param h         the height of the region
+ *
+ * \return  a new BMPmini_image if successful
+ * \return  NULL if an error occurs, the region does not fit  in
+ *          the image or the image is RLE compressed
+ ***************************************************************/
+extern BMPmini_image *BMPmini_read_region(const char *restrict filename, int32_t x, int32_t y, int32_t w, int32_t h);
+
+/***************************************************************
+ * \brief  Same as BMPmini_read_region, allocating the new image  with
+ *         'allocator' (NULL for the default allocator).
+ ***************************************************************/
+extern BMPmini_image *BMPmini_read_region_with(const char *restrict filename, int32_t x, int32_t y, int32_t w,
+                                               int32_t h, const BMPmini_allocator *allocator);
+
+/***************************************************************
+ * \brief  Reads many BMP images at once, overlapping their I/O
+ *         across threads. Nothing is printed on errors.
+ *
+ * \param paths     the paths of the BMP images
+ * \param n         the number of images
+ * \param images    where to store the images, NULL  for  those
+ *                  that could not be read
+ * \param status    where to store the BMPmini status  code  of
+ *                  each image, may be NULL
+ * \param nthreads  the number of threads, 0 for the  default
+ *                  set by BMPmini_set_threads
+ *
+ * \return  the number of images read
+ ***************************************************************/
+extern size_t BMPmini_read_batch(const char *const *paths, size_t n, BMPmini_image **images, int *status, int nthreads);
+
+/***************************************************************
+ * \brief  Describes a BMPmini status code.
+ *
+ * \param  status  the status code
+ *
+ * \return  a static string describing the status
+ ***************************************************************/
+extern const char *BMPmini_strerror(int status);
+
+/***************************************************************
+ * \brief  Sets the function called with every error and warning
+ *         instead of printing them to stderr.
+ *
+ * The handler is called on the thread reporting  the  error,
+ * worker threads included, so it must be thread-safe. A handler
+ * doing nothing silences the library. Should not  be  called
+ * while other threads are using the library.
+ *
+ * \param  cb   the handler, NULL to print to stderr again
+ * \param  ctx  passed untouched to 'cb'
+ ***************************************************************/
+extern void BMPmini_set_error_handler(BMPmini_error_cb cb, void *ctx);
+
+/***************************************************************
+ * \brief  Gets the last error or warning reported on the calling
+ *         thread, whether or not a handler is set.
+ *
+ * \param  err  where to store the error
+ *
+ * \return  true    if one was reported since BMPmini_clear_error
+ * \return  false   otherwise, 'err' is left untouched
+ ***************************************************************/
+extern bool BMPmini_last_error(BMPmini_error *err);
+
+/***************************************************************
+ * \brief  Forgets the last error of the calling thread.
+ ***************************************************************/
+extern void BMPmini_clear_error(void);
+
+/***************************************************************
+ * \brief  Enables or disables the metrics: the calls, time  and
+ *         bytes of each BMPmini_PHASE_*, counted per thread.
+ *
+ * Off by default, when they cost a test per phase. Once on,  a
+ * phase costs two reads of the monotonic clock  and  a  few
+ * atomic additions to counters of the running thread.
+ *
+ * \param  enabled  whether phases are counted
+ ***************************************************************/
+extern void BMPmini_set_metrics(bool enabled);
+
+/***************************************************************
+ * \brief  Gets the metrics of the calling thread.
+ *
+ * \param  m  where to store the metrics
+ ***************************************************************/
+extern void BMPmini_get_metrics(BMPmini_metrics *m);
+
+/***************************************************************
+ * \brief  Gets the metrics of all threads, exited ones included.
+ *
+ * Phases running meanwhile on other threads may be  counted
+ * in some fields and not yet in others.
+ *
+ * \param  m  where to store the metrics
+ ***************************************************************/
+extern void BMPmini_get_metrics_total(BMPmini_metrics *m);
+
+/***************************************************************
+ * \brief  Sets the metrics of all threads back to zero.
+ ***************************************************************/
+extern void BMPmini_reset_metrics(void);
+
+/***************************************************************
+ * \brief  Names a phase, for logs and metrics exports.
+ *
+ * \param  phase  a BMPmini_PHASE_* phase
+ *
+ * \return  a static string such as "read"
+ ***************************************************************/
+extern const char *BMPmini_phase_name(int phase);
+
 /***************************************************************
  * \brief  Check if the header is a valid BMP header.
  *
@@ -57,9 +430,21 @@ extern bool BMPmini_check_header(BMPmini_header *restrict header, FILE *imgfp);
  ***************************************************************/
 extern int BMPmini_write(const char *restrict filename, BMPmini_image *img);
 
+/***************************************************************
+ * \brief  Same as BMPmini_write, with BMPmini_WRITE_* flags.
+ *
+ * With BMPmini_WRITE_RLE the pixels are run-length  encoded,
+ * which suits images with large flat areas such as screen
+ * captures. Compressed images are always stored Bottom-Up.
+ *
+ * \return BMPmini_FORMAT_ERR  if the image cannot be compressed
+ * \return other BMPmini status codes as BMPmini_write
+ ***************************************************************/
+extern int BMPmini_write_opts(const char *restrict filename, BMPmini_image *img, int flags);
+
 /***************************************************************
  * \brief  Deallocate the heap memory used  by the BMPmini_image
- *         object.
+ *         object. Mapped images are unmapped.
  *
  * \param  img   the BMPmini_image object to be deallocated
  ***************************************************************/
@@ -80,4 +465,1199 @@ extern void BMPmini_free(BMPmini_image *img);
  ***************************************************************/
 extern BMPmini_image *BMPmini_crop(BMPmini_image *img, int32_t x, int32_t y, int32_t w, int32_t h);
 
+/***************************************************************
+ * \brief  Crops the BMP image into a buffer owned by the caller.
+ *
+ * Rows are stored top to bottom, without BMP padding.
+ *
+ * \param  img      the image to be cropped
+ * \param  x        the image x coordinate from which start the crop
+ * \param  y        the image y coordinate from which start the crop
+ * \param  w        the width of the cropped region
+ * \param  h        the height of the cropped region
+ * \param  buf      where to store the pixels
+ * \param  bufsize  the size of 'buf'
+ * \param  stride   the distance in bytes between two rows in
+ *                  'buf', 0 for tightly packed rows
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_RANGE_ERR   if the region does not fit in the image
+ * \return BMPmini_BUFFER_ERR  if 'buf' is too small
+ ***************************************************************/
+extern int BMPmini_crop_into(BMPmini_image *img, int32_t x, int32_t y, int32_t w, int32_t h,
+                             void *buf, size_t bufsize, size_t stride);
+
+/***************************************************************
+ * \brief  Same as BMPmini_crop, allocating the new image  with
+ *         'allocator' (NULL for the default allocator).
+ ***************************************************************/
+extern BMPmini_image *BMPmini_crop_with(BMPmini_image *img, int32_t x, int32_t y, int32_t w, int32_t h,
+                                        const BMPmini_allocator *allocator);
+
+/***************************************************************
+ * \brief  Maps a BMP image file into memory without copying its
+ *         pixels.
+ *
+ * The returned image refers  directly  to  the  file  mapping.
+ * With BMPmini_MAP_RDONLY its pixels must not be written  to;
+ * with BMPmini_MAP_COW they can be changed in place, and  only
+ * the touched pages get copied (the file is never modified).
+ * On systems without mmap, and for RLE compressed images, the
+ * image is read into the heap.
+ *
+ * \param filename  the path of the BMP image
+ * \param flags     BMPmini_MAP_RDONLY or BMPmini_MAP_COW
+ *
+ * \return  a new mapped BMPmini_image if successful
+ * \return  NULL if an error occurs
+ ***************************************************************/
+extern BMPmini_image *BMPmini_map(const char *restrict filename, int flags);
+
+/***************************************************************
+ * \brief  Unmaps an image returned by BMPmini_map and releases
+ *         its memory.
+ *
+ * \param  img   the mapped BMPmini_image object to be released
+ ***************************************************************/
+extern void BMPmini_unmap(BMPmini_image *img);
+
+/***************************************************************
+ * \brief  Gets the pixel array of the image, starting  at  the
+ *         first row as stored in the file.
+ *
+ * \param  img  the image
+ *
+ * \return  a pointer to the first byte of pixel data
+ ***************************************************************/
+extern uint8_t *BMPmini_pixels(BMPmini_image *img);
+
+/***************************************************************
+ * \brief  Gets the geometry of the image.
+ *
+ * \param  img   the image
+ * \param  info  where to store the image geometry
+ ***************************************************************/
+extern void BMPmini_get_info(BMPmini_image *img, BMPmini_info *info);
+
+/***************************************************************
+ * \brief  Gets the color table of the image, without copying it.
+ *
+ * Each entry takes 4 bytes: blue, green, red and an unused one.
+ *
+ * \param  img      the image
+ * \param  palette  where to store a pointer to the first entry
+ *
+ * \return  the number of entries, 0 if there is no color table
+ ***************************************************************/
+extern uint32_t BMPmini_get_palette(BMPmini_image *img, const uint8_t **palette);
+
+/***************************************************************
+ * \brief  Gets the channel masks of a 32 bpp image.
+ *
+ * Pixels are little-endian 32-bit words, and masks select their
+ * red, green, blue and alpha bits. Images without  BI_BITFIELDS
+ * compression store BGR bytes followed by an unused one.  Heap
+ * allocated images start their pixels on a 4-byte boundary,  so
+ * BMPmini_get_view gives direct access to the words.
+ *
+ * \param  img    the image
+ * \param  masks  where to store the red, green, blue and  alpha
+ *                masks, alpha being 0 when there is none
+ *
+ * \return  true    if successful
+ * \return  false   if the image does not have 32 bpp
+ ***************************************************************/
+extern bool BMPmini_get_masks(BMPmini_image *img, uint32_t masks[4]);
+
+/***************************************************************
+ * \brief  Gets a view over all the pixels of the image.
+ *
+ * The view refers to the image memory and is valid as long  as
+ * the image is.
+ *
+ * \param  img   the image
+ * \param  view  where to store the view
+ ***************************************************************/
+extern void BMPmini_get_view(BMPmini_image *img, BMPmini_view *view);
+
+/***************************************************************
+ * \brief  Crops a view starting in (x, y) with w width and h
+ *         height, without copying any pixel.
+ *
+ * \param  view  the view to be cropped
+ * \param  x     the x coordinate from which start the crop
+ * \param  y     the y coordinate, from the top, from which start
+ *               the crop
+ * \param  w     the width of the cropped view
+ * \param  h     the height of the cropped view
+ * \param  out   where to store the cropped view, may be 'view'
+ *
+ * \return  true    if successful
+ * \return  false   if the region does not fit in the view, or  does
+ *                  not start on a byte boundary (1 and 4 bpp)
+ ***************************************************************/
+extern bool BMPmini_crop_view(const BMPmini_view *view, int32_t x, int32_t y, int32_t w, int32_t h, BMPmini_view *out);
+
+/***************************************************************
+ * \brief  Copies the pixels of a view into a new image.
+ *
+ * \param  view  the view to be copied, with 24 or 32 bpp
+ *
+ * \return  a new heap allocated image if successful
+ * \return  a NULL pointer otherwise
+ ***************************************************************/
+extern BMPmini_image *BMPmini_image_from_view(const BMPmini_view *view);
+
+/***************************************************************
+ * \brief  Same as BMPmini_image_from_view, allocating the  new
+ *         image with 'allocator' (NULL for the default allocator).
+ ***************************************************************/
+extern BMPmini_image *BMPmini_image_from_view_with(const BMPmini_view *view, const BMPmini_allocator *allocator);
+
+/***************************************************************
+ * \brief  Writes to a file the pixels of a view, copying  them
+ *         straight from the view memory.
+ *
+ * \param filename  the path name of the file to  be  create for
+ *                  writing
+ * \param view      the view to be written
+ *
+ * \return BMPmini_SUCCESS     if the writing is successful
+ * \return BMPmini_FORMAT_ERR    if the view does not have 24 bpp
+ * \return BMPmini_FOPEN_ERR     if fails to open the file for writing
+ * \return BMPmini_OVERFLOW_ERR  if the view is too large for a BMP
+ *                              file
+ * \return BMPmini_FWRITE_ERR    if fails to write to the file
+ ***************************************************************/
+extern int BMPmini_write_view(const char *restrict filename, const BMPmini_view *view);
+
+/***************************************************************
+ * \brief  Sets the default number of threads used by  crops,
+ *         copies and per-pixel operations.
+ *
+ * Work is split in bands of rows run on a  shared  pool  of
+ * threads, and the result is the same whatever the  number  of
+ * threads. The default is 1 (everything runs on the  calling
+ * thread). Jobs of several threads share the pool side by side.
+ * Calls into the library made from a pool thread, such as  an
+ * error handler reporting from a band, run on that thread only.
+ * Should not be called while other threads are using the
+ * library.
+ *
+ * \param  nthreads  the number of threads, 0  for  one  per
+ *                   online CPU
+ ***************************************************************/
+extern void BMPmini_set_threads(int nthreads);
+
+/***************************************************************
+ * \brief  Gets the default number of threads.
+ *
+ * \return  the number of threads set by BMPmini_set_threads
+ ***************************************************************/
+extern int BMPmini_get_threads(void);
+
+/***************************************************************
+ * \brief  Copies the pixels of a view into another  view  of
+ *         the same size. Padding bytes are not touched.
+ *
+ * \param  src       the view to be copied
+ * \param  dst       the view to copy to
+ * \param  nthreads  the number of threads, 0 for the  default
+ *                   set by BMPmini_set_threads
+ ***************************************************************/
+extern void BMPmini_copy_view(const BMPmini_view *src, const BMPmini_view *dst, int nthreads);
+
+/***************************************************************
+ * \brief  Same as BMPmini_crop, using 'nthreads' threads  (0
+ *         for the default set by BMPmini_set_threads).
+ ***************************************************************/
+extern BMPmini_image *BMPmini_crop_threads(BMPmini_image *img, int32_t x, int32_t y, int32_t w, int32_t h, int nthreads);
+
+/***************************************************************
+ * \brief  Opens a BMP image for reading it a few rows at a time.
+ *
+ * Only the header is read, so memory use does not depend on the
+ * image size. RLE compressed images cannot be read this  way,
+ * nor images whose rows lie past LONG_MAX bytes into the file.
+ *
+ * \param filename  the path of the BMP image
+ *
+ * \return  a new BMPmini_reader if successful
+ * \return  NULL if an error occurs
+ ***************************************************************/
+extern BMPmini_reader *BMPmini_reader_open(const char *restrict filename);
+
+/***************************************************************
+ * \brief  Gets the geometry of the image being read.
+ *
+ * \param  reader  the reader
+ * \param  info    where to store the image geometry
+ ***************************************************************/
+extern void BMPmini_reader_info(BMPmini_reader *reader, BMPmini_info *info);
+
+/***************************************************************
+ * \brief  Reads the next rows of the image.
+ *
+ * Rows are always delivered top to bottom, whatever the  order
+ * they are stored in the file.  Each row takes  info.row_size
+ * bytes in 'buf', padding included.
+ *
+ * \param  reader  the reader
+ * \param  buf     where to store the rows, at least 'nrows'  *
+ *                 info.row_size bytes
+ * \param  nrows   the maximum number of rows to be read
+ *
+ * \return  the number of rows read, 0 once all rows have  been
+ *          read or if an error occurs
+ ***************************************************************/
+extern size_t BMPmini_reader_read_rows(BMPmini_reader *reader, void *buf, size_t nrows);
+
+/***************************************************************
+ * \brief  Closes the reader and releases its memory.
+ *
+ * \param  reader  the reader to be closed
+ ***************************************************************/
+extern void BMPmini_reader_close(BMPmini_reader *reader);
+
+/***************************************************************
+ * \brief  Creates a BMP image to be written a few  rows  at  a
+ *         time. The height is only known when it is closed.
+ *
+ * \param filename  the path name of the file to  be  create for
+ *                  writing
+ * \param width     the width of the image in pixels
+ * \param flags     BMPmini_STREAM_TOP_DOWN or
+ *                  BMPmini_STREAM_BOTTOM_UP,  the  order  rows
+ *                  will be pushed in
+ *
+ * \return  a new BMPmini_writer if successful
+ * \return  NULL if an error occurs, BMPmini_OVERFLOW_ERR  being
+ *          reported if a single row is too big for a BMP file
+ ***************************************************************/
+extern BMPmini_writer *BMPmini_writer_open(const char *restrict filename, int32_t width, int flags);
+
+/***************************************************************
+ * \brief  Appends rows to the image being written.
+ *
+ * \param  writer  the writer
+ * \param  rows    the first byte of the first row, each  row
+ *                 holding 'width' BGR pixels
+ * \param  nrows   the number of rows
+ * \param  stride  the distance in bytes between two rows
+ *
+ * \return BMPmini_SUCCESS       if the writing is successful
+ * \return BMPmini_OVERFLOW_ERR  if the image would grow too large
+ *                               for a BMP header,  nothing  is
+ *                               written
+ * \return BMPmini_FWRITE_ERR    if fails to write to the file
+ ***************************************************************/
+extern int BMPmini_writer_write_rows(BMPmini_writer *writer, const void *rows, size_t nrows, size_t stride);
+
+/***************************************************************
+ * \brief  Completes the header with the final image  size  and
+ *         closes the writer.
+ *
+ * The writer is closed in every case. Without any row written
+ * the header is not completed, and the file is left invalid.
+ *
+ * \param  writer  the writer to be closed
+ *
+ * \return BMPmini_SUCCESS     if the writing is successful
+ * \return BMPmini_RANGE_ERR   if no row was written
+ * \return BMPmini_FWRITE_ERR  if fails to write to the file
+ ***************************************************************/
+extern int BMPmini_writer_close(BMPmini_writer *writer);
+
+/***************************************************************
+ * \brief  Writes an image from several threads, each of  them
+ *         writing a band of rows where it goes in the file.
+ *
+ * The file gets the same bytes as with BMPmini_write.  It  is
+ * created with its final size before any row is  written,  so
+ * its blocks are allocated at once. RLE compressed images  are
+ * encoded by the calling thread, as with BMPmini_write_opts.
+ *
+ * \param filename  the path name of the file to  be  create for
+ *                  writing
+ * \param img       the BMPmini_image to be written
+ * \param flags     BMPmini_WRITE_* flags, BMPmini_WRITE_DIRECT
+ *                  to keep the pixels out of the page cache
+ * \param nthreads  the number of threads, 0  for  the  default
+ *                  set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if the writing is successful
+ * \return BMPmini_FOPEN_ERR   if fails to create the file
+ * \return BMPmini_FWRITE_ERR  if fails to write to the file
+ * \return BMPmini_NOMEM_ERR   if there is not enough memory
+ ***************************************************************/
+extern int BMPmini_write_parallel(const char *restrict filename, BMPmini_image *img, int flags, int nthreads);
+
+/***************************************************************
+ * \brief  Creates a BMP image of known size whose pixels  can
+ *         be written by tiles, in any order and from any thread.
+ *
+ * Rows sit at fixed places in BMP files, so every tile  goes
+ * straight where it belongs and bands of an image can be saved
+ * as soon as they are produced, without waiting for the  ones
+ * above them. Pixels never written are black.
+ *
+ * With BMPmini_WRITE_DIRECT, the whole blocks of tiles  as
+ * wide as the image are written with O_DIRECT, which suits
+ * images larger than the memory; narrower tiles and the blocks
+ * shared by two tiles go through the page cache.
+ *
+ * \param filename      the path name of the file to  be  create
+ *                      for writing
+ * \param width         the width of the image in pixels
+ * \param height        the height of the image in pixels
+ * \param bitsperpixel  24 or 32
+ * \param flags         BMPmini_WRITE_DIRECT and
+ *                      BMPmini_WRITE_BOTTOM_UP
+ *
+ * \return  a new BMPmini_tile_writer if successful
+ * \return  NULL if an error occurs
+ ***************************************************************/
+extern BMPmini_tile_writer *BMPmini_tile_writer_open(const char *restrict filename, int32_t width, int32_t height,
+                                                     uint16_t bitsperpixel, int flags);
+
+/***************************************************************
+ * \brief  Gets the geometry of the image being written.
+ *
+ * \param  w     the tile writer
+ * \param  info  where to store the image geometry
+ ***************************************************************/
+extern void BMPmini_tile_writer_info(BMPmini_tile_writer *w, BMPmini_info *info);
+
+/***************************************************************
+ * \brief  Writes the pixels of a tile at (x, y) from the  top
+ *         of the image. Can be called from several threads at
+ *         once, as long as their tiles do not overlap.
+ *
+ * \param  w     the tile writer
+ * \param  tile  the pixels, with the bits per pixel of the image
+ * \param  x     the x coordinate of the tile in the image
+ * \param  y     the y coordinate of the tile in the image
+ *
+ * \return BMPmini_SUCCESS     if the writing is successful
+ * \return BMPmini_FORMAT_ERR  if the tile has other bits per pixel
+ * \return BMPmini_RANGE_ERR   if the tile does not fit the image
+ * \return BMPmini_NOMEM_ERR   if there is not enough memory
+ * \return BMPmini_FWRITE_ERR  if fails to write to the file
+ ***************************************************************/
+extern int BMPmini_tile_writer_write(BMPmini_tile_writer *w, const BMPmini_view *tile, int32_t x, int32_t y);
+
+/***************************************************************
+ * \brief  Closes the tile writer once every  tile  has  been
+ *         written.
+ *
+ * \param  w  the tile writer to be closed
+ *
+ * \return BMPmini_SUCCESS  if every write was successful
+ * \return the error of the first failed write otherwise
+ ***************************************************************/
+extern int BMPmini_tile_writer_close(BMPmini_tile_writer *w);
+
+/***************************************************************
+ * \brief  Converts the pixels of a view to another  format,  in
+ *         a buffer owned by the caller.
+ *
+ * Rows are stored top to bottom. BMPmini_FMT_PLANAR_F32 stores
+ * each plane as 'height' rows, one plane after the other.
+ *
+ * \param  src         the view to be converted
+ * \param  format      a BMPmini_FMT_* format
+ * \param  dst         where to store the converted pixels
+ * \param  dst_stride  the distance in bytes between two rows in
+ *                     'dst', 0 for tightly packed rows
+ * \param  nthreads    the number of threads, 0 for the default
+ *                     set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if either format is not supported
+ * \return BMPmini_BUFFER_ERR  if 'dst_stride' is too small
+ ***************************************************************/
+extern int BMPmini_convert(const BMPmini_view *src, int format, void *dst, size_t dst_stride, int nthreads);
+
+/***************************************************************
+ * \brief  Converts pixels from a buffer in another format  into
+ *         a view, the reverse of BMPmini_convert.
+ *
+ * \param  src         the pixels to be converted, rows top  to
+ *                     bottom
+ * \param  src_stride  the distance in bytes between two rows in
+ *                     'src', 0 for tightly packed rows
+ * \param  format      the BMPmini_FMT_* format of 'src'
+ * \param  dst         the view to store the converted pixels
+ * \param  nthreads    the number of threads, 0 for the default
+ *                     set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if either format is not supported
+ * \return BMPmini_BUFFER_ERR  if 'src_stride' is too small
+ ***************************************************************/
+extern int BMPmini_convert_to_view(const void *src, size_t src_stride, int format, const BMPmini_view *dst, int nthreads);
+
+/***************************************************************
+ * \brief  Decodes the pixels of an image of any supported depth
+ *         to another format, in a buffer owned by the caller.
+ *
+ * Paletted rows are expanded through a table giving the pixels
+ * of every possible byte, 32 bpp pixels are  split  with  the
+ * image masks. Rows are stored top to bottom. 24 bpp images are
+ * handed to BMPmini_convert.
+ *
+ * \param  img         the image to be decoded
+ * \param  format      a BMPmini_FMT_* format, planar  only  for
+ *                     24 bpp images
+ * \param  dst         where to store the decoded pixels
+ * \param  dst_stride  the distance in bytes between two rows in
+ *                     'dst', 0 for tightly packed rows
+ * \param  nthreads    the number of threads, 0 for the default
+ *                     set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the format or the masks are not
+ *                             supported
+ * \return BMPmini_BUFFER_ERR  if 'dst_stride' is too small
+ * \return BMPmini_NOMEM_ERR   if there is not enough memory
+ ***************************************************************/
+extern int BMPmini_decode(BMPmini_image *img, int format, void *dst, size_t dst_stride, int nthreads);
+
+/***************************************************************
+ * \brief  Resizes a 24 bpp image to w width and h height.
+ *
+ * Rows are filtered horizontally, then columns vertically, with
+ * weights computed once per output column and row.  Filters are
+ * stretched when downscaling, so that every source pixel counts.
+ * The new image keeps the row order of 'img'.
+ *
+ * \param  img     the image to be resized
+ * \param  w       the new width
+ * \param  h       the new height
+ * \param  filter  a BMPmini_FILTER_* filter
+ *
+ * \return  a new heap allocated image if successful
+ * \return  a NULL pointer otherwise
+ ***************************************************************/
+extern BMPmini_image *BMPmini_resize(BMPmini_image *img, int32_t w, int32_t h, int filter);
+
+/***************************************************************
+ * \brief  Same as BMPmini_resize, allocating the new image  with
+ *         'allocator' (NULL for the default allocator).
+ ***************************************************************/
+extern BMPmini_image *BMPmini_resize_with(BMPmini_image *img, int32_t w, int32_t h, int filter,
+                                          const BMPmini_allocator *allocator);
+
+/***************************************************************
+ * \brief  Resizes the pixels of a view into another view,  of
+ *         the wanted size. Padding bytes are not touched.
+ *
+ * \param  src       the view to be resized, with 24 bpp
+ * \param  dst       the view to store the result, with 24 bpp
+ * \param  filter    a BMPmini_FILTER_* filter
+ * \param  nthreads  the number of threads, 0 for the  default
+ *                   set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if a view does not have 24 bpp or
+ *                             the filter is unknown
+ * \return BMPmini_NOMEM_ERR   if there is not enough memory
+ ***************************************************************/
+extern int BMPmini_resize_view(const BMPmini_view *src, const BMPmini_view *dst, int filter, int nthreads);
+
+/***************************************************************
+ * \brief  Rotates, flips or transposes an 8, 24 or 32 bpp image
+ *         into a new one.
+ *
+ * Rotations and transposition copy square tiles of pixels, so
+ * that reads and writes both stay in the cache.  The new image
+ * keeps the row order and color table of 'img'.
+ *
+ * \param  img  the image to be transformed
+ * \param  op   a BMPmini_ROTATE_*, BMPmini_FLIP_* or
+ *              BMPmini_TRANSPOSE operation
+ *
+ * \return  a new heap allocated image if successful
+ * \return  a NULL pointer otherwise
+ ***************************************************************/
+extern BMPmini_image *BMPmini_transform(BMPmini_image *img, int op);
+
+/***************************************************************
+ * \brief  Same as BMPmini_transform, allocating the new image  with
+ *         'allocator' (NULL for the default allocator).
+ ***************************************************************/
+extern BMPmini_image *BMPmini_transform_with(BMPmini_image *img, int op, const BMPmini_allocator *allocator);
+
+/***************************************************************
+ * \brief  Same as BMPmini_transform, storing the result  in  a
+ *         view. Padding bytes are not touched.
+ *
+ * \param  src       the view to be transformed, with 8, 24  or
+ *                   32 bpp
+ * \param  dst       the view to store the result, not overlapping
+ *                   'src', with the width and height swapped  for
+ *                   rotations by 90 and 270 and transposition
+ * \param  op        the operation
+ * \param  nthreads  the number of threads, 0 for the  default
+ *                   set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the pixel format or the operation
+ *                             is not supported
+ * \return BMPmini_RANGE_ERR   if 'dst' does not have the right size
+ ***************************************************************/
+extern int BMPmini_transform_view(const BMPmini_view *src, const BMPmini_view *dst, int op, int nthreads);
+
+/***************************************************************
+ * \brief  Flips an image in place.
+ *
+ * A vertical flip only changes the sign of the height  in  the
+ * header, storing the same rows Top-Down instead of  Bottom-Up
+ * or the other way around, so it works on any image and  costs
+ * nothing. Horizontal flips reverse the pixels of each row.
+ *
+ * \param  img  the image to be flipped
+ * \param  op   BMPmini_FLIP_H, BMPmini_FLIP_V or BMPmini_ROTATE_180
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the operation is not  supported,
+ *                             or mirrors left and right  an  image
+ *                             not having 8, 24 or 32 bpp
+ * \return BMPmini_BUFFER_ERR  if the pixels are read-only (images
+ *                             mapped with BMPmini_MAP_RDONLY)
+ ***************************************************************/
+extern int BMPmini_flip(BMPmini_image *img, int op);
+
+/***************************************************************
+ * \brief  Flips the pixels of a view in place,  swapping  rows
+ *         for vertical flips.
+ *
+ * \param  view      the view to be flipped, with 8, 24 or 32 bpp
+ * \param  op        BMPmini_FLIP_H,      BMPmini_FLIP_V       or
+ *                   BMPmini_ROTATE_180
+ * \param  nthreads  the number of threads, 0 for the  default
+ *                   set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the pixel format or the operation
+ *                             is not supported
+ ***************************************************************/
+extern int BMPmini_flip_view(const BMPmini_view *view, int op, int nthreads);
+
+/***************************************************************
+ * \brief  Creates an empty pipeline.
+ *
+ * A pipeline reads a source, crops it, resizes it and  stores
+ * it in a sink, a band of rows at a time,  without  any  full
+ * size intermediate image.  It needs a source and a sink, the
+ * stages are optional and run in the order crop, resize, then
+ * conversion to the sink format, whatever the order they  are
+ * declared in. Only 24 bpp images go through pipelines.
+ *
+ * \return  a new pipeline if successful
+ * \return  NULL if there is not enough memory
+ ***************************************************************/
+extern BMPmini_pipeline *BMPmini_pipeline_new(void);
+
+/***************************************************************
+ * \brief  Releases a pipeline. The sink buffer and the  source
+ *         view are not released.
+ ***************************************************************/
+extern void BMPmini_pipeline_free(BMPmini_pipeline *p);
+
+/***************************************************************
+ * \brief  Takes the pixels of a view as the source.
+ *
+ * \param  p     the pipeline
+ * \param  view  the source, valid until the pipeline has run
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the view does not have 24 bpp
+ ***************************************************************/
+extern int BMPmini_pipeline_source_view(BMPmini_pipeline *p, const BMPmini_view *view);
+
+/***************************************************************
+ * \brief  Takes a BMP file as the source, read a few rows at a
+ *         time as with BMPmini_reader_open. The file can only be
+ *         read by one run.
+ *
+ * \param  p         the pipeline
+ * \param  filename  the path of the BMP image
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FREAD_ERR   if the file cannot be read by rows
+ * \return BMPmini_FORMAT_ERR  if the image does not have 24 bpp
+ ***************************************************************/
+extern int BMPmini_pipeline_source_file(BMPmini_pipeline *p, const char *restrict filename);
+
+/***************************************************************
+ * \brief  Crops the source starting in (x, y),  from  the  top,
+ *         with w width and h height. The region is  checked  by
+ *         BMPmini_pipeline_run.
+ ***************************************************************/
+extern void BMPmini_pipeline_crop(BMPmini_pipeline *p, int32_t x, int32_t y, int32_t w, int32_t h);
+
+/***************************************************************
+ * \brief  Resizes the cropped source to w width and h  height,
+ *         as BMPmini_resize does.
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the filter is unknown
+ ***************************************************************/
+extern int BMPmini_pipeline_resize(BMPmini_pipeline *p, int32_t w, int32_t h, int filter);
+
+/***************************************************************
+ * \brief  Writes the result to a 24 bpp Top-Down BMP file.
+ *
+ * \param  p         the pipeline
+ * \param  filename  the path of the file, created by the run
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_NOMEM_ERR   if there is not enough memory
+ ***************************************************************/
+extern int BMPmini_pipeline_sink_file(BMPmini_pipeline *p, const char *restrict filename);
+
+/***************************************************************
+ * \brief  Stores the result in a buffer owned by the caller,  as
+ *         BMPmini_convert does.
+ *
+ * \param  p           the pipeline
+ * \param  format      BMPmini_FMT_BGR24, BMPmini_FMT_RGBA32  or
+ *                     BMPmini_FMT_GRAY8
+ * \param  dst         where to store the pixels, top to bottom
+ * \param  dst_stride  the distance in bytes between two rows in
+ *                     'dst', 0 for tightly packed rows
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the format is not supported
+ ***************************************************************/
+extern int BMPmini_pipeline_sink_buffer(BMPmini_pipeline *p, int format, void *dst, size_t dst_stride);
+
+/***************************************************************
+ * \brief  Runs a pipeline.
+ *
+ * View sources are split in bands of rows run on the  thread
+ * pool, each band writing its rows straight  where  they  go
+ * in file sinks. File sources are read in order by the calling
+ * thread. A few rows per band are kept in memory.
+ *
+ * \param  p         the pipeline
+ * \param  nthreads  the number of threads, 0 for the  default
+ *                   set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_RANGE_ERR   if the crop does not fit the source
+ * \return BMPmini_BUFFER_ERR  if the sink stride is too small
+ * \return BMPmini_NOMEM_ERR   if there is not enough memory
+ * \return BMPmini_FREAD_ERR   if fails to read the source file
+ * \return BMPmini_FOPEN_ERR   if fails to create the sink file
+ * \return BMPmini_FWRITE_ERR  if fails to write the sink file
+ ***************************************************************/
+extern int BMPmini_pipeline_run(BMPmini_pipeline *p, int nthreads);
+
+/***************************************************************
+ * \brief  Maps each channel of the pixels of a view  through  a
+ *         table, in place.
+ *
+ * Point operations change the blue, green and red bytes of  24
+ * and 32 bpp pixels,  leaving  the  fourth  byte  of  32  bpp
+ * pixels and the row padding untouched. Views of  images  get
+ * changed in place, images mapped with BMPmini_MAP_RDONLY  must
+ * not be.
+ *
+ * \param  view      the view to be changed
+ * \param  lut       the tables of the blue, green and red channels
+ * \param  nthreads  the number of threads, 0 for the  default
+ *                   set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the view does not have 24 or  32
+ *                             bpp
+ ***************************************************************/
+extern int BMPmini_apply_lut(const BMPmini_view *view, const uint8_t lut[3][256], int nthreads);
+
+/***************************************************************
+ * \brief  Changes the brightness and contrast of the pixels  of
+ *         a view, in place.
+ *
+ * Each channel x becomes (x - 128) * contrast + 128 + brightness,
+ * rounded and clamped to [0, 255].
+ *
+ * \param  view        the view to be changed
+ * \param  brightness  in [-255, 255], 0 to keep it
+ * \param  contrast    in [-127, 127], 1 to keep it
+ * \param  nthreads    the number of threads, 0 for the default
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the view does not have 24 or  32
+ *                             bpp
+ * \return BMPmini_RANGE_ERR   if a parameter is out of range
+ ***************************************************************/
+extern int BMPmini_adjust(const BMPmini_view *view, float brightness, float contrast, int nthreads);
+
+/***************************************************************
+ * \brief  Sets each channel to 255 if it is at least 'level', to
+ *         0 otherwise, in place.
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the view does not have 24 or  32
+ *                             bpp
+ ***************************************************************/
+extern int BMPmini_threshold(const BMPmini_view *view, uint8_t level, int nthreads);
+
+/***************************************************************
+ * \brief  Inverts each channel (255 - x), in place.
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the view does not have 24 or  32
+ *                             bpp
+ ***************************************************************/
+extern int BMPmini_invert(const BMPmini_view *view, int nthreads);
+
+/***************************************************************
+ * \brief  Counts the values of the blue, green and red channels
+ *         of the pixels of a view.
+ *
+ * \param  view      the view, of 24 or 32 bpp
+ * \param  hist      where to store the histograms, overwritten
+ * \param  nthreads  the number of threads, 0 for the  default
+ *                   set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the view does not have 24 or  32
+ *                             bpp
+ * \return BMPmini_NOMEM_ERR   if there is not enough memory
+ ***************************************************************/
+extern int BMPmini_histogram(const BMPmini_view *view, uint64_t hist[3][256], int nthreads);
+
+/***************************************************************
+ * \brief  Computes the histograms, the  minimum,  maximum,  mean
+ *         and standard deviation of each channel, and a checksum
+ *         of the pixels of a view.
+ *
+ * Same as BMPmini_stats_init followed by BMPmini_stats_update.
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the view does not have 24 or  32
+ *                             bpp
+ * \return BMPmini_NOMEM_ERR   if there is not enough memory
+ ***************************************************************/
+extern int BMPmini_get_stats(const BMPmini_view *view, BMPmini_stats *stats, int nthreads);
+
+/***************************************************************
+ * \brief  Resets statistics, before BMPmini_stats_update  adds
+ *         pixels to them.
+ ***************************************************************/
+extern void BMPmini_stats_init(BMPmini_stats *stats);
+
+/***************************************************************
+ * \brief  Adds the rows of a view to statistics, as  if  they
+ *         followed the rows added before.
+ *
+ * Images can thus be summarized a band of rows at a time,  as
+ * they are streamed by BMPmini_reader_read_rows  or  produced,
+ * giving the same results as for the whole image at once.
+ *
+ * \param  stats     statistics set up by BMPmini_stats_init
+ * \param  view      the rows to add, of 24 or 32 bpp
+ * \param  nthreads  the number of threads, 0 for the  default
+ *                   set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the view does not have 24 or  32
+ *                             bpp
+ * \return BMPmini_NOMEM_ERR   if there is not enough memory, the
+ *                             statistics are left unchanged
+ ***************************************************************/
+extern int BMPmini_stats_update(BMPmini_stats *stats, const BMPmini_view *view, int nthreads);
+
+/***************************************************************
+ * \brief  Computes a 64-bit hash of the pixels of an image,  to
+ *         tell images with the same content apart from the others.
+ *
+ * Only the pixels are hashed, rows top to bottom, padding  and
+ * header fields such as the resolution excluded: the same pixels
+ * stored Top-Down or Bottom-Up, or read, mapped or streamed  hash
+ * the same. The width, height and bits per pixel are  hashed  as
+ * well, and the fourth byte of 32 bpp pixels counts,  so the same
+ * colors at 24 and 32 bpp hash differently. The hash is the same
+ * on every CPU, with or without SIMD kernels, but is not  meant
+ * to resist deliberate collisions.
+ *
+ * \param  img   the image, of 24 or 32 bpp
+ * \param  hash  where to store the hash
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the image does not have 24 or 32
+ *                             bpp
+ ***************************************************************/
+extern int BMPmini_hash(BMPmini_image *img, uint64_t *hash);
+
+/***************************************************************
+ * \brief  Same as BMPmini_hash, for the pixels of a view.
+ ***************************************************************/
+extern int BMPmini_hash_view(const BMPmini_view *view, uint64_t *hash);
+
+/***************************************************************
+ * \brief  Starts a hash, before BMPmini_hash_update adds rows to
+ *         it.
+ ***************************************************************/
+extern void BMPmini_hash_init(BMPmini_hash_state *state);
+
+/***************************************************************
+ * \brief  Adds the rows of a view to a hash, as if they followed
+ *         the rows added before.
+ *
+ * Images can thus be hashed a band of rows at a time, as  they
+ * are streamed by BMPmini_reader_read_rows or produced,  giving
+ * the same hash as BMPmini_hash for the whole image.
+ *
+ * \param  state  a hash started by BMPmini_hash_init
+ * \param  view   the rows to add, of 24 or 32 bpp
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the view does not have 24 or  32
+ *                             bpp, or not those of the rows added
+ *                             before
+ * \return BMPmini_RANGE_ERR   if the view is not as wide  as  the
+ *                             rows added before
+ ***************************************************************/
+extern int BMPmini_hash_update(BMPmini_hash_state *state, const BMPmini_view *view);
+
+/***************************************************************
+ * \brief  Gets the hash of the rows added so far. The state  is
+ *         left as is, more rows may still be added.
+ ***************************************************************/
+extern uint64_t BMPmini_hash_final(const BMPmini_hash_state *state);
+
+/***************************************************************
+ * \brief  Finds the smallest rectangle holding every pixel  that
+ *         differs between two images of the same size.
+ *
+ * Rows are compared a vector at a time. Once some rows differ,
+ * the others are only compared left and right of the pixels
+ * found so far, so images differing in a small area cost little
+ * more than comparing its rows once. Pixels are compared as
+ * stored, the header and row padding are not.
+ *
+ * \param  a    the first image, of 24 or 32 bpp
+ * \param  b    the second image, of the same size and bpp
+ * \param  box  where to store the rectangle, empty if the pixels
+ *              are the same
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the images do not have both  24
+ *                             or 32 bpp
+ * \return BMPmini_RANGE_ERR   if the sizes differ
+ ***************************************************************/
+extern int BMPmini_diff(BMPmini_image *a, BMPmini_image *b, BMPmini_rect *box);
+
+/***************************************************************
+ * \brief  Same as BMPmini_diff, for the pixels  of  two  views,
+ *         using 'nthreads' threads (0 for the default  set  by
+ *         BMPmini_set_threads).
+ ***************************************************************/
+extern int BMPmini_diff_view(const BMPmini_view *a, const BMPmini_view *b, BMPmini_rect *box, int nthreads);
+
+/***************************************************************
+ * \brief  Convolves the pixels of a view with a separable kernel,
+ *         the product of a horizontal and a vertical one.
+ *
+ * Both kernels have an odd number of taps, the middle one being
+ * applied to the pixel itself. Weights are rounded to fixed point
+ * numbers, with fewer fractional bits for kernels with large sums.
+ * The blue, green and red channels are clamped to [0, 255],  the
+ * fourth byte of 32 bpp pixels is copied.
+ *
+ * \param  src       the source view, of 24 or 32 bpp
+ * \param  dst       the destination view, of the same size and bpp,
+ *                   not overlapping the source
+ * \param  hkernel   the 'hsize' taps of the horizontal kernel
+ * \param  hsize     an odd number in [1, 1023]
+ * \param  vkernel   the 'vsize' taps of the vertical kernel
+ * \param  vsize     an odd number in [1, 1023]
+ * \param  border    a BMPmini_BORDER_* mode
+ * \param  nthreads  the number of threads, 0 for the  default
+ *                   set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the views do not have both 24  or
+ *                             32 bpp, or the border is unknown
+ * \return BMPmini_RANGE_ERR   if the sizes differ,  or  a  kernel
+ *                             is too large
+ * \return BMPmini_BUFFER_ERR  if both views share their pixels
+ * \return BMPmini_NOMEM_ERR   if there is not enough memory
+ ***************************************************************/
+extern int BMPmini_convolve_view(const BMPmini_view *src, const BMPmini_view *dst, const float *hkernel, int hsize,
+                                 const float *vkernel, int vsize, int border, int nthreads);
+
+/***************************************************************
+ * \brief  Applies a BMPmini_BLUR_*, BMPmini_SHARPEN  or  Sobel
+ *         filter to the pixels of a view.
+ *
+ * Box blurs keep running sums, so that their cost does not grow
+ * with the radius. The others are separable convolutions,  the
+ * sharpening subtracting a Gaussian blur of standard deviation 1.
+ *
+ * \param  src       the source view, of 24 or 32 bpp
+ * \param  dst       the destination view, of the same size and bpp,
+ *                   not overlapping the source
+ * \param  op        the filter
+ * \param  param     its parameter
+ * \param  border    a BMPmini_BORDER_* mode
+ * \param  nthreads  the number of threads, 0 for the  default
+ *                   set by BMPmini_set_threads
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_FORMAT_ERR  if the views do not have both 24  or
+ *                             32 bpp, or the filter or border  is
+ *                             unknown
+ * \return BMPmini_RANGE_ERR   if the sizes differ, or 'param'  is
+ *                             out of range
+ * \return BMPmini_BUFFER_ERR  if both views share their pixels
+ * \return BMPmini_NOMEM_ERR   if there is not enough memory
+ ***************************************************************/
+extern int BMPmini_filter_view(const BMPmini_view *src, const BMPmini_view *dst, int op, float param, int border,
+                               int nthreads);
+
+/***************************************************************
+ * \brief  Creates a filtered copy of an image, with the same
+ *         header and row order (see BMPmini_filter_view).
+ *
+ * \return  a new BMPmini_image if successful
+ * \return  NULL if the image does not have 24 or 32 bpp, or  a
+ *          parameter is invalid
+ ***************************************************************/
+extern BMPmini_image *BMPmini_filter(BMPmini_image *img, int op, float param, int border);
+
+/***************************************************************
+ * \brief  Same as BMPmini_filter, allocating the new image  with
+ *         'allocator' (NULL for the default allocator).
+ ***************************************************************/
+extern BMPmini_image *BMPmini_filter_with(BMPmini_image *img, int op, float param, int border,
+                                          const BMPmini_allocator *allocator);
+
+/***************************************************************
+ * \brief  Enables or disables the SIMD kernels,  which  are
+ *         otherwise picked at run time for the CPU. The results
+ *         are the same either way.
+ *
+ * \param  enabled  false to use the scalar kernels only
+ ***************************************************************/
+extern void BMPmini_set_simd(bool enabled);
+
+/***************************************************************
+ * \brief  Gets the name of the kernels in use: "avx2", "ssse3",
+ *         "neon" or "scalar".
+ ***************************************************************/
+extern const char *BMPmini_simd_name(void);
+
+/***************************************************************
+ * \brief  Sets the allocator used for image buffers  when  none
+ *         is given. Images remember the allocator they come from,
+ *         so BMPmini_free always releases them correctly.
+ *
+ * An allocator can be given per call to the _with variants  of
+ * BMPmini_read, BMPmini_read_region, BMPmini_crop,
+ * BMPmini_image_from_view, BMPmini_resize, BMPmini_transform,
+ * BMPmini_filter and BMPmini_async_read, and to
+ * BMPmini_read_stats.  BMPmini_read_batch  and
+ * BMPmini_crop_threads always use  this  default  one.  Tiles
+ * of a BMPmini_pyramid, and other internal buffers, are  not
+ * images and always come from malloc.
+ *
+ * Should not be called while other threads are using the library.
+ *
+ * \param  allocator  the allocator, NULL to go back to malloc
+ ***************************************************************/
+extern void BMPmini_set_allocator(const BMPmini_allocator *allocator);
+
+/***************************************************************
+ * \brief  Creates a pool keeping released image buffers to  be
+ *         handed out again for images of the same size.
+ *
+ * The pool is thread safe. Once warmed up, a steady stream  of
+ * same-size images does no system allocation.
+ *
+ * \param  max_buffers  the maximum number of idle buffers kept
+ *
+ * \return  a new BMPmini_pool if successful
+ * \return  NULL if an error occurs
+ ***************************************************************/
+extern BMPmini_pool *BMPmini_pool_create(size_t max_buffers);
+
+/***************************************************************
+ * \brief  Gets an allocator drawing from the pool.
+ *
+ * \param  pool       the pool
+ * \param  allocator  where to store the allocator
+ ***************************************************************/
+extern void BMPmini_pool_allocator(BMPmini_pool *pool, BMPmini_allocator *allocator);
+
+/***************************************************************
+ * \brief  Releases the pool and its idle buffers. Every  image
+ *         allocated from it must have been freed.
+ *
+ * \param  pool  the pool to be destroyed
+ ***************************************************************/
+extern void BMPmini_pool_destroy(BMPmini_pool *pool);
+
+/***************************************************************
+ * \brief  Creates a queue of asynchronous image reads.
+ *
+ * On Linux reads go through io_uring, each file being read with
+ * a single request, resubmitted for what is left after a short
+ * read. Elsewhere, or if the kernel refuses it, reads  are
+ * completed inside BMPmini_async_poll, and so are those  left
+ * once io_uring fails later on.
+ *
+ * Only whole images are read: there are no asynchronous writes,
+ * and images are not split in bands of rows submitted apart.
+ * BMPmini_read_region reads regions synchronously.
+ *
+ * \param  depth  the maximum number of reads in flight
+ *
+ * \return  a new BMPmini_async if successful
+ * \return  NULL if an error occurs
+ ***************************************************************/
+extern BMPmini_async *BMPmini_async_create(unsigned depth);
+
+/***************************************************************
+ * \brief  Queues the reading of a BMP image.
+ *
+ * Nothing is read until BMPmini_async_poll is called, and errors
+ * are reported through the callback.
+ *
+ * \param  as        the queue
+ * \param  filename  the path of the BMP image, which must  stay
+ *                   valid until the callback is called
+ * \param  cb        the function called once the read completes
+ * \param  ctx       passed untouched to 'cb'
+ *
+ * \return BMPmini_SUCCESS     if the read was queued
+ * \return BMPmini_NOMEM_ERR   if there is not enough memory
+ ***************************************************************/
+extern int BMPmini_async_read(BMPmini_async *as, const char *filename, BMPmini_async_cb cb, void *ctx);
+
+/***************************************************************
+ * \brief  Same as BMPmini_async_read, allocating the image with
+ *         'allocator' (NULL for the default allocator), which
+ *         is copied and so need not outlive the call.
+ ***************************************************************/
+extern int BMPmini_async_read_with(BMPmini_async *as, const char *filename, BMPmini_async_cb cb, void *ctx,
+                                   const BMPmini_allocator *allocator);
+
+/***************************************************************
+ * \brief  Submits queued reads and calls the callback of  the
+ *         completed ones. Must not be called from a callback.
+ *
+ * \param  as    the queue
+ * \param  wait  whether to block until a read completes
+ *
+ * \return  the number of reads completed
+ ***************************************************************/
+extern size_t BMPmini_async_poll(BMPmini_async *as, bool wait);
+
+/***************************************************************
+ * \brief  Gets the number of reads whose callback has not been
+ *         called yet.
+ *
+ * \param  as  the queue
+ *
+ * \return  the number of pending reads
+ ***************************************************************/
+extern size_t BMPmini_async_pending(BMPmini_async *as);
+
+/***************************************************************
+ * \brief  Completes the pending reads and releases the queue.
+ *
+ * \param  as  the queue to be destroyed
+ ***************************************************************/
+extern void BMPmini_async_destroy(BMPmini_async *as);
+
+/***************************************************************
+ * \brief  Opens a pyramid of tiles over a BMP image, to serve
+ *         its regions at any zoom level.
+ *
+ * Level 0 is the image itself, each level above  is  half  the
+ * size of the one below it, up to a level of a single tile.
+ * Tiles are made on demand: those of level 0 by reading  their
+ * rows from the file, the others by averaging 2x2  pixels  of
+ * the four tiles below them. They are kept in memory, the least
+ * recently used ones going once over  'budget'.  Tiles  above
+ * level 0 are also stored in the sidecar file, if any, and read
+ * back from it by later pyramids over the  same  source.  The
+ * sidecar is started over once the source changes inode, size,
+ * modification or status change time. Each stored tile has  a
+ * checksum, one not matching it after a crash  is  made  again.
+ * The source must not change while opened.
+ *
+ * \param filename   the path of the BMP image, of 24 or 32 bpp
+ * \param tile_size  the width and height of tiles, even
+ * \param budget     the bytes of tiles kept in memory
+ * \param sidecar    the path of the sidecar file, NULL for none
+ *
+ * \return  a new BMPmini_pyramid if successful
+ * \return  NULL if an error occurs
+ ***************************************************************/
+extern BMPmini_pyramid *BMPmini_pyramid_open(const char *restrict filename, int32_t tile_size, size_t budget,
+                                             const char *restrict sidecar);
+
+/***************************************************************
+ * \brief  Gets the number of levels of a pyramid.
+ *
+ * \param  p  the pyramid
+ *
+ * \return  the number of levels, at least 1
+ ***************************************************************/
+extern int BMPmini_pyramid_levels(BMPmini_pyramid *p);
+
+/***************************************************************
+ * \brief  Gets the size of a level. Its tiles are  numbered
+ *         from the top left one, those of the right and bottom
+ *         edges may be smaller than the others.
+ *
+ * \param  p       the pyramid
+ * \param  level   the level, 0 for the full size image
+ * \param  width   where to store the width of the level
+ * \param  height  where to store the height of the level
+ *
+ * \return  true    if successful
+ * \return  false   if there is no such level
+ ***************************************************************/
+extern bool BMPmini_pyramid_size(BMPmini_pyramid *p, int level, int32_t *width, int32_t *height);
+
+/***************************************************************
+ * \brief  Copies a tile into a buffer owned by the caller. May
+ *         be called from several threads at once.
+ *
+ * Rows are stored top to bottom, without BMP padding.
+ *
+ * \param  p        the pyramid
+ * \param  level    the level of the tile
+ * \param  tx       the column of the tile in its level
+ * \param  ty       the row of the tile in its level, from the top
+ * \param  buf      where to store the pixels
+ * \param  bufsize  the size of 'buf'
+ * \param  stride   the distance in bytes between two rows in
+ *                  'buf', 0 for tightly packed rows
+ * \param  view     where to store a view of the tile in 'buf',
+ *                  may be NULL
+ *
+ * \return BMPmini_SUCCESS     if successful
+ * \return BMPmini_RANGE_ERR   if there is no such tile
+ * \return BMPmini_BUFFER_ERR  if 'buf' is too small
+ * \return other BMPmini status codes if the tile cannot be made
+ ***************************************************************/
+extern int BMPmini_pyramid_tile(BMPmini_pyramid *p, int level, int32_t tx, int32_t ty, void *buf, size_t bufsize,
+                                size_t stride, BMPmini_view *view);
+
+/***************************************************************
+ * \brief  Releases a pyramid, its sidecar keeps  the  tiles
+ *         stored so far.
+ *
+ * \param  p  the pyramid to be released
+ ***************************************************************/
+extern void BMPmini_pyramid_close(BMPmini_pyramid *p);
+
 #endif
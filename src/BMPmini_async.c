@@ -0,0 +1,468 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_async.c
+//
+// Asynchronous reading of BMP images for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <assert.h>
+#if defined(BMP_HAVE_IO_URING)
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <sys/syscall.h>
+  #include <sys/uio.h>
+  #include <time.h>
+  #include <linux/io_uring.h>
+  #if !defined(__NR_io_uring_setup) || !defined(__NR_io_uring_enter)
+    #undef BMP_HAVE_IO_URING
+  #endif
+#endif
+
+// Pause between looks at the ring for completions once it cannot be waited on
+#define BMP_ASYNC_BROKEN_WAIT_NS 1000000L
+
+struct __async_req {
+    const char *filename;
+    BMPmini_async_cb cb;
+    void *ctx;
+    BMPmini_image *img;
+    BMPmini_allocator allocator;  // Of the image, fixed when the read is queued
+    int status;
+#if defined(BMP_HAVE_IO_URING)
+    int fd;
+    long file_size;
+    uint64_t off;         // File offset of 'iov'
+    struct iovec iov;     // What is left to read of the header, then of the rest of the file
+    unsigned char hdrbytes[BMP_HEADER_SIZE];
+#endif
+    struct __async_req *next;
+};
+
+#if defined(BMP_HAVE_IO_URING)
+struct __uring {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+};
+#endif
+
+struct _BMPmini_async {
+    unsigned depth;               // Maximum number of reads in flight
+    unsigned inflight;
+    size_t pending;               // Reads whose callback was not called yet
+    struct __async_req *queued;   // Not submitted yet, oldest first
+    struct __async_req *queued_tail;
+#if defined(BMP_HAVE_IO_URING)
+    bool uring;
+    bool broken;                  // io_uring_enter failed, reads go through the fallback
+    struct __uring ring;
+#endif
+};
+
+static void __complete(BMPmini_async *as, struct __async_req *req)
+{
+    as->pending--;
+    req->cb(req->filename, req->img, req->status, req->ctx);
+    free(req);
+}
+
+// Completes up to 'depth' queued reads right here. Readiness of regular
+// files cannot be polled, so this is the fallback without io_uring.
+static size_t __sync_poll(BMPmini_async *as)
+{
+    size_t ncomplete = 0;
+    while (as->queued && ncomplete < as->depth) {
+        struct __async_req *req = as->queued;
+        as->queued = req->next;
+        req->status = __read_image(req->filename, &req->img, &req->allocator);
+        __complete(as, req);
+        ncomplete++;
+    }
+    return ncomplete;
+}
+
+#if defined(BMP_HAVE_IO_URING)
+static bool __uring_setup(struct __uring *ring, unsigned depth)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->fd = (int) syscall(__NR_io_uring_setup, depth, &p);
+    if (ring->fd < 0) {
+        return false;
+    }
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_len = ring->cq_len = ring->sq_len > ring->cq_len ? ring->sq_len : ring->cq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        goto CLEANUP_U2;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            goto CLEANUP_U1;
+        }
+    }
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        goto CLEANUP_U0;
+    }
+
+    uint8_t *sq = ring->sq_ptr;
+    uint8_t *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *) (sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+    ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return true;
+CLEANUP_U0:
+    if (ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+CLEANUP_U1:
+    munmap(ring->sq_ptr, ring->sq_len);
+CLEANUP_U2:
+    close(ring->fd);
+    return false;
+}
+
+static void __uring_teardown(struct __uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->fd);
+}
+
+// Queues the reading of what is left of the current part of a file
+static void __uring_queue(struct __uring *ring, struct __async_req *req)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = req->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &req->iov;
+    sqe->len = 1;
+    sqe->off = req->off;
+    sqe->user_data = (uint64_t) (uintptr_t) req;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Opens the file and queues the reading of its header
+static bool __uring_prepare(BMPmini_async *as, struct __async_req *req)
+{
+    req->fd = open(req->filename, O_RDONLY);
+    if (req->fd == -1) {
+        req->status = BMPmini_FOPEN_ERR;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(req->fd, &st) == -1) {
+        req->status = BMPmini_FREAD_ERR;
+        goto CLEANUP_P1;
+    }
+    /* The BMP 'size' field cannot describe anything larger */
+    if (st.st_size < (off_t) BMP_HEADER_SIZE || (uintmax_t) st.st_size > UINT32_MAX) {
+        req->status = BMPmini_HEADER_ERR;
+        goto CLEANUP_P1;
+    }
+    req->file_size = (long) st.st_size;
+
+    /* The image is allocated once the header tells where its pixels start */
+    req->iov.iov_base = req->hdrbytes;
+    req->iov.iov_len = BMP_HEADER_SIZE;
+    req->off = 0;
+    __uring_queue(&as->ring, req);
+    return true;
+CLEANUP_P1:
+    close(req->fd);
+    return false;
+}
+
+// Takes the result of a read. Returns true if more has to be read, the
+// rest of a short read or the pixels after the header.
+static bool __uring_finish(struct __async_req *req, int res)
+{
+    req->status = BMPmini_FREAD_ERR;
+    if (res <= 0) {
+        goto CLEANUP_F1;
+    }
+    req->iov.iov_base = (uint8_t *) req->iov.iov_base + res;
+    req->iov.iov_len -= (size_t) res;
+    req->off += (uint64_t) res;
+    if (req->iov.iov_len > 0) {
+        return true;
+    }
+
+    if (!req->img) {
+        BMPmini_header header;
+        __parse_bytes2hdr(&header, req->hdrbytes);
+        if (!__check_header(&header, req->file_size)) {
+            req->status = BMPmini_HEADER_ERR;
+            goto CLEANUP_F1;
+        }
+        size_t datasz = (size_t) req->file_size - BMP_HEADER_SIZE;
+        /* Compressed pixels land in a buffer of their own, decoded into the image */
+        req->img = __alloc_image(&header, datasz, __is_rle(&header) ? NULL : &req->allocator);
+        if (!req->img) {
+            req->status = BMPmini_NOMEM_ERR;
+            goto CLEANUP_F1;
+        }
+        req->iov.iov_base = req->img->data;
+        req->iov.iov_len = datasz;
+        if (datasz > 0) {
+            return true;
+        }
+    }
+
+    close(req->fd);
+    if (__is_rle(&req->img->header)) {
+        BMPmini_image *img;
+        req->status = __rle_decode_image(&req->img->header, req->img->data, &img, &req->allocator);
+        __free_image(req->img);
+        req->img = img;
+        return false;
+    }
+    req->status = BMPmini_SUCCESS;
+    return false;
+CLEANUP_F1:
+    close(req->fd);
+    if (req->img) {
+        __free_image(req->img);
+        req->img = NULL;
+    }
+    return false;
+}
+
+// Completes a read the ring can no longer take with the fallback path
+static void __uring_fallback(BMPmini_async *as, struct __async_req *req)
+{
+    close(req->fd);
+    if (req->img) {
+        __free_image(req->img);
+        req->img = NULL;
+    }
+    as->inflight--;
+    req->status = __read_image(req->filename, &req->img, &req->allocator);
+    __complete(as, req);
+}
+
+// Gives up on the ring once io_uring_enter fails for good: the reads it did
+// not take yet are taken back and done synchronously, those it took are
+// still reaped as they complete
+static size_t __uring_break(BMPmini_async *as)
+{
+    struct __uring *ring = &as->ring;
+    size_t ncomplete = 0;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+    as->broken = true;
+    for (; head != tail; head++) {
+        struct io_uring_sqe *sqe = &ring->sqes[ring->sq_array[head & *ring->sq_mask]];
+        __uring_fallback(as, (struct __async_req *) (uintptr_t) sqe->user_data);
+        ncomplete++;
+    }
+    return ncomplete;
+}
+
+static size_t __uring_reap(BMPmini_async *as)
+{
+    struct __uring *ring = &as->ring;
+    size_t ncomplete = 0;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        struct __async_req *req = (struct __async_req *) (uintptr_t) cqe->user_data;
+        int res = cqe->res;
+        /* The entry is free once copied, a read queued again may need it */
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+        if (!__uring_finish(req, res)) {
+            as->inflight--;
+            __complete(as, req);
+        }
+        else if (as->broken) {
+            __uring_fallback(as, req);
+        }
+        else {
+            __uring_queue(ring, req);
+            continue;
+        }
+        ncomplete++;
+    }
+    return ncomplete;
+}
+
+static size_t __uring_poll(BMPmini_async *as, bool wait)
+{
+    struct __uring *ring = &as->ring;
+    size_t ncomplete = 0;
+    for (;;) {
+        if (as->broken) {
+            ncomplete += __sync_poll(as);
+        }
+        while (!as->broken && as->queued && as->inflight < as->depth) {
+            struct __async_req *req = as->queued;
+            as->queued = req->next;
+            if (__uring_prepare(as, req)) {
+                as->inflight++;
+            }
+            else {
+                __complete(as, req);
+                ncomplete++;
+            }
+        }
+
+        /* Reads queued again after a short read are submitted as well */
+        unsigned to_submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        bool ready = *ring->cq_head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        unsigned min_complete = wait && !ncomplete && !ready && as->inflight ? 1 : 0;
+        if (as->broken && min_complete) {
+            /* Completions still reach the ring, they are just not waited for */
+            struct timespec ts = {0, BMP_ASYNC_BROKEN_WAIT_NS};
+            nanosleep(&ts, NULL);
+        }
+        else if (to_submit || min_complete) {
+            unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+            int ret = (int) syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags, NULL, 0);
+            /* EBUSY asks for completions to be reaped first, EAGAIN to retry */
+            if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[WARN]: io_uring_enter", 1);
+                ncomplete += __uring_break(as);
+            }
+        }
+
+        ncomplete += __uring_reap(as);
+        if (!wait || ncomplete || !as->pending) {
+            return ncomplete;
+        }
+    }
+}
+#endif
+
+BMPmini_async *BMPmini_async_create(unsigned depth)
+{
+    assert(depth > 0);
+
+    BMPmini_async *as = malloc(sizeof(*as));
+    if (!as) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        return NULL;
+    }
+    as->depth = depth;
+    as->inflight = 0;
+    as->pending = 0;
+    as->queued = NULL;
+    as->queued_tail = NULL;
+#if defined(BMP_HAVE_IO_URING)
+    /* Kernels without io_uring (or sandboxes denying it) use the fallback */
+    as->uring = __uring_setup(&as->ring, depth);
+    as->broken = false;
+#endif
+    return as;
+}
+
+int BMPmini_async_read(BMPmini_async *as, const char *filename, BMPmini_async_cb cb, void *ctx)
+{
+    return BMPmini_async_read_with(as, filename, cb, ctx, NULL);
+}
+
+int BMPmini_async_read_with(BMPmini_async *as, const char *filename, BMPmini_async_cb cb, void *ctx,
+                            const BMPmini_allocator *allocator)
+{
+    assert(as && filename && cb);
+
+    struct __async_req *req = malloc(sizeof(*req));
+    if (!req) {
+        return BMPmini_NOMEM_ERR;
+    }
+    req->filename = filename;
+    req->cb = cb;
+    req->ctx = ctx;
+    req->img = NULL;
+    req->allocator = *__get_allocator(allocator);
+    req->status = BMPmini_SUCCESS;
+    req->next = NULL;
+
+    if (as->queued) {
+        as->queued_tail->next = req;
+    }
+    else {
+        as->queued = req;
+    }
+    as->queued_tail = req;
+    as->pending++;
+    return BMPmini_SUCCESS;
+}
+
+size_t BMPmini_async_poll(BMPmini_async *as, bool wait)
+{
+    assert(as);
+#if defined(BMP_HAVE_IO_URING)
+    if (as->uring) {
+        return __uring_poll(as, wait);
+    }
+#endif
+    (void) wait;
+    return __sync_poll(as);
+}
+
+size_t BMPmini_async_pending(BMPmini_async *as)
+{
+    assert(as);
+    return as->pending;
+}
+
+void BMPmini_async_destroy(BMPmini_async *as)
+{
+    if (as) {
+        while (as->pending) {
+            BMPmini_async_poll(as, true);
+        }
+#if defined(BMP_HAVE_IO_URING)
+        if (as->uring) {
+            __uring_teardown(&as->ring);
+        }
+#endif
+        free(as);
+    }
+}
@@ -0,0 +1,707 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_convert.c
+//
+// Pixel format conversion for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <assert.h>
+#if defined(BMP_HAVE_X86_SIMD)
+  #include <immintrin.h>
+#endif
+#if defined(BMP_HAVE_NEON)
+  #include <arm_neon.h>
+#endif
+
+// Gray levels use 7-bit weights, so every kernel gives the same result:
+//     Y = (38 R + 75 G + 15 B + 64) >> 7
+#define BMP_GRAY_R 38
+#define BMP_GRAY_G 75
+#define BMP_GRAY_B 15
+
+#define BMP_F32_SCALE (1.0f / 255.0f)
+
+// Narrower rows are mostly scalar tails, they are not worth the SIMD setup
+#define BMP_SIMD_MIN_WIDTH 16
+
+typedef void (*__row_fn)(const uint8_t *src, uint8_t *dst, size_t n);
+typedef void (*__planar_fn)(const uint8_t *src, float *r, float *g, float *b, size_t n);
+
+struct __convert_kernels {
+    const char *name;
+    __row_fn bgr24_to_rgba32;
+    __row_fn bgr24_to_gray8;
+    __planar_fn bgr24_to_planar;
+    __row_fn rgba32_to_bgr24;
+};
+
+static bool __simd_enabled = true;
+
+//-------------------------------------
+// Scalar kernels, the reference for all the others
+//-------------------------------------
+static void __bgr24_to_rgba32_c(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++, src += 3, dst += 4) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        dst[3] = 0xFF;
+    }
+}
+
+static void __bgr24_to_gray8_c(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++, src += 3) {
+        dst[i] = (uint8_t) ((BMP_GRAY_B * src[0] + BMP_GRAY_G * src[1] + BMP_GRAY_R * src[2] + 64) >> 7);
+    }
+}
+
+static void __bgr24_to_planar_c(const uint8_t *src, float *r, float *g, float *b, size_t n)
+{
+    for (size_t i = 0; i < n; i++, src += 3) {
+        b[i] = (float) src[0] * BMP_F32_SCALE;
+        g[i] = (float) src[1] * BMP_F32_SCALE;
+        r[i] = (float) src[2] * BMP_F32_SCALE;
+    }
+}
+
+static void __rgba32_to_bgr24_c(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++, src += 4, dst += 3) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+    }
+}
+
+static void __gray8_to_bgr24(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++, dst += 3) {
+        dst[0] = dst[1] = dst[2] = src[i];
+    }
+}
+
+static uint8_t __f32_to_u8(float v)
+{
+    v = v * 255.0f + 0.5f;
+    return v <= 0.0f ? 0 : v >= 255.0f ? 255 : (uint8_t) v;
+}
+
+static void __planar_to_bgr24(const float *r, const float *g, const float *b, uint8_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++, dst += 3) {
+        dst[0] = __f32_to_u8(b[i]);
+        dst[1] = __f32_to_u8(g[i]);
+        dst[2] = __f32_to_u8(r[i]);
+    }
+}
+
+static const struct __convert_kernels __kernels_c = {
+    "scalar", __bgr24_to_rgba32_c, __bgr24_to_gray8_c, __bgr24_to_planar_c, __rgba32_to_bgr24_c
+};
+
+//-------------------------------------
+// x86 kernels
+//-------------------------------------
+// 16 byte loads only use their first 12 bytes (4 pixels), a chunk of P
+// pixels may be loaded as long as P + 2 pixels are left in the row. AVX2
+// kernels clear the upper halves of the registers before handing the tail
+// to the SSE kernels, or mixing both encodings stalls.
+#if defined(BMP_HAVE_X86_SIMD)
+#define BMP_SSSE3 __attribute__((target("ssse3")))
+#define BMP_AVX2  __attribute__((target("avx2")))
+
+BMP_SSSE3 static void __bgr24_to_rgba32_ssse3(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    const __m128i shuf = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+    size_t i = 0;
+    for (; i + 4 + 2 <= n; i += 4, src += 12, dst += 16) {
+        __m128i px = _mm_loadu_si128((const __m128i *) src);
+        _mm_storeu_si128((__m128i *) dst, _mm_or_si128(_mm_shuffle_epi8(px, shuf), alpha));
+    }
+    __bgr24_to_rgba32_c(src, dst, n - i);
+}
+
+BMP_SSSE3 static void __bgr24_to_gray8_ssse3(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    const __m128i shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i weights = _mm_setr_epi8(BMP_GRAY_B, BMP_GRAY_G, BMP_GRAY_R, 0, BMP_GRAY_B, BMP_GRAY_G, BMP_GRAY_R, 0,
+                                          BMP_GRAY_B, BMP_GRAY_G, BMP_GRAY_R, 0, BMP_GRAY_B, BMP_GRAY_G, BMP_GRAY_R, 0);
+    const __m128i round = _mm_set1_epi16(64);
+    size_t i = 0;
+    for (; i + 16 + 2 <= n; i += 16, src += 48) {
+        __m128i p0 = _mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) src), shuf), weights);
+        __m128i p1 = _mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 12)), shuf), weights);
+        __m128i p2 = _mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 24)), shuf), weights);
+        __m128i p3 = _mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 36)), shuf), weights);
+        __m128i y0 = _mm_srli_epi16(_mm_add_epi16(_mm_hadd_epi16(p0, p1), round), 7);
+        __m128i y1 = _mm_srli_epi16(_mm_add_epi16(_mm_hadd_epi16(p2, p3), round), 7);
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(y0, y1));
+    }
+    __bgr24_to_gray8_c(src, dst + i, n - i);
+}
+
+BMP_SSSE3 static void __bgr24_to_planar_ssse3(const uint8_t *src, float *r, float *g, float *b, size_t n)
+{
+    const __m128i shuf_r = _mm_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1);
+    const __m128i shuf_g = _mm_setr_epi8(1, -1, -1, -1, 4, -1, -1, -1, 7, -1, -1, -1, 10, -1, -1, -1);
+    const __m128i shuf_b = _mm_setr_epi8(0, -1, -1, -1, 3, -1, -1, -1, 6, -1, -1, -1, 9, -1, -1, -1);
+    const __m128 scale = _mm_set1_ps(BMP_F32_SCALE);
+    size_t i = 0;
+    for (; i + 4 + 2 <= n; i += 4, src += 12) {
+        __m128i px = _mm_loadu_si128((const __m128i *) src);
+        _mm_storeu_ps(r + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_shuffle_epi8(px, shuf_r)), scale));
+        _mm_storeu_ps(g + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_shuffle_epi8(px, shuf_g)), scale));
+        _mm_storeu_ps(b + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_shuffle_epi8(px, shuf_b)), scale));
+    }
+    __bgr24_to_planar_c(src, r + i, g + i, b + i, n - i);
+}
+
+BMP_SSSE3 static void __rgba32_to_bgr24_ssse3(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    const __m128i shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    size_t i = 0;
+    /* Each store spills 4 bytes over the next pixels, which are written later */
+    for (; i + 4 + 2 <= n; i += 4, src += 16, dst += 12) {
+        __m128i px = _mm_loadu_si128((const __m128i *) src);
+        _mm_storeu_si128((__m128i *) dst, _mm_shuffle_epi8(px, shuf));
+    }
+    __rgba32_to_bgr24_c(src, dst, n - i);
+}
+
+BMP_AVX2 static inline __m256i __load_8px_avx2(const uint8_t *src)
+{
+    __m128i lo = _mm_loadu_si128((const __m128i *) src);
+    __m128i hi = _mm_loadu_si128((const __m128i *) (src + 12));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+BMP_AVX2 static void __bgr24_to_rgba32_avx2(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    const __m256i shuf = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+                                          2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m256i alpha = _mm256_set1_epi32((int) 0xFF000000);
+    size_t i = 0;
+    for (; i + 16 + 2 <= n; i += 16, src += 48, dst += 64) {
+        __m256i p0 = _mm256_shuffle_epi8(__load_8px_avx2(src), shuf);
+        __m256i p1 = _mm256_shuffle_epi8(__load_8px_avx2(src + 24), shuf);
+        _mm256_storeu_si256((__m256i *) dst, _mm256_or_si256(p0, alpha));
+        _mm256_storeu_si256((__m256i *) (dst + 32), _mm256_or_si256(p1, alpha));
+    }
+    _mm256_zeroupper();
+    __bgr24_to_rgba32_ssse3(src, dst, n - i);
+}
+
+BMP_AVX2 static void __bgr24_to_gray8_avx2(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    const __m256i shuf = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                          0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i weights = _mm256_setr_epi8(BMP_GRAY_B, BMP_GRAY_G, BMP_GRAY_R, 0, BMP_GRAY_B, BMP_GRAY_G, BMP_GRAY_R, 0,
+                                             BMP_GRAY_B, BMP_GRAY_G, BMP_GRAY_R, 0, BMP_GRAY_B, BMP_GRAY_G, BMP_GRAY_R, 0,
+                                             BMP_GRAY_B, BMP_GRAY_G, BMP_GRAY_R, 0, BMP_GRAY_B, BMP_GRAY_G, BMP_GRAY_R, 0,
+                                             BMP_GRAY_B, BMP_GRAY_G, BMP_GRAY_R, 0, BMP_GRAY_B, BMP_GRAY_G, BMP_GRAY_R, 0);
+    const __m256i round = _mm256_set1_epi16(64);
+    /* hadd and packus work within 128-bit lanes, this puts 4 pixel groups back in order */
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 32 + 2 <= n; i += 32, src += 96) {
+        __m256i p0 = _mm256_maddubs_epi16(_mm256_shuffle_epi8(__load_8px_avx2(src), shuf), weights);
+        __m256i p1 = _mm256_maddubs_epi16(_mm256_shuffle_epi8(__load_8px_avx2(src + 24), shuf), weights);
+        __m256i p2 = _mm256_maddubs_epi16(_mm256_shuffle_epi8(__load_8px_avx2(src + 48), shuf), weights);
+        __m256i p3 = _mm256_maddubs_epi16(_mm256_shuffle_epi8(__load_8px_avx2(src + 72), shuf), weights);
+        __m256i y0 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_hadd_epi16(p0, p1), round), 7);
+        __m256i y1 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_hadd_epi16(p2, p3), round), 7);
+        __m256i y = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(y0, y1), order);
+        _mm256_storeu_si256((__m256i *) (dst + i), y);
+    }
+    _mm256_zeroupper();
+    __bgr24_to_gray8_ssse3(src, dst + i, n - i);
+}
+
+BMP_AVX2 static void __bgr24_to_planar_avx2(const uint8_t *src, float *r, float *g, float *b, size_t n)
+{
+    const __m256i shuf_r = _mm256_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1,
+                                            2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1);
+    const __m256i shuf_g = _mm256_setr_epi8(1, -1, -1, -1, 4, -1, -1, -1, 7, -1, -1, -1, 10, -1, -1, -1,
+                                            1, -1, -1, -1, 4, -1, -1, -1, 7, -1, -1, -1, 10, -1, -1, -1);
+    const __m256i shuf_b = _mm256_setr_epi8(0, -1, -1, -1, 3, -1, -1, -1, 6, -1, -1, -1, 9, -1, -1, -1,
+                                            0, -1, -1, -1, 3, -1, -1, -1, 6, -1, -1, -1, 9, -1, -1, -1);
+    const __m256 scale = _mm256_set1_ps(BMP_F32_SCALE);
+    size_t i = 0;
+    for (; i + 8 + 2 <= n; i += 8, src += 24) {
+        __m256i px = __load_8px_avx2(src);
+        _mm256_storeu_ps(r + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_shuffle_epi8(px, shuf_r)), scale));
+        _mm256_storeu_ps(g + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_shuffle_epi8(px, shuf_g)), scale));
+        _mm256_storeu_ps(b + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_shuffle_epi8(px, shuf_b)), scale));
+    }
+    _mm256_zeroupper();
+    __bgr24_to_planar_ssse3(src, r + i, g + i, b + i, n - i);
+}
+
+static const struct __convert_kernels __kernels_ssse3 = {
+    "ssse3", __bgr24_to_rgba32_ssse3, __bgr24_to_gray8_ssse3, __bgr24_to_planar_ssse3, __rgba32_to_bgr24_ssse3
+};
+
+static const struct __convert_kernels __kernels_avx2 = {
+    "avx2", __bgr24_to_rgba32_avx2, __bgr24_to_gray8_avx2, __bgr24_to_planar_avx2, __rgba32_to_bgr24_ssse3
+};
+#endif
+
+//-------------------------------------
+// ARM kernels
+//-------------------------------------
+#if defined(BMP_HAVE_NEON)
+static void __bgr24_to_rgba32_neon(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16, src += 48, dst += 64) {
+        uint8x16x3_t bgr = vld3q_u8(src);
+        uint8x16x4_t rgba = {{bgr.val[2], bgr.val[1], bgr.val[0], vdupq_n_u8(0xFF)}};
+        vst4q_u8(dst, rgba);
+    }
+    __bgr24_to_rgba32_c(src, dst, n - i);
+}
+
+static void __bgr24_to_gray8_neon(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    const uint8x8_t wr = vdup_n_u8(BMP_GRAY_R);
+    const uint8x8_t wg = vdup_n_u8(BMP_GRAY_G);
+    const uint8x8_t wb = vdup_n_u8(BMP_GRAY_B);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8, src += 24) {
+        uint8x8x3_t bgr = vld3_u8(src);
+        uint16x8_t y = vmull_u8(bgr.val[0], wb);
+        y = vmlal_u8(y, bgr.val[1], wg);
+        y = vmlal_u8(y, bgr.val[2], wr);
+        vst1_u8(dst + i, vrshrn_n_u16(y, 7));
+    }
+    __bgr24_to_gray8_c(src, dst + i, n - i);
+}
+
+static inline void __u8_to_f32_neon(uint8x8_t v, float *dst, float32x4_t scale)
+{
+    uint16x8_t w = vmovl_u8(v);
+    vst1q_f32(dst, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(w))), scale));
+    vst1q_f32(dst + 4, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(w))), scale));
+}
+
+static void __bgr24_to_planar_neon(const uint8_t *src, float *r, float *g, float *b, size_t n)
+{
+    const float32x4_t scale = vdupq_n_f32(BMP_F32_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8, src += 24) {
+        uint8x8x3_t bgr = vld3_u8(src);
+        __u8_to_f32_neon(bgr.val[0], b + i, scale);
+        __u8_to_f32_neon(bgr.val[1], g + i, scale);
+        __u8_to_f32_neon(bgr.val[2], r + i, scale);
+    }
+    __bgr24_to_planar_c(src, r + i, g + i, b + i, n - i);
+}
+
+static void __rgba32_to_bgr24_neon(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16, src += 64, dst += 48) {
+        uint8x16x4_t rgba = vld4q_u8(src);
+        uint8x16x3_t bgr = {{rgba.val[2], rgba.val[1], rgba.val[0]}};
+        vst3q_u8(dst, bgr);
+    }
+    __rgba32_to_bgr24_c(src, dst, n - i);
+}
+
+static const struct __convert_kernels __kernels_neon = {
+    "neon", __bgr24_to_rgba32_neon, __bgr24_to_gray8_neon, __bgr24_to_planar_neon, __rgba32_to_bgr24_neon
+};
+#endif
+
+unsigned __simd_caps(void)
+{
+    unsigned caps = 0;
+    if (!__simd_enabled) {
+        return caps;
+    }
+#if defined(BMP_HAVE_X86_SIMD)
+    if (__builtin_cpu_supports("ssse3")) {
+        caps |= BMP_SIMD_SSSE3;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        caps |= BMP_SIMD_AVX2;
+    }
+#endif
+#if defined(BMP_HAVE_NEON)
+    caps |= BMP_SIMD_NEON;
+#endif
+    return caps;
+}
+
+static const struct __convert_kernels *__get_kernels(void)
+{
+    unsigned caps = __simd_caps();
+#if defined(BMP_HAVE_X86_SIMD)
+    if (caps & BMP_SIMD_AVX2) {
+        return &__kernels_avx2;
+    }
+    if (caps & BMP_SIMD_SSSE3) {
+        return &__kernels_ssse3;
+    }
+#endif
+#if defined(BMP_HAVE_NEON)
+    if (caps & BMP_SIMD_NEON) {
+        return &__kernels_neon;
+    }
+#endif
+    (void) caps;
+    return &__kernels_c;
+}
+
+void BMPmini_set_simd(bool enabled)
+{
+    __simd_enabled = enabled;
+}
+
+const char *BMPmini_simd_name(void)
+{
+    return __get_kernels()->name;
+}
+
+static size_t __format_bytes_per_pixel(int format)
+{
+    switch (format) {
+    case BMPmini_FMT_BGR24:      return 3;
+    case BMPmini_FMT_RGBA32:     return 4;
+    case BMPmini_FMT_GRAY8:      return 1;
+    case BMPmini_FMT_PLANAR_F32: return sizeof(float);
+    default:                     return 0;
+    }
+}
+
+struct __convert_job {
+    const struct __convert_kernels *kernels;
+    const BMPmini_view *view;
+    uint8_t *buf;          // Caller buffer, rows top to bottom
+    size_t stride;         // Distance in bytes between two rows of 'buf'
+    size_t plane_size;     // Distance in bytes between two planes of 'buf'
+    int format;
+};
+
+static void __convert_from_band(void *arg, int32_t first, int32_t last)
+{
+    struct __convert_job *job = arg;
+    const BMPmini_view *view = job->view;
+    size_t n = (size_t) view->width;
+    for (int32_t i = first; i < last; i++) {
+        const uint8_t *src = view->base + i * view->stride;
+        uint8_t *dst = job->buf + i * job->stride;
+        switch (job->format) {
+        case BMPmini_FMT_BGR24:
+            memcpy(dst, src, n * 3);
+            break;
+        case BMPmini_FMT_RGBA32:
+            job->kernels->bgr24_to_rgba32(src, dst, n);
+            break;
+        case BMPmini_FMT_GRAY8:
+            job->kernels->bgr24_to_gray8(src, dst, n);
+            break;
+        case BMPmini_FMT_PLANAR_F32:
+            job->kernels->bgr24_to_planar(src, (float *) dst, (float *) (dst + job->plane_size),
+                                          (float *) (dst + 2 * job->plane_size), n);
+            break;
+        }
+    }
+}
+
+static void __convert_to_band(void *arg, int32_t first, int32_t last)
+{
+    struct __convert_job *job = arg;
+    const BMPmini_view *view = job->view;
+    size_t n = (size_t) view->width;
+    for (int32_t i = first; i < last; i++) {
+        const uint8_t *src = job->buf + i * job->stride;
+        uint8_t *dst = view->base + i * view->stride;
+        switch (job->format) {
+        case BMPmini_FMT_BGR24:
+            memcpy(dst, src, n * 3);
+            break;
+        case BMPmini_FMT_RGBA32:
+            job->kernels->rgba32_to_bgr24(src, dst, n);
+            break;
+        case BMPmini_FMT_GRAY8:
+            __gray8_to_bgr24(src, dst, n);
+            break;
+        case BMPmini_FMT_PLANAR_F32:
+            __planar_to_bgr24((const float *) src, (const float *) (src + job->plane_size),
+                              (const float *) (src + 2 * job->plane_size), dst, n);
+            break;
+        }
+    }
+}
+
+static int __convert(const BMPmini_view *view, int format, uint8_t *buf, size_t stride, int nthreads, __band_fn fn)
+{
+    assert(view && (buf || view->height == 0));
+
+    size_t bpp = __format_bytes_per_pixel(format);
+    if (!bpp || view->bitsperpixel != BMP_BITS_PER_PIXEL) {
+        return BMPmini_FORMAT_ERR;
+    }
+    if (stride == 0) {
+        stride = (size_t) view->width * bpp;
+    }
+    if (stride < (size_t) view->width * bpp) {
+        return BMPmini_BUFFER_ERR;
+    }
+
+    const struct __convert_kernels *kernels = view->width < BMP_SIMD_MIN_WIDTH ? &__kernels_c : __get_kernels();
+    struct __convert_job job = {kernels, view, buf, stride, stride * view->height, format};
+    __run_bands(view->height, (size_t) view->width * bpp, nthreads, fn, &job);
+    return BMPmini_SUCCESS;
+}
+
+int BMPmini_convert(const BMPmini_view *src, int format, void *dst, size_t dst_stride, int nthreads)
+{
+    return __convert(src, format, dst, dst_stride, nthreads, __convert_from_band);
+}
+
+int BMPmini_convert_to_view(const void *src, size_t src_stride, int format, const BMPmini_view *dst, int nthreads)
+{
+    return __convert(dst, format, (uint8_t *) src, src_stride, nthreads, __convert_to_band);
+}
+
+//-------------------------------------
+// Decoding of paletted and 32 bpp images
+//-------------------------------------
+// Paletted rows are expanded a source byte at a time: a table holds the
+// converted pixels packed in each of the 256 possible bytes, at most 8
+// pixels of 4 bytes.
+#define BMP_EXPAND_MAX (BMP_BITS_PER_BYTE * 4)
+
+struct __indexed_job {
+    BMPmini_view view;
+    uint8_t *buf;          // Caller buffer, rows top to bottom
+    size_t stride;         // Distance in bytes between two rows of 'buf'
+    size_t pixel_size;     // Bytes per converted pixel
+    size_t entry_size;     // Bytes per table entry
+    uint8_t table[256 * BMP_EXPAND_MAX];
+};
+
+// Converts a BGR color to 'format', returns the number of bytes written
+static inline size_t __pack_color(uint8_t b, uint8_t g, uint8_t r, uint8_t a, int format, uint8_t *dst)
+{
+    switch (format) {
+    case BMPmini_FMT_BGR24:
+        dst[0] = b;
+        dst[1] = g;
+        dst[2] = r;
+        return 3;
+    case BMPmini_FMT_RGBA32:
+        dst[0] = r;
+        dst[1] = g;
+        dst[2] = b;
+        dst[3] = a;
+        return 4;
+    default:
+        dst[0] = (uint8_t) ((BMP_GRAY_B * b + BMP_GRAY_G * g + BMP_GRAY_R * r + 64) >> 7);
+        return 1;
+    }
+}
+
+static inline void __expand_bytes(const uint8_t *src, uint8_t *dst, size_t nbytes, const uint8_t *table, size_t size)
+{
+    for (size_t i = 0; i < nbytes; i++, dst += size) {
+        memcpy(dst, table + src[i] * size, size);
+    }
+}
+
+static void __decode_indexed_band(void *arg, int32_t first, int32_t last)
+{
+    struct __indexed_job *job = arg;
+    size_t ppb = job->entry_size / job->pixel_size;  // Pixels per source byte
+    size_t nbytes = (size_t) job->view.width / ppb;
+    size_t tail = (size_t) job->view.width % ppb;
+    for (int32_t i = first; i < last; i++) {
+        const uint8_t *src = job->view.base + i * job->view.stride;
+        uint8_t *dst = job->buf + i * job->stride;
+        /* Constant sizes let the copies be inlined */
+        switch (job->entry_size) {
+        case 1:  __expand_bytes(src, dst, nbytes, job->table, 1);  break;
+        case 2:  __expand_bytes(src, dst, nbytes, job->table, 2);  break;
+        case 3:  __expand_bytes(src, dst, nbytes, job->table, 3);  break;
+        case 4:  __expand_bytes(src, dst, nbytes, job->table, 4);  break;
+        case 6:  __expand_bytes(src, dst, nbytes, job->table, 6);  break;
+        case 8:  __expand_bytes(src, dst, nbytes, job->table, 8);  break;
+        case 24: __expand_bytes(src, dst, nbytes, job->table, 24); break;
+        case 32: __expand_bytes(src, dst, nbytes, job->table, 32); break;
+        }
+        if (tail) {
+            memcpy(dst + nbytes * job->entry_size, job->table + src[nbytes] * job->entry_size, tail * job->pixel_size);
+        }
+    }
+}
+
+static int __decode_indexed(BMPmini_image *img, int format, uint8_t *buf, size_t stride, int nthreads)
+{
+    struct __indexed_job *job = malloc(sizeof(*job));
+    if (!job) {
+        return BMPmini_NOMEM_ERR;
+    }
+    BMPmini_get_view(img, &job->view);
+    job->buf = buf;
+    job->stride = stride;
+
+    /* Indices past the end of the palette are black */
+    static const uint8_t black[4] = {0, 0, 0, 0};
+    uint8_t colors[256][4];
+    const uint8_t *palette;
+    uint32_t entries = BMPmini_get_palette(img, &palette);
+    for (uint32_t k = 0; k < 256; k++) {
+        const uint8_t *quad = k < entries ? palette + 4 * k : black;
+        job->pixel_size = __pack_color(quad[0], quad[1], quad[2], 0xFF, format, colors[k]);
+    }
+
+    unsigned depth = img->header.bitsperpixel;
+    unsigned ppb = BMP_BITS_PER_BYTE / depth;
+    unsigned index_mask = (1U << depth) - 1;
+    job->entry_size = ppb * job->pixel_size;
+    for (unsigned v = 0; v < 256; v++) {
+        /* The leftmost pixel is in the most significant bits */
+        for (unsigned j = 0; j < ppb; j++) {
+            unsigned index = (v >> (BMP_BITS_PER_BYTE - depth * (j + 1))) & index_mask;
+            memcpy(job->table + v * job->entry_size + j * job->pixel_size, colors[index], job->pixel_size);
+        }
+    }
+
+    __run_bands(job->view.height, stride, nthreads, __decode_indexed_band, job);
+    free(job);
+    return BMPmini_SUCCESS;
+}
+
+struct __channel {
+    uint32_t mask;
+    unsigned shift;
+    unsigned bits;
+};
+
+struct __masked_job {
+    BMPmini_view view;
+    uint8_t *buf;
+    size_t stride;
+    int format;
+    struct __channel ch[4];  // Red, green, blue, alpha
+    int bytes[4];            // Byte of each channel when all are whole bytes, -1 for no alpha
+};
+
+// Contiguous masks only, a missing one gets 0 bits
+static bool __parse_mask(uint32_t mask, struct __channel *ch)
+{
+    ch->mask = mask;
+    ch->shift = 0;
+    ch->bits = 0;
+    if (!mask) {
+        return true;
+    }
+    while (!(mask & 1U)) {
+        mask >>= 1;
+        ch->shift++;
+    }
+    if (mask & (mask + 1)) {
+        return false;
+    }
+    while (mask) {
+        mask >>= 1;
+        ch->bits++;
+    }
+    return true;
+}
+
+static uint8_t __channel_u8(uint32_t px, const struct __channel *ch, uint8_t missing)
+{
+    if (!ch->bits) {
+        return missing;
+    }
+    uint32_t v = (px & ch->mask) >> ch->shift;
+    if (ch->bits >= BMP_BITS_PER_BYTE) {
+        return (uint8_t) (v >> (ch->bits - BMP_BITS_PER_BYTE));
+    }
+    /* Scale narrow channels so that their maximum is 255 */
+    uint32_t max = (1U << ch->bits) - 1;
+    return (uint8_t) ((v * 255 + max / 2) / max);
+}
+
+static void __decode_masked_band(void *arg, int32_t first, int32_t last)
+{
+    struct __masked_job *job = arg;
+    size_t n = (size_t) job->view.width;
+    for (int32_t i = first; i < last; i++) {
+        const uint8_t *src = job->view.base + i * job->view.stride;
+        uint8_t *dst = job->buf + i * job->stride;
+        if (job->bytes[0] >= 0) {
+            int r = job->bytes[0], g = job->bytes[1], b = job->bytes[2], a = job->bytes[3];
+            for (size_t k = 0; k < n; k++, src += 4) {
+                dst += __pack_color(src[b], src[g], src[r], a < 0 ? 0xFF : src[a], job->format, dst);
+            }
+        }
+        else {
+            for (size_t k = 0; k < n; k++, src += 4) {
+                /* Pixels are little-endian words */
+                uint32_t px = (uint32_t) src[0] | (uint32_t) src[1] << 8 | (uint32_t) src[2] << 16 | (uint32_t) src[3] << 24;
+                dst += __pack_color(__channel_u8(px, &job->ch[2], 0), __channel_u8(px, &job->ch[1], 0),
+                                    __channel_u8(px, &job->ch[0], 0), __channel_u8(px, &job->ch[3], 0xFF),
+                                    job->format, dst);
+            }
+        }
+    }
+}
+
+static int __decode_masked(BMPmini_image *img, int format, uint8_t *buf, size_t stride, int nthreads)
+{
+    uint32_t masks[4];
+    BMPmini_get_masks(img, masks);
+
+    struct __masked_job job = {.buf = buf, .stride = stride, .format = format};
+    BMPmini_get_view(img, &job.view);
+    bool whole_bytes = true;
+    for (int c = 0; c < 4; c++) {
+        if (!__parse_mask(masks[c], &job.ch[c])) {
+            return BMPmini_FORMAT_ERR;
+        }
+        job.bytes[c] = job.ch[c].bits ? (int) job.ch[c].shift / BMP_BITS_PER_BYTE : -1;
+        whole_bytes &= (job.ch[c].bits == BMP_BITS_PER_BYTE && job.ch[c].shift % BMP_BITS_PER_BYTE == 0)
+                       || (c == 3 && !job.ch[c].bits);
+    }
+    if (!whole_bytes) {
+        job.bytes[0] = -1;
+    }
+
+    __run_bands(job.view.height, (size_t) job.view.width * 4, nthreads, __decode_masked_band, &job);
+    return BMPmini_SUCCESS;
+}
+
+int BMPmini_decode(BMPmini_image *img, int format, void *dst, size_t dst_stride, int nthreads)
+{
+    assert(img && dst);
+
+    BMPmini_view view;
+    BMPmini_get_view(img, &view);
+    if (view.bitsperpixel == BMP_BITS_PER_PIXEL) {
+        return BMPmini_convert(&view, format, dst, dst_stride, nthreads);
+    }
+
+    size_t bpp = __format_bytes_per_pixel(format);
+    if (!bpp || format == BMPmini_FMT_PLANAR_F32) {
+        return BMPmini_FORMAT_ERR;
+    }
+    if (dst_stride == 0) {
+        dst_stride = (size_t) view.width * bpp;
+    }
+    if (dst_stride < (size_t) view.width * bpp) {
+        return BMPmini_BUFFER_ERR;
+    }
+
+    if (view.bitsperpixel == 32) {
+        return __decode_masked(img, format, dst, dst_stride, nthreads);
+    }
+    return __decode_indexed(img, format, dst, dst_stride, nthreads);
+}
@@ -0,0 +1,289 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_diag.c
+//
+// Error reporting and per-thread phase metrics for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#if defined(BMP_HAVE_PTHREAD)
+  #include <pthread.h>
+#endif
+
+#if defined(__GNUC__)
+  #define __load(p)     __atomic_load_n(p, __ATOMIC_RELAXED)
+  #define __add(p, v)   __atomic_fetch_add(p, v, __ATOMIC_RELAXED)
+  #define __take(p)     __atomic_exchange_n(p, 0, __ATOMIC_RELAXED)
+#else
+  #define __load(p)     (*(p))
+  #define __add(p, v)   (*(p) += (v))
+  #define __take(p)     __take_plain(p)
+static uint64_t __take_plain(uint64_t *p)
+{
+    uint64_t v = *p;
+    *p = 0;
+    return v;
+}
+#endif
+
+//-------------------------------------
+// Errors
+//-------------------------------------
+static BMPmini_error_cb __error_cb = NULL;
+static void *__error_ctx = NULL;
+
+static BMP_THREAD_LOCAL BMPmini_error __last_error;
+static BMP_THREAD_LOCAL bool __has_error = false;
+
+void BMPmini_set_error_handler(BMPmini_error_cb cb, void *ctx)
+{
+    __error_cb = cb;
+    __error_ctx = ctx;
+}
+
+bool BMPmini_last_error(BMPmini_error *err)
+{
+    assert(err);
+    if (__has_error) {
+        *err = __last_error;
+    }
+    return __has_error;
+}
+
+void BMPmini_clear_error(void)
+{
+    __has_error = false;
+}
+
+void __report_error(const char *file, const char *func, unsigned long line, int status, const char *restrict msg,
+                    bool syserr)
+{
+    int errnum = errno;
+    BMPmini_error *err = &__last_error;
+    err->status = status;
+    err->sys_errno = syserr ? errnum : 0;
+    err->warning = !strncmp(msg, "[WARN]", 6);
+    err->file = file;
+    err->func = func;
+    err->line = line;
+
+    /* The message without its "[TAG]: " and what was only there for stderr */
+    const char *text = msg;
+    if (*text == '[' && (text = strstr(msg, "]: ")) != NULL) {
+        text += 3;
+    }
+    else {
+        text = msg;
+    }
+    size_t len = strlen(text);
+    while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == ' ' || text[len - 1] == ':')) {
+        len--;
+    }
+    len = len < sizeof(err->message) - 1 ? len : sizeof(err->message) - 1;
+    memcpy(err->message, text, len);
+    err->message[len] = '\0';
+    __has_error = true;
+    if (!err->warning) {
+        __metrics_error();
+    }
+
+    if (__error_cb) {
+        __error_cb(err, __error_ctx);
+        return;
+    }
+    fprintf(stderr, "%s:%s:%lu: ", file, func, line);
+    if (syserr) {
+        errno = errnum;
+        perror(msg);
+    }
+    else {
+        fputs(msg, stderr);
+    }
+}
+
+//-------------------------------------
+// Metrics
+//-------------------------------------
+// Counters of a thread. Only their thread adds to them, other threads read
+// or reset them, so every access is atomic but none needs ordering.
+struct __metrics_block {
+    BMPmini_metrics m;
+    struct __metrics_block *next;
+    bool live;  // Owned by a running thread, free for the next one otherwise
+};
+
+bool __metrics_on = false;
+
+static struct __metrics_block *__blocks = NULL;  // Every block, never freed
+static BMPmini_metrics __retired;                // Counts of the threads gone
+static BMP_THREAD_LOCAL struct __metrics_block *__my_block = NULL;
+
+static void __metrics_sum(BMPmini_metrics *dst, BMPmini_metrics *src)
+{
+    for (int i = 0; i < BMPmini_PHASES; i++) {
+        dst->count[i] += __load(&src->count[i]);
+        dst->ns[i] += __load(&src->ns[i]);
+        dst->bytes[i] += __load(&src->bytes[i]);
+    }
+    dst->errors += __load(&src->errors);
+}
+
+// Sets the counts of 'src' back to zero, adding them to 'dst' unless NULL.
+// Counts the owning thread adds meanwhile are either taken or kept.
+static void __metrics_take(BMPmini_metrics *dst, BMPmini_metrics *src)
+{
+    for (int i = 0; i < BMPmini_PHASES; i++) {
+        uint64_t count = __take(&src->count[i]), ns = __take(&src->ns[i]), bytes = __take(&src->bytes[i]);
+        if (dst) {
+            dst->count[i] += count;
+            dst->ns[i] += ns;
+            dst->bytes[i] += bytes;
+        }
+    }
+    uint64_t errors = __take(&src->errors);
+    if (dst) {
+        dst->errors += errors;
+    }
+}
+
+#if defined(BMP_HAVE_PTHREAD)
+static pthread_mutex_t __blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t __key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t __block_key;
+static bool __key_ok = false;
+
+// Keeps the counts of an exiting thread and frees its block for another one
+static void __retire_block(void *arg)
+{
+    struct __metrics_block *b = arg;
+    pthread_mutex_lock(&__blocks_lock);
+    __metrics_take(&__retired, &b->m);
+    b->live = false;
+    pthread_mutex_unlock(&__blocks_lock);
+}
+
+static void __make_key(void)
+{
+    __key_ok = pthread_key_create(&__block_key, __retire_block) == 0;
+}
+
+#define __lock_blocks()   pthread_mutex_lock(&__blocks_lock)
+#define __unlock_blocks() pthread_mutex_unlock(&__blocks_lock)
+#else
+#define __lock_blocks()
+#define __unlock_blocks()
+#endif
+
+// Block of the calling thread, NULL if there is no memory for one
+static struct __metrics_block *__get_block(void)
+{
+    if (__my_block) {
+        return __my_block;
+    }
+
+    __lock_blocks();
+    struct __metrics_block *b = __blocks;
+    while (b && b->live) {
+        b = b->next;
+    }
+    if (!b && (b = calloc(1, sizeof(*b))) != NULL) {
+        b->next = __blocks;
+        __blocks = b;
+    }
+    if (b) {
+        b->live = true;
+    }
+    __unlock_blocks();
+
+#if defined(BMP_HAVE_PTHREAD)
+    /* Without a key the block stays with the thread once it exits */
+    pthread_once(&__key_once, __make_key);
+    if (b && __key_ok) {
+        pthread_setspecific(__block_key, b);
+    }
+#endif
+    __my_block = b;
+    return b;
+}
+
+void BMPmini_set_metrics(bool enabled)
+{
+    __metrics_on = enabled;
+}
+
+uint64_t __metrics_now(void)
+{
+    struct timespec ts;
+#if defined(BMP_HAVE_PTHREAD)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+void __metrics_add(int phase, uint64_t start, uint64_t bytes)
+{
+    uint64_t ns = __metrics_now() - start;
+    struct __metrics_block *b = __get_block();
+    if (b) {
+        __add(&b->m.count[phase], 1);
+        __add(&b->m.ns[phase], ns);
+        __add(&b->m.bytes[phase], bytes);
+    }
+}
+
+void __metrics_error(void)
+{
+    struct __metrics_block *b;
+    if (__metrics_on && (b = __get_block()) != NULL) {
+        __add(&b->m.errors, 1);
+    }
+}
+
+void BMPmini_get_metrics(BMPmini_metrics *m)
+{
+    assert(m);
+    memset(m, 0, sizeof(*m));
+    if (__my_block) {
+        __metrics_sum(m, &__my_block->m);
+    }
+}
+
+void BMPmini_get_metrics_total(BMPmini_metrics *m)
+{
+    assert(m);
+    memset(m, 0, sizeof(*m));
+    __lock_blocks();
+    __metrics_sum(m, &__retired);
+    for (struct __metrics_block *b = __blocks; b; b = b->next) {
+        __metrics_sum(m, &b->m);
+    }
+    __unlock_blocks();
+}
+
+void BMPmini_reset_metrics(void)
+{
+    __lock_blocks();
+    memset(&__retired, 0, sizeof(__retired));
+    for (struct __metrics_block *b = __blocks; b; b = b->next) {
+        __metrics_take(NULL, &b->m);
+    }
+    __unlock_blocks();
+}
+
+const char *BMPmini_phase_name(int phase)
+{
+    switch (phase) {
+    case BMPmini_PHASE_OPEN:   return "open";
+    case BMPmini_PHASE_HEADER: return "header";
+    case BMPmini_PHASE_READ:   return "read";
+    case BMPmini_PHASE_ALLOC:  return "alloc";
+    case BMPmini_PHASE_COPY:   return "copy";
+    case BMPmini_PHASE_WRITE:  return "write";
+    default:                   return "unknown";
+    }
+}
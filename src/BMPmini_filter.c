@@ -0,0 +1,830 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_filter.c
+//
+// Convolutions and neighborhood filters of BMP images for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#if defined(BMP_HAVE_X86_SIMD)
+  #include <immintrin.h>
+#endif
+#if defined(BMP_HAVE_NEON)
+  #include <arm_neon.h>
+#endif
+
+// Separable kernels run as a horizontal pass into 16-bit rows keeping a few
+// fractional bits, then a vertical pass back to pixel values. Weights are
+// fixed point numbers with at most BMP_TAP_BITS fractional bits, fewer when
+// the sums of a kernel could overflow 16 bits between the passes or 32 bits
+// in the vertical one. Every kernel computes the same exact integer sums.
+#define BMP_TAP_BITS 14
+#define BMP_MID_BITS 7   // Most fractional bits of the rows between passes
+
+#define BMP_MAX_TAPS      1023
+#define BMP_BOX_MAX_RADIUS 511   // Box means divide by a reciprocal exact up to (2 * 511 + 1)^2 pixels
+#define BMP_DIV_BITS      48
+#define BMP_GAUSS_MAX_SIGMA 64.0
+#define BMP_SHARPEN_SIGMA 1.0
+#define BMP_SHARPEN_MAX   16.0
+#define BMP_AMOUNT_BITS   8      // Fractional bits of the sharpening amount
+
+// How rows of the vertical pass are stored
+enum {
+    __STORE_CLAMP=0,  // Clamped to [0, 255]
+    __STORE_SHARPEN,  // Source plus 'amount' times the source minus the blur
+    __STORE_SOBEL,    // Sum of the magnitudes of both gradients
+};
+
+// A 1D kernel in fixed point, centered on its middle tap
+struct __taps {
+    int16_t *w;       // 'n' weights, then a zero weight
+    int32_t *pairs;   // Weights 2k and 2k + 1 packed in 16-bit halves
+    int n;            // Odd number of taps
+    int bits;         // Fractional bits of the weights
+};
+
+// A separable kernel: the horizontal pass sums to (... + round) >> hshift,
+// the vertical one from there back to pixel values with vshift
+struct __plan {
+    struct __taps h;
+    struct __taps v;
+    int hshift;
+    int vshift;
+};
+
+// Passes compute elements [k, n) of a row, the vertical one to 'out8' clamped
+// to bytes, or else to 'out16'
+typedef void (*__hconv_fn)(const uint8_t *pad, const struct __taps *t, size_t bpp, int shift, int16_t *out,
+                           size_t k, size_t n);
+typedef void (*__vconv_fn)(const int16_t *const *rows, const struct __taps *t, int shift, int16_t *out16,
+                           uint8_t *out8, size_t k, size_t n);
+
+static inline int32_t __round_half(int shift)
+{
+    return shift > 0 ? 1 << (shift - 1) : 0;
+}
+
+static inline int16_t __sat_s16(int32_t v)
+{
+    return v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : (int16_t) v;
+}
+
+static inline uint8_t __sat_u8(int32_t v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t) v;
+}
+
+//-------------------------------------
+// Kernels
+//-------------------------------------
+static void __free_taps(struct __taps *t)
+{
+    free(t->w);
+    free(t->pairs);
+    t->w = NULL;
+    t->pairs = NULL;
+}
+
+// Rounds 'n' taps to 'bits' fractional bits, returns the sum of the absolute
+// weights or -1 if one does not fit 16 bits. Taps of a normalized kernel sum
+// to exactly one, the center tap taking the rounding errors.
+static int64_t __quantize(struct __taps *t, const double *k, int n, int bits, bool normalized)
+{
+    int64_t sum = 0, abs_sum = 0;
+    for (int i = 0; i < n; i++) {
+        double w = floor(k[i] * (1 << bits) + 0.5);
+        if (fabs(w) > INT16_MAX) {
+            return -1;
+        }
+        t->w[i] = (int16_t) w;
+        sum += t->w[i];
+    }
+    if (normalized) {
+        int32_t center = t->w[n / 2] + ((1 << bits) - (int32_t) sum);
+        if (center < INT16_MIN || center > INT16_MAX) {
+            return -1;
+        }
+        t->w[n / 2] = (int16_t) center;
+    }
+    t->w[n] = 0;
+    for (int i = 0; i < n; i++) {
+        abs_sum += t->w[i] < 0 ? -t->w[i] : t->w[i];
+    }
+    for (int i = 0; i < n; i += 2) {
+        t->pairs[i / 2] = (int32_t) ((uint32_t) (uint16_t) t->w[i] | (uint32_t) (uint16_t) t->w[i + 1] << 16);
+    }
+    t->n = n;
+    t->bits = bits;
+    return abs_sum;
+}
+
+static bool __alloc_taps(struct __taps *t, int n)
+{
+    t->w = malloc((size_t) (n + 1) * sizeof(*t->w));
+    t->pairs = malloc((size_t) (n + 1) / 2 * sizeof(*t->pairs));
+    return t->w && t->pairs;
+}
+
+// Picks the fixed point formats of a separable kernel
+static int __make_plan(struct __plan *p, const double *hk, int hn, const double *vk, int vn, bool normalized)
+{
+    memset(p, 0, sizeof(*p));
+    if (!__alloc_taps(&p->h, hn) || !__alloc_taps(&p->v, vn)) {
+        return BMPmini_NOMEM_ERR;
+    }
+
+    int64_t hsum = -1;
+    for (int bits = BMP_TAP_BITS; bits >= 0 && hsum < 0; bits--) {
+        hsum = __quantize(&p->h, hk, hn, bits, normalized);
+    }
+    if (hsum < 0) {
+        return BMPmini_RANGE_ERR;
+    }
+
+    /* Rows between the passes keep as many fractional bits as fit 16 bits */
+    int mid = BMP_MID_BITS < p->h.bits ? BMP_MID_BITS : p->h.bits;
+    int64_t bound;
+    for (;; mid--) {
+        p->hshift = p->h.bits - mid;
+        bound = (255 * hsum + __round_half(p->hshift)) >> p->hshift;
+        if (bound <= INT16_MAX) {
+            break;
+        }
+        if (mid == 0) {
+            return BMPmini_RANGE_ERR;
+        }
+    }
+
+    for (int bits = BMP_TAP_BITS; bits >= 0; bits--) {
+        int64_t vsum = __quantize(&p->v, vk, vn, bits, normalized);
+        p->vshift = mid + bits;
+        if (vsum >= 0 && bound * vsum + __round_half(p->vshift) <= INT32_MAX) {
+            return BMPmini_SUCCESS;
+        }
+    }
+    return BMPmini_RANGE_ERR;
+}
+
+static void __free_plan(struct __plan *p)
+{
+    __free_taps(&p->h);
+    __free_taps(&p->v);
+}
+
+// Taps of a Gaussian of standard deviation 'sigma', 'k' holds 2 * r + 1 of them
+static int __gaussian_taps(double sigma, double **k)
+{
+    int r = (int) ceil(3.0 * sigma);
+    r = r < 1 ? 1 : r;
+    *k = malloc((size_t) (2 * r + 1) * sizeof(**k));
+    if (!*k) {
+        return 0;
+    }
+    double sum = 0.0;
+    for (int i = -r; i <= r; i++) {
+        (*k)[i + r] = exp(-(double) i * i / (2.0 * sigma * sigma));
+        sum += (*k)[i + r];
+    }
+    for (int i = 0; i < 2 * r + 1; i++) {
+        (*k)[i] /= sum;
+    }
+    return 2 * r + 1;
+}
+
+//-------------------------------------
+// Scalar passes, the reference for all the others
+//-------------------------------------
+static void __hconv_c(const uint8_t *pad, const struct __taps *t, size_t bpp, int shift, int16_t *out,
+                      size_t k, size_t n)
+{
+    for (size_t i = k; i < n; i++) {
+        int32_t acc = __round_half(shift);
+        for (int j = 0; j < t->n; j++) {
+            acc += pad[i + j * bpp] * t->w[j];
+        }
+        out[i] = __sat_s16(acc >> shift);
+    }
+}
+
+static void __vconv_c(const int16_t *const *rows, const struct __taps *t, int shift, int16_t *out16,
+                      uint8_t *out8, size_t k, size_t n)
+{
+    for (size_t i = k; i < n; i++) {
+        int32_t acc = __round_half(shift);
+        for (int j = 0; j < t->n; j++) {
+            acc += rows[j][i] * t->w[j];
+        }
+        int16_t v = __sat_s16(acc >> shift);
+        if (out8) {
+            out8[i] = __sat_u8(v);
+        }
+        else {
+            out16[i] = v;
+        }
+    }
+}
+
+//-------------------------------------
+// x86 passes
+//-------------------------------------
+// Taps are taken 2 at a time: the 16-bit values they weigh are interleaved
+// and multiplied by both weights at once with pmaddwd.
+#if defined(BMP_HAVE_X86_SIMD)
+#define BMP_SSSE3 __attribute__((target("ssse3")))
+#define BMP_AVX2  __attribute__((target("avx2")))
+
+BMP_SSSE3 static void __hconv_ssse3(const uint8_t *pad, const struct __taps *t, size_t bpp, int shift,
+                                    int16_t *out, size_t k, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(__round_half(shift));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = k;
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = round, hi = round;
+        const uint8_t *p = pad + i;
+        for (int j = 0; j < t->n; j += 2, p += 2 * bpp) {
+            __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) p), zero);
+            __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (p + bpp)), zero);
+            __m128i w = _mm_set1_epi32(t->pairs[j / 2]);
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+        }
+        __m128i v = _mm_packs_epi32(_mm_sra_epi32(lo, count), _mm_sra_epi32(hi, count));
+        _mm_storeu_si128((__m128i *) (out + i), v);
+    }
+    __hconv_c(pad, t, bpp, shift, out, i, n);
+}
+
+BMP_SSSE3 static void __vconv_ssse3(const int16_t *const *rows, const struct __taps *t, int shift,
+                                    int16_t *out16, uint8_t *out8, size_t k, size_t n)
+{
+    const __m128i round = _mm_set1_epi32(__round_half(shift));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = k;
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = round, hi = round;
+        for (int j = 0; j < t->n; j += 2) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (rows[j] + i));
+            __m128i b = _mm_loadu_si128((const __m128i *) (rows[j + 1] + i));
+            __m128i w = _mm_set1_epi32(t->pairs[j / 2]);
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+        }
+        __m128i v = _mm_packs_epi32(_mm_sra_epi32(lo, count), _mm_sra_epi32(hi, count));
+        if (out8) {
+            _mm_storel_epi64((__m128i *) (out8 + i), _mm_packus_epi16(v, v));
+        }
+        else {
+            _mm_storeu_si128((__m128i *) (out16 + i), v);
+        }
+    }
+    __vconv_c(rows, t, shift, out16, out8, i, n);
+}
+
+// Unpacking and packing both work within 128-bit lanes, which keeps the
+// elements in order
+BMP_AVX2 static void __hconv_avx2(const uint8_t *pad, const struct __taps *t, size_t bpp, int shift,
+                                  int16_t *out, size_t k, size_t n)
+{
+    const __m256i round = _mm256_set1_epi32(__round_half(shift));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = k;
+    for (; i + 16 <= n; i += 16) {
+        __m256i lo = round, hi = round;
+        const uint8_t *p = pad + i;
+        for (int j = 0; j < t->n; j += 2, p += 2 * bpp) {
+            __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) p));
+            __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (p + bpp)));
+            __m256i w = _mm256_set1_epi32(t->pairs[j / 2]);
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+        }
+        __m256i v = _mm256_packs_epi32(_mm256_sra_epi32(lo, count), _mm256_sra_epi32(hi, count));
+        _mm256_storeu_si256((__m256i *) (out + i), v);
+    }
+    _mm256_zeroupper();
+    __hconv_ssse3(pad, t, bpp, shift, out, i, n);
+}
+
+BMP_AVX2 static void __vconv_avx2(const int16_t *const *rows, const struct __taps *t, int shift,
+                                  int16_t *out16, uint8_t *out8, size_t k, size_t n)
+{
+    const __m256i round = _mm256_set1_epi32(__round_half(shift));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = k;
+    for (; i + 16 <= n; i += 16) {
+        __m256i lo = round, hi = round;
+        for (int j = 0; j < t->n; j += 2) {
+            __m256i a = _mm256_loadu_si256((const __m256i *) (rows[j] + i));
+            __m256i b = _mm256_loadu_si256((const __m256i *) (rows[j + 1] + i));
+            __m256i w = _mm256_set1_epi32(t->pairs[j / 2]);
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+        }
+        __m256i v = _mm256_packs_epi32(_mm256_sra_epi32(lo, count), _mm256_sra_epi32(hi, count));
+        if (out8) {
+            /* Both lanes pack to their low half, which are then joined */
+            __m256i u = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+            _mm_storeu_si128((__m128i *) (out8 + i), _mm256_castsi256_si128(u));
+        }
+        else {
+            _mm256_storeu_si256((__m256i *) (out16 + i), v);
+        }
+    }
+    _mm256_zeroupper();
+    __vconv_ssse3(rows, t, shift, out16, out8, i, n);
+}
+#endif
+
+//-------------------------------------
+// ARM passes
+//-------------------------------------
+#if defined(BMP_HAVE_NEON)
+static void __hconv_neon(const uint8_t *pad, const struct __taps *t, size_t bpp, int shift, int16_t *out,
+                         size_t k, size_t n)
+{
+    const int32x4_t round = vdupq_n_s32(__round_half(shift));
+    const int32x4_t count = vdupq_n_s32(-shift);
+    size_t i = k;
+    for (; i + 8 <= n; i += 8) {
+        int32x4_t lo = round, hi = round;
+        for (int j = 0; j < t->n; j++) {
+            int16x8_t x = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(pad + i + j * bpp)));
+            lo = vmlal_n_s16(lo, vget_low_s16(x), t->w[j]);
+            hi = vmlal_n_s16(hi, vget_high_s16(x), t->w[j]);
+        }
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(vshlq_s32(lo, count)), vqmovn_s32(vshlq_s32(hi, count))));
+    }
+    __hconv_c(pad, t, bpp, shift, out, i, n);
+}
+
+static void __vconv_neon(const int16_t *const *rows, const struct __taps *t, int shift, int16_t *out16,
+                         uint8_t *out8, size_t k, size_t n)
+{
+    const int32x4_t round = vdupq_n_s32(__round_half(shift));
+    const int32x4_t count = vdupq_n_s32(-shift);
+    size_t i = k;
+    for (; i + 8 <= n; i += 8) {
+        int32x4_t lo = round, hi = round;
+        for (int j = 0; j < t->n; j++) {
+            int16x8_t x = vld1q_s16(rows[j] + i);
+            lo = vmlal_n_s16(lo, vget_low_s16(x), t->w[j]);
+            hi = vmlal_n_s16(hi, vget_high_s16(x), t->w[j]);
+        }
+        int16x8_t v = vcombine_s16(vqmovn_s32(vshlq_s32(lo, count)), vqmovn_s32(vshlq_s32(hi, count)));
+        if (out8) {
+            vst1_u8(out8 + i, vqmovun_s16(v));
+        }
+        else {
+            vst1q_s16(out16 + i, v);
+        }
+    }
+    __vconv_c(rows, t, shift, out16, out8, i, n);
+}
+#endif
+
+static void __filter_kernels(__hconv_fn *hconv, __vconv_fn *vconv)
+{
+    unsigned caps = __simd_caps();
+    *hconv = __hconv_c;
+    *vconv = __vconv_c;
+#if defined(BMP_HAVE_X86_SIMD)
+    if (caps & BMP_SIMD_SSSE3) {
+        *hconv = caps & BMP_SIMD_AVX2 ? __hconv_avx2 : __hconv_ssse3;
+        *vconv = caps & BMP_SIMD_AVX2 ? __vconv_avx2 : __vconv_ssse3;
+    }
+#endif
+#if defined(BMP_HAVE_NEON)
+    if (caps & BMP_SIMD_NEON) {
+        *hconv = __hconv_neon;
+        *vconv = __vconv_neon;
+    }
+#endif
+    (void) caps;
+}
+
+//-------------------------------------
+// Rows
+//-------------------------------------
+// Index of pixel 'i' along a dimension of 'n' pixels, -1 for a zero pixel
+static int32_t __border_index(int64_t i, int32_t n, int border)
+{
+    if (i >= 0 && i < n) {
+        return (int32_t) i;
+    }
+    switch (border) {
+    case BMPmini_BORDER_CLAMP:
+        return i < 0 ? 0 : n - 1;
+    case BMPmini_BORDER_MIRROR: {
+        if (n == 1) {
+            return 0;
+        }
+        int64_t period = 2 * (int64_t) (n - 1);
+        i %= period;
+        i = i < 0 ? i + period : i;
+        return (int32_t) (i < n ? i : period - i);
+    }
+    default:
+        return -1;
+    }
+}
+
+// Copies source row 'y' with 'r' pixels of border on both sides to 'pad',
+// returns false if the whole row lies in a zero border
+static bool __pad_row(const BMPmini_view *src, int64_t y, int32_t r, size_t bpp, int border, uint8_t *pad)
+{
+    int32_t sy = __border_index(y, src->height, border);
+    if (sy < 0) {
+        return false;
+    }
+    const uint8_t *row = src->base + sy * src->stride;
+    memcpy(pad + r * bpp, row, (size_t) src->width * bpp);
+    for (int32_t j = 1; j <= r; j++) {
+        int32_t left = __border_index(-(int64_t) j, src->width, border);
+        int32_t right = __border_index((int64_t) src->width - 1 + j, src->width, border);
+        uint8_t *l = pad + (size_t) (r - j) * bpp;
+        uint8_t *e = pad + (size_t) (r + src->width - 1 + j) * bpp;
+        if (left < 0) {
+            memset(l, 0, bpp);
+            memset(e, 0, bpp);
+        }
+        else {
+            memcpy(l, row + left * bpp, bpp);
+            memcpy(e, row + right * bpp, bpp);
+        }
+    }
+    return true;
+}
+
+struct __filter_job {
+    const BMPmini_view *src;
+    const BMPmini_view *dst;
+    struct __plan plans[2];  // Two for the gradients of __STORE_SOBEL
+    int nplans;
+    int store;               // __STORE_* mode
+    int32_t amount;          // __STORE_SHARPEN, in 1/2^BMP_AMOUNT_BITS
+    int32_t radius;          // Box blurs only
+    int border;
+    uint32_t padding;        // Bytes to be zeroed after each destination row
+    __hconv_fn hconv;
+    __vconv_fn vconv;
+    int status;              // First error of a band, set with __fail_status
+};
+
+// Restores the fourth byte of 32 bpp pixels, zeroes the padding
+static void __finish_row(const struct __filter_job *job, int32_t i, size_t bpp)
+{
+    uint8_t *out = job->dst->base + i * job->dst->stride;
+    if (bpp == 4) {
+        const uint8_t *in = job->src->base + i * job->src->stride;
+        for (int32_t j = 0; j < job->dst->width; j++) {
+            out[4 * j + 3] = in[4 * j + 3];
+        }
+    }
+    memset(out + (size_t) job->dst->width * bpp, 0, job->padding);
+}
+
+static void __store_row(const struct __filter_job *job, int32_t i, int16_t *const *res, size_t n)
+{
+    const uint8_t *in = job->src->base + i * job->src->stride;
+    uint8_t *out = job->dst->base + i * job->dst->stride;
+    if (job->store == __STORE_SHARPEN) {
+        const int32_t round = 1 << (BMP_AMOUNT_BITS - 1);
+        for (size_t k = 0; k < n; k++) {
+            int32_t diff = in[k] - res[0][k];
+            out[k] = __sat_u8(in[k] + ((diff * job->amount + round) >> BMP_AMOUNT_BITS));
+        }
+    }
+    else {
+        for (size_t k = 0; k < n; k++) {
+            int32_t gx = res[0][k], gy = res[1][k];
+            out[k] = __sat_u8((gx < 0 ? -gx : gx) + (gy < 0 ? -gy : gy));
+        }
+    }
+}
+
+// Each band keeps, for each kernel, a ring of the rows of the horizontal pass
+// the vertical one reads, computing each of them once
+static void __conv_band(void *arg, int32_t first, int32_t last)
+{
+    struct __filter_job *job = arg;
+    const BMPmini_view *src = job->src;
+    size_t bpp = src->bitsperpixel / BMP_BITS_PER_BYTE;
+    size_t n = (size_t) src->width * bpp;
+    int32_t rx = job->plans[0].h.n / 2;
+    int vn = job->plans[0].v.n;
+    int32_t ry = vn / 2;
+
+    /* Vector loads of the last taps reach a few bytes past the padded row */
+    uint8_t *pad = calloc((size_t) (src->width + 2 * rx) * bpp + 32, 1);
+    int16_t *ring = malloc((size_t) job->nplans * vn * n * sizeof(*ring));
+    int16_t *res = malloc((size_t) job->nplans * n * sizeof(*res));
+    const int16_t **rows = malloc((size_t) (vn + 1) * sizeof(*rows));
+    if (!pad || !ring || !res || !rows) {
+        __fail_status(&job->status, BMPmini_NOMEM_ERR);
+        goto CLEANUP_FB1;
+    }
+
+    int16_t *out16[2] = {res, res + n};
+    for (int64_t y = (int64_t) first - ry; y < (int64_t) last + ry; y++) {
+        /* Row y of the horizontal pass goes to slot y - first + ry of the ring */
+        size_t slot = (size_t) ((y - first + ry) % vn);
+        bool inside = __pad_row(src, y, rx, bpp, job->border, pad);
+        for (int p = 0; p < job->nplans; p++) {
+            int16_t *row = ring + ((size_t) p * vn + slot) * n;
+            if (inside) {
+                job->hconv(pad, &job->plans[p].h, bpp, job->plans[p].hshift, row, 0, n);
+            }
+            else {
+                memset(row, 0, n * sizeof(*row));
+            }
+        }
+
+        /* Output row i needs rows [i - ry, i + ry] */
+        int64_t i = y - ry;
+        if (i < first) {
+            continue;
+        }
+        for (int p = 0; p < job->nplans; p++) {
+            for (int k = 0; k < vn; k++) {
+                rows[k] = ring + ((size_t) p * vn + (size_t) ((i - first + k) % vn)) * n;
+            }
+            rows[vn] = rows[0];
+            uint8_t *out8 = job->store == __STORE_CLAMP ? job->dst->base + i * job->dst->stride : NULL;
+            job->vconv(rows, &job->plans[p].v, job->plans[p].vshift, out16[p], out8, 0, n);
+        }
+        if (job->store != __STORE_CLAMP) {
+            __store_row(job, (int32_t) i, out16, n);
+        }
+        __finish_row(job, (int32_t) i, bpp);
+    }
+CLEANUP_FB1:
+    free(pad);
+    free(ring);
+    free(res);
+    free(rows);
+}
+
+// Sums of the 2 * r + 1 values of each channel around each pixel of row 'y'
+static void __box_row(const struct __filter_job *job, int64_t y, uint8_t *pad, uint32_t *sums)
+{
+    const BMPmini_view *src = job->src;
+    size_t bpp = src->bitsperpixel / BMP_BITS_PER_BYTE;
+    size_t n = (size_t) src->width * bpp;
+    size_t span = (size_t) (2 * job->radius) * bpp;
+    if (!__pad_row(src, y, job->radius, bpp, job->border, pad)) {
+        memset(sums, 0, n * sizeof(*sums));
+        return;
+    }
+    for (size_t c = 0; c < bpp; c++) {
+        uint32_t s = 0;
+        for (size_t k = c; k <= c + span; k += bpp) {
+            s += pad[k];
+        }
+        sums[c] = s;
+    }
+    /* The window slides by one pixel: a value enters, another leaves */
+    for (size_t k = bpp; k < n; k++) {
+        sums[k] = sums[k - bpp] + pad[k + span] - pad[k - bpp];
+    }
+}
+
+// Box means from running sums: each row adds the sums of the row entering
+// the window and subtracts those of the row leaving it, whatever the radius
+static void __box_band(void *arg, int32_t first, int32_t last)
+{
+    struct __filter_job *job = arg;
+    const BMPmini_view *src = job->src;
+    size_t bpp = src->bitsperpixel / BMP_BITS_PER_BYTE;
+    size_t n = (size_t) src->width * bpp;
+    int32_t r = job->radius;
+
+    uint8_t *pad = malloc((size_t) (src->width + 2 * r) * bpp);
+    uint32_t *cols = malloc(3 * n * sizeof(*cols));
+    if (!pad || !cols) {
+        __fail_status(&job->status, BMPmini_NOMEM_ERR);
+        goto CLEANUP_FB2;
+    }
+    uint32_t *enter = cols + n, *leave = cols + 2 * n;
+
+    /* x / area rounded, as a multiplication exact for x <= 256 * area */
+    uint64_t area = (uint64_t) (2 * r + 1) * (2 * r + 1);
+    uint64_t recip = (((uint64_t) 1 << BMP_DIV_BITS) + area - 1) / area;
+    uint32_t half = (uint32_t) (area / 2);
+
+    memset(cols, 0, n * sizeof(*cols));
+    for (int64_t y = (int64_t) first - r; y <= (int64_t) first + r; y++) {
+        __box_row(job, y, pad, enter);
+        for (size_t k = 0; k < n; k++) {
+            cols[k] += enter[k];
+        }
+    }
+    for (int32_t i = first; i < last; i++) {
+        uint8_t *out = job->dst->base + i * job->dst->stride;
+        for (size_t k = 0; k < n; k++) {
+            out[k] = (uint8_t) ((cols[k] + half) * recip >> BMP_DIV_BITS);
+        }
+        __finish_row(job, i, bpp);
+        if (i + 1 < last) {
+            __box_row(job, (int64_t) i + 1 + r, pad, enter);
+            __box_row(job, (int64_t) i - r, pad, leave);
+            for (size_t k = 0; k < n; k++) {
+                cols[k] += enter[k] - leave[k];
+            }
+        }
+    }
+CLEANUP_FB2:
+    free(pad);
+    free(cols);
+}
+
+//-------------------------------------
+// Filters
+//-------------------------------------
+static int __check_views(const BMPmini_view *src, const BMPmini_view *dst, int border)
+{
+    assert(src && dst);
+    if ((src->bitsperpixel != 24 && src->bitsperpixel != 32) || src->bitsperpixel != dst->bitsperpixel
+        || border < BMPmini_BORDER_CLAMP || border > BMPmini_BORDER_ZERO) {
+        return BMPmini_FORMAT_ERR;
+    }
+    if (src->width != dst->width || src->height != dst->height) {
+        return BMPmini_RANGE_ERR;
+    }
+    /* Pixels are read around the one being written */
+    if (src->base == dst->base && src->width > 0 && src->height > 0) {
+        return BMPmini_BUFFER_ERR;
+    }
+    return BMPmini_SUCCESS;
+}
+
+static int __run_filter(struct __filter_job *job, int nthreads)
+{
+    const BMPmini_view *dst = job->dst;
+    if (dst->width == 0 || dst->height == 0) {
+        return BMPmini_SUCCESS;
+    }
+    size_t row_bytes = (size_t) dst->width * (dst->bitsperpixel / BMP_BITS_PER_BYTE);
+    if (job->nplans == 0) {
+        __run_bands(dst->height, row_bytes * 3, nthreads, __box_band, job);
+    }
+    else {
+        __filter_kernels(&job->hconv, &job->vconv);
+        __run_bands(dst->height, row_bytes * job->plans[0].v.n, nthreads, __conv_band, job);
+    }
+    return __get_status(&job->status);
+}
+
+static int __convolve(const BMPmini_view *src, const BMPmini_view *dst, uint32_t padding, const float *hkernel,
+                      int hsize, const float *vkernel, int vsize, int border, int nthreads)
+{
+    int res = __check_views(src, dst, border);
+    if (res != BMPmini_SUCCESS) {
+        return res;
+    }
+    assert(hkernel && vkernel);
+    if (hsize < 1 || hsize > BMP_MAX_TAPS || hsize % 2 == 0 || vsize < 1 || vsize > BMP_MAX_TAPS || vsize % 2 == 0) {
+        return BMPmini_RANGE_ERR;
+    }
+
+    struct __filter_job job = {.src = src, .dst = dst, .nplans = 1, .store = __STORE_CLAMP, .border = border,
+                               .padding = padding};
+    double *hk = malloc((size_t) hsize * sizeof(*hk));
+    double *vk = malloc((size_t) vsize * sizeof(*vk));
+    res = BMPmini_NOMEM_ERR;
+    if (!hk || !vk) {
+        goto CLEANUP_FC1;
+    }
+    for (int i = 0; i < hsize; i++) {
+        hk[i] = hkernel[i];
+    }
+    for (int i = 0; i < vsize; i++) {
+        vk[i] = vkernel[i];
+    }
+    if ((res = __make_plan(&job.plans[0], hk, hsize, vk, vsize, false)) == BMPmini_SUCCESS) {
+        res = __run_filter(&job, nthreads);
+    }
+    __free_plan(&job.plans[0]);
+CLEANUP_FC1:
+    free(hk);
+    free(vk);
+    return res;
+}
+
+static int __filter(const BMPmini_view *src, const BMPmini_view *dst, uint32_t padding, int op, float param,
+                    int border, int nthreads)
+{
+    int res = __check_views(src, dst, border);
+    if (res != BMPmini_SUCCESS) {
+        return res;
+    }
+
+    static const double smooth[3] = {0.25, 0.5, 0.25};
+    static const double derive[3] = {-0.5, 0.0, 0.5};
+    struct __filter_job job = {.src = src, .dst = dst, .nplans = 1, .store = __STORE_CLAMP, .border = border,
+                               .padding = padding};
+    double *k = NULL;
+    int n;
+    switch (op) {
+    case BMPmini_BLUR_BOX:
+        if (!(param >= 0.0f && param <= BMP_BOX_MAX_RADIUS)) {
+            return BMPmini_RANGE_ERR;
+        }
+        job.nplans = 0;
+        job.radius = (int32_t) param;
+        return __run_filter(&job, nthreads);
+    case BMPmini_BLUR_GAUSSIAN:
+    case BMPmini_SHARPEN:
+        if (op == BMPmini_BLUR_GAUSSIAN ? !(param > 0.0f && param <= BMP_GAUSS_MAX_SIGMA)
+                                        : !(param >= 0.0f && param <= BMP_SHARPEN_MAX)) {
+            return BMPmini_RANGE_ERR;
+        }
+        n = __gaussian_taps(op == BMPmini_SHARPEN ? BMP_SHARPEN_SIGMA : param, &k);
+        if (!n) {
+            return BMPmini_NOMEM_ERR;
+        }
+        res = __make_plan(&job.plans[0], k, n, k, n, true);
+        if (op == BMPmini_SHARPEN) {
+            job.store = __STORE_SHARPEN;
+            job.amount = (int32_t) lrintf(param * (1 << BMP_AMOUNT_BITS));
+        }
+        free(k);
+        break;
+    case BMPmini_EDGES_SOBEL:
+        job.nplans = 2;
+        job.store = __STORE_SOBEL;
+        res = __make_plan(&job.plans[0], derive, 3, smooth, 3, false);
+        if (res == BMPmini_SUCCESS) {
+            res = __make_plan(&job.plans[1], smooth, 3, derive, 3, false);
+        }
+        break;
+    default:
+        return BMPmini_FORMAT_ERR;
+    }
+
+    if (res == BMPmini_SUCCESS) {
+        res = __run_filter(&job, nthreads);
+    }
+    for (int p = 0; p < job.nplans; p++) {
+        __free_plan(&job.plans[p]);
+    }
+    return res;
+}
+
+int BMPmini_convolve_view(const BMPmini_view *src, const BMPmini_view *dst, const float *hkernel, int hsize,
+                          const float *vkernel, int vsize, int border, int nthreads)
+{
+    return __convolve(src, dst, 0, hkernel, hsize, vkernel, vsize, border, nthreads);
+}
+
+int BMPmini_filter_view(const BMPmini_view *src, const BMPmini_view *dst, int op, float param, int border,
+                        int nthreads)
+{
+    return __filter(src, dst, 0, op, param, border, nthreads);
+}
+
+BMPmini_image *BMPmini_filter(BMPmini_image *img, int op, float param, int border)
+{
+    return BMPmini_filter_with(img, op, param, border, NULL);
+}
+
+BMPmini_image *BMPmini_filter_with(BMPmini_image *img, int op, float param, int border,
+                                   const BMPmini_allocator *allocator)
+{
+    assert(img);
+
+    BMPmini_view src;
+    BMPmini_get_view(img, &src);
+    if (src.bitsperpixel != 24 && src.bitsperpixel != 32) {
+        BMPmini_PERROR(__func__, BMPmini_FORMAT_ERR, "[ERROR]: only 24 and 32 bpp images can be filtered\n", 0);
+        return NULL;
+    }
+
+    /* Same header and color table, keeping the row order */
+    uint32_t extra = img->header.offset - BMP_HEADER_SIZE;
+    BMPmini_image *newimg = __alloc_image(&img->header, (size_t) img->header.image_size_bytes + extra, allocator);
+    if (!newimg) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        return NULL;
+    }
+    memcpy(newimg->data, img->data, extra);
+
+    BMPmini_view dst;
+    BMPmini_get_view(newimg, &dst);
+    int res = __filter(&src, &dst, __get_padding(&newimg->header), op, param, border, 0);
+    if (res != BMPmini_SUCCESS) {
+        if (res == BMPmini_RANGE_ERR) {
+            BMPmini_PERROR(__func__, res, "[ERROR]: filter parameter out of range\n", 0);
+        }
+        else {
+            __perror_status(__func__, res);
+        }
+        __free_image(newimg);
+        return NULL;
+    }
+    return newimg;
+}
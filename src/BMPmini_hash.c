@@ -0,0 +1,605 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_hash.c
+//
+// Content hashes and differences of BMP images for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <assert.h>
+#if defined(BMP_HAVE_X86_SIMD)
+  #include <immintrin.h>
+#endif
+#if defined(BMP_HAVE_NEON)
+  #include <arm_neon.h>
+#endif
+
+// Pixel bytes are hashed in stripes of 8 little-endian 64-bit words, each
+// added to its own accumulator, after the manner of XXH3. A block of
+// stripes takes its keys at growing offsets of the key table, so that
+// swapping two stripes changes the hash, then the accumulators are
+// scrambled, so that swapping two blocks does too.
+#define BMP_HASH_LANES  8
+#define BMP_HASH_STRIPE (BMP_HASH_LANES * 8)
+#define BMP_HASH_BLOCK  16  // Stripes per block
+#define BMP_HASH_KEYS   (BMP_HASH_BLOCK + BMP_HASH_LANES - 1)
+
+#define BMP_PRIME32   UINT64_C(0x9E3779B1)
+#define BMP_PRIME64_1 UINT64_C(0x9E3779B185EBCA87)
+#define BMP_PRIME64_2 UINT64_C(0xC2B2AE3D27D4EB4F)
+
+// Largest number of bands an image is split in, each with its own box
+#define BMP_DIFF_PARTS 64
+
+static const uint64_t __keys[BMP_HASH_KEYS] = {
+    UINT64_C(0xAB2F1EA1C7562BCB), UINT64_C(0xF528A3C871FF4F33), UINT64_C(0x151977C74F1A9926),
+    UINT64_C(0x7D3AF6647A999B4C), UINT64_C(0x9CFF69B65B06E141), UINT64_C(0x6FEC7D2A703BDDF5),
+    UINT64_C(0xAC5160715B3D8026), UINT64_C(0x2FA80AD9C14F0C47), UINT64_C(0x6DF3C1E1F97E26D4),
+    UINT64_C(0xEFF9948E9AF5E4B2), UINT64_C(0x28C05CE8663A4573), UINT64_C(0x10F19B2F5A4FDB74),
+    UINT64_C(0xC0C10AF1863564A0), UINT64_C(0x5CF0109293CFA7B6), UINT64_C(0x16622784ED3EFAE8),
+    UINT64_C(0xE03D4FA3C5C0A3F5), UINT64_C(0xBE025B6096EFF000), UINT64_C(0xBAF66F00F030E1E9),
+    UINT64_C(0xD5F3679942492F81), UINT64_C(0x10E8A0DF3683E6F1), UINT64_C(0xFAB5114237BD12EA),
+    UINT64_C(0x360F6245650DCFC6), UINT64_C(0xFCEAA64E08552B19),
+};
+
+// Accumulates 'n' stripes of 'p' into 'acc', stripe k using keys [k, k + 8)
+typedef void (*__stripes_fn)(uint64_t acc[BMP_HASH_LANES], const uint8_t *p, size_t n, const uint64_t *keys);
+
+// Offset of the first differing byte of 'a' and 'b', 'n' if none
+typedef size_t (*__first_diff_fn)(const uint8_t *a, const uint8_t *b, size_t n);
+// Offset past the last differing byte of 'a' and 'b', 0 if none
+typedef size_t (*__last_diff_fn)(const uint8_t *a, const uint8_t *b, size_t n);
+
+struct __diff_kernels {
+    __first_diff_fn first;
+    __last_diff_fn last;
+};
+
+// Box of the differing pixels of a band, in bytes across
+struct __diff_part {
+    int32_t top, bottom;  // Rows [top, bottom), empty if top == bottom
+    size_t left, right;   // Bytes [left, right) of the rows
+};
+
+struct __diff_job {
+    const BMPmini_view *a, *b;
+    struct __diff_part *parts;
+    int32_t nparts;
+    size_t row_bytes;
+    const struct __diff_kernels *kernels;
+};
+
+//-------------------------------------
+// Hash kernels
+//-------------------------------------
+static inline uint64_t __read64le(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static void __stripes_c(uint64_t acc[BMP_HASH_LANES], const uint8_t *p, size_t n, const uint64_t *keys)
+{
+    for (size_t s = 0; s < n; s++, p += BMP_HASH_STRIPE) {
+        for (int i = 0; i < BMP_HASH_LANES; i++) {
+            uint64_t d = __read64le(p + 8 * i);
+            uint64_t k = d ^ keys[s + i];
+            acc[i ^ 1] += d;
+            acc[i] += (k & 0xFFFFFFFFU) * (k >> 32);
+        }
+    }
+}
+
+// Both halves of each lane multiplied together (pmuludq), and the words
+// added to the neighbor lane
+#if defined(BMP_HAVE_X86_SIMD)
+#define BMP_SSSE3 __attribute__((target("ssse3")))
+#define BMP_AVX2  __attribute__((target("avx2")))
+
+BMP_SSSE3 static void __stripes_ssse3(uint64_t acc[BMP_HASH_LANES], const uint8_t *p, size_t n,
+                                      const uint64_t *keys)
+{
+    __m128i va[BMP_HASH_LANES / 2];
+    for (int i = 0; i < BMP_HASH_LANES / 2; i++) {
+        va[i] = _mm_loadu_si128((const __m128i *) acc + i);
+    }
+    for (size_t s = 0; s < n; s++, p += BMP_HASH_STRIPE) {
+        for (int i = 0; i < BMP_HASH_LANES / 2; i++) {
+            __m128i d = _mm_loadu_si128((const __m128i *) p + i);
+            __m128i k = _mm_xor_si128(d, _mm_loadu_si128((const __m128i *) (keys + s) + i));
+            __m128i prod = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+            __m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+            va[i] = _mm_add_epi64(va[i], _mm_add_epi64(prod, swapped));
+        }
+    }
+    for (int i = 0; i < BMP_HASH_LANES / 2; i++) {
+        _mm_storeu_si128((__m128i *) acc + i, va[i]);
+    }
+}
+
+BMP_AVX2 static void __stripes_avx2(uint64_t acc[BMP_HASH_LANES], const uint8_t *p, size_t n,
+                                    const uint64_t *keys)
+{
+    __m256i va[BMP_HASH_LANES / 4];
+    for (int i = 0; i < BMP_HASH_LANES / 4; i++) {
+        va[i] = _mm256_loadu_si256((const __m256i *) acc + i);
+    }
+    for (size_t s = 0; s < n; s++, p += BMP_HASH_STRIPE) {
+        for (int i = 0; i < BMP_HASH_LANES / 4; i++) {
+            __m256i d = _mm256_loadu_si256((const __m256i *) p + i);
+            __m256i k = _mm256_xor_si256(d, _mm256_loadu_si256((const __m256i *) (keys + s) + i));
+            __m256i prod = _mm256_mul_epu32(k, _mm256_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+            __m256i swapped = _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+            va[i] = _mm256_add_epi64(va[i], _mm256_add_epi64(prod, swapped));
+        }
+    }
+    for (int i = 0; i < BMP_HASH_LANES / 4; i++) {
+        _mm256_storeu_si256((__m256i *) acc + i, va[i]);
+    }
+    _mm256_zeroupper();
+}
+#endif
+
+#if defined(BMP_HAVE_NEON)
+static void __stripes_neon(uint64_t acc[BMP_HASH_LANES], const uint8_t *p, size_t n, const uint64_t *keys)
+{
+    uint64x2_t va[BMP_HASH_LANES / 2];
+    for (int i = 0; i < BMP_HASH_LANES / 2; i++) {
+        va[i] = vld1q_u64(acc + 2 * i);
+    }
+    for (size_t s = 0; s < n; s++, p += BMP_HASH_STRIPE) {
+        for (int i = 0; i < BMP_HASH_LANES / 2; i++) {
+            uint64x2_t d = vreinterpretq_u64_u8(vld1q_u8(p + 16 * i));
+            uint64x2_t k = veorq_u64(d, vld1q_u64(keys + s + 2 * i));
+            uint64x2_t prod = vmull_u32(vmovn_u64(k), vshrn_n_u64(k, 32));
+            va[i] = vaddq_u64(va[i], vaddq_u64(prod, vextq_u64(d, d, 1)));
+        }
+    }
+    for (int i = 0; i < BMP_HASH_LANES / 2; i++) {
+        vst1q_u64(acc + 2 * i, va[i]);
+    }
+}
+#endif
+
+static __stripes_fn __stripes_kernel(void)
+{
+    unsigned caps = __simd_caps();
+#if defined(BMP_HAVE_X86_SIMD)
+    if (caps & BMP_SIMD_AVX2) {
+        return __stripes_avx2;
+    }
+    if (caps & BMP_SIMD_SSSE3) {
+        return __stripes_ssse3;
+    }
+#endif
+#if defined(BMP_HAVE_NEON)
+    if (caps & BMP_SIMD_NEON) {
+        return __stripes_neon;
+    }
+#endif
+    (void) caps;
+    return __stripes_c;
+}
+
+//-------------------------------------
+// Hashes
+//-------------------------------------
+static void __scramble(uint64_t acc[BMP_HASH_LANES])
+{
+    for (int i = 0; i < BMP_HASH_LANES; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= __keys[BMP_HASH_BLOCK - 1 + i];
+        acc[i] = a * BMP_PRIME32;
+    }
+}
+
+// Accumulates 'n' stripes, scrambling at the end of every block. 'stripe'
+// counts the stripes of the block taken so far.
+static void __hash_stripes(BMPmini_hash_state *state, __stripes_fn fn, const uint8_t *p, size_t n)
+{
+    while (n > 0) {
+        uint32_t stripe = (uint32_t) (state->bytes / BMP_HASH_STRIPE % BMP_HASH_BLOCK);
+        size_t k = BMP_HASH_BLOCK - stripe < n ? BMP_HASH_BLOCK - stripe : n;
+        fn(state->acc, p, k, __keys + stripe);
+        state->bytes += k * BMP_HASH_STRIPE;
+        if (stripe + k == BMP_HASH_BLOCK) {
+            __scramble(state->acc);
+        }
+        p += k * BMP_HASH_STRIPE;
+        n -= k;
+    }
+}
+
+// Hashes the bytes of a row after those hashed before. The bytes short of
+// a stripe wait in 'buf', 'bytes' counting them too.
+static void __hash_bytes(BMPmini_hash_state *state, __stripes_fn fn, const uint8_t *p, size_t n)
+{
+    size_t pending = (size_t) (state->bytes % BMP_HASH_STRIPE);
+    if (pending > 0) {
+        size_t k = BMP_HASH_STRIPE - pending < n ? BMP_HASH_STRIPE - pending : n;
+        memcpy(state->buf + pending, p, k);
+        p += k;
+        n -= k;
+        if (pending + k < BMP_HASH_STRIPE) {
+            state->bytes += k;
+            return;
+        }
+        state->bytes -= pending;
+        __hash_stripes(state, fn, state->buf, 1);
+    }
+    __hash_stripes(state, fn, p, n / BMP_HASH_STRIPE);
+    p += n / BMP_HASH_STRIPE * BMP_HASH_STRIPE;
+    n %= BMP_HASH_STRIPE;
+    memcpy(state->buf, p, n);
+    state->bytes += n;
+}
+
+// Finalizer of MurmurHash3, every bit of 'h' flips about half of the result
+static inline uint64_t __fmix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= UINT64_C(0xFF51AFD7ED558CCD);
+    h ^= h >> 33;
+    h *= UINT64_C(0xC4CEB9FE1A85EC53);
+    h ^= h >> 33;
+    return h;
+}
+
+void BMPmini_hash_init(BMPmini_hash_state *state)
+{
+    assert(state);
+    memset(state, 0, sizeof(*state));
+    for (int i = 0; i < BMP_HASH_LANES; i++) {
+        state->acc[i] = __keys[i] * BMP_PRIME64_1;
+    }
+}
+
+int BMPmini_hash_update(BMPmini_hash_state *state, const BMPmini_view *view)
+{
+    assert(state && view);
+    if (view->bitsperpixel != 24 && view->bitsperpixel != 32) {
+        return BMPmini_FORMAT_ERR;
+    }
+    if (state->rows == 0) {
+        state->width = view->width;
+        state->bitsperpixel = view->bitsperpixel;
+    }
+    else if (view->width != state->width || view->bitsperpixel != state->bitsperpixel) {
+        return view->width != state->width ? BMPmini_RANGE_ERR : BMPmini_FORMAT_ERR;
+    }
+    if (view->height <= 0) {
+        return BMPmini_SUCCESS;
+    }
+
+    __stripes_fn fn = __stripes_kernel();
+    size_t row_bytes = (size_t) view->width * (view->bitsperpixel / BMP_BITS_PER_BYTE);
+    for (int32_t i = 0; i < view->height; i++) {
+        __hash_bytes(state, fn, view->base + i * view->stride, row_bytes);
+    }
+    state->rows += (uint64_t) view->height;
+    return BMPmini_SUCCESS;
+}
+
+uint64_t BMPmini_hash_final(const BMPmini_hash_state *state)
+{
+    assert(state);
+    uint64_t acc[BMP_HASH_LANES];
+    memcpy(acc, state->acc, sizeof(acc));
+
+    /* The last bytes padded with zeros, the length telling them apart */
+    size_t pending = (size_t) (state->bytes % BMP_HASH_STRIPE);
+    if (pending > 0) {
+        uint8_t last[BMP_HASH_STRIPE] = {0};
+        memcpy(last, state->buf, pending);
+        __stripes_c(acc, last, 1, __keys + state->bytes / BMP_HASH_STRIPE % BMP_HASH_BLOCK);
+    }
+
+    /* The geometry is part of the content: 2x3 and 3x2 pixels differ */
+    uint64_t h = state->bytes * BMP_PRIME64_1;
+    h ^= ((uint64_t) (uint32_t) state->width << 16 | state->bitsperpixel) * BMP_PRIME64_2;
+    h ^= __fmix64(state->rows);
+    for (int i = 0; i < BMP_HASH_LANES; i++) {
+        h = (h ^ __fmix64(acc[i] ^ __keys[BMP_HASH_KEYS - 1 - i])) * BMP_PRIME64_1;
+    }
+    return __fmix64(h);
+}
+
+int BMPmini_hash_view(const BMPmini_view *view, uint64_t *hash)
+{
+    assert(hash);
+    BMPmini_hash_state state;
+    BMPmini_hash_init(&state);
+    int res = BMPmini_hash_update(&state, view);
+    if (res == BMPmini_SUCCESS) {
+        *hash = BMPmini_hash_final(&state);
+    }
+    return res;
+}
+
+int BMPmini_hash(BMPmini_image *img, uint64_t *hash)
+{
+    assert(img);
+    BMPmini_view view;
+    BMPmini_get_view(img, &view);
+    return BMPmini_hash_view(&view, hash);
+}
+
+//-------------------------------------
+// Difference kernels
+//-------------------------------------
+static size_t __first_diff_c(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        if (x != y) {
+            break;
+        }
+    }
+    while (i < n && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+static size_t __last_diff_c(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    for (; n >= 8; n -= 8) {
+        uint64_t x, y;
+        memcpy(&x, a + n - 8, sizeof(x));
+        memcpy(&y, b + n - 8, sizeof(y));
+        if (x != y) {
+            break;
+        }
+    }
+    while (n > 0 && a[n - 1] == b[n - 1]) {
+        n--;
+    }
+    return n;
+}
+
+static const struct __diff_kernels __diff_c = {__first_diff_c, __last_diff_c};
+
+// Bytes compared a vector at a time, a mask of the equal ones telling
+// where the first or last difference is
+#if defined(BMP_HAVE_X86_SIMD)
+BMP_SSSE3 static size_t __first_diff_ssse3(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *) (b + i));
+        unsigned ne = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xFFFFU;
+        if (ne) {
+            return i + (size_t) __builtin_ctz(ne);
+        }
+    }
+    return i + __first_diff_c(a + i, b + i, n - i);
+}
+
+BMP_SSSE3 static size_t __last_diff_ssse3(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    for (; n >= 16; n -= 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (a + n - 16));
+        __m128i y = _mm_loadu_si128((const __m128i *) (b + n - 16));
+        unsigned ne = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xFFFFU;
+        if (ne) {
+            return n - 16 + (size_t) (32 - __builtin_clz(ne));
+        }
+    }
+    return __last_diff_c(a, b, n);
+}
+
+BMP_AVX2 static size_t __first_diff_avx2(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+        unsigned ne = ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (ne) {
+            _mm256_zeroupper();
+            return i + (size_t) __builtin_ctz(ne);
+        }
+    }
+    _mm256_zeroupper();
+    return i + __first_diff_ssse3(a + i, b + i, n - i);
+}
+
+BMP_AVX2 static size_t __last_diff_avx2(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    for (; n >= 32; n -= 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (a + n - 32));
+        __m256i y = _mm256_loadu_si256((const __m256i *) (b + n - 32));
+        unsigned ne = ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (ne) {
+            _mm256_zeroupper();
+            return n - 32 + (size_t) (32 - __builtin_clz(ne));
+        }
+    }
+    _mm256_zeroupper();
+    return __last_diff_ssse3(a, b, n);
+}
+
+static const struct __diff_kernels __diff_ssse3 = {__first_diff_ssse3, __last_diff_ssse3};
+static const struct __diff_kernels __diff_avx2 = {__first_diff_avx2, __last_diff_avx2};
+#endif
+
+#if defined(BMP_HAVE_NEON)
+// 4 bits per byte, set for the differing ones
+static inline uint64_t __ne_mask_neon(const uint8_t *a, const uint8_t *b)
+{
+    uint8x16_t eq = vceqq_u8(vld1q_u8(a), vld1q_u8(b));
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+    return ~vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+}
+
+static size_t __first_diff_neon(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint64_t ne = __ne_mask_neon(a + i, b + i);
+        if (ne) {
+            return i + (size_t) __builtin_ctzll(ne) / 4;
+        }
+    }
+    return i + __first_diff_c(a + i, b + i, n - i);
+}
+
+static size_t __last_diff_neon(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    for (; n >= 16; n -= 16) {
+        uint64_t ne = __ne_mask_neon(a + n - 16, b + n - 16);
+        if (ne) {
+            return n - 16 + (size_t) (63 - __builtin_clzll(ne)) / 4 + 1;
+        }
+    }
+    return __last_diff_c(a, b, n);
+}
+
+static const struct __diff_kernels __diff_neon = {__first_diff_neon, __last_diff_neon};
+#endif
+
+static const struct __diff_kernels *__diff_kernels(void)
+{
+    unsigned caps = __simd_caps();
+#if defined(BMP_HAVE_X86_SIMD)
+    if (caps & BMP_SIMD_AVX2) {
+        return &__diff_avx2;
+    }
+    if (caps & BMP_SIMD_SSSE3) {
+        return &__diff_ssse3;
+    }
+#endif
+#if defined(BMP_HAVE_NEON)
+    if (caps & BMP_SIMD_NEON) {
+        return &__diff_neon;
+    }
+#endif
+    (void) caps;
+    return &__diff_c;
+}
+
+//-------------------------------------
+// Differences
+//-------------------------------------
+static inline int32_t __diff_part_row(const struct __diff_job *job, int32_t part)
+{
+    return (int32_t) ((int64_t) job->a->height * part / job->nparts);
+}
+
+// Finds the first and last differing rows of each band, then widens the
+// box with the other rows only where they are outside of it. Every byte is
+// compared at most once, and rows stop being compared once the box spans
+// them whole.
+static void __diff_band(void *arg, int32_t first, int32_t last)
+{
+    struct __diff_job *job = arg;
+    const BMPmini_view *a = job->a, *b = job->b;
+    const struct __diff_kernels *k = job->kernels;
+    size_t n = job->row_bytes;
+
+    for (int32_t part = first; part < last; part++) {
+        struct __diff_part *out = &job->parts[part];
+        int32_t top = __diff_part_row(job, part), end = __diff_part_row(job, part + 1);
+        size_t left = n, right = 0;
+        for (; top < end; top++) {
+            const uint8_t *pa = a->base + top * a->stride, *pb = b->base + top * b->stride;
+            if ((left = k->first(pa, pb, n)) < n) {
+                right = k->last(pa, pb, n);
+                break;
+            }
+        }
+        out->top = out->bottom = top;
+        if (top == end) {
+            continue;
+        }
+
+        int32_t bottom = end - 1;
+        for (; bottom > top; bottom--) {
+            const uint8_t *pa = a->base + bottom * a->stride, *pb = b->base + bottom * b->stride;
+            size_t r = k->last(pa, pb, n);
+            if (r > 0) {
+                size_t l = k->first(pa, pb, left);
+                left = l < left ? l : left;
+                right = r > right ? r : right;
+                break;
+            }
+        }
+        out->bottom = bottom + 1;
+
+        for (int32_t i = top + 1; i < bottom && (left > 0 || right < n); i++) {
+            const uint8_t *pa = a->base + i * a->stride, *pb = b->base + i * b->stride;
+            left = k->first(pa, pb, left);
+            right += k->last(pa + right, pb + right, n - right);
+        }
+        out->left = left;
+        out->right = right;
+    }
+}
+
+int BMPmini_diff_view(const BMPmini_view *a, const BMPmini_view *b, BMPmini_rect *box, int nthreads)
+{
+    assert(a && b && box);
+    memset(box, 0, sizeof(*box));
+    if ((a->bitsperpixel != 24 && a->bitsperpixel != 32) || a->bitsperpixel != b->bitsperpixel) {
+        return BMPmini_FORMAT_ERR;
+    }
+    if (a->width != b->width || a->height != b->height) {
+        return BMPmini_RANGE_ERR;
+    }
+    if (a->width <= 0 || a->height <= 0 || (a->base == b->base && a->stride == b->stride)) {
+        return BMPmini_SUCCESS;
+    }
+
+    /* A few bands per thread, none too small to be worth a thread */
+    size_t bpp = a->bitsperpixel / BMP_BITS_PER_BYTE;
+    size_t row_bytes = (size_t) a->width * bpp;
+    uint64_t total = (uint64_t) row_bytes * a->height * 2;
+    int64_t n = (int64_t) __resolve_threads(nthreads) * BMP_BANDS_PER_THREAD;
+    if ((uint64_t) n > total / BMP_MIN_BAND_BYTES) {
+        n = (int64_t) (total / BMP_MIN_BAND_BYTES);
+    }
+    n = n < 1 ? 1 : n > BMP_DIFF_PARTS ? BMP_DIFF_PARTS : n;
+    n = n > a->height ? a->height : n;
+
+    struct __diff_part parts[BMP_DIFF_PARTS];
+    struct __diff_job job = {a, b, parts, (int32_t) n, row_bytes, __diff_kernels()};
+    __run_bands(job.nparts, (size_t) (total / n), nthreads, __diff_band, &job);
+
+    /* The union of the boxes of the bands, from bytes to pixels */
+    int32_t top = a->height, bottom = 0;
+    size_t left = row_bytes, right = 0;
+    for (int32_t p = 0; p < job.nparts; p++) {
+        if (parts[p].top == parts[p].bottom) {
+            continue;
+        }
+        top = parts[p].top < top ? parts[p].top : top;
+        bottom = parts[p].bottom;
+        left = parts[p].left < left ? parts[p].left : left;
+        right = parts[p].right > right ? parts[p].right : right;
+    }
+    if (top < bottom) {
+        box->x = (int32_t) (left / bpp);
+        box->y = top;
+        box->width = (int32_t) ((right - 1) / bpp + 1) - box->x;
+        box->height = bottom - top;
+    }
+    return BMPmini_SUCCESS;
+}
+
+int BMPmini_diff(BMPmini_image *a, BMPmini_image *b, BMPmini_rect *box)
+{
+    assert(a && b);
+    BMPmini_view va, vb;
+    BMPmini_get_view(a, &va);
+    BMPmini_get_view(b, &vb);
+    return BMPmini_diff_view(&va, &vb, box, 0);
+}
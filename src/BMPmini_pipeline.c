@@ -0,0 +1,404 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_pipeline.c
+//
+// Fused crop, resize and conversion of BMP images for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <assert.h>
+
+// Output rows produced between two flushes to the sink, few enough for the
+// intermediate rows of a band to stay in the L2 cache
+#define BMP_PIPE_ROWS 16
+
+#define BMP_CHANNELS 3  // BGR
+
+enum {
+    __SINK_NONE=0,
+    __SINK_FILE,
+    __SINK_BUFFER,
+};
+
+struct _BMPmini_pipeline {
+    BMPmini_view src;          // Source pixels, only the size for file sources
+    BMPmini_reader *reader;    // File sources
+    uint32_t src_row_size;     // Bytes per row of file sources, padding included
+    int32_t x, y, w, h;        // Crop region, the whole source unless cropped
+    bool cropped;
+    int32_t out_w, out_h;      // Output size, the crop size unless resized
+    int filter;                // -1 when not resized
+    int sink;                  // __SINK_* sink
+    char *filename;            // File sinks
+    int format;                // Buffer sinks
+    uint8_t *dst;
+    size_t dst_stride;
+};
+
+// One run of a pipeline
+struct __pipe_job {
+    BMPmini_pipeline *p;
+    BMPmini_tile_writer *writer;
+    struct __coeffs hc, vc;
+    bool hres, vres;           // Whether each pass is needed
+    __vpass_fn vpass;
+    __hpass_fn hpass;
+    int status;                // First error of a band, set with __fail_status
+};
+
+// What a band of output rows works with
+struct __pipe_state {
+    struct __pipe_job *job;
+    int32_t k;                 // Rows kept from the horizontal pass
+    uint8_t *ring;             // 'k' rows out of the horizontal pass, row y at y % k
+    const uint8_t **rows;      // Where crop row y is, at y % k
+    const uint8_t **taps;      // Rows of the taps of an output row
+    int32_t next;              // Next crop row to go in the ring
+    uint8_t *buf;              // Rows read from the file
+    int32_t buf_first;         // First source row in 'buf'
+    int32_t buf_rows;          // Number of rows in 'buf'
+    uint8_t *out;              // Output rows waiting for the sink
+};
+
+BMPmini_pipeline *BMPmini_pipeline_new(void)
+{
+    BMPmini_pipeline *p = calloc(1, sizeof(*p));
+    if (!p) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        return NULL;
+    }
+    p->filter = -1;
+    return p;
+}
+
+void BMPmini_pipeline_free(BMPmini_pipeline *p)
+{
+    if (p) {
+        BMPmini_reader_close(p->reader);
+        free(p->filename);
+        free(p);
+    }
+}
+
+//-------------------------------------
+// Stages
+//-------------------------------------
+int BMPmini_pipeline_source_view(BMPmini_pipeline *p, const BMPmini_view *view)
+{
+    assert(p && view);
+    if (view->bitsperpixel != BMP_BITS_PER_PIXEL) {
+        return BMPmini_FORMAT_ERR;
+    }
+    BMPmini_reader_close(p->reader);
+    p->reader = NULL;
+    p->src = *view;
+    return BMPmini_SUCCESS;
+}
+
+int BMPmini_pipeline_source_file(BMPmini_pipeline *p, const char *restrict filename)
+{
+    assert(p && filename);
+    BMPmini_reader *reader = BMPmini_reader_open(filename);
+    if (!reader) {
+        return BMPmini_FREAD_ERR;
+    }
+    BMPmini_info info;
+    BMPmini_reader_info(reader, &info);
+    if (info.bitsperpixel != BMP_BITS_PER_PIXEL) {
+        BMPmini_reader_close(reader);
+        return BMPmini_FORMAT_ERR;
+    }
+
+    BMPmini_reader_close(p->reader);
+    p->reader = reader;
+    p->src_row_size = info.row_size;
+    p->src = (BMPmini_view) {NULL, 0, info.width, info.height, info.bitsperpixel};
+    return BMPmini_SUCCESS;
+}
+
+void BMPmini_pipeline_crop(BMPmini_pipeline *p, int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    assert(p && x >= 0 && y >= 0 && w > 0 && h > 0);
+    p->x = x;
+    p->y = y;
+    p->w = w;
+    p->h = h;
+    p->cropped = true;
+}
+
+int BMPmini_pipeline_resize(BMPmini_pipeline *p, int32_t w, int32_t h, int filter)
+{
+    assert(p && w > 0 && h > 0);
+    if (filter < BMPmini_FILTER_BOX || filter > BMPmini_FILTER_LANCZOS) {
+        return BMPmini_FORMAT_ERR;
+    }
+    p->out_w = w;
+    p->out_h = h;
+    p->filter = filter;
+    return BMPmini_SUCCESS;
+}
+
+int BMPmini_pipeline_sink_file(BMPmini_pipeline *p, const char *restrict filename)
+{
+    assert(p && filename);
+    size_t len = strlen(filename) + 1;
+    char *copy = malloc(len);
+    if (!copy) {
+        return BMPmini_NOMEM_ERR;
+    }
+    memcpy(copy, filename, len);
+    free(p->filename);
+    p->filename = copy;
+    p->sink = __SINK_FILE;
+    return BMPmini_SUCCESS;
+}
+
+int BMPmini_pipeline_sink_buffer(BMPmini_pipeline *p, int format, void *dst, size_t dst_stride)
+{
+    assert(p && dst);
+    /* Planes span the whole image, bands could not be converted on their own */
+    if (format != BMPmini_FMT_BGR24 && format != BMPmini_FMT_RGBA32 && format != BMPmini_FMT_GRAY8) {
+        return BMPmini_FORMAT_ERR;
+    }
+    p->format = format;
+    p->dst = dst;
+    p->dst_stride = dst_stride;
+    p->sink = __SINK_BUFFER;
+    return BMPmini_SUCCESS;
+}
+
+//-------------------------------------
+// Running
+//-------------------------------------
+// Hands output rows, starting with output row 'first', to the sink
+static void __flush(struct __pipe_job *job, const BMPmini_view *rows, int32_t first)
+{
+    BMPmini_pipeline *p = job->p;
+    if (p->sink == __SINK_BUFFER) {
+        BMPmini_convert(rows, p->format, p->dst + first * p->dst_stride, p->dst_stride, 1);
+        return;
+    }
+
+    /* Rows go where they belong in the file, whichever band is first */
+    int res = BMPmini_tile_writer_write(job->writer, rows, 0, first);
+    if (res != BMPmini_SUCCESS) {
+        __fail_status(&job->status, res);
+    }
+}
+
+// Gets crop row 'y', rows being read in order from file sources
+static const uint8_t *__fetch(struct __pipe_state *st, int32_t y)
+{
+    BMPmini_pipeline *p = st->job->p;
+    y += p->y;
+    if (!p->reader) {
+        return p->src.base + y * p->src.stride + (size_t) p->x * BMP_CHANNELS;
+    }
+
+    while (y >= st->buf_first + st->buf_rows) {
+        st->buf_first += st->buf_rows;
+        int32_t n = p->src.height - st->buf_first < BMP_PIPE_ROWS ? p->src.height - st->buf_first : BMP_PIPE_ROWS;
+        st->buf_rows = (int32_t) BMPmini_reader_read_rows(p->reader, st->buf, n);
+        if (st->buf_rows == 0) {
+            __fail_status(&st->job->status, BMPmini_FREAD_ERR);
+            return NULL;
+        }
+    }
+    return st->buf + (size_t) (y - st->buf_first) * p->src_row_size + (size_t) p->x * BMP_CHANNELS;
+}
+
+// Neither pass: crops go straight from the source to the sink
+static void __copy_band(struct __pipe_state *st, int32_t first, int32_t last)
+{
+    BMPmini_pipeline *p = st->job->p;
+    for (int32_t i = first; i < last && __get_status(&st->job->status) == BMPmini_SUCCESS; ) {
+        BMPmini_view rows = {NULL, p->src.stride, p->w, last - i < BMP_PIPE_ROWS ? last - i : BMP_PIPE_ROWS,
+                             BMP_BITS_PER_PIXEL};
+        rows.base = (uint8_t *) __fetch(st, i);
+        if (!rows.base) {
+            return;
+        }
+        /* Only the rows already read from the file */
+        if (p->reader) {
+            int32_t avail = st->buf_first + st->buf_rows - (p->y + i);
+            rows.height = rows.height < avail ? rows.height : avail;
+            rows.stride = (ptrdiff_t) p->src_row_size;
+        }
+        __flush(st->job, &rows, i);
+        i += rows.height;
+    }
+}
+
+// Puts crop row y through the horizontal pass into the ring
+static bool __push_row(struct __pipe_state *st, int32_t y)
+{
+    struct __pipe_job *job = st->job;
+    const uint8_t *row = __fetch(st, y);
+    if (!row) {
+        return false;
+    }
+
+    uint8_t *slot = st->ring + (size_t) (y % st->k) * job->p->out_w * BMP_CHANNELS;
+    if (job->hres) {
+        job->hpass(row, (size_t) job->p->w * BMP_CHANNELS, &job->hc, slot, job->p->out_w);
+        row = slot;
+    }
+    /* Rows of the file buffer are overwritten by the next read */
+    else if (job->p->reader) {
+        memcpy(slot, row, (size_t) job->p->w * BMP_CHANNELS);
+        row = slot;
+    }
+    st->rows[y % st->k] = row;
+    return true;
+}
+
+static void __resize_band(struct __pipe_state *st, int32_t first, int32_t last)
+{
+    struct __pipe_job *job = st->job;
+    BMPmini_pipeline *p = job->p;
+    size_t out_bytes = (size_t) p->out_w * BMP_CHANNELS;
+    const struct __coeffs *vc = &job->vc;
+
+    st->next = job->vres ? vc->start[first] : first;
+    BMPmini_view rows = {st->out, (ptrdiff_t) out_bytes, p->out_w, 0, BMP_BITS_PER_PIXEL};
+    for (int32_t i = first; i < last && __get_status(&job->status) == BMPmini_SUCCESS; i++) {
+        /* Bring the rows of the taps of output row i in the ring */
+        int32_t lo = job->vres ? vc->start[i] : i;
+        int32_t hi = lo + st->k < p->h ? lo + st->k : p->h;
+        for (; st->next < hi; st->next++) {
+            if (!__push_row(st, st->next)) {
+                return;
+            }
+        }
+
+        uint8_t *out = st->out + rows.height * out_bytes;
+        if (job->vres) {
+            /* Taps past the last row have a zero weight, any row will do */
+            for (int t = 0; t < vc->ksize; t++) {
+                st->taps[t] = st->rows[(lo + t < p->h ? lo + t : p->h - 1) % st->k];
+            }
+            job->vpass(st->taps, vc->weights + (size_t) i * vc->ksize, vc->ksize, out, 0, out_bytes);
+        }
+        else {
+            memcpy(out, st->rows[i % st->k], out_bytes);
+        }
+
+        if (++rows.height == BMP_PIPE_ROWS || i + 1 == last) {
+            __flush(job, &rows, i + 1 - rows.height);
+            rows.height = 0;
+        }
+    }
+}
+
+static void __pipe_band(void *arg, int32_t first, int32_t last)
+{
+    struct __pipe_job *job = arg;
+    BMPmini_pipeline *p = job->p;
+    size_t out_bytes = (size_t) p->out_w * BMP_CHANNELS;
+
+    struct __pipe_state st = {job, 1, NULL, NULL, NULL, 0, NULL, 0, 0, NULL};
+    if (job->vres) {
+        st.k = job->vc.ksize < p->h ? job->vc.ksize : p->h;
+    }
+    bool resized = job->hres || job->vres;
+    if (resized) {
+        st.ring = malloc(st.k * out_bytes);
+        st.rows = malloc(st.k * sizeof(*st.rows));
+        st.out = malloc(BMP_PIPE_ROWS * out_bytes);
+    }
+    if (job->vres) {
+        st.taps = malloc(job->vc.ksize * sizeof(*st.taps));
+    }
+    if (p->reader) {
+        st.buf = malloc(BMP_PIPE_ROWS * (size_t) p->src_row_size);
+    }
+    if ((resized && (!st.ring || !st.rows || !st.out)) || (job->vres && !st.taps) || (p->reader && !st.buf)) {
+        __fail_status(&job->status, BMPmini_NOMEM_ERR);
+        goto CLEANUP_PB1;
+    }
+
+    if (resized) {
+        __resize_band(&st, first, last);
+    }
+    else {
+        __copy_band(&st, first, last);
+    }
+CLEANUP_PB1:
+    free(st.ring);
+    free(st.rows);
+    free(st.taps);
+    free(st.out);
+    free(st.buf);
+}
+
+int BMPmini_pipeline_run(BMPmini_pipeline *p, int nthreads)
+{
+    assert(p && p->src.width > 0 && p->sink != __SINK_NONE);
+
+    if (!p->cropped) {
+        p->w = p->src.width;
+        p->h = p->src.height;
+    }
+    if (__int32_overflow(p->x, p->w) || __int32_overflow(p->y, p->h)
+        || p->x + p->w > p->src.width || p->y + p->h > p->src.height) {
+        return BMPmini_RANGE_ERR;
+    }
+    if (p->filter < 0) {
+        p->out_w = p->w;
+        p->out_h = p->h;
+    }
+    if (p->sink == __SINK_BUFFER) {
+        size_t bpp = p->format == BMPmini_FMT_BGR24 ? 3 : p->format == BMPmini_FMT_RGBA32 ? 4 : 1;
+        if (p->dst_stride == 0) {
+            p->dst_stride = (size_t) p->out_w * bpp;
+        }
+        if (p->dst_stride < (size_t) p->out_w * bpp) {
+            return BMPmini_BUFFER_ERR;
+        }
+    }
+
+    struct __pipe_job job = {p, NULL, {NULL, NULL, 0}, {NULL, NULL, 0}, p->out_w != p->w, p->out_h != p->h,
+                             NULL, NULL, BMPmini_SUCCESS};
+    __resize_kernels(&job.vpass, &job.hpass);
+    if ((job.hres && !__compute_coeffs(&job.hc, p->filter, p->w, p->out_w))
+        || (job.vres && !__compute_coeffs(&job.vc, p->filter, p->h, p->out_h))) {
+        job.status = BMPmini_NOMEM_ERR;
+        goto CLEANUP_PR1;
+    }
+
+    if (p->sink == __SINK_FILE) {
+        job.writer = BMPmini_tile_writer_open(p->filename, p->out_w, p->out_h, BMP_BITS_PER_PIXEL, 0);
+        if (!job.writer) {
+            job.status = BMPmini_FOPEN_ERR;
+            goto CLEANUP_PR1;
+        }
+    }
+
+    /* Files are read in order, by a single band. Otherwise every band
+     * works on its own, reading again the few source rows its taps
+     * share with the band above. */
+    if (p->reader) {
+        __pipe_band(&job, 0, p->out_h);
+    }
+    else {
+        size_t band_bytes = (size_t) p->w * BMP_CHANNELS * (job.vres ? (size_t) p->h / p->out_h + 1 : 1);
+        __run_bands(p->out_h, band_bytes, nthreads, __pipe_band, &job);
+    }
+
+    if (job.writer) {
+        int res = BMPmini_tile_writer_close(job.writer);
+        if (job.status == BMPmini_SUCCESS) {
+            job.status = res;
+        }
+    }
+CLEANUP_PR1:
+    __free_coeffs(&job.hc);
+    __free_coeffs(&job.vc);
+    /* File sources can only be read once */
+    if (p->reader) {
+        BMPmini_reader_close(p->reader);
+        p->reader = NULL;
+        p->src.width = 0;
+    }
+    return job.status;
+}
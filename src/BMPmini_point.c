@@ -0,0 +1,308 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_point.c
+//
+// In place per-pixel operations on BMP images for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#if defined(BMP_HAVE_X86_SIMD)
+  #include <immintrin.h>
+#endif
+#if defined(BMP_HAVE_NEON)
+  #include <arm_neon.h>
+#endif
+
+// Contrast is a fixed point gain with BMP_GAIN_BITS fractional bits, applied
+// with a rounding multiplication keeping the high half of 16-bit products
+// (pmulhrsw, vqrdmulh), pixels being first centered and scaled by 2^7.
+#define BMP_GAIN_BITS 8
+#define BMP_GAIN_MAX  127.0  // Largest contrast
+
+enum {
+    __POINT_LUT=0,
+    __POINT_AFFINE,
+    __POINT_THRESHOLD,
+    __POINT_INVERT,
+};
+
+struct __point_op {
+    int kind;                   // __POINT_* operation
+    size_t bpp;                 // Bytes per pixel, only the first 3 are changed
+    const uint8_t (*lut)[256];  // __POINT_LUT: one table for blue, green and red
+    int16_t gain;               // __POINT_AFFINE: contrast, in 1/2^BMP_GAIN_BITS
+    int16_t offset;             // __POINT_AFFINE: 128 plus brightness
+    uint8_t level;              // __POINT_THRESHOLD: lowest value mapped to 255
+};
+
+typedef void (*__point_fn)(uint8_t *row, size_t n, const struct __point_op *op);
+
+static inline uint8_t __affine(uint8_t x, const struct __point_op *op)
+{
+    int32_t centered = ((int32_t) x - 128) * (1 << 7);
+    int32_t v = ((centered * op->gain + (1 << 14)) >> 15) + op->offset;
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t) v;
+}
+
+//-------------------------------------
+// Scalar kernels, the reference for all the others
+//-------------------------------------
+// Changes bytes [k, n) of a row, skipping the fourth byte of 32 bpp pixels
+#define BMP_POINT_LOOP(expr)                                                   \
+    for (size_t c = k % op->bpp; k < n; k++, c = c + 1 == op->bpp ? 0 : c + 1) { \
+        if (c != 3) {                                                          \
+            row[k] = (expr);                                                   \
+        }                                                                      \
+    }
+
+static void __point_tail(uint8_t *row, size_t k, size_t n, const struct __point_op *op)
+{
+    switch (op->kind) {
+    case __POINT_LUT:       BMP_POINT_LOOP(op->lut[c][row[k]]); break;
+    case __POINT_AFFINE:    BMP_POINT_LOOP(__affine(row[k], op)); break;
+    case __POINT_THRESHOLD: BMP_POINT_LOOP(row[k] >= op->level ? 255 : 0); break;
+    case __POINT_INVERT:    BMP_POINT_LOOP((uint8_t) ~row[k]); break;
+    }
+}
+#undef BMP_POINT_LOOP
+
+static void __point_c(uint8_t *row, size_t n, const struct __point_op *op)
+{
+    /* Tables go a pixel at a time, to keep the channel out of the loop */
+    if (op->kind == __POINT_LUT) {
+        const uint8_t *b = op->lut[0], *g = op->lut[1], *r = op->lut[2];
+        for (uint8_t *end = row + n; row < end; row += op->bpp) {
+            row[0] = b[row[0]];
+            row[1] = g[row[1]];
+            row[2] = r[row[2]];
+        }
+        return;
+    }
+    __point_tail(row, 0, n, op);
+}
+
+//-------------------------------------
+// x86 kernels
+//-------------------------------------
+// Bytes are processed 16 or 32 at a time, which is a whole number of 32 bpp
+// pixels from the start of the row, so a fixed mask keeps their fourth byte.
+#if defined(BMP_HAVE_X86_SIMD)
+#define BMP_SSSE3 __attribute__((target("ssse3")))
+#define BMP_AVX2  __attribute__((target("avx2")))
+
+BMP_SSSE3 static inline __m128i __affine_ssse3(__m128i x, __m128i gain, __m128i offset)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i center = _mm_set1_epi16(128 << 7);
+    __m128i lo = _mm_sub_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(x, zero), 7), center);
+    __m128i hi = _mm_sub_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(x, zero), 7), center);
+    lo = _mm_add_epi16(_mm_mulhrs_epi16(lo, gain), offset);
+    hi = _mm_add_epi16(_mm_mulhrs_epi16(hi, gain), offset);
+    return _mm_packus_epi16(lo, hi);
+}
+
+BMP_SSSE3 static void __point_ssse3(uint8_t *row, size_t n, const struct __point_op *op)
+{
+    if (op->kind == __POINT_LUT) {
+        __point_c(row, n, op);
+        return;
+    }
+    const __m128i keep = op->bpp == 4 ? _mm_set1_epi32(0x00FFFFFF) : _mm_set1_epi8(-1);
+    const __m128i gain = _mm_set1_epi16(op->gain);
+    const __m128i offset = _mm_set1_epi16(op->offset);
+    const __m128i level = _mm_set1_epi8((char) op->level);
+    const __m128i ones = _mm_set1_epi8(-1);
+    size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (row + k));
+        __m128i y;
+        switch (op->kind) {
+        case __POINT_AFFINE:
+            y = __affine_ssse3(x, gain, offset);
+            break;
+        case __POINT_THRESHOLD:
+            y = _mm_cmpeq_epi8(_mm_max_epu8(x, level), x);
+            break;
+        default:
+            y = _mm_xor_si128(x, ones);
+            break;
+        }
+        y = _mm_or_si128(_mm_and_si128(keep, y), _mm_andnot_si128(keep, x));
+        _mm_storeu_si128((__m128i *) (row + k), y);
+    }
+    __point_tail(row, k, n, op);
+}
+
+BMP_AVX2 static void __point_avx2(uint8_t *row, size_t n, const struct __point_op *op)
+{
+    if (op->kind == __POINT_LUT) {
+        __point_c(row, n, op);
+        return;
+    }
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i center = _mm256_set1_epi16(128 << 7);
+    const __m256i keep = op->bpp == 4 ? _mm256_set1_epi32(0x00FFFFFF) : _mm256_set1_epi8(-1);
+    const __m256i gain = _mm256_set1_epi16(op->gain);
+    const __m256i offset = _mm256_set1_epi16(op->offset);
+    const __m256i level = _mm256_set1_epi8((char) op->level);
+    const __m256i ones = _mm256_set1_epi8(-1);
+    size_t k = 0;
+    for (; k + 32 <= n; k += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (row + k));
+        __m256i y;
+        switch (op->kind) {
+        case __POINT_AFFINE: {
+            /* Unpacking and packing both work within 128-bit lanes */
+            __m256i lo = _mm256_sub_epi16(_mm256_slli_epi16(_mm256_unpacklo_epi8(x, zero), 7), center);
+            __m256i hi = _mm256_sub_epi16(_mm256_slli_epi16(_mm256_unpackhi_epi8(x, zero), 7), center);
+            lo = _mm256_add_epi16(_mm256_mulhrs_epi16(lo, gain), offset);
+            hi = _mm256_add_epi16(_mm256_mulhrs_epi16(hi, gain), offset);
+            y = _mm256_packus_epi16(lo, hi);
+            break;
+        }
+        case __POINT_THRESHOLD:
+            y = _mm256_cmpeq_epi8(_mm256_max_epu8(x, level), x);
+            break;
+        default:
+            y = _mm256_xor_si256(x, ones);
+            break;
+        }
+        y = _mm256_or_si256(_mm256_and_si256(keep, y), _mm256_andnot_si256(keep, x));
+        _mm256_storeu_si256((__m256i *) (row + k), y);
+    }
+    _mm256_zeroupper();
+    __point_ssse3(row + k, n - k, op);
+}
+#endif
+
+//-------------------------------------
+// ARM kernels
+//-------------------------------------
+#if defined(BMP_HAVE_NEON)
+static void __point_neon(uint8_t *row, size_t n, const struct __point_op *op)
+{
+    if (op->kind == __POINT_LUT) {
+        __point_c(row, n, op);
+        return;
+    }
+    const uint8x16_t keep = op->bpp == 4 ? vreinterpretq_u8_u32(vdupq_n_u32(0x00FFFFFF)) : vdupq_n_u8(0xFF);
+    const int16x8_t center = vdupq_n_s16(128 << 7);
+    const int16x8_t offset = vdupq_n_s16(op->offset);
+    const uint8x16_t level = vdupq_n_u8(op->level);
+    size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        uint8x16_t x = vld1q_u8(row + k);
+        uint8x16_t y;
+        switch (op->kind) {
+        case __POINT_AFFINE: {
+            int16x8_t lo = vsubq_s16(vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(x), 7)), center);
+            int16x8_t hi = vsubq_s16(vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(x), 7)), center);
+            lo = vaddq_s16(vqrdmulhq_n_s16(lo, op->gain), offset);
+            hi = vaddq_s16(vqrdmulhq_n_s16(hi, op->gain), offset);
+            y = vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi));
+            break;
+        }
+        case __POINT_THRESHOLD:
+            y = vcgeq_u8(x, level);
+            break;
+        default:
+            y = vmvnq_u8(x);
+            break;
+        }
+        vst1q_u8(row + k, vbslq_u8(keep, y, x));
+    }
+    __point_tail(row, k, n, op);
+}
+#endif
+
+//-------------------------------------
+// Operations
+//-------------------------------------
+struct __point_job {
+    const BMPmini_view *view;
+    const struct __point_op *op;
+    __point_fn fn;
+};
+
+static void __point_band(void *arg, int32_t first, int32_t last)
+{
+    struct __point_job *job = arg;
+    size_t n = (size_t) job->view->width * job->op->bpp;
+    for (int32_t i = first; i < last; i++) {
+        job->fn(job->view->base + i * job->view->stride, n, job->op);
+    }
+}
+
+static int __point(const BMPmini_view *view, struct __point_op *op, int nthreads)
+{
+    assert(view);
+    if (view->bitsperpixel != 24 && view->bitsperpixel != 32) {
+        return BMPmini_FORMAT_ERR;
+    }
+    op->bpp = view->bitsperpixel / BMP_BITS_PER_BYTE;
+
+    unsigned caps = __simd_caps();
+    struct __point_job job = {view, op, __point_c};
+#if defined(BMP_HAVE_X86_SIMD)
+    if (caps & BMP_SIMD_SSSE3) {
+        job.fn = caps & BMP_SIMD_AVX2 ? __point_avx2 : __point_ssse3;
+    }
+#endif
+#if defined(BMP_HAVE_NEON)
+    if (caps & BMP_SIMD_NEON) {
+        job.fn = __point_neon;
+    }
+#endif
+    (void) caps;
+
+    /* Without SIMD kernels, a table computed once beats arithmetic per byte */
+    uint8_t table[3][256];
+    struct __point_op lut_op = *op;
+    if (job.fn == __point_c && op->kind != __POINT_LUT) {
+        lut_op.bpp = 1;
+        for (int x = 0; x < 256; x++) {
+            table[0][x] = (uint8_t) x;
+        }
+        __point_tail(table[0], 0, 256, &lut_op);
+        lut_op.bpp = op->bpp;
+        memcpy(table[1], table[0], 256);
+        memcpy(table[2], table[0], 256);
+        lut_op.kind = __POINT_LUT;
+        lut_op.lut = (const uint8_t (*)[256]) table;
+        job.op = &lut_op;
+    }
+
+    __run_bands(view->height, (size_t) view->width * op->bpp, nthreads, __point_band, &job);
+    return BMPmini_SUCCESS;
+}
+
+int BMPmini_apply_lut(const BMPmini_view *view, const uint8_t lut[3][256], int nthreads)
+{
+    assert(lut);
+    struct __point_op op = {__POINT_LUT, 0, lut, 0, 0, 0};
+    return __point(view, &op, nthreads);
+}
+
+int BMPmini_adjust(const BMPmini_view *view, float brightness, float contrast, int nthreads)
+{
+    if (!(fabsf(contrast) <= BMP_GAIN_MAX && fabsf(brightness) <= 255.0f)) {
+        return BMPmini_RANGE_ERR;
+    }
+    struct __point_op op = {__POINT_AFFINE, 0, NULL, (int16_t) lrintf(contrast * (1 << BMP_GAIN_BITS)),
+                            (int16_t) (128 + lrintf(brightness)), 0};
+    return __point(view, &op, nthreads);
+}
+
+int BMPmini_threshold(const BMPmini_view *view, uint8_t level, int nthreads)
+{
+    struct __point_op op = {__POINT_THRESHOLD, 0, NULL, 0, 0, level};
+    return __point(view, &op, nthreads);
+}
+
+int BMPmini_invert(const BMPmini_view *view, int nthreads)
+{
+    struct __point_op op = {__POINT_INVERT, 0, NULL, 0, 0, 0};
+    return __point(view, &op, nthreads);
+}
@@ -0,0 +1,125 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_pool.c
+//
+// Pool of recycled image buffers for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <assert.h>
+#if defined(BMP_HAVE_PTHREAD)
+  #include <pthread.h>
+#endif
+
+struct __pool_buf {
+    void *ptr;
+    size_t size;
+};
+
+struct _BMPmini_pool {
+#if defined(BMP_HAVE_PTHREAD)
+    pthread_mutex_t lock;
+#endif
+    size_t max_buffers;  // Maximum number of idle buffers kept
+    size_t nbuffers;     // Number of idle buffers
+    struct __pool_buf bufs[FLEX_ARRAY];
+};
+
+static void __pool_lock(BMPmini_pool *pool)
+{
+#if defined(BMP_HAVE_PTHREAD)
+    pthread_mutex_lock(&pool->lock);
+#else
+    (void) pool;
+#endif
+}
+
+static void __pool_unlock(BMPmini_pool *pool)
+{
+#if defined(BMP_HAVE_PTHREAD)
+    pthread_mutex_unlock(&pool->lock);
+#else
+    (void) pool;
+#endif
+}
+
+static void *__pool_alloc(void *ctx, size_t size)
+{
+    BMPmini_pool *pool = ctx;
+    void *ptr = NULL;
+
+    /* Most recently released buffers first, they are likely still cached */
+    __pool_lock(pool);
+    for (size_t i = pool->nbuffers; i-- > 0;) {
+        if (pool->bufs[i].size == size) {
+            ptr = pool->bufs[i].ptr;
+            pool->bufs[i] = pool->bufs[--pool->nbuffers];
+            break;
+        }
+    }
+    __pool_unlock(pool);
+
+    return ptr ? ptr : malloc(size);
+}
+
+static void __pool_free(void *ctx, void *ptr, size_t size)
+{
+    BMPmini_pool *pool = ctx;
+
+    __pool_lock(pool);
+    if (pool->nbuffers < pool->max_buffers) {
+        pool->bufs[pool->nbuffers].ptr = ptr;
+        pool->bufs[pool->nbuffers].size = size;
+        pool->nbuffers++;
+        ptr = NULL;
+    }
+    __pool_unlock(pool);
+
+    free(ptr);
+}
+
+BMPmini_pool *BMPmini_pool_create(size_t max_buffers)
+{
+    assert(max_buffers > 0);
+
+    if (max_buffers > (SIZE_MAX - sizeof(BMPmini_pool)) / sizeof(struct __pool_buf)) {
+        BMPmini_PERROR(__func__, BMPmini_OVERFLOW_ERR, "[OVERFLOW]: size_t overflow encountered", 0);
+        return NULL;
+    }
+
+    BMPmini_pool *pool = malloc(sizeof(*pool) + max_buffers * sizeof(struct __pool_buf));
+    if (!pool) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        return NULL;
+    }
+#if defined(BMP_HAVE_PTHREAD)
+    if (pthread_mutex_init(&pool->lock, NULL)) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: pthread_mutex_init failed", 0);
+        free(pool);
+        return NULL;
+    }
+#endif
+    pool->max_buffers = max_buffers;
+    pool->nbuffers = 0;
+    return pool;
+}
+
+void BMPmini_pool_allocator(BMPmini_pool *pool, BMPmini_allocator *allocator)
+{
+    assert(pool && allocator);
+    allocator->alloc = __pool_alloc;
+    allocator->free = __pool_free;
+    allocator->ctx = pool;
+}
+
+void BMPmini_pool_destroy(BMPmini_pool *pool)
+{
+    if (pool) {
+        for (size_t i = 0; i < pool->nbuffers; i++) {
+            free(pool->bufs[i].ptr);
+        }
+#if defined(BMP_HAVE_PTHREAD)
+        pthread_mutex_destroy(&pool->lock);
+#endif
+        free(pool);
+    }
+}
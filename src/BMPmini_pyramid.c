@@ -0,0 +1,608 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_pyramid.c
+//
+// Multi-resolution tile cache over BMP files for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <assert.h>
+#if defined(BMP_HAVE_PTHREAD)
+  #include <pthread.h>
+#endif
+#if defined(BMP_HAVE_PWRITE)
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+#if defined(__APPLE__)
+  #define BMP_ST_MTIM st_mtimespec
+  #define BMP_ST_CTIM st_ctimespec
+#else
+  #define BMP_ST_MTIM st_mtim
+  #define BMP_ST_CTIM st_ctim
+#endif
+
+#define BMP_PYRAMID_MAX_LEVELS 32  // Enough to halve any int32_t size down to a tile
+#define BMP_PYRAMID_MIN_BUCKETS 64
+#define BMP_PYRAMID_MAX_BUCKETS (1U << 20)
+#define BMP_SIDECAR_MAGIC "BMPMPYR2"
+#define BMP_SIDECAR_ALIGN 4096U  // Tiles of the sidecar start on a page
+
+// A tile of a level, rows top to bottom without padding
+struct __tile {
+    struct __tile *hnext;        // Next tile of its hash bucket
+    struct __tile *prev, *next;  // Least recently used list, most recent first
+    int level;
+    int32_t tx, ty;
+    int32_t w, h;
+    size_t bytes;                // Size of 'pixels'
+    unsigned refs;               // Users of the tile, which cannot be evicted meanwhile
+    uint8_t pixels[FLEX_ARRAY];
+};
+
+// Start of a sidecar file, followed by a checksum per tile of the levels
+// above 0, 0 until it is stored, then by a slot per tile. Only read back by
+// the same machine, fields are in its byte order.
+struct __sidecar_header {
+    char magic[8];
+    uint64_t source_size;   // Identity, size and times of the source, a
+    uint64_t source_ino;    // sidecar is thrown away once any changes
+    int64_t source_mtime;
+    int64_t source_mtime_ns;
+    int64_t source_ctime;
+    int64_t source_ctime_ns;
+    int32_t width;
+    int32_t height;
+    int32_t tile;
+    int32_t bytes;          // Bytes per pixel
+};
+
+struct _BMPmini_pyramid {
+    FILE *imgfp;             // Source, read with pread from all threads
+    BMPmini_header header;
+    int32_t tile;
+    int bytes;               // Bytes per pixel
+    int levels;
+    int32_t width[BMP_PYRAMID_MAX_LEVELS];
+    int32_t height[BMP_PYRAMID_MAX_LEVELS];
+    int32_t tiles_x[BMP_PYRAMID_MAX_LEVELS];
+    int32_t tiles_y[BMP_PYRAMID_MAX_LEVELS];
+    uint64_t first_slot[BMP_PYRAMID_MAX_LEVELS];  // Sidecar slot of the first tile of each level
+
+#if defined(BMP_HAVE_PTHREAD)
+    pthread_mutex_t lock;    // Protects everything below
+#endif
+    size_t budget;           // Bytes of tiles kept once nobody uses them
+    size_t cached;
+    struct __tile **buckets;
+    size_t nbuckets;         // A power of 2
+    struct __tile *mru, *lru;
+
+    int side_fd;             // -1 without a sidecar
+    uint64_t *sums;          // Checksum per sidecar slot, 0 until the tile is in it
+    size_t nslots;
+    uint64_t slots_off;      // File offset of the first slot
+};
+
+static void __pyr_lock(BMPmini_pyramid *p)
+{
+#if defined(BMP_HAVE_PTHREAD)
+    pthread_mutex_lock(&p->lock);
+#else
+    (void) p;
+#endif
+}
+
+static void __pyr_unlock(BMPmini_pyramid *p)
+{
+#if defined(BMP_HAVE_PTHREAD)
+    pthread_mutex_unlock(&p->lock);
+#else
+    (void) p;
+#endif
+}
+
+//-------------------------------------
+// Cache, must be called with the lock held
+//-------------------------------------
+static size_t __bucket(BMPmini_pyramid *p, int level, int32_t tx, int32_t ty)
+{
+    uint32_t h = (uint32_t) level * 0x9E3779B1U ^ (uint32_t) tx * 0x85EBCA77U ^ (uint32_t) ty * 0xC2B2AE3DU;
+    return (h ^ h >> 15) & (p->nbuckets - 1);
+}
+
+static struct __tile *__lookup(BMPmini_pyramid *p, int level, int32_t tx, int32_t ty)
+{
+    struct __tile *t = p->buckets[__bucket(p, level, tx, ty)];
+    while (t && (t->level != level || t->tx != tx || t->ty != ty)) {
+        t = t->hnext;
+    }
+    return t;
+}
+
+static void __lru_unlink(BMPmini_pyramid *p, struct __tile *t)
+{
+    *(t->prev ? &t->prev->next : &p->mru) = t->next;
+    *(t->next ? &t->next->prev : &p->lru) = t->prev;
+}
+
+static void __lru_push(BMPmini_pyramid *p, struct __tile *t)
+{
+    t->prev = NULL;
+    t->next = p->mru;
+    *(p->mru ? &p->mru->prev : &p->lru) = t;
+    p->mru = t;
+}
+
+static void __remove(BMPmini_pyramid *p, struct __tile *t)
+{
+    struct __tile **link = &p->buckets[__bucket(p, t->level, t->tx, t->ty)];
+    while (*link != t) {
+        link = &(*link)->hnext;
+    }
+    *link = t->hnext;
+    __lru_unlink(p, t);
+    p->cached -= t->bytes;
+    free(t);
+}
+
+// Drops the least recently used tiles nobody uses until the budget is met
+static void __evict(BMPmini_pyramid *p)
+{
+    struct __tile *t = p->lru;
+    while (t && p->cached > p->budget) {
+        struct __tile *prev = t->prev;
+        if (t->refs == 0) {
+            __remove(p, t);
+        }
+        t = prev;
+    }
+}
+
+// Adds a new tile, or gives the same one added meanwhile by another thread
+static struct __tile *__insert(BMPmini_pyramid *p, struct __tile *t)
+{
+    struct __tile *old = __lookup(p, t->level, t->tx, t->ty);
+    if (old) {
+        free(t);
+        old->refs++;
+        return old;
+    }
+    size_t b = __bucket(p, t->level, t->tx, t->ty);
+    t->hnext = p->buckets[b];
+    p->buckets[b] = t;
+    __lru_push(p, t);
+    t->refs = 1;
+    p->cached += t->bytes;
+    __evict(p);
+    return t;
+}
+
+static void __release(BMPmini_pyramid *p, struct __tile *t)
+{
+    __pyr_lock(p);
+    t->refs--;
+    __evict(p);
+    __pyr_unlock(p);
+}
+
+//-------------------------------------
+// Sidecar
+//-------------------------------------
+#if defined(BMP_HAVE_PWRITE)
+static size_t __slot_size(BMPmini_pyramid *p)
+{
+    return (size_t) p->tile * (size_t) p->tile * (size_t) p->bytes;
+}
+
+static uint64_t __slot(BMPmini_pyramid *p, struct __tile *t)
+{
+    return p->first_slot[t->level] + (uint64_t) t->ty * (uint64_t) p->tiles_x[t->level] + (uint64_t) t->tx;
+}
+
+// Content hash of the pixels of a tile, never 0 which stands for no tile
+static uint64_t __checksum(BMPmini_pyramid *p, struct __tile *t)
+{
+    BMPmini_view view = {t->pixels, (ptrdiff_t) t->w * p->bytes, t->w, t->h, p->header.bitsperpixel};
+    uint64_t sum = 0;
+    BMPmini_hash_view(&view, &sum);
+    return sum ? sum : 1;
+}
+
+static uint64_t __stored(BMPmini_pyramid *p, uint64_t slot)
+{
+    __pyr_lock(p);
+    uint64_t sum = p->sums[slot];
+    __pyr_unlock(p);
+    return sum;
+}
+
+// Reads a stored tile back. The file has no ordering between the slot and
+// its checksum after a crash, a tile not matching its checksum is made again.
+static bool __sidecar_read(BMPmini_pyramid *p, struct __tile *t)
+{
+    uint64_t sum;
+    if (p->side_fd < 0 || t->level == 0 || !(sum = __stored(p, __slot(p, t)))) {
+        return false;
+    }
+    BMP_PHASE_START(tm);
+    off_t off = (off_t) (p->slots_off + __slot(p, t) * __slot_size(p));
+    if (pread(p->side_fd, t->pixels, t->bytes, off) != (ssize_t) t->bytes || __checksum(p, t) != sum) {
+        return false;
+    }
+    BMP_PHASE_STOP(tm, BMPmini_PHASE_READ, t->bytes);
+    return true;
+}
+
+// Stores a tile, then its checksum so that it is read back only once written
+static void __sidecar_write(BMPmini_pyramid *p, struct __tile *t)
+{
+    if (p->side_fd < 0 || t->level == 0) {
+        return;
+    }
+    BMP_PHASE_START(tm);
+    uint64_t slot = __slot(p, t), sum = __checksum(p, t);
+    off_t off = (off_t) (p->slots_off + slot * __slot_size(p));
+    if (pwrite(p->side_fd, t->pixels, t->bytes, off) != (ssize_t) t->bytes) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[WARN]: pwrite", 1);
+        return;
+    }
+    __pyr_lock(p);
+    p->sums[slot] = sum;
+    off = (off_t) (sizeof(struct __sidecar_header) + slot * sizeof(sum));
+    if (pwrite(p->side_fd, &p->sums[slot], sizeof(sum), off) != (ssize_t) sizeof(sum)) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[WARN]: pwrite", 1);
+    }
+    __pyr_unlock(p);
+    BMP_PHASE_STOP(tm, BMPmini_PHASE_WRITE, t->bytes);
+}
+
+// Opens the sidecar, starting it over unless it was made from this source.
+// A pyramid works without it, failures are only warnings.
+static void __sidecar_open(BMPmini_pyramid *p, const char *restrict sidecar)
+{
+    /* Level 0 is never stored, its tiles are read from the source */
+    struct stat st;
+    uint64_t nslots = p->first_slot[p->levels - 1] + (uint64_t) p->tiles_x[p->levels - 1] * p->tiles_y[p->levels - 1];
+    if (p->levels < 2 || nslots >= SIZE_MAX / sizeof(uint64_t) || fstat(fileno(p->imgfp), &st) == -1) {
+        return;
+    }
+
+    struct __sidecar_header hdr, old;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BMP_SIDECAR_MAGIC, sizeof(hdr.magic));
+    hdr.source_size = (uint64_t) st.st_size;
+    hdr.source_ino = (uint64_t) st.st_ino;
+    hdr.source_mtime = (int64_t) st.BMP_ST_MTIM.tv_sec;
+    hdr.source_mtime_ns = (int64_t) st.BMP_ST_MTIM.tv_nsec;
+    hdr.source_ctime = (int64_t) st.BMP_ST_CTIM.tv_sec;
+    hdr.source_ctime_ns = (int64_t) st.BMP_ST_CTIM.tv_nsec;
+    hdr.width = p->width[0];
+    hdr.height = p->height[0];
+    hdr.tile = p->tile;
+    hdr.bytes = p->bytes;
+
+    p->nslots = (size_t) nslots;
+    size_t sums_bytes = p->nslots * sizeof(*p->sums);
+    p->slots_off = (sizeof(hdr) + sums_bytes + BMP_SIDECAR_ALIGN - 1) / BMP_SIDECAR_ALIGN * BMP_SIDECAR_ALIGN;
+    p->sums = calloc(p->nslots, sizeof(*p->sums));
+    if (!p->sums) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[WARN]: malloc", 1);
+        return;
+    }
+    int fd = open(sidecar, O_RDWR | O_CREAT, 0666);
+    if (fd == -1) {
+        BMPmini_PERROR(__func__, BMPmini_FOPEN_ERR, "[WARN]: open", 1);
+        goto CLEANUP_SO1;
+    }
+
+    if (pread(fd, &old, sizeof(old), 0) == (ssize_t) sizeof(old) && !memcmp(&old, &hdr, sizeof(hdr))
+        && pread(fd, p->sums, sums_bytes, sizeof(hdr)) == (ssize_t) sums_bytes) {
+        p->side_fd = fd;
+        return;
+    }
+    /* Slots are left as holes until their tile is stored */
+    memset(p->sums, 0, sums_bytes);
+    if (ftruncate(fd, 0) || ftruncate(fd, (off_t) (p->slots_off + nslots * __slot_size(p)))
+        || pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t) sizeof(hdr)) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[WARN]: sidecar", 1);
+        close(fd);
+        goto CLEANUP_SO1;
+    }
+    p->side_fd = fd;
+    return;
+CLEANUP_SO1:
+    free(p->sums);
+    p->sums = NULL;
+}
+#else
+static bool __sidecar_read(BMPmini_pyramid *p, struct __tile *t)
+{
+    (void) p;
+    (void) t;
+    return false;
+}
+
+static void __sidecar_write(BMPmini_pyramid *p, struct __tile *t)
+{
+    (void) p;
+    (void) t;
+}
+#endif
+
+//-------------------------------------
+// Tiles
+//-------------------------------------
+// Halves the size of 'src', each pixel the mean of 2x2 pixels. Odd sizes
+// only happen on the right and bottom edges of a level, whose last pixels
+// are then counted twice.
+static void __halve(const uint8_t *src, int32_t w, int32_t h, uint8_t *dst, size_t dst_stride, int bytes)
+{
+    size_t stride = (size_t) w * (size_t) bytes;
+    for (int32_t i = 0; i < h; i += 2, dst += dst_stride) {
+        const uint8_t *r0 = src + (size_t) i * stride;
+        const uint8_t *r1 = i + 1 < h ? r0 + stride : r0;
+        uint8_t *out = dst;
+        for (int32_t j = 0; j < w; j += 2, out += bytes) {
+            size_t c0 = (size_t) j * (size_t) bytes;
+            size_t c1 = j + 1 < w ? c0 + (size_t) bytes : c0;
+            for (int c = 0; c < bytes; c++) {
+                out[c] = (uint8_t) ((r0[c0 + c] + r0[c1 + c] + r1[c0 + c] + r1[c1 + c] + 2) >> 2);
+            }
+        }
+    }
+}
+
+static int __get_tile(BMPmini_pyramid *p, int level, int32_t tx, int32_t ty, struct __tile **out);
+
+// Computes the pixels of a tile: rows of the source at level 0, the four
+// tiles below it halved otherwise
+static int __make_tile(BMPmini_pyramid *p, struct __tile *t)
+{
+    if (t->level == 0) {
+        BMPmini_view view = {t->pixels, (ptrdiff_t) t->w * p->bytes, t->w, t->h, p->header.bitsperpixel};
+        return __read_region_into(p->imgfp, &p->header, t->tx * p->tile, t->ty * p->tile, &view, 0);
+    }
+    if (__sidecar_read(p, t)) {
+        return BMPmini_SUCCESS;
+    }
+
+    int below = t->level - 1;
+    size_t stride = (size_t) t->w * (size_t) p->bytes;
+    for (int32_t cy = 2 * t->ty; cy <= 2 * t->ty + 1 && cy < p->tiles_y[below]; cy++) {
+        for (int32_t cx = 2 * t->tx; cx <= 2 * t->tx + 1 && cx < p->tiles_x[below]; cx++) {
+            struct __tile *child;
+            int res = __get_tile(p, below, cx, cy, &child);
+            if (res != BMPmini_SUCCESS) {
+                return res;
+            }
+            /* Each child gives a quarter of the tile */
+            size_t y = (size_t) (cy - 2 * t->ty) * (size_t) (p->tile / 2);
+            size_t x = (size_t) (cx - 2 * t->tx) * (size_t) (p->tile / 2);
+            __halve(child->pixels, child->w, child->h, t->pixels + y * stride + x * p->bytes, stride, p->bytes);
+            __release(p, child);
+        }
+    }
+    __sidecar_write(p, t);
+    return BMPmini_SUCCESS;
+}
+
+// Gives a tile that cannot be evicted until released
+static int __get_tile(BMPmini_pyramid *p, int level, int32_t tx, int32_t ty, struct __tile **out)
+{
+    __pyr_lock(p);
+    struct __tile *t = __lookup(p, level, tx, ty);
+    if (t) {
+        t->refs++;
+        __lru_unlink(p, t);
+        __lru_push(p, t);
+        __pyr_unlock(p);
+        *out = t;
+        return BMPmini_SUCCESS;
+    }
+    __pyr_unlock(p);
+
+    /* Made without the lock, other tiles are served meanwhile */
+    int32_t w = p->width[level] - tx * p->tile;
+    int32_t h = p->height[level] - ty * p->tile;
+    w = w < p->tile ? w : p->tile;
+    h = h < p->tile ? h : p->tile;
+    size_t bytes = (size_t) w * (size_t) h * (size_t) p->bytes;
+    BMP_PHASE_START(tm);
+    t = malloc(sizeof(*t) + bytes);
+    BMP_PHASE_STOP(tm, BMPmini_PHASE_ALLOC, sizeof(*t) + bytes);
+    if (!t) {
+        return BMPmini_NOMEM_ERR;
+    }
+    t->level = level;
+    t->tx = tx;
+    t->ty = ty;
+    t->w = w;
+    t->h = h;
+    t->bytes = bytes;
+    int res = __make_tile(p, t);
+    if (res != BMPmini_SUCCESS) {
+        free(t);
+        return res;
+    }
+
+    __pyr_lock(p);
+    *out = __insert(p, t);
+    __pyr_unlock(p);
+    return BMPmini_SUCCESS;
+}
+
+//-------------------------------------
+// Interface
+//-------------------------------------
+BMPmini_pyramid *BMPmini_pyramid_open(const char *restrict filename, int32_t tile_size, size_t budget,
+                                      const char *restrict sidecar)
+{
+    assert(tile_size > 0 && tile_size % 2 == 0);
+
+    BMPmini_pyramid *p = calloc(1, sizeof(*p));
+    if (!p) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        return NULL;
+    }
+    p->side_fd = -1;
+    p->imgfp = __open_file(filename, "rb");
+    if (!p->imgfp) {
+        BMPmini_PERROR(__func__, BMPmini_FOPEN_ERR, "[ERROR]: fopen", 1);
+        free(p);
+        return NULL;
+    }
+
+    unsigned char hdrbytes[BMP_HEADER_SIZE];
+    if (fread(hdrbytes, BMP_HEADER_SIZE, 1, p->imgfp) != 1) {
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[ERROR]: fread", 1);
+        goto CLEANUP_PO1;
+    }
+    __parse_bytes2hdr(&p->header, hdrbytes);
+    if (!BMPmini_check_header(&p->header, p->imgfp)) {
+        BMPmini_PERROR(__func__, BMPmini_HEADER_ERR, "[ERROR]: invalid BMP header", 0);
+        goto CLEANUP_PO1;
+    }
+    if (__is_rle(&p->header) || (p->header.bitsperpixel != 24 && p->header.bitsperpixel != 32)) {
+        BMPmini_PERROR(__func__, BMPmini_FORMAT_ERR, "[ERROR]: only 24 and 32 bpp images can be tiled\n", 0);
+        goto CLEANUP_PO1;
+    }
+
+    /* Each level halves the one below, up to a level of a single tile */
+    p->tile = tile_size;
+    p->bytes = p->header.bitsperpixel / BMP_BITS_PER_BYTE;
+    int32_t w = p->header.width_px;
+    int32_t h = (int32_t) __get_abs_height(&p->header);
+    for (int level = 0;; level++) {
+        p->width[level] = w;
+        p->height[level] = h;
+        p->tiles_x[level] = w / tile_size + (w % tile_size != 0);
+        p->tiles_y[level] = h / tile_size + (h % tile_size != 0);
+        p->first_slot[level] = level < 2 ? 0 : p->first_slot[level - 1]
+                               + (uint64_t) p->tiles_x[level - 1] * (uint64_t) p->tiles_y[level - 1];
+        if (w <= tile_size && h <= tile_size) {
+            p->levels = level + 1;
+            break;
+        }
+        w = w / 2 + w % 2;
+        h = h / 2 + h % 2;
+    }
+
+    /* About two buckets per tile the budget holds */
+    size_t tiles = budget / ((size_t) tile_size * (size_t) tile_size * (size_t) p->bytes);
+    p->nbuckets = BMP_PYRAMID_MIN_BUCKETS;
+    while (p->nbuckets < BMP_PYRAMID_MAX_BUCKETS && p->nbuckets < 2 * tiles) {
+        p->nbuckets *= 2;
+    }
+    p->buckets = calloc(p->nbuckets, sizeof(*p->buckets));
+    if (!p->buckets) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        goto CLEANUP_PO1;
+    }
+#if defined(BMP_HAVE_PTHREAD)
+    if (pthread_mutex_init(&p->lock, NULL)) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: pthread_mutex_init failed", 0);
+        free(p->buckets);
+        goto CLEANUP_PO1;
+    }
+#endif
+    p->budget = budget;
+
+#if defined(BMP_HAVE_PWRITE)
+    if (sidecar) {
+        __sidecar_open(p, sidecar);
+    }
+#else
+    (void) sidecar;
+#endif
+    return p;
+CLEANUP_PO1:
+    __close_file(p->imgfp);
+    free(p);
+    return NULL;
+}
+
+int BMPmini_pyramid_levels(BMPmini_pyramid *p)
+{
+    assert(p);
+    return p->levels;
+}
+
+bool BMPmini_pyramid_size(BMPmini_pyramid *p, int level, int32_t *width, int32_t *height)
+{
+    assert(p && width && height);
+    if (level < 0 || level >= p->levels) {
+        return false;
+    }
+    *width = p->width[level];
+    *height = p->height[level];
+    return true;
+}
+
+int BMPmini_pyramid_tile(BMPmini_pyramid *p, int level, int32_t tx, int32_t ty, void *buf, size_t bufsize,
+                         size_t stride, BMPmini_view *view)
+{
+    assert(p && (buf || bufsize == 0));
+
+    if (level < 0 || level >= p->levels || tx < 0 || ty < 0 || tx >= p->tiles_x[level] || ty >= p->tiles_y[level]) {
+        return BMPmini_RANGE_ERR;
+    }
+    int32_t w = p->width[level] - tx * p->tile;
+    int32_t h = p->height[level] - ty * p->tile;
+    w = w < p->tile ? w : p->tile;
+    h = h < p->tile ? h : p->tile;
+    size_t row_bytes = (size_t) w * (size_t) p->bytes;
+    if (stride == 0) {
+        stride = row_bytes;
+    }
+    /* The last row only needs 'row_bytes' */
+    if (stride < row_bytes || stride > PTRDIFF_MAX || bufsize < row_bytes
+        || (bufsize - row_bytes) / stride < (size_t) h - 1) {
+        return BMPmini_BUFFER_ERR;
+    }
+
+    struct __tile *t;
+    int res = __get_tile(p, level, tx, ty, &t);
+    if (res != BMPmini_SUCCESS) {
+        return res;
+    }
+    BMP_PHASE_START(tm);
+    uint8_t *dst = buf;
+    for (int32_t i = 0; i < h; i++) {
+        memcpy(dst + (size_t) i * stride, t->pixels + (size_t) i * row_bytes, row_bytes);
+    }
+    BMP_PHASE_STOP(tm, BMPmini_PHASE_COPY, row_bytes * (size_t) h);
+    __release(p, t);
+
+    if (view) {
+        view->base = buf;
+        view->stride = (ptrdiff_t) stride;
+        view->width = w;
+        view->height = h;
+        view->bitsperpixel = p->header.bitsperpixel;
+    }
+    return BMPmini_SUCCESS;
+}
+
+void BMPmini_pyramid_close(BMPmini_pyramid *p)
+{
+    if (!p) {
+        return;
+    }
+    while (p->mru) {
+        assert(p->mru->refs == 0);
+        __remove(p, p->mru);
+    }
+#if defined(BMP_HAVE_PWRITE)
+    if (p->side_fd >= 0 && close(p->side_fd)) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[WARN]: close", 1);
+    }
+    free(p->sums);
+#endif
+#if defined(BMP_HAVE_PTHREAD)
+    pthread_mutex_destroy(&p->lock);
+#endif
+    __close_file(p->imgfp);
+    free(p->buckets);
+    free(p);
+}
@@ -0,0 +1,498 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_resize.c
+//
+// Resizing of BMP images for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#if defined(BMP_HAVE_X86_SIMD)
+  #include <immintrin.h>
+#endif
+#if defined(BMP_HAVE_NEON)
+  #include <arm_neon.h>
+#endif
+
+// Weights are fixed point numbers with BMP_WEIGHT_BITS fractional bits, small
+// enough for 16-bit multiplications. All kernels share the rounding, so they
+// give the same result.
+#define BMP_WEIGHT_BITS  14
+#define BMP_WEIGHT_ONE   (1 << BMP_WEIGHT_BITS)
+#define BMP_WEIGHT_ROUND (1 << (BMP_WEIGHT_BITS - 1))
+
+#define BMP_LANCZOS_LOBES 3.0
+#define BMP_PI 3.14159265358979323846
+
+#define BMP_CHANNELS 3  // BGR
+
+static inline uint8_t __clamp_u8(int32_t v)
+{
+    v >>= BMP_WEIGHT_BITS;
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t) v;
+}
+
+//-------------------------------------
+// Filters
+//-------------------------------------
+static double __triangle(double x)
+{
+    x = fabs(x);
+    return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+static double __sinc(double x)
+{
+    if (x == 0.0) {
+        return 1.0;
+    }
+    x *= BMP_PI;
+    return sin(x) / x;
+}
+
+static double __lanczos(double x)
+{
+    return fabs(x) < BMP_LANCZOS_LOBES ? __sinc(x) * __sinc(x / BMP_LANCZOS_LOBES) : 0.0;
+}
+
+// Fills the weights of output pixel 'i', returns how many there are
+static int __filter_weights(int filter, int32_t i, double scale, int32_t src_n, int32_t *start, double *w, int max)
+{
+    double center = (i + 0.5) * scale;
+    int32_t first, last;
+
+    if (filter == BMPmini_FILTER_BOX) {
+        /* Exact area of each source pixel under the output pixel */
+        double lo = i * scale, hi = (i + 1) * scale;
+        first = (int32_t) floor(lo);
+        last = (int32_t) ceil(hi);
+        if (last > src_n) {
+            last = src_n;
+        }
+        for (int32_t j = first; j < last; j++) {
+            double a = j < lo ? lo : j, b = j + 1 > hi ? hi : j + 1;
+            w[j - first] = b > a ? b - a : 0.0;
+        }
+    }
+    else {
+        /* Filters are stretched when downscaling, to cover every source pixel */
+        double fscale = scale > 1.0 ? scale : 1.0;
+        double support = (filter == BMPmini_FILTER_LANCZOS ? BMP_LANCZOS_LOBES : 1.0) * fscale;
+        first = (int32_t) floor(center - support);
+        last = (int32_t) ceil(center + support);
+        if (first < 0) {
+            first = 0;
+        }
+        if (last > src_n) {
+            last = src_n;
+        }
+        for (int32_t j = first; j < last; j++) {
+            double x = (j + 0.5 - center) / fscale;
+            w[j - first] = filter == BMPmini_FILTER_LANCZOS ? __lanczos(x) : __triangle(x);
+        }
+    }
+
+    assert(last - first <= max);
+    (void) max;
+    *start = first;
+    return last - first;
+}
+
+bool __compute_coeffs(struct __coeffs *c, int filter, int32_t src_n, int32_t dst_n)
+{
+    double scale = (double) src_n / dst_n;
+    double fscale = scale > 1.0 ? scale : 1.0;
+    double support = (filter == BMPmini_FILTER_LANCZOS ? BMP_LANCZOS_LOBES : 1.0) * fscale;
+    int max = (int) ceil(2.0 * support) + 2;
+
+    double *w = malloc(max * sizeof(*w));
+    c->ksize = (max + 3) & ~3;
+    c->start = malloc(dst_n * sizeof(*c->start));
+    c->weights = calloc((size_t) dst_n * c->ksize, sizeof(*c->weights));
+    if (!w || !c->start || !c->weights) {
+        free(w);
+        free(c->start);
+        free(c->weights);
+        return false;
+    }
+
+    for (int32_t i = 0; i < dst_n; i++) {
+        int32_t start;
+        int n = __filter_weights(filter, i, scale, src_n, &start, w, max);
+
+        double sum = 0.0;
+        for (int t = 0; t < n; t++) {
+            sum += w[t];
+        }
+
+        /* Slide the window back from the end, so that all 'ksize' taps are
+         * inside the source whenever it is wide enough */
+        int shift = 0;
+        if (start + c->ksize > src_n && src_n >= c->ksize) {
+            shift = start + c->ksize - src_n;
+        }
+
+        /* Fixed point weights adding up to exactly one, the rounding error
+         * going to the largest one */
+        int16_t *iw = c->weights + (size_t) i * c->ksize + shift;
+        int32_t isum = 0;
+        int peak = 0;
+        for (int t = 0; t < n; t++) {
+            iw[t] = (int16_t) lrint(w[t] / sum * BMP_WEIGHT_ONE);
+            isum += iw[t];
+            peak = iw[t] > iw[peak] ? t : peak;
+        }
+        iw[peak] += BMP_WEIGHT_ONE - isum;
+        c->start[i] = start - shift;
+    }
+
+    free(w);
+    return true;
+}
+
+void __free_coeffs(struct __coeffs *c)
+{
+    free(c->start);
+    free(c->weights);
+}
+
+//-------------------------------------
+// Scalar kernels, the reference for all the others
+//-------------------------------------
+static void __vpass_c(const uint8_t *const *rows, const int16_t *weights, int ksize, uint8_t *dst, size_t k, size_t n)
+{
+    for (; k < n; k++) {
+        int32_t acc = BMP_WEIGHT_ROUND;
+        for (int t = 0; t < ksize; t++) {
+            acc += weights[t] * rows[t][k];
+        }
+        dst[k] = __clamp_u8(acc);
+    }
+}
+
+// Output pixel 'j', taps past the end of the source row are skipped
+static inline void __hpixel_c(const uint8_t *src, size_t src_bytes, const struct __coeffs *c, uint8_t *dst, int32_t j)
+{
+    const int16_t *w = c->weights + (size_t) j * c->ksize;
+    const uint8_t *px = src + (size_t) c->start[j] * BMP_CHANNELS;
+    size_t taps = (src_bytes - (size_t) c->start[j] * BMP_CHANNELS) / BMP_CHANNELS;
+    if (taps > (size_t) c->ksize) {
+        taps = (size_t) c->ksize;
+    }
+
+    int32_t b = BMP_WEIGHT_ROUND, g = BMP_WEIGHT_ROUND, r = BMP_WEIGHT_ROUND;
+    for (size_t t = 0; t < taps; t++, px += BMP_CHANNELS) {
+        b += w[t] * px[0];
+        g += w[t] * px[1];
+        r += w[t] * px[2];
+    }
+    dst[0] = __clamp_u8(b);
+    dst[1] = __clamp_u8(g);
+    dst[2] = __clamp_u8(r);
+}
+
+static void __hpass_c(const uint8_t *src, size_t src_bytes, const struct __coeffs *c, uint8_t *dst, int32_t n)
+{
+    for (int32_t j = 0; j < n; j++, dst += BMP_CHANNELS) {
+        __hpixel_c(src, src_bytes, c, dst, j);
+    }
+}
+
+//-------------------------------------
+// x86 kernels
+//-------------------------------------
+// Vertical passes interleave two source rows so that a single madd applies
+// a pair of weights. Horizontal passes load 4 pixels (12 bytes) with a 16
+// byte load, pixels too close to the end of the row go scalar.
+#if defined(BMP_HAVE_X86_SIMD)
+#define BMP_SSSE3 __attribute__((target("ssse3")))
+#define BMP_AVX2  __attribute__((target("avx2")))
+
+static inline int32_t __weight_pair(const int16_t *w)
+{
+    return (int32_t) ((uint32_t) (uint16_t) w[0] | (uint32_t) (uint16_t) w[1] << 16);
+}
+
+BMP_SSSE3 static void __vpass_ssse3(const uint8_t *const *rows, const int16_t *weights, int ksize, uint8_t *dst, size_t k, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    for (; k + 16 <= n; k += 16) {
+        __m128i a0 = _mm_set1_epi32(BMP_WEIGHT_ROUND), a1 = a0, a2 = a0, a3 = a0;
+        for (int t = 0; t < ksize; t += 2) {
+            __m128i r0 = _mm_loadu_si128((const __m128i *) (rows[t] + k));
+            __m128i r1 = _mm_loadu_si128((const __m128i *) (rows[t + 1] + k));
+            __m128i w = _mm_set1_epi32(__weight_pair(weights + t));
+            __m128i lo = _mm_unpacklo_epi8(r0, r1);
+            __m128i hi = _mm_unpackhi_epi8(r0, r1);
+            a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+            a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+            a2 = _mm_add_epi32(a2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+            a3 = _mm_add_epi32(a3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+        }
+        __m128i p0 = _mm_packs_epi32(_mm_srai_epi32(a0, BMP_WEIGHT_BITS), _mm_srai_epi32(a1, BMP_WEIGHT_BITS));
+        __m128i p1 = _mm_packs_epi32(_mm_srai_epi32(a2, BMP_WEIGHT_BITS), _mm_srai_epi32(a3, BMP_WEIGHT_BITS));
+        _mm_storeu_si128((__m128i *) (dst + k), _mm_packus_epi16(p0, p1));
+    }
+    __vpass_c(rows, weights, ksize, dst, k, n);
+}
+
+BMP_AVX2 static void __vpass_avx2(const uint8_t *const *rows, const int16_t *weights, int ksize, uint8_t *dst, size_t k, size_t n)
+{
+    /* Unpacking and packing both work within 128-bit lanes, so bytes end up in order */
+    const __m256i zero = _mm256_setzero_si256();
+    for (; k + 32 <= n; k += 32) {
+        __m256i a0 = _mm256_set1_epi32(BMP_WEIGHT_ROUND), a1 = a0, a2 = a0, a3 = a0;
+        for (int t = 0; t < ksize; t += 2) {
+            __m256i r0 = _mm256_loadu_si256((const __m256i *) (rows[t] + k));
+            __m256i r1 = _mm256_loadu_si256((const __m256i *) (rows[t + 1] + k));
+            __m256i w = _mm256_set1_epi32(__weight_pair(weights + t));
+            __m256i lo = _mm256_unpacklo_epi8(r0, r1);
+            __m256i hi = _mm256_unpackhi_epi8(r0, r1);
+            a0 = _mm256_add_epi32(a0, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), w));
+            a1 = _mm256_add_epi32(a1, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), w));
+            a2 = _mm256_add_epi32(a2, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), w));
+            a3 = _mm256_add_epi32(a3, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), w));
+        }
+        __m256i p0 = _mm256_packs_epi32(_mm256_srai_epi32(a0, BMP_WEIGHT_BITS), _mm256_srai_epi32(a1, BMP_WEIGHT_BITS));
+        __m256i p1 = _mm256_packs_epi32(_mm256_srai_epi32(a2, BMP_WEIGHT_BITS), _mm256_srai_epi32(a3, BMP_WEIGHT_BITS));
+        _mm256_storeu_si256((__m256i *) (dst + k), _mm256_packus_epi16(p0, p1));
+    }
+    _mm256_zeroupper();
+    __vpass_ssse3(rows, weights, ksize, dst, k, n);
+}
+
+BMP_SSSE3 static void __hpass_ssse3(const uint8_t *src, size_t src_bytes, const struct __coeffs *c, uint8_t *dst, int32_t n)
+{
+    /* Pixels 0 and 1, then 2 and 3, as (B0 B1 G0 G1 R0 R1 0 0) words */
+    const __m128i shuf_lo = _mm_setr_epi8(0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1);
+    const __m128i shuf_hi = _mm_setr_epi8(6, -1, 9, -1, 7, -1, 10, -1, 8, -1, 11, -1, -1, -1, -1, -1);
+    for (int32_t j = 0; j < n; j++, dst += BMP_CHANNELS) {
+        size_t first = (size_t) c->start[j] * BMP_CHANNELS;
+        if (first + (size_t) c->ksize * BMP_CHANNELS + 4 > src_bytes) {
+            __hpixel_c(src, src_bytes, c, dst, j);
+            continue;
+        }
+
+        const int16_t *w = c->weights + (size_t) j * c->ksize;
+        const uint8_t *px = src + first;
+        __m128i acc = _mm_set1_epi32(BMP_WEIGHT_ROUND);
+        for (int t = 0; t < c->ksize; t += 4, px += 4 * BMP_CHANNELS) {
+            __m128i p = _mm_loadu_si128((const __m128i *) px);
+            __m128i w01 = _mm_set1_epi32(__weight_pair(w + t));
+            __m128i w23 = _mm_set1_epi32(__weight_pair(w + t + 2));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(p, shuf_lo), w01));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(p, shuf_hi), w23));
+        }
+        acc = _mm_srai_epi32(acc, BMP_WEIGHT_BITS);
+        acc = _mm_packus_epi16(_mm_packs_epi32(acc, acc), acc);
+        uint32_t bgr = (uint32_t) _mm_cvtsi128_si32(acc);
+        memcpy(dst, &bgr, BMP_CHANNELS);
+    }
+}
+#endif
+
+//-------------------------------------
+// ARM kernels
+//-------------------------------------
+#if defined(BMP_HAVE_NEON)
+static void __vpass_neon(const uint8_t *const *rows, const int16_t *weights, int ksize, uint8_t *dst, size_t k, size_t n)
+{
+    for (; k + 8 <= n; k += 8) {
+        int32x4_t lo = vdupq_n_s32(BMP_WEIGHT_ROUND), hi = lo;
+        for (int t = 0; t < ksize; t++) {
+            int16x8_t r = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(rows[t] + k)));
+            lo = vmlal_n_s16(lo, vget_low_s16(r), weights[t]);
+            hi = vmlal_n_s16(hi, vget_high_s16(r), weights[t]);
+        }
+        int16x8_t v = vcombine_s16(vshrn_n_s32(lo, BMP_WEIGHT_BITS), vshrn_n_s32(hi, BMP_WEIGHT_BITS));
+        vst1_u8(dst + k, vqmovun_s16(v));
+    }
+    __vpass_c(rows, weights, ksize, dst, k, n);
+}
+#endif
+
+//-------------------------------------
+// Passes
+//-------------------------------------
+void __resize_kernels(__vpass_fn *vpass, __hpass_fn *hpass)
+{
+    unsigned caps = __simd_caps();
+    *vpass = __vpass_c;
+    *hpass = __hpass_c;
+#if defined(BMP_HAVE_X86_SIMD)
+    if (caps & BMP_SIMD_SSSE3) {
+        *vpass = caps & BMP_SIMD_AVX2 ? __vpass_avx2 : __vpass_ssse3;
+        *hpass = __hpass_ssse3;
+    }
+#endif
+#if defined(BMP_HAVE_NEON)
+    if (caps & BMP_SIMD_NEON) {
+        *vpass = __vpass_neon;
+    }
+#endif
+    (void) caps;
+}
+
+struct __resize_job {
+    const BMPmini_view *src;
+    const BMPmini_view *dst;
+    const struct __coeffs *c;
+    uint32_t padding;     // Bytes to be zeroed after each destination row
+    __vpass_fn vpass;
+    __hpass_fn hpass;
+    int status;           // First error of a band, set with __fail_status
+};
+
+static void __hpass_band(void *arg, int32_t first, int32_t last)
+{
+    struct __resize_job *job = arg;
+    size_t src_bytes = (size_t) job->src->width * BMP_CHANNELS;
+    size_t dst_bytes = (size_t) job->dst->width * BMP_CHANNELS;
+    for (int32_t i = first; i < last; i++) {
+        uint8_t *row = job->dst->base + i * job->dst->stride;
+        job->hpass(job->src->base + i * job->src->stride, src_bytes, job->c, row, job->dst->width);
+        memset(row + dst_bytes, 0, job->padding);
+    }
+}
+
+static void __vpass_band(void *arg, int32_t first, int32_t last)
+{
+    struct __resize_job *job = arg;
+    const struct __coeffs *c = job->c;
+    const uint8_t **rows = malloc(c->ksize * sizeof(*rows));
+    if (!rows) {
+        __fail_status(&job->status, BMPmini_NOMEM_ERR);
+        return;
+    }
+    size_t dst_bytes = (size_t) job->dst->width * BMP_CHANNELS;
+    for (int32_t i = first; i < last; i++) {
+        /* Taps past the last row have a zero weight, any row will do */
+        for (int t = 0; t < c->ksize; t++) {
+            int32_t y = c->start[i] + t < job->src->height ? c->start[i] + t : job->src->height - 1;
+            rows[t] = job->src->base + y * job->src->stride;
+        }
+        uint8_t *row = job->dst->base + i * job->dst->stride;
+        job->vpass(rows, c->weights + (size_t) i * c->ksize, c->ksize, row, 0, dst_bytes);
+        memset(row + dst_bytes, 0, job->padding);
+    }
+    free(rows);
+}
+
+static int __resize(const BMPmini_view *src, const BMPmini_view *dst, uint32_t padding, int filter, int nthreads)
+{
+    assert(src && dst && src->width > 0 && src->height > 0 && dst->width > 0 && dst->height > 0);
+
+    if (src->bitsperpixel != BMP_BITS_PER_PIXEL || dst->bitsperpixel != BMP_BITS_PER_PIXEL
+        || filter < BMPmini_FILTER_BOX || filter > BMPmini_FILTER_LANCZOS) {
+        return BMPmini_FORMAT_ERR;
+    }
+
+    __vpass_fn vpass;
+    __hpass_fn hpass;
+    __resize_kernels(&vpass, &hpass);
+
+    /* A dimension that does not change needs no pass, the filters are
+     * exact there: the horizontal pass writes straight to the destination
+     * and the vertical one reads straight from the source */
+    bool hpass_needed = src->width != dst->width;
+    bool vpass_needed = src->height != dst->height;
+    if (!hpass_needed && !vpass_needed) {
+        BMPmini_copy_view(src, dst, nthreads);
+        for (int32_t i = 0; i < dst->height && padding; i++) {
+            memset(dst->base + i * dst->stride + (size_t) dst->width * BMP_CHANNELS, 0, padding);
+        }
+        return BMPmini_SUCCESS;
+    }
+
+    struct __coeffs hc = {NULL, NULL, 0}, vc = {NULL, NULL, 0};
+    uint8_t *tmp = NULL;
+    int res = BMPmini_NOMEM_ERR;
+    if ((hpass_needed && !__compute_coeffs(&hc, filter, src->width, dst->width))
+        || (vpass_needed && !__compute_coeffs(&vc, filter, src->height, dst->height))) {
+        goto CLEANUP_RS1;
+    }
+
+    BMPmini_view mid = *dst;
+    if (hpass_needed && vpass_needed) {
+        mid.height = src->height;
+        mid.stride = (ptrdiff_t) dst->width * BMP_CHANNELS;
+        tmp = malloc((size_t) mid.stride * mid.height);
+        if (!tmp) {
+            goto CLEANUP_RS1;
+        }
+        mid.base = tmp;
+    }
+    else if (!hpass_needed) {
+        mid = *src;
+    }
+
+    if (hpass_needed) {
+        struct __resize_job job = {src, &mid, &hc, vpass_needed ? 0 : padding, vpass, hpass, BMPmini_SUCCESS};
+        __run_bands(mid.height, (size_t) src->width * BMP_CHANNELS, nthreads, __hpass_band, &job);
+    }
+    if (vpass_needed) {
+        struct __resize_job job = {&mid, dst, &vc, padding, vpass, hpass, BMPmini_SUCCESS};
+        __run_bands(dst->height, (size_t) dst->width * BMP_CHANNELS * vc.ksize, nthreads, __vpass_band, &job);
+        if (__get_status(&job.status) != BMPmini_SUCCESS) {
+            goto CLEANUP_RS1;
+        }
+    }
+    res = BMPmini_SUCCESS;
+CLEANUP_RS1:
+    free(tmp);
+    __free_coeffs(&hc);
+    __free_coeffs(&vc);
+    return res;
+}
+
+int BMPmini_resize_view(const BMPmini_view *src, const BMPmini_view *dst, int filter, int nthreads)
+{
+    return __resize(src, dst, 0, filter, nthreads);
+}
+
+BMPmini_image *BMPmini_resize(BMPmini_image *img, int32_t w, int32_t h, int filter)
+{
+    return BMPmini_resize_with(img, w, h, filter, NULL);
+}
+
+BMPmini_image *BMPmini_resize_with(BMPmini_image *img, int32_t w, int32_t h, int filter,
+                                   const BMPmini_allocator *allocator)
+{
+    assert(img && w > 0 && h > 0);
+
+    BMPmini_view src;
+    BMPmini_get_view(img, &src);
+    if (src.bitsperpixel != BMP_BITS_PER_PIXEL) {
+        BMPmini_PERROR(__func__, BMPmini_FORMAT_ERR, "[ERROR]: only 24 bpp images can be resized\n", 0);
+        return NULL;
+    }
+    if (filter < BMPmini_FILTER_BOX || filter > BMPmini_FILTER_LANCZOS) {
+        BMPmini_PERROR(__func__, BMPmini_FORMAT_ERR, "[ERROR]: unknown filter\n", 0);
+        return NULL;
+    }
+
+    /* Keep the row order of the source */
+    BMPmini_header header;
+    __init_header(&header, w, img->header.height_px < 0 ? -h : h, BMP_BITS_PER_PIXEL);
+    uint64_t imgsz = (__get_row_bytes(w, BMP_BITS_PER_PIXEL) + 3) & ~(uint64_t) 3;
+    if (imgsz * (uint64_t) h > UINT32_MAX - header.offset) {
+        BMPmini_PERROR(__func__, BMPmini_OVERFLOW_ERR, "[OVERFLOW]: BMP image size overflow encountered\n", 0);
+        return NULL;
+    }
+    BMPmini_image *newimg = __alloc_image(&header, header.image_size_bytes, allocator);
+    if (!newimg) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        return NULL;
+    }
+
+    BMPmini_view dst;
+    BMPmini_get_view(newimg, &dst);
+    int res = __resize(&src, &dst, __get_padding(&header), filter, 0);
+    if (res != BMPmini_SUCCESS) {
+        __perror_status(__func__, res);
+        __free_image(newimg);
+        return NULL;
+    }
+    return newimg;
+}
@@ -0,0 +1,381 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_rle.c
+//
+// RLE4 and RLE8 compression for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <assert.h>
+
+#define BMP_RLE_CHUNK   (16U * 1024U)  // Compressed bytes read from a file at once
+#define BMP_RLE_MAX_RUN 255U
+
+// Escapes, following a 0 count
+#define BMP_RLE_EOL   0  // End of line
+#define BMP_RLE_EOB   1  // End of bitmap
+#define BMP_RLE_DELTA 2  // Move right and up, by the next two bytes
+
+// Compressed input, read from a file a chunk at a time or all in memory
+struct __rle_src {
+    FILE *fp;             // NULL when the whole stream is in memory
+    const uint8_t *p;     // Next byte
+    const uint8_t *end;   // End of the bytes available
+    size_t left;          // Bytes of the stream still in the file
+    bool error;           // Reading from the file failed
+    uint8_t buf[BMP_RLE_CHUNK];
+};
+
+// Decoded output, rows stored Bottom-Up
+struct __rle_dst {
+    uint8_t *pixels;      // Bottom row
+    uint32_t row_size;    // Bytes per row, padding included
+    uint32_t width;
+    uint32_t height;
+    unsigned bpp;         // 4 or 8
+    uint32_t x;           // Next pixel of the current row
+    uint32_t y;           // Current row, from the bottom
+};
+
+// Makes 'n' bytes available, false if the stream ends before
+static bool __rle_need(struct __rle_src *src, size_t n)
+{
+    size_t avail = (size_t) (src->end - src->p);
+    if (avail >= n) {
+        return true;
+    }
+    if (!src->fp || src->left == 0) {
+        return false;
+    }
+
+    memmove(src->buf, src->p, avail);
+    size_t len = BMP_RLE_CHUNK - avail < src->left ? BMP_RLE_CHUNK - avail : src->left;
+    if (fread(src->buf + avail, len, 1, src->fp) != 1) {
+        src->error = true;
+        src->left = 0;
+        return false;
+    }
+    src->left -= len;
+    src->p = src->buf;
+    src->end = src->buf + avail + len;
+    return avail + len >= n;
+}
+
+static inline size_t __rle_byte(const struct __rle_dst *dst, uint32_t x)
+{
+    // First byte holding no pixel before 'x'
+    return ((size_t) x * dst->bpp + BMP_BITS_PER_BYTE - 1) / BMP_BITS_PER_BYTE;
+}
+
+// Skipped pixels get index 0. Nibbles are only ever or-ed into a byte whose
+// high nibble was just written, so the bytes they land in are cleared here.
+static void __rle_skip(struct __rle_dst *dst, uint32_t x)
+{
+    uint8_t *row = dst->pixels + (size_t) dst->y * dst->row_size;
+    size_t from = __rle_byte(dst, dst->x);
+    memset(row + from, 0, __rle_byte(dst, x) - from);
+    dst->x = x;
+}
+
+static void __rle_next_row(struct __rle_dst *dst)
+{
+    uint8_t *row = dst->pixels + (size_t) dst->y * dst->row_size;
+    size_t from = __rle_byte(dst, dst->x);
+    memset(row + from, 0, dst->row_size - from);
+    dst->x = 0;
+    dst->y++;
+}
+
+// Pixels alternate between the high and the low nibble of 'v' on RLE4
+static void __rle_fill(struct __rle_dst *dst, uint32_t n, uint8_t v)
+{
+    uint8_t *row = dst->pixels + (size_t) dst->y * dst->row_size;
+    if (n > dst->width - dst->x) {
+        n = dst->width - dst->x;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    if (dst->bpp == 8) {
+        memset(row + dst->x, v, n);
+        dst->x += n;
+        return;
+    }
+
+    uint32_t x = dst->x;
+    if (x & 1U) {
+        row[x / 2] |= v >> 4;
+        x++;
+        n--;
+        v = (uint8_t) (v << 4 | v >> 4);
+    }
+    memset(row + x / 2, v, n / 2);
+    if (n & 1U) {
+        row[(x + n) / 2] = v & 0xF0;
+    }
+    dst->x = x + n;
+}
+
+// 'data' holds 'n' packed pixels
+static void __rle_copy(struct __rle_dst *dst, const uint8_t *data, uint32_t n)
+{
+    uint8_t *row = dst->pixels + (size_t) dst->y * dst->row_size;
+    if (n > dst->width - dst->x) {
+        n = dst->width - dst->x;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    if (dst->bpp == 8) {
+        memcpy(row + dst->x, data, n);
+        dst->x += n;
+        return;
+    }
+
+    uint32_t x = dst->x;
+    if (x & 1U) {
+        /* Every pixel moves down a nibble */
+        uint8_t *out = row + x / 2;
+        *out |= data[0] >> 4;
+        for (uint32_t k = 1; k < n; k += 2) {
+            uint8_t hi = (uint8_t) (data[(k - 1) / 2] << 4);
+            *++out = k + 1 < n ? (uint8_t) (hi | data[(k + 1) / 2] >> 4) : hi;
+        }
+    }
+    else {
+        memcpy(row + x / 2, data, n / 2);
+        if (n & 1U) {
+            row[(x + n) / 2] = data[n / 2] & 0xF0;
+        }
+    }
+    dst->x = x + n;
+}
+
+int __rle_decode(FILE *fp, const uint8_t *data, size_t len, BMPmini_header *header, uint8_t *pixels)
+{
+    assert(header->bitsperpixel == 4 || header->bitsperpixel == 8);
+
+    struct __rle_src *src = malloc(sizeof(*src));
+    if (!src) {
+        return BMPmini_NOMEM_ERR;
+    }
+    src->fp = fp;
+    src->p = fp ? src->buf : data;
+    src->end = fp ? src->buf : data + len;
+    src->left = fp ? len : 0;
+    src->error = false;
+
+    struct __rle_dst dst = {pixels, __get_image_row_size_bytes(header), (uint32_t) header->width_px,
+                            __get_abs_height(header), header->bitsperpixel, 0, 0};
+
+    /* A stream ending early, with or without an end of bitmap, leaves the
+     * remaining pixels at index 0. So do pixels past the end of a row. */
+    while (dst.y < dst.height && __rle_need(src, 2)) {
+        uint8_t count = src->p[0];
+        uint8_t v = src->p[1];
+        src->p += 2;
+        if (count) {
+            __rle_fill(&dst, count, v);
+            continue;
+        }
+
+        if (v == BMP_RLE_EOL) {
+            __rle_next_row(&dst);
+        }
+        else if (v == BMP_RLE_EOB) {
+            break;
+        }
+        else if (v == BMP_RLE_DELTA) {
+            if (!__rle_need(src, 2)) {
+                break;
+            }
+            uint32_t x = dst.x + src->p[0];
+            uint32_t dy = src->p[1];
+            src->p += 2;
+            for (; dy && dst.y < dst.height; dy--) {
+                __rle_next_row(&dst);
+            }
+            if (dst.y < dst.height) {
+                __rle_skip(&dst, x < dst.width ? x : dst.width);
+            }
+        }
+        else {
+            /* Absolute run, padded to a 16-bit boundary */
+            size_t nbytes = ((size_t) v * dst.bpp + BMP_BITS_PER_BYTE - 1) / BMP_BITS_PER_BYTE;
+            size_t padded = (nbytes + 1) & ~(size_t) 1;
+            if (!__rle_need(src, padded)) {
+                break;
+            }
+            __rle_copy(&dst, src->p, v);
+            src->p += padded;
+        }
+    }
+
+    while (dst.y < dst.height) {
+        __rle_next_row(&dst);
+    }
+
+    int res = src->error ? BMPmini_FREAD_ERR : BMPmini_SUCCESS;
+    free(src);
+    return res;
+}
+
+void __rle_decoded_header(BMPmini_header *header)
+{
+    header->compression = BMP_COMPRESSION;
+    header->image_size_bytes = __get_image_size_bytes(header);
+    header->size = header->offset + header->image_size_bytes;
+}
+
+int __rle_decode_image(BMPmini_header *header, const uint8_t *data, BMPmini_image **out,
+                       const BMPmini_allocator *allocator)
+{
+    *out = NULL;
+    BMPmini_header decoded = *header;
+    __rle_decoded_header(&decoded);
+
+    uint32_t extra = decoded.offset - BMP_HEADER_SIZE;
+    if (__st_overflow(decoded.image_size_bytes, extra)) {
+        return BMPmini_OVERFLOW_ERR;
+    }
+    BMPmini_image *img = __alloc_image(&decoded, decoded.image_size_bytes + extra, allocator);
+    if (!img) {
+        return BMPmini_NOMEM_ERR;
+    }
+
+    memcpy(img->data, data, extra);
+    int res = __rle_decode(NULL, data + extra, header->image_size_bytes, &decoded, BMPmini_pixels(img));
+    if (res != BMPmini_SUCCESS) {
+        __free_image(img);
+        return res;
+    }
+    *out = img;
+    return BMPmini_SUCCESS;
+}
+
+//-------------------------------------
+// Encoder
+//-------------------------------------
+static inline uint8_t __rle_pixel(const uint8_t *row, uint32_t x, unsigned bpp)
+{
+    if (bpp == 8) {
+        return row[x];
+    }
+    return (row[x / 2] >> (x & 1U ? 0 : 4)) & 0x0F;
+}
+
+// Length of the run starting at 'x': equal pixels on RLE8, pixels equal to
+// those at 'x' and 'x + 1' alternately on RLE4
+static uint32_t __rle_run(const uint8_t *row, uint32_t x, uint32_t width, unsigned bpp)
+{
+    uint32_t max = width - x < BMP_RLE_MAX_RUN ? width - x : BMP_RLE_MAX_RUN;
+    uint32_t n = 1;
+    if (bpp == 8) {
+        while (n < max && row[x + n] == row[x]) {
+            n++;
+        }
+        return n;
+    }
+
+    uint8_t p[2] = {__rle_pixel(row, x, bpp), max > 1 ? __rle_pixel(row, x + 1, bpp) : 0};
+    n = max > 1 ? 2 : 1;
+    while (n < max && __rle_pixel(row, x + n, bpp) == p[n & 1U]) {
+        n++;
+    }
+    return n;
+}
+
+// Encodes a row, returns the number of bytes written to 'out'
+static size_t __rle_encode_row(const uint8_t *row, uint32_t width, unsigned bpp, uint8_t *out)
+{
+    /* Shorter runs cost more as a run than as absolute pixels */
+    uint32_t min_run = bpp == 8 ? 3 : 4;
+    uint8_t *o = out;
+    uint32_t x = 0;
+    while (x < width) {
+        uint32_t run = __rle_run(row, x, width, bpp);
+        if (run >= min_run) {
+            *o++ = (uint8_t) run;
+            *o++ = bpp == 8 ? row[x] : (uint8_t) (__rle_pixel(row, x, bpp) << 4 | __rle_pixel(row, x + 1, bpp));
+            x += run;
+            continue;
+        }
+
+        /* Gather pixels up to the next run worth encoding */
+        uint32_t n = run;
+        while (x + n < width && n < BMP_RLE_MAX_RUN && __rle_run(row, x + n, width, bpp) < min_run) {
+            n++;
+        }
+
+        /* Absolute runs need 3 pixels at least, fewer go as short runs */
+        if (n < 3) {
+            while (n) {
+                uint32_t m = bpp == 8 ? __rle_run(row, x, x + n, bpp) : n < 2 ? 1 : 2;
+                *o++ = (uint8_t) m;
+                *o++ = bpp == 8 ? row[x]
+                                : (uint8_t) (__rle_pixel(row, x, bpp) << 4 | (m == 2 ? __rle_pixel(row, x + 1, bpp) : 0));
+                x += m;
+                n -= m;
+            }
+            continue;
+        }
+
+        *o++ = 0;
+        *o++ = (uint8_t) n;
+        size_t nbytes = ((size_t) n * bpp + BMP_BITS_PER_BYTE - 1) / BMP_BITS_PER_BYTE;
+        if (bpp == 8) {
+            memcpy(o, row + x, n);
+        }
+        else {
+            for (size_t k = 0; k < nbytes; k++) {
+                uint32_t px = x + 2 * (uint32_t) k;
+                o[k] = (uint8_t) (__rle_pixel(row, px, bpp) << 4 | (px + 1 < x + n ? __rle_pixel(row, px + 1, bpp) : 0));
+            }
+        }
+        o += nbytes;
+        if (nbytes & 1U) {
+            *o++ = 0;
+        }
+        x += n;
+    }
+    return (size_t) (o - out);
+}
+
+int __rle_encode(FILE *fp, BMPmini_image *img, uint32_t *size)
+{
+    assert(img->header.bitsperpixel == 4 || img->header.bitsperpixel == 8);
+
+    BMPmini_view view;
+    BMPmini_get_view(img, &view);
+
+    /* A row takes at most 2 bytes per pixel, and 2 more for its end */
+    uint8_t *buf = malloc(2 * (size_t) view.width + 2);
+    if (!buf) {
+        return BMPmini_NOMEM_ERR;
+    }
+
+    /* RLE images are always stored Bottom-Up */
+    int res = BMPmini_SUCCESS;
+    uint64_t total = 0;
+    uint64_t max = UINT32_MAX - img->header.offset;
+    for (int32_t i = view.height - 1; i >= 0; i--) {
+        size_t n = __rle_encode_row(view.base + i * view.stride, (uint32_t) view.width, view.bitsperpixel, buf);
+        buf[n++] = 0;
+        buf[n++] = i == 0 ? BMP_RLE_EOB : BMP_RLE_EOL;
+        total += n;
+        if (total > max) {
+            res = BMPmini_OVERFLOW_ERR;
+            break;
+        }
+        if (fwrite(buf, n, 1, fp) != 1) {
+            res = BMPmini_FWRITE_ERR;
+            break;
+        }
+    }
+
+    free(buf);
+    *size = (uint32_t) total;
+    return res;
+}
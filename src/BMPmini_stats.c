@@ -0,0 +1,465 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_stats.c
+//
+// Histograms, statistics and checksums of BMP images for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#if defined(BMP_HAVE_X86_SIMD)
+  #include <immintrin.h>
+#endif
+#if defined(BMP_HAVE_NEON)
+  #include <arm_neon.h>
+#endif
+
+// Consecutive pixels count into different sub-histograms: incrementing the
+// same bin twice in a row would wait for the first store to complete.
+// Pixels are loaded 8 at a time as 64-bit words, one per sub-histogram.
+#define BMP_SUB_HISTS 8
+
+// Byte k of 8 bytes loaded as a word
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  #define BMP_WORD_BYTE(w, k) ((uint8_t) ((w) >> (56 - 8 * (k))))
+#else
+  #define BMP_WORD_BYTE(w, k) ((uint8_t) ((w) >> (8 * (k))))
+#endif
+
+// Sub-histograms count in 32 bits, and are added to the totals before
+// they may overflow
+#define BMP_SUB_MAX_PX (UINT32_MAX / 2)
+
+// Largest number of bands an image is split in, each with its own totals
+#define BMP_STATS_PARTS 64
+
+// Adler-32: sums modulo BMP_ADLER_BASE, reduced every BMP_ADLER_NMAX bytes at
+// the latest, the most bytes before the second sum may overflow 32 bits
+#define BMP_ADLER_BASE 65521U
+#define BMP_ADLER_NMAX 5552U
+
+typedef uint32_t (*__adler_fn)(uint32_t adler, const uint8_t *p, size_t n);
+
+// Totals of the rows of a band
+struct __stats_part {
+    uint64_t hist[3][256];
+    uint32_t adler;
+};
+
+struct __stats_job {
+    const BMPmini_view *view;
+    struct __stats_part *parts;
+    int32_t nparts;
+    size_t bpp;             // Bytes per pixel, only the first 3 are counted
+    __adler_fn adler;       // NULL to skip the checksum
+};
+
+//-------------------------------------
+// Histograms
+//-------------------------------------
+// Counts byte k of word w in channel c of sub-histogram s
+#define BMP_COUNT(s, c, w, k) sub[s][c][BMP_WORD_BYTE(w, k)]++
+
+static inline void __hist_rows(const BMPmini_view *view, int32_t first, int32_t last,
+                               uint32_t sub[BMP_SUB_HISTS][3][256], const size_t bpp)
+{
+    for (int32_t i = first; i < last; i++) {
+        const uint8_t *p = view->base + i * view->stride;
+        int32_t j = 0;
+        for (; j + BMP_SUB_HISTS <= view->width; j += BMP_SUB_HISTS, p += BMP_SUB_HISTS * bpp) {
+            uint64_t w[4];
+            memcpy(w, p, BMP_SUB_HISTS * bpp);
+            if (bpp == 3) {
+                BMP_COUNT(0, 0, w[0], 0); BMP_COUNT(0, 1, w[0], 1); BMP_COUNT(0, 2, w[0], 2);
+                BMP_COUNT(1, 0, w[0], 3); BMP_COUNT(1, 1, w[0], 4); BMP_COUNT(1, 2, w[0], 5);
+                BMP_COUNT(2, 0, w[0], 6); BMP_COUNT(2, 1, w[0], 7); BMP_COUNT(2, 2, w[1], 0);
+                BMP_COUNT(3, 0, w[1], 1); BMP_COUNT(3, 1, w[1], 2); BMP_COUNT(3, 2, w[1], 3);
+                BMP_COUNT(4, 0, w[1], 4); BMP_COUNT(4, 1, w[1], 5); BMP_COUNT(4, 2, w[1], 6);
+                BMP_COUNT(5, 0, w[1], 7); BMP_COUNT(5, 1, w[2], 0); BMP_COUNT(5, 2, w[2], 1);
+                BMP_COUNT(6, 0, w[2], 2); BMP_COUNT(6, 1, w[2], 3); BMP_COUNT(6, 2, w[2], 4);
+                BMP_COUNT(7, 0, w[2], 5); BMP_COUNT(7, 1, w[2], 6); BMP_COUNT(7, 2, w[2], 7);
+            }
+            else {
+                for (int k = 0; k < 4; k++) {
+                    BMP_COUNT(2 * k, 0, w[k], 0); BMP_COUNT(2 * k, 1, w[k], 1); BMP_COUNT(2 * k, 2, w[k], 2);
+                    BMP_COUNT(2 * k + 1, 0, w[k], 4); BMP_COUNT(2 * k + 1, 1, w[k], 5);
+                    BMP_COUNT(2 * k + 1, 2, w[k], 6);
+                }
+            }
+        }
+        for (; j < view->width; j++, p += bpp) {
+            sub[0][0][p[0]]++;
+            sub[0][1][p[1]]++;
+            sub[0][2][p[2]]++;
+        }
+    }
+}
+
+// Adds the sub-histograms to 'hist' and clears them
+static void __fold(uint32_t sub[BMP_SUB_HISTS][3][256], uint64_t hist[3][256])
+{
+    for (int c = 0; c < 3; c++) {
+        for (int v = 0; v < 256; v++) {
+            uint32_t n = 0;
+            for (int s = 0; s < BMP_SUB_HISTS; s++) {
+                n += sub[s][c][v];
+            }
+            hist[c][v] += n;
+        }
+    }
+    memset(sub, 0, sizeof(uint32_t[BMP_SUB_HISTS][3][256]));
+}
+
+//-------------------------------------
+// Checksums
+//-------------------------------------
+static uint32_t __adler_c(uint32_t adler, const uint8_t *p, size_t n)
+{
+    uint32_t s1 = adler & 0xFFFF;
+    uint32_t s2 = adler >> 16;
+    while (n > 0) {
+        size_t k = n < BMP_ADLER_NMAX ? n : BMP_ADLER_NMAX;
+        n -= k;
+        while (k--) {
+            s1 += *p++;
+            s2 += s1;
+        }
+        s1 %= BMP_ADLER_BASE;
+        s2 %= BMP_ADLER_BASE;
+    }
+    return s1 | s2 << 16;
+}
+
+// Checksum of the bytes of 'a' followed by the 'n' bytes of 'b'
+static uint32_t __adler_combine(uint32_t a, uint32_t b, uint64_t n)
+{
+    uint32_t rem = (uint32_t) (n % BMP_ADLER_BASE);
+    uint32_t s1 = a & 0xFFFF;
+    uint32_t s2 = (uint32_t) ((uint64_t) rem * s1 % BMP_ADLER_BASE);
+    s1 += (b & 0xFFFF) + BMP_ADLER_BASE - 1;
+    s2 += (a >> 16) + (b >> 16) + BMP_ADLER_BASE - rem;
+    if (s1 >= BMP_ADLER_BASE) {
+        s1 -= BMP_ADLER_BASE;
+    }
+    if (s1 >= BMP_ADLER_BASE) {
+        s1 -= BMP_ADLER_BASE;
+    }
+    if (s2 >= 2 * BMP_ADLER_BASE) {
+        s2 -= 2 * BMP_ADLER_BASE;
+    }
+    if (s2 >= BMP_ADLER_BASE) {
+        s2 -= BMP_ADLER_BASE;
+    }
+    return s1 | s2 << 16;
+}
+
+// SIMD kernels take blocks of 16 or 32 bytes: the first sum adds the bytes
+// (psadbw), the second adds them weighted by their distance to the end of
+// the block (pmaddubsw) and 16 or 32 times the first sum before each block.
+#if defined(BMP_HAVE_X86_SIMD)
+#define BMP_SSSE3 __attribute__((target("ssse3")))
+#define BMP_AVX2  __attribute__((target("avx2")))
+
+BMP_SSSE3 static inline uint32_t __hsum_epi32(__m128i x)
+{
+    x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+    x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t) _mm_cvtsi128_si32(x);
+}
+
+BMP_SSSE3 static uint32_t __adler_ssse3(uint32_t adler, const uint8_t *p, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i taps = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    uint32_t s1 = adler & 0xFFFF;
+    uint32_t s2 = adler >> 16;
+    while (n >= 16) {
+        size_t k = (n < BMP_ADLER_NMAX ? n : BMP_ADLER_NMAX) & ~(size_t) 15;
+        n -= k;
+        __m128i vs1 = _mm_cvtsi32_si128((int) s1);
+        __m128i vs2 = _mm_cvtsi32_si128((int) s2);
+        __m128i prev = zero;  // First sums before each block
+        for (; k > 0; k -= 16, p += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i *) p);
+            prev = _mm_add_epi32(prev, vs1);
+            vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(x, zero));
+            vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_maddubs_epi16(x, taps), ones));
+        }
+        vs2 = _mm_add_epi32(vs2, _mm_slli_epi32(prev, 4));
+        s1 = __hsum_epi32(vs1) % BMP_ADLER_BASE;
+        s2 = __hsum_epi32(vs2) % BMP_ADLER_BASE;
+    }
+    return __adler_c(s1 | s2 << 16, p, n);
+}
+
+BMP_AVX2 static uint32_t __adler_avx2(uint32_t adler, const uint8_t *p, size_t n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i taps = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                          16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    uint32_t s1 = adler & 0xFFFF;
+    uint32_t s2 = adler >> 16;
+    while (n >= 32) {
+        size_t k = (n < BMP_ADLER_NMAX ? n : BMP_ADLER_NMAX) & ~(size_t) 31;
+        n -= k;
+        __m256i vs1 = _mm256_setr_epi32((int) s1, 0, 0, 0, 0, 0, 0, 0);
+        __m256i vs2 = _mm256_setr_epi32((int) s2, 0, 0, 0, 0, 0, 0, 0);
+        __m256i prev = zero;
+        for (; k > 0; k -= 32, p += 32) {
+            __m256i x = _mm256_loadu_si256((const __m256i *) p);
+            prev = _mm256_add_epi32(prev, vs1);
+            vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(x, zero));
+            vs2 = _mm256_add_epi32(vs2, _mm256_madd_epi16(_mm256_maddubs_epi16(x, taps), ones));
+        }
+        vs2 = _mm256_add_epi32(vs2, _mm256_slli_epi32(prev, 5));
+        __m128i h1 = _mm_add_epi32(_mm256_castsi256_si128(vs1), _mm256_extracti128_si256(vs1, 1));
+        __m128i h2 = _mm_add_epi32(_mm256_castsi256_si128(vs2), _mm256_extracti128_si256(vs2, 1));
+        _mm256_zeroupper();
+        s1 = __hsum_epi32(h1) % BMP_ADLER_BASE;
+        s2 = __hsum_epi32(h2) % BMP_ADLER_BASE;
+    }
+    return __adler_ssse3(s1 | s2 << 16, p, n);
+}
+#endif
+
+#if defined(BMP_HAVE_NEON)
+static uint32_t __adler_neon(uint32_t adler, const uint8_t *p, size_t n)
+{
+    static const uint8_t taps[16] = {16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+    const uint8x8_t taps_lo = vld1_u8(taps);
+    const uint8x8_t taps_hi = vld1_u8(taps + 8);
+    uint32_t s1 = adler & 0xFFFF;
+    uint32_t s2 = adler >> 16;
+    while (n >= 16) {
+        size_t k = (n < BMP_ADLER_NMAX ? n : BMP_ADLER_NMAX) & ~(size_t) 15;
+        n -= k;
+        uint32x4_t vs1 = vsetq_lane_u32(s1, vdupq_n_u32(0), 0);
+        uint32x4_t vs2 = vsetq_lane_u32(s2, vdupq_n_u32(0), 0);
+        uint32x4_t prev = vdupq_n_u32(0);
+        for (; k > 0; k -= 16, p += 16) {
+            uint8x16_t x = vld1q_u8(p);
+            prev = vaddq_u32(prev, vs1);
+            vs1 = vpadalq_u16(vs1, vpaddlq_u8(x));
+            uint16x8_t w = vmull_u8(vget_low_u8(x), taps_lo);
+            w = vmlal_u8(w, vget_high_u8(x), taps_hi);
+            vs2 = vpadalq_u16(vs2, w);
+        }
+        vs2 = vaddq_u32(vs2, vshlq_n_u32(prev, 4));
+        uint32x2_t h1 = vadd_u32(vget_low_u32(vs1), vget_high_u32(vs1));
+        uint32x2_t h2 = vadd_u32(vget_low_u32(vs2), vget_high_u32(vs2));
+        s1 = (vget_lane_u32(h1, 0) + vget_lane_u32(h1, 1)) % BMP_ADLER_BASE;
+        s2 = (vget_lane_u32(h2, 0) + vget_lane_u32(h2, 1)) % BMP_ADLER_BASE;
+    }
+    return __adler_c(s1 | s2 << 16, p, n);
+}
+#endif
+
+static __adler_fn __adler_kernel(void)
+{
+    unsigned caps = __simd_caps();
+#if defined(BMP_HAVE_X86_SIMD)
+    if (caps & BMP_SIMD_SSSE3) {
+        return caps & BMP_SIMD_AVX2 ? __adler_avx2 : __adler_ssse3;
+    }
+#endif
+#if defined(BMP_HAVE_NEON)
+    if (caps & BMP_SIMD_NEON) {
+        return __adler_neon;
+    }
+#endif
+    (void) caps;
+    return __adler_c;
+}
+
+//-------------------------------------
+// Bands
+//-------------------------------------
+static inline int32_t __part_row(const struct __stats_job *job, int32_t part)
+{
+    return (int32_t) ((int64_t) job->view->height * part / job->nparts);
+}
+
+static void __stats_band(void *arg, int32_t first, int32_t last)
+{
+    struct __stats_job *job = arg;
+    const BMPmini_view *view = job->view;
+    size_t row_bytes = (size_t) view->width * job->bpp;
+    uint32_t sub[BMP_SUB_HISTS][3][256];
+    memset(sub, 0, sizeof(sub));
+
+    /* Rows are taken a few at a time, so that they are still in the
+     * cache when the checksum reads them again */
+    int32_t rows = view->width > 0 ? (int32_t) (BMP_SUB_MAX_PX / view->width) : 1;
+    rows = rows < 1 ? 1 : rows > 16 ? 16 : rows;
+    for (int32_t part = first; part < last; part++) {
+        struct __stats_part *out = &job->parts[part];
+        int32_t end = __part_row(job, part + 1);
+        uint64_t pixels = 0;
+        memset(out->hist, 0, sizeof(out->hist));
+        out->adler = 1;
+        for (int32_t i = __part_row(job, part); i < end; i += rows) {
+            int32_t n = end - i < rows ? end - i : rows;
+            if (pixels + (uint64_t) n * view->width > BMP_SUB_MAX_PX) {
+                __fold(sub, out->hist);
+                pixels = 0;
+            }
+            pixels += (uint64_t) n * view->width;
+            if (job->bpp == 3) {
+                __hist_rows(view, i, i + n, sub, 3);
+            }
+            else {
+                __hist_rows(view, i, i + n, sub, 4);
+            }
+            for (int32_t k = 0; job->adler && k < n; k++) {
+                out->adler = job->adler(out->adler, view->base + (i + k) * view->stride, row_bytes);
+            }
+        }
+        __fold(sub, out->hist);
+    }
+}
+
+// Computes the histograms, and the checksum unless 'adler' is NULL, of each
+// of the 'nparts' bands of a view
+static int __stats_parts(const BMPmini_view *view, int nthreads, __adler_fn adler,
+                         struct __stats_part **parts, int32_t *nparts)
+{
+    assert(view);
+    *parts = NULL;
+    *nparts = 0;
+    if (view->bitsperpixel != 24 && view->bitsperpixel != 32) {
+        return BMPmini_FORMAT_ERR;
+    }
+    if (view->height <= 0) {
+        return BMPmini_SUCCESS;
+    }
+
+    /* A few bands per thread, none too small to be worth a thread */
+    size_t bpp = view->bitsperpixel / BMP_BITS_PER_BYTE;
+    size_t row_bytes = (size_t) view->width * bpp;
+    uint64_t total = (uint64_t) row_bytes * view->height;
+    int64_t n = (int64_t) __resolve_threads(nthreads) * BMP_BANDS_PER_THREAD;
+    if ((uint64_t) n > total / BMP_MIN_BAND_BYTES) {
+        n = (int64_t) (total / BMP_MIN_BAND_BYTES);
+    }
+    n = n < 1 ? 1 : n > BMP_STATS_PARTS ? BMP_STATS_PARTS : n;
+    n = n > view->height ? view->height : n;
+
+    struct __stats_job job = {view, malloc((size_t) n * sizeof(struct __stats_part)), (int32_t) n, bpp, adler};
+    if (!job.parts) {
+        return BMPmini_NOMEM_ERR;
+    }
+    __run_bands(job.nparts, (size_t) (total / n), nthreads, __stats_band, &job);
+    *parts = job.parts;
+    *nparts = job.nparts;
+    return BMPmini_SUCCESS;
+}
+
+//-------------------------------------
+// Statistics
+//-------------------------------------
+void BMPmini_stats_init(BMPmini_stats *stats)
+{
+    assert(stats);
+    memset(stats, 0, sizeof(*stats));
+    stats->checksum = 1;
+}
+
+// Derives the other fields from the histograms
+static void __summarize(BMPmini_stats *stats)
+{
+    for (int c = 0; c < 3; c++) {
+        const uint64_t *hist = stats->hist[c];
+        uint64_t sum = 0;
+        double sq = 0.0;
+        int lo = 256, hi = -1;
+        for (int v = 0; v < 256; v++) {
+            if (hist[v]) {
+                lo = lo < v ? lo : v;
+                hi = v;
+                sum += hist[v] * v;
+                sq += (double) hist[v] * v * v;
+            }
+        }
+        stats->sum[c] = sum;
+        stats->min[c] = hi < 0 ? 0 : (uint8_t) lo;
+        stats->max[c] = hi < 0 ? 0 : (uint8_t) hi;
+        if (stats->count == 0) {
+            stats->mean[c] = stats->stddev[c] = 0.0;
+            continue;
+        }
+        double mean = (double) sum / stats->count;
+        double var = sq / stats->count - mean * mean;
+        stats->mean[c] = mean;
+        stats->stddev[c] = var > 0.0 ? sqrt(var) : 0.0;
+    }
+}
+
+int __stats_update(BMPmini_stats *stats, const BMPmini_view *view, int nthreads, bool prepend)
+{
+    assert(stats);
+    struct __stats_part *parts;
+    int32_t nparts;
+    int res = __stats_parts(view, nthreads, __adler_kernel(), &parts, &nparts);
+    if (res != BMPmini_SUCCESS || nparts == 0) {
+        return res;
+    }
+
+    /* Bands follow each other, their checksums are chained in order */
+    uint32_t adler = 1;
+    uint64_t bytes = 0;
+    size_t row_bytes = (size_t) view->width * (view->bitsperpixel / BMP_BITS_PER_BYTE);
+    struct __stats_job job = {view, parts, nparts, 0, NULL};
+    for (int32_t p = 0; p < nparts; p++) {
+        uint64_t n = (uint64_t) (__part_row(&job, p + 1) - __part_row(&job, p)) * row_bytes;
+        adler = __adler_combine(adler, parts[p].adler, n);
+        bytes += n;
+        for (int c = 0; c < 3; c++) {
+            for (int v = 0; v < 256; v++) {
+                stats->hist[c][v] += parts[p].hist[c][v];
+            }
+        }
+    }
+    free(parts);
+
+    stats->checksum = prepend ? __adler_combine(adler, stats->checksum, stats->bytes)
+                              : __adler_combine(stats->checksum, adler, bytes);
+    stats->bytes += bytes;
+    stats->count += (uint64_t) view->width * view->height;
+    __summarize(stats);
+    return BMPmini_SUCCESS;
+}
+
+int BMPmini_stats_update(BMPmini_stats *stats, const BMPmini_view *view, int nthreads)
+{
+    return __stats_update(stats, view, nthreads, false);
+}
+
+int BMPmini_get_stats(const BMPmini_view *view, BMPmini_stats *stats, int nthreads)
+{
+    BMPmini_stats_init(stats);
+    return __stats_update(stats, view, nthreads, false);
+}
+
+int BMPmini_histogram(const BMPmini_view *view, uint64_t hist[3][256], int nthreads)
+{
+    assert(hist);
+    struct __stats_part *parts;
+    int32_t nparts;
+    int res = __stats_parts(view, nthreads, NULL, &parts, &nparts);
+    if (res != BMPmini_SUCCESS) {
+        return res;
+    }
+    memset(hist, 0, sizeof(uint64_t[3][256]));
+    for (int32_t p = 0; p < nparts; p++) {
+        for (int c = 0; c < 3; c++) {
+            for (int v = 0; v < 256; v++) {
+                hist[c][v] += parts[p].hist[c][v];
+            }
+        }
+    }
+    free(parts);
+    return BMPmini_SUCCESS;
+}
@@ -0,0 +1,246 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_stream.c
+//
+// Row by row reading and writing of BMP images for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <assert.h>
+
+struct _BMPmini_reader {
+    FILE *imgfp;
+    BMPmini_header header;
+    uint32_t row_size;  // Bytes per stored row, padding included
+    uint32_t height;    // Number of rows
+    uint32_t next_row;  // Next row to be delivered, counting from the top
+    long pos;           // Current file position, -1 if unknown
+    uint8_t tmp_row[FLEX_ARRAY];
+};
+
+struct _BMPmini_writer {
+    FILE *imgfp;
+    BMPmini_header header;
+    uint32_t row_bytes;  // Bytes per row, padding excluded
+    uint32_t padding;
+    uint32_t rows;       // Number of rows written so far
+    int flags;
+};
+
+BMPmini_reader *BMPmini_reader_open(const char *restrict filename)
+{
+    FILE *imgfp = __open_file(filename, "rb");
+    if (!imgfp) {
+        BMPmini_PERROR(__func__, BMPmini_FOPEN_ERR, "[ERROR]: fopen", 1);
+        return NULL;
+    }
+
+    BMP_PHASE_START(t);
+    unsigned char hdrbytes[BMP_HEADER_SIZE];
+    if (fread(hdrbytes, BMP_HEADER_SIZE, 1, imgfp) != 1) {
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[ERROR]: fread", 1);
+        goto CLEANUP_RO1;
+    }
+    BMPmini_header header;
+    __parse_bytes2hdr(&header, hdrbytes);
+
+    bool valid = BMPmini_check_header(&header, imgfp);
+    BMP_PHASE_STOP(t, BMPmini_PHASE_HEADER, BMP_HEADER_SIZE);
+    if (!valid) {
+        BMPmini_PERROR(__func__, BMPmini_HEADER_ERR, "[ERROR]: invalid BMP header", 0);
+        goto CLEANUP_RO1;
+    }
+    /* Rows of RLE images have no fixed place in the file */
+    if (__is_rle(&header)) {
+        BMPmini_PERROR(__func__, BMPmini_FORMAT_ERR, "[ERROR]: RLE compressed images cannot be read by rows\n", 0);
+        goto CLEANUP_RO1;
+    }
+
+    /* Rows are reached with fseek, whose offsets are longs */
+    uint32_t row_size = __get_image_row_size_bytes(&header);
+    if ((uint64_t) header.offset + (uint64_t) row_size * __get_abs_height(&header) > LONG_MAX) {
+        BMPmini_PERROR(__func__, BMPmini_OVERFLOW_ERR, "[ERROR]: file offsets do not fit in a long\n", 0);
+        goto CLEANUP_RO1;
+    }
+    BMPmini_reader *reader = malloc(sizeof(*reader) + row_size);
+    if (!reader) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        goto CLEANUP_RO1;
+    }
+    reader->imgfp = imgfp;
+    reader->header = header;
+    reader->row_size = row_size;
+    reader->height = __get_abs_height(&header);
+    reader->next_row = 0;
+    reader->pos = BMP_HEADER_SIZE;
+    return reader;
+CLEANUP_RO1:
+    if (__close_file(imgfp) == EOF) {
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[WARN]: fclose", 1);
+    }
+    return NULL;
+}
+
+void BMPmini_reader_info(BMPmini_reader *reader, BMPmini_info *info)
+{
+    assert(reader && info);
+    __fill_info(&reader->header, info);
+}
+
+size_t BMPmini_reader_read_rows(BMPmini_reader *reader, void *buf, size_t nrows)
+{
+    assert(reader && buf);
+
+    size_t remaining = reader->height - reader->next_row;
+    size_t n = nrows < remaining ? nrows : remaining;
+    if (n == 0) {
+        return 0;
+    }
+
+    /* The requested rows are contiguous in the file in both orientations,
+     * Bottom-Up DIBs just store them in reverse order */
+    bool top_down = reader->header.height_px < 0;
+    size_t first = top_down ? reader->next_row : reader->height - reader->next_row - n;
+    long pos = (long) (reader->header.offset + first * reader->row_size);
+    BMP_PHASE_START(t);
+    if (pos != reader->pos && fseek(reader->imgfp, pos, SEEK_SET)) {
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[ERROR]: fseek", 1);
+        reader->pos = -1;
+        return 0;
+    }
+
+    if (fread(buf, reader->row_size, n, reader->imgfp) != n) {
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[ERROR]: fread", 1);
+        reader->pos = -1;
+        return 0;
+    }
+    reader->pos = pos + (long) (n * reader->row_size);
+    BMP_PHASE_STOP(t, BMPmini_PHASE_READ, n * reader->row_size);
+
+    if (!top_down) {
+        uint8_t *lo = buf;
+        uint8_t *hi = lo + (n - 1) * reader->row_size;
+        for (; lo < hi; lo += reader->row_size, hi -= reader->row_size) {
+            memcpy(reader->tmp_row, lo, reader->row_size);
+            memcpy(lo, hi, reader->row_size);
+            memcpy(hi, reader->tmp_row, reader->row_size);
+        }
+    }
+
+    reader->next_row += n;
+    return n;
+}
+
+void BMPmini_reader_close(BMPmini_reader *reader)
+{
+    if (reader) {
+        if (__close_file(reader->imgfp) == EOF) {
+            BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[WARN]: fclose", 1);
+        }
+        free(reader);
+    }
+}
+
+BMPmini_writer *BMPmini_writer_open(const char *restrict filename, int32_t width, int flags)
+{
+    assert(width > 0);
+
+    /* Even a single row must fit in the size fields of the header */
+    uint64_t row_size = (__get_row_bytes(width, BMP_BITS_PER_PIXEL) + 3) & ~(uint64_t) 3;
+    if (BMP_HEADER_SIZE + row_size > UINT32_MAX) {
+        BMPmini_PERROR(__func__, BMPmini_OVERFLOW_ERR, "[OVERFLOW]: BMP image size overflow encountered\n", 0);
+        return NULL;
+    }
+
+    BMPmini_writer *writer = malloc(sizeof(*writer));
+    if (!writer) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        return NULL;
+    }
+
+    writer->imgfp = __open_file(filename, "wb");
+    if (!writer->imgfp) {
+        BMPmini_PERROR(__func__, BMPmini_FOPEN_ERR, "[ERROR]: fopen", 1);
+        free(writer);
+        return NULL;
+    }
+
+    /* Reserve room for the header, it is completed at close */
+    __init_header(&writer->header, width, 0, BMP_BITS_PER_PIXEL);
+    writer->row_bytes = (uint32_t) __get_row_bytes(width, BMP_BITS_PER_PIXEL);
+    writer->padding = __get_padding(&writer->header);
+    writer->rows = 0;
+    writer->flags = flags;
+
+    unsigned char hdrbytes[BMP_HEADER_SIZE];
+    __parse_hdr2bytes(writer->header, hdrbytes);
+    if (fwrite(hdrbytes, BMP_HEADER_SIZE, 1, writer->imgfp) != 1) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: fwrite", 1);
+        if (__close_file(writer->imgfp) == EOF) {
+            BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[WARN]: fclose", 1);
+        }
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+int BMPmini_writer_write_rows(BMPmini_writer *writer, const void *rows, size_t nrows, size_t stride)
+{
+    assert(writer && (rows || nrows == 0));
+
+    /* The final header must still be able to describe the image */
+    uint64_t row_size = writer->row_bytes + writer->padding;
+    uint64_t total_rows = (uint64_t) writer->rows + nrows;
+    if (total_rows > INT32_MAX || BMP_HEADER_SIZE + total_rows * row_size > UINT32_MAX) {
+        BMPmini_PERROR(__func__, BMPmini_OVERFLOW_ERR, "[OVERFLOW]: BMP image size overflow encountered", 0);
+        return BMPmini_OVERFLOW_ERR;
+    }
+
+    BMP_PHASE_START(t);
+    static const uint8_t padding[3] = {0, 0, 0};
+    const uint8_t *row = rows;
+    for (size_t i = 0; i < nrows; i++, row += stride) {
+        if (fwrite(row, writer->row_bytes, 1, writer->imgfp) != 1
+            || (writer->padding && fwrite(padding, writer->padding, 1, writer->imgfp) != 1)) {
+            BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: fwrite", 1);
+            return BMPmini_FWRITE_ERR;
+        }
+    }
+
+    BMP_PHASE_STOP(t, BMPmini_PHASE_WRITE, nrows * row_size);
+    writer->rows += nrows;
+    return BMPmini_SUCCESS;
+}
+
+int BMPmini_writer_close(BMPmini_writer *writer)
+{
+    assert(writer);
+
+    int res = BMPmini_SUCCESS;
+    int32_t rows = (int32_t) writer->rows;
+    /* BMP images have at least a row, a header of height 0 is never read back */
+    if (rows == 0) {
+        BMPmini_PERROR(__func__, BMPmini_RANGE_ERR, "[ERROR]: no rows were written\n", 0);
+        res = BMPmini_RANGE_ERR;
+        goto CLEANUP_WC1;
+    }
+    __init_header(&writer->header, writer->header.width_px,
+                  (writer->flags & BMPmini_STREAM_BOTTOM_UP) ? rows : -rows, BMP_BITS_PER_PIXEL);
+
+    unsigned char hdrbytes[BMP_HEADER_SIZE];
+    __parse_hdr2bytes(writer->header, hdrbytes);
+    if (fseek(writer->imgfp, 0, SEEK_SET)
+        || fwrite(hdrbytes, BMP_HEADER_SIZE, 1, writer->imgfp) != 1) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: fwrite", 1);
+        res = BMPmini_FWRITE_ERR;
+    }
+
+CLEANUP_WC1:
+    if (__close_file(writer->imgfp) == EOF) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: fclose", 1);
+        res = BMPmini_FWRITE_ERR;
+    }
+    free(writer);
+    return res;
+}
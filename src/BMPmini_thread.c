@@ -0,0 +1,201 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_thread.c
+//
+// Thread pool running row bands of a job for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <assert.h>
+#if defined(BMP_HAVE_PTHREAD)
+  #include <pthread.h>
+  #include <unistd.h>
+#endif
+
+static int __default_threads = 1;
+
+#if defined(BMP_HAVE_PTHREAD)
+// A job submitted by a thread, living on its stack until all its bands ran
+struct __job {
+    struct __job *next;      // Next job with bands left to hand out
+    __band_fn fn;
+    void *arg;
+    int32_t rows;
+    int32_t band_rows;
+    int32_t nbands;
+    int32_t next_band;
+    int32_t pending;         // Bands not finished yet
+    int slots;               // Workers still allowed to join the job
+    pthread_cond_t done;
+};
+
+// Workers are created on demand and live as long as the process. Jobs of
+// several threads are queued side by side, the bands of each handed out to
+// the thread that submitted it and to whichever workers ask first.
+static struct {
+    pthread_mutex_t lock;    // Protects everything below and the queued jobs
+    pthread_cond_t work;
+    int nworkers;
+    struct __job *jobs;      // Oldest first
+} __pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, NULL};
+
+// Jobs started from a band run by a worker run inline, a worker never waits
+// for other workers
+static BMP_THREAD_LOCAL bool __in_worker = false;
+
+// Must be called with __pool.lock held
+static void __unlink_job_locked(struct __job *job)
+{
+    struct __job **link = &__pool.jobs;
+    while (*link && *link != job) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = job->next;
+    }
+}
+
+// Runs bands of 'job' until none is left to hand out. Must be called with
+// __pool.lock held, 'job' must not be touched once its last band finished.
+static void __run_job_locked(struct __job *job)
+{
+    while (job->next_band < job->nbands) {
+        int32_t band = job->next_band++;
+        if (job->next_band == job->nbands) {
+            __unlink_job_locked(job);
+        }
+        int32_t first = band * job->band_rows;
+        int32_t last = job->rows - first < job->band_rows ? job->rows : first + job->band_rows;
+
+        pthread_mutex_unlock(&__pool.lock);
+        job->fn(job->arg, first, last);
+        pthread_mutex_lock(&__pool.lock);
+
+        if (--job->pending == 0) {
+            pthread_cond_signal(&job->done);
+            return;
+        }
+    }
+}
+
+static void *__worker(void *unused)
+{
+    (void) unused;
+    __in_worker = true;
+    pthread_mutex_lock(&__pool.lock);
+    for (;;) {
+        struct __job *job = __pool.jobs;
+        while (job && job->slots == 0) {
+            job = job->next;
+        }
+        if (!job) {
+            pthread_cond_wait(&__pool.work, &__pool.lock);
+            continue;
+        }
+        job->slots--;
+        __run_job_locked(job);
+    }
+    return NULL;
+}
+
+// Must be called with __pool.lock held
+static void __grow_pool_locked(int nworkers)
+{
+    while (__pool.nworkers < nworkers) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, __worker, NULL)) {
+            /* Not fatal: the calling thread runs the bands left over */
+            BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[WARN]: pthread_create failed", 0);
+            return;
+        }
+        pthread_detach(tid);
+        __pool.nworkers++;
+    }
+}
+#endif
+
+int __resolve_threads(int nthreads)
+{
+    if (nthreads <= 0) {
+        nthreads = __default_threads;
+    }
+    return nthreads > BMP_MAX_THREADS ? BMP_MAX_THREADS : nthreads;
+}
+
+void __run_bands(int32_t rows, size_t row_bytes, int nthreads, __band_fn fn, void *arg)
+{
+    assert(fn && rows >= 0);
+    if (rows == 0) {
+        return;
+    }
+
+    /* Do not split the job in bands too small to pay for the wake up */
+    nthreads = __resolve_threads(nthreads);
+    size_t max_bands = (size_t) rows * row_bytes / BMP_MIN_BAND_BYTES;
+    if ((size_t) nthreads > max_bands) {
+        nthreads = max_bands > 1 ? (int) max_bands : 1;
+    }
+    if (nthreads > rows) {
+        nthreads = rows;
+    }
+
+#if defined(BMP_HAVE_PTHREAD)
+    if (nthreads > 1 && !__in_worker) {
+        /* A few bands per thread even out bands that take longer */
+        size_t nbands = (size_t) nthreads * BMP_BANDS_PER_THREAD;
+        if (nbands > max_bands) {
+            nbands = max_bands;
+        }
+        if (nbands > (size_t) rows) {
+            nbands = (size_t) rows;
+        }
+        struct __job job;
+        job.next = NULL;
+        job.fn = fn;
+        job.arg = arg;
+        job.rows = rows;
+        job.band_rows = (int32_t) ((rows + nbands - 1) / nbands);
+        job.nbands = (rows + job.band_rows - 1) / job.band_rows;
+        job.next_band = 0;
+        job.pending = job.nbands;
+        job.slots = nthreads - 1;
+        pthread_cond_init(&job.done, NULL);
+
+        pthread_mutex_lock(&__pool.lock);
+        __grow_pool_locked(nthreads - 1);
+        struct __job **link = &__pool.jobs;
+        while (*link) {
+            link = &(*link)->next;
+        }
+        *link = &job;
+        pthread_cond_broadcast(&__pool.work);
+
+        __run_job_locked(&job);
+        while (job.pending > 0) {
+            pthread_cond_wait(&job.done, &__pool.lock);
+        }
+        pthread_mutex_unlock(&__pool.lock);
+        pthread_cond_destroy(&job.done);
+        return;
+    }
+#endif
+    fn(arg, 0, rows);
+}
+
+void BMPmini_set_threads(int nthreads)
+{
+    if (nthreads <= 0) {
+        nthreads = 1;
+#if defined(BMP_HAVE_PTHREAD) && defined(_SC_NPROCESSORS_ONLN)
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (ncpus > 1) {
+            nthreads = ncpus > BMP_MAX_THREADS ? BMP_MAX_THREADS : (int) ncpus;
+        }
+#endif
+    }
+    __default_threads = nthreads > BMP_MAX_THREADS ? BMP_MAX_THREADS : nthreads;
+}
+
+int BMPmini_get_threads(void)
+{
+    return __default_threads;
+}
@@ -0,0 +1,493 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_tile.c
+//
+// Writing of BMP images by tiles from several threads for BMPmini library
+//-----------------------------------------------------------------------------
+#if defined(__linux__)
+  #define _GNU_SOURCE  // fallocate and O_DIRECT
+#endif
+#include "BMPminidef.h"
+#include <string.h>
+#include <assert.h>
+#if defined(BMP_HAVE_PWRITE)
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+// File offsets, lengths and addresses of O_DIRECT writes are multiples of
+// this, the largest logical block size of common devices
+#define BMP_DIRECT_ALIGN 4096U
+
+// Bytes staged before being written, enough for each write to be worth a
+// system call and few enough to stay in the L2 cache
+#define BMP_TILE_CHUNK (1024U * 1024U)
+
+struct _BMPmini_tile_writer {
+#if defined(BMP_HAVE_PWRITE)
+    int fd;
+    int direct_fd;          // The same file opened with O_DIRECT, -1 if not asked or not supported
+    bool direct;            // Cleared if O_DIRECT writes turn out not to work, see __set_flag
+#else
+    FILE *imgfp;            // Without pwrite there are no threads either, writes seek first
+#endif
+    BMPmini_header header;
+    uint32_t row_size;      // Bytes per stored row, padding included
+    uint32_t row_bytes;     // Bytes per row, padding excluded
+    uint32_t height;
+    int status;             // First error of a write, set with __fail_status
+};
+
+// Bytes held on their way to the file, starting at file offset 'start'.
+// They sit at 'buf' + 'start' % BMP_DIRECT_ALIGN for O_DIRECT writes, so
+// that aligned file offsets fall on aligned addresses.
+struct __stage {
+    BMPmini_tile_writer *w;
+    bool direct;            // Blocks go through O_DIRECT
+    uint8_t *buf;
+    size_t cap;
+    uint64_t start;
+    size_t len;
+};
+
+//-------------------------------------
+// File access
+//-------------------------------------
+#if defined(BMP_HAVE_PWRITE)
+static bool __pwrite_all(int fd, const uint8_t *buf, size_t len, uint64_t off)
+{
+    BMP_PHASE_START(t);
+    size_t total = len;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, (off_t) off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= (size_t) n;
+        off += (uint64_t) n;
+    }
+    BMP_PHASE_STOP(t, BMPmini_PHASE_WRITE, total);
+    return true;
+}
+
+static int __write_at(BMPmini_tile_writer *w, const uint8_t *buf, size_t len, uint64_t off)
+{
+    if (!__pwrite_all(w->fd, buf, len, off)) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: pwrite", 1);
+        return BMPmini_FWRITE_ERR;
+    }
+    return BMPmini_SUCCESS;
+}
+
+// Writes whole aligned blocks, bypassing the page cache when possible
+static int __write_direct(BMPmini_tile_writer *w, const uint8_t *buf, size_t len, uint64_t off)
+{
+    if (__get_flag(&w->direct)) {
+        if (__pwrite_all(w->direct_fd, buf, len, off)) {
+            return BMPmini_SUCCESS;
+        }
+        if (errno != EINVAL) {
+            BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: pwrite", 1);
+            return BMPmini_FWRITE_ERR;
+        }
+        /* Some file systems accept O_DIRECT but not these alignments. The
+         * descriptor stays open, other bands may be using it. */
+        __set_flag(&w->direct, false);
+    }
+    return __write_at(w, buf, len, off);
+}
+
+static uint8_t *__stage_alloc(size_t size)
+{
+    void *buf;
+    return posix_memalign(&buf, BMP_DIRECT_ALIGN, size) ? NULL : buf;
+}
+
+// Opens the file with its final size, its blocks allocated at once
+static bool __create(BMPmini_tile_writer *w, const char *restrict filename, uint64_t size, int flags)
+{
+    BMP_PHASE_START(t);
+    w->direct_fd = -1;
+    w->direct = false;
+    w->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (w->fd < 0) {
+        BMPmini_PERROR(__func__, BMPmini_FOPEN_ERR, "[ERROR]: open", 1);
+        return false;
+    }
+#if defined(__linux__)
+    /* Extents reserved in one go rather than grown by every band, file
+     * systems without fallocate just get the size */
+    if (fallocate(w->fd, 0, 0, (off_t) size) && errno != EOPNOTSUPP && errno != ENOSYS) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: fallocate", 1);
+        goto CLEANUP_TC1;
+    }
+#endif
+    if (ftruncate(w->fd, (off_t) size)) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: ftruncate", 1);
+        goto CLEANUP_TC1;
+    }
+#if defined(O_DIRECT)
+    /* Not an error where unsupported, writes go through the page cache */
+    if (flags & BMPmini_WRITE_DIRECT) {
+        w->direct_fd = open(filename, O_WRONLY | O_DIRECT);
+    }
+    w->direct = w->direct_fd >= 0;
+#else
+    (void) flags;
+#endif
+    BMP_PHASE_STOP(t, BMPmini_PHASE_OPEN, 0);
+    return true;
+CLEANUP_TC1:
+    close(w->fd);
+    return false;
+}
+
+static int __close(BMPmini_tile_writer *w)
+{
+    BMP_PHASE_START(t);
+    int res = BMPmini_SUCCESS;
+    if (w->direct_fd >= 0 && close(w->direct_fd)) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: close", 1);
+        res = BMPmini_FWRITE_ERR;
+    }
+    if (close(w->fd)) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: close", 1);
+        res = BMPmini_FWRITE_ERR;
+    }
+    BMP_PHASE_STOP(t, BMPmini_PHASE_OPEN, 0);
+    return res;
+}
+#else
+static int __write_at(BMPmini_tile_writer *w, const uint8_t *buf, size_t len, uint64_t off)
+{
+    BMP_PHASE_START(t);
+    if (off > LONG_MAX || fseek(w->imgfp, (long) off, SEEK_SET) || fwrite(buf, len, 1, w->imgfp) != 1) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: fwrite", 1);
+        return BMPmini_FWRITE_ERR;
+    }
+    BMP_PHASE_STOP(t, BMPmini_PHASE_WRITE, len);
+    return BMPmini_SUCCESS;
+}
+
+static int __write_direct(BMPmini_tile_writer *w, const uint8_t *buf, size_t len, uint64_t off)
+{
+    return __write_at(w, buf, len, off);
+}
+
+static uint8_t *__stage_alloc(size_t size)
+{
+    return malloc(size);
+}
+
+// Opens the file with its final size
+static bool __create(BMPmini_tile_writer *w, const char *restrict filename, uint64_t size, int flags)
+{
+    (void) flags;
+    w->imgfp = __open_file(filename, "wb");
+    if (!w->imgfp) {
+        BMPmini_PERROR(__func__, BMPmini_FOPEN_ERR, "[ERROR]: fopen", 1);
+        return false;
+    }
+    static const uint8_t zero = 0;
+    if (__write_at(w, &zero, 1, size - 1) != BMPmini_SUCCESS) {
+        __close_file(w->imgfp);
+        return false;
+    }
+    return true;
+}
+
+static int __close(BMPmini_tile_writer *w)
+{
+    if (__close_file(w->imgfp) == EOF) {
+        BMPmini_PERROR(__func__, BMPmini_FWRITE_ERR, "[ERROR]: fclose", 1);
+        return BMPmini_FWRITE_ERR;
+    }
+    return BMPmini_SUCCESS;
+}
+#endif
+
+static bool __direct(const BMPmini_tile_writer *w)
+{
+#if defined(BMP_HAVE_PWRITE)
+    return __get_flag(&w->direct);
+#else
+    (void) w;
+    return false;
+#endif
+}
+
+//-------------------------------------
+// Staging
+//-------------------------------------
+// Room for chunks of up to 'bytes' bytes, at least a row and a block more
+static bool __stage_init(struct __stage *st, BMPmini_tile_writer *w, size_t bytes, uint64_t start)
+{
+    size_t min = (size_t) w->row_size + 2 * BMP_DIRECT_ALIGN;
+    st->w = w;
+    st->direct = __direct(w);
+    st->cap = bytes < BMP_TILE_CHUNK ? bytes + 2 * BMP_DIRECT_ALIGN : BMP_TILE_CHUNK;
+    st->cap = st->cap < min ? min : st->cap;
+    st->buf = __stage_alloc(st->cap);
+    st->start = start;
+    st->len = 0;
+    if (!st->buf) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        return false;
+    }
+    return true;
+}
+
+// Writes the staged bytes. Unless it is the 'last' flush, the bytes of the
+// final partial block stay staged, so that only the first and last blocks
+// of a tile go through the page cache.
+static int __stage_flush(struct __stage *st, bool last)
+{
+    BMPmini_tile_writer *w = st->w;
+    size_t skew = st->direct ? (size_t) (st->start % BMP_DIRECT_ALIGN) : 0;
+    const uint8_t *p = st->buf + skew;
+    uint64_t off = st->start, end = st->start + st->len;
+    int res = BMPmini_SUCCESS;
+
+    if (st->direct) {
+        uint64_t a = (off + BMP_DIRECT_ALIGN - 1) / BMP_DIRECT_ALIGN * BMP_DIRECT_ALIGN;
+        uint64_t b = end / BMP_DIRECT_ALIGN * BMP_DIRECT_ALIGN;
+        if (a < b) {
+            if (a > off) {
+                res = __write_at(w, p, (size_t) (a - off), off);
+            }
+            if (res == BMPmini_SUCCESS) {
+                res = __write_direct(w, p + (a - off), (size_t) (b - a), a);
+            }
+            p += b - off;
+            off = b;
+        }
+    }
+    if (res == BMPmini_SUCCESS && (last || !st->direct) && end > off) {
+        res = __write_at(w, p, (size_t) (end - off), off);
+        p += end - off;
+        off = end;
+    }
+
+    /* At most a partial block is left, it moves to the front */
+    memmove(st->buf + (st->direct ? off % BMP_DIRECT_ALIGN : 0), p, (size_t) (end - off));
+    st->start = off;
+    st->len = (size_t) (end - off);
+    return res;
+}
+
+// Where the next 'n' bytes go, flushing first if they do not fit
+static uint8_t *__stage_reserve(struct __stage *st, size_t n, int *res)
+{
+    size_t skew = st->direct ? (size_t) (st->start % BMP_DIRECT_ALIGN) : 0;
+    if (skew + st->len + n > st->cap) {
+        *res = __stage_flush(st, false);
+        skew = st->direct ? (size_t) (st->start % BMP_DIRECT_ALIGN) : 0;
+    }
+    uint8_t *p = st->buf + skew + st->len;
+    st->len += n;
+    return p;
+}
+
+//-------------------------------------
+// Writers
+//-------------------------------------
+// Creates the file for an image described by 'header', followed by 'extra'
+// header bytes, color table included
+static BMPmini_tile_writer *__tile_open(const char *restrict filename, BMPmini_header *restrict header,
+                                        const uint8_t *extra, int flags)
+{
+    BMPmini_tile_writer *w = malloc(sizeof(*w));
+    if (!w) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        return NULL;
+    }
+    w->header = *header;
+    w->row_size = __get_image_row_size_bytes(header);
+    w->row_bytes = (uint32_t) __get_row_bytes(header->width_px, header->bitsperpixel);
+    w->height = __get_abs_height(header);
+    w->status = BMPmini_SUCCESS;
+    if (!__create(w, filename, (uint64_t) header->offset + header->image_size_bytes, flags)) {
+        free(w);
+        return NULL;
+    }
+
+    unsigned char hdrbytes[BMP_HEADER_SIZE];
+    __parse_hdr2bytes(*header, hdrbytes);
+    if (__write_at(w, hdrbytes, BMP_HEADER_SIZE, 0) != BMPmini_SUCCESS
+        || (header->offset > BMP_HEADER_SIZE
+            && __write_at(w, extra, header->offset - BMP_HEADER_SIZE, BMP_HEADER_SIZE) != BMPmini_SUCCESS)) {
+        __close(w);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+BMPmini_tile_writer *BMPmini_tile_writer_open(const char *restrict filename, int32_t width, int32_t height,
+                                              uint16_t bitsperpixel, int flags)
+{
+    assert(width > 0 && height > 0);
+
+    if (bitsperpixel != BMP_BITS_PER_PIXEL && bitsperpixel != 32) {
+        BMPmini_PERROR(__func__, BMPmini_FORMAT_ERR, "[ERROR]: only 24 and 32 bpp images can be written by tiles\n", 0);
+        return NULL;
+    }
+    uint64_t row_size = (__get_row_bytes(width, bitsperpixel) + 3) & ~(uint64_t) 3;
+    if (BMP_HEADER_SIZE + row_size * (uint32_t) height > UINT32_MAX) {
+        BMPmini_PERROR(__func__, BMPmini_OVERFLOW_ERR, "[OVERFLOW]: BMP image size overflow encountered\n", 0);
+        return NULL;
+    }
+
+    BMPmini_header header;
+    __init_header(&header, width, (flags & BMPmini_WRITE_BOTTOM_UP) ? height : -height, bitsperpixel);
+    return __tile_open(filename, &header, NULL, flags);
+}
+
+void BMPmini_tile_writer_info(BMPmini_tile_writer *w, BMPmini_info *info)
+{
+    assert(w && info);
+    __fill_info(&w->header, info);
+}
+
+// Full width tiles: padded rows are staged in file order, then written a
+// chunk at a time
+static int __write_rows(BMPmini_tile_writer *w, const BMPmini_view *tile, int32_t y)
+{
+    bool bottom_up = w->header.height_px > 0;
+    uint32_t first = bottom_up ? w->height - (uint32_t) (y + tile->height) : (uint32_t) y;
+    struct __stage st;
+    if (!__stage_init(&st, w, (size_t) w->row_size * (uint32_t) tile->height,
+                      w->header.offset + (uint64_t) first * w->row_size)) {
+        return BMPmini_NOMEM_ERR;
+    }
+
+    int res = BMPmini_SUCCESS;
+    size_t padding = w->row_size - w->row_bytes;
+    for (int32_t i = 0; i < tile->height && res == BMPmini_SUCCESS; i++) {
+        const uint8_t *row = tile->base + (bottom_up ? tile->height - 1 - i : i) * tile->stride;
+        uint8_t *dst = __stage_reserve(&st, w->row_size, &res);
+        memcpy(dst, row, w->row_bytes);
+        memset(dst + w->row_bytes, 0, padding);
+    }
+    if (res == BMPmini_SUCCESS) {
+        res = __stage_flush(&st, true);
+    }
+    free(st.buf);
+    return res;
+}
+
+int BMPmini_tile_writer_write(BMPmini_tile_writer *w, const BMPmini_view *tile, int32_t x, int32_t y)
+{
+    assert(w && tile);
+
+    if (tile->bitsperpixel != w->header.bitsperpixel) {
+        return BMPmini_FORMAT_ERR;
+    }
+    if (x < 0 || y < 0 || tile->width <= 0 || tile->height <= 0 || __int32_overflow(x, tile->width)
+        || __int32_overflow(y, tile->height) || x + tile->width > w->header.width_px
+        || (uint32_t) (y + tile->height) > w->height) {
+        return BMPmini_RANGE_ERR;
+    }
+
+    int res;
+    if (tile->width == w->header.width_px) {
+        res = __write_rows(w, tile, y);
+    }
+    else {
+        /* Partial rows are written where they are, padding stays as zeroed
+         * when the file was created */
+        size_t bpp = w->header.bitsperpixel / BMP_BITS_PER_BYTE;
+        bool bottom_up = w->header.height_px > 0;
+        res = BMPmini_SUCCESS;
+        for (int32_t i = 0; i < tile->height && res == BMPmini_SUCCESS; i++) {
+            uint32_t row = bottom_up ? w->height - 1 - (uint32_t) (y + i) : (uint32_t) (y + i);
+            uint64_t off = w->header.offset + (uint64_t) row * w->row_size + (uint64_t) x * bpp;
+            res = __write_at(w, tile->base + i * tile->stride, (size_t) tile->width * bpp, off);
+        }
+    }
+    if (res != BMPmini_SUCCESS) {
+        __fail_status(&w->status, res);
+    }
+    return res;
+}
+
+int BMPmini_tile_writer_close(BMPmini_tile_writer *w)
+{
+    assert(w);
+
+    int res = __close(w);
+    if (__get_status(&w->status) != BMPmini_SUCCESS) {
+        res = __get_status(&w->status);
+    }
+    free(w);
+    return res;
+}
+
+//-------------------------------------
+// Whole images
+//-------------------------------------
+struct __write_job {
+    BMPmini_tile_writer *w;
+    const uint8_t *pixels;
+};
+
+// Stored rows [first, last), which are in the file as in memory
+static void __write_band(void *arg, int32_t first, int32_t last)
+{
+    struct __write_job *job = arg;
+    BMPmini_tile_writer *w = job->w;
+    const uint8_t *src = job->pixels + (size_t) first * w->row_size;
+    size_t len = (size_t) (last - first) * w->row_size;
+    uint64_t off = w->header.offset + (uint64_t) first * w->row_size;
+
+    /* Without O_DIRECT the bytes need not be staged */
+    if (!__direct(w)) {
+        int res = __write_at(w, src, len, off);
+        if (res != BMPmini_SUCCESS) {
+            __fail_status(&w->status, res);
+        }
+        return;
+    }
+
+    struct __stage st;
+    if (!__stage_init(&st, w, len, off)) {
+        __fail_status(&w->status, BMPmini_NOMEM_ERR);
+        return;
+    }
+    int res = BMPmini_SUCCESS;
+    size_t piece = st.cap - 2 * BMP_DIRECT_ALIGN;
+    for (size_t i = 0; i < len && res == BMPmini_SUCCESS; i += piece) {
+        size_t n = len - i < piece ? len - i : piece;
+        memcpy(__stage_reserve(&st, n, &res), src + i, n);
+    }
+    if (res == BMPmini_SUCCESS) {
+        res = __stage_flush(&st, true);
+    }
+    if (res != BMPmini_SUCCESS) {
+        __fail_status(&w->status, res);
+    }
+    free(st.buf);
+}
+
+int BMPmini_write_parallel(const char *restrict filename, BMPmini_image *img, int flags, int nthreads)
+{
+    assert(img);
+
+    /* Compressed rows have no fixed place in the file */
+    if ((flags & BMPmini_WRITE_RLE) || __is_rle(&img->header)) {
+        return BMPmini_write_opts(filename, img, flags & BMPmini_WRITE_RLE);
+    }
+
+    BMPmini_tile_writer *w = __tile_open(filename, &img->header, img->data, flags);
+    if (!w) {
+        return BMPmini_FOPEN_ERR;
+    }
+    struct __write_job job = {w, BMPmini_pixels(img)};
+    __run_bands((int32_t) w->height, w->row_size, nthreads, __write_band, &job);
+    return BMPmini_tile_writer_close(w);
+}
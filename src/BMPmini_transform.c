@@ -0,0 +1,295 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMPmini_transform.c
+//
+// Rotations, flips and transposition of BMP images for BMPmini library
+//-----------------------------------------------------------------------------
+#include "BMPminidef.h"
+#include <string.h>
+#include <assert.h>
+
+// Pixels are transposed a square tile at a time: a tile of source rows and
+// the matching tile of destination rows both stay in the L1 cache, whereas
+// a whole destination column touches one cache line per row.
+#define BMP_TILE_PX 16
+
+// Rows are swapped in chunks of this size
+#define BMP_SWAP_CHUNK 1024
+
+struct __transform_job {
+    const BMPmini_view *src;
+    const BMPmini_view *dst;
+    size_t bpp;         // Bytes per pixel
+};
+
+// The view with its rows in the reverse order, sharing its pixels
+static inline BMPmini_view __flipped(const BMPmini_view *view)
+{
+    BMPmini_view out = *view;
+    out.base = view->base + (view->height - 1) * view->stride;
+    out.stride = -view->stride;
+    return out;
+}
+
+static bool __swaps_sides(int op)
+{
+    return op == BMPmini_ROTATE_90 || op == BMPmini_ROTATE_270 || op == BMPmini_TRANSPOSE;
+}
+
+//-------------------------------------
+// Kernels
+//-------------------------------------
+// Kernels take the pixel size as a constant, so that copies of 1, 3 or 4
+// bytes compile to plain loads and stores.
+static inline void __transpose_tile(const BMPmini_view *src, const BMPmini_view *dst, int32_t i0, int32_t i1,
+                                    int32_t j0, int32_t j1, const size_t bpp)
+{
+    /* Source row j goes to destination column j */
+    for (int32_t j = j0; j < j1; j++) {
+        const uint8_t *s = src->base + j * src->stride + i0 * bpp;
+        uint8_t *d = dst->base + i0 * dst->stride + j * bpp;
+        for (int32_t i = i0; i < i1; i++, s += bpp, d += dst->stride) {
+            memcpy(d, s, bpp);
+        }
+    }
+}
+
+static inline void __transpose_rows(const BMPmini_view *src, const BMPmini_view *dst, int32_t first, int32_t last,
+                                    const size_t bpp)
+{
+    for (int32_t i0 = first; i0 < last; i0 += BMP_TILE_PX) {
+        int32_t i1 = last - i0 < BMP_TILE_PX ? last : i0 + BMP_TILE_PX;
+        for (int32_t j0 = 0; j0 < dst->width; j0 += BMP_TILE_PX) {
+            int32_t j1 = dst->width - j0 < BMP_TILE_PX ? dst->width : j0 + BMP_TILE_PX;
+            __transpose_tile(src, dst, i0, i1, j0, j1, bpp);
+        }
+    }
+}
+
+// Reverses the pixels of a row, 'dst' may be 'src'
+static inline void __reverse_row(const uint8_t *src, uint8_t *dst, int32_t width, const size_t bpp)
+{
+    const uint8_t *s = src + (size_t) (width - 1) * bpp;
+    uint8_t *d = dst;
+    if (src == dst) {
+        for (int32_t j = 0; j < width / 2; j++, s -= bpp, d += bpp) {
+            uint8_t px[4];
+            memcpy(px, d, bpp);
+            memcpy(d, s, bpp);
+            memcpy((uint8_t *) s, px, bpp);
+        }
+        return;
+    }
+    for (int32_t j = 0; j < width; j++, s -= bpp, d += bpp) {
+        memcpy(d, s, bpp);
+    }
+}
+
+static inline void __reverse_rows(const BMPmini_view *src, const BMPmini_view *dst, int32_t first, int32_t last,
+                                  const size_t bpp)
+{
+    for (int32_t i = first; i < last; i++) {
+        __reverse_row(src->base + i * src->stride, dst->base + i * dst->stride, src->width, bpp);
+    }
+}
+
+static void __transpose_band(void *arg, int32_t first, int32_t last)
+{
+    struct __transform_job *job = arg;
+    switch (job->bpp) {
+    case 1:  __transpose_rows(job->src, job->dst, first, last, 1); break;
+    case 3:  __transpose_rows(job->src, job->dst, first, last, 3); break;
+    default: __transpose_rows(job->src, job->dst, first, last, 4); break;
+    }
+}
+
+static void __reverse_band(void *arg, int32_t first, int32_t last)
+{
+    struct __transform_job *job = arg;
+    switch (job->bpp) {
+    case 1:  __reverse_rows(job->src, job->dst, first, last, 1); break;
+    case 3:  __reverse_rows(job->src, job->dst, first, last, 3); break;
+    default: __reverse_rows(job->src, job->dst, first, last, 4); break;
+    }
+}
+
+// Swaps row i with its mirror, for the rows i in [first, last) of the top half
+static void __swap_band(void *arg, int32_t first, int32_t last)
+{
+    struct __transform_job *job = arg;
+    const BMPmini_view *view = job->src;
+    size_t row_bytes = (size_t) view->width * job->bpp;
+    uint8_t tmp[BMP_SWAP_CHUNK];
+    for (int32_t i = first; i < last; i++) {
+        uint8_t *a = view->base + i * view->stride;
+        uint8_t *b = view->base + (view->height - 1 - i) * view->stride;
+        for (size_t k = 0; k < row_bytes; k += BMP_SWAP_CHUNK) {
+            size_t n = row_bytes - k < BMP_SWAP_CHUNK ? row_bytes - k : BMP_SWAP_CHUNK;
+            memcpy(tmp, a + k, n);
+            memcpy(a + k, b + k, n);
+            memcpy(b + k, tmp, n);
+        }
+    }
+}
+
+//-------------------------------------
+// Views
+//-------------------------------------
+static bool __check_bpp(const BMPmini_view *view)
+{
+    return view->bitsperpixel == 8 || view->bitsperpixel == 24 || view->bitsperpixel == 32;
+}
+
+int BMPmini_transform_view(const BMPmini_view *src, const BMPmini_view *dst, int op, int nthreads)
+{
+    assert(src && dst);
+
+    if (!__check_bpp(src) || src->bitsperpixel != dst->bitsperpixel
+        || op < BMPmini_ROTATE_90 || op > BMPmini_TRANSPOSE) {
+        return BMPmini_FORMAT_ERR;
+    }
+    bool swap = __swaps_sides(op);
+    if (dst->width != (swap ? src->height : src->width) || dst->height != (swap ? src->width : src->height)) {
+        return BMPmini_RANGE_ERR;
+    }
+
+    size_t bpp = src->bitsperpixel / BMP_BITS_PER_BYTE;
+    size_t row_bytes = (size_t) dst->width * bpp;
+    BMPmini_view flipped;
+    struct __transform_job job = {src, dst, bpp};
+    switch (op) {
+    case BMPmini_FLIP_V:
+        flipped = __flipped(src);
+        BMPmini_copy_view(&flipped, dst, nthreads);
+        return BMPmini_SUCCESS;
+    case BMPmini_ROTATE_180:
+        /* A flip of the rows, then of the columns */
+        flipped = __flipped(src);
+        job.src = &flipped;
+        /* fall through */
+    case BMPmini_FLIP_H:
+        __run_bands(dst->height, row_bytes, nthreads, __reverse_band, &job);
+        return BMPmini_SUCCESS;
+    case BMPmini_ROTATE_90:
+        /* dst[i][j] = src[h - 1 - j][i] */
+        flipped = __flipped(src);
+        job.src = &flipped;
+        break;
+    case BMPmini_ROTATE_270:
+        /* dst[i][j] = src[j][w - 1 - i] */
+        flipped = __flipped(dst);
+        job.dst = &flipped;
+        break;
+    default:
+        break;
+    }
+    __run_bands(dst->height, row_bytes, nthreads, __transpose_band, &job);
+    return BMPmini_SUCCESS;
+}
+
+int BMPmini_flip_view(const BMPmini_view *view, int op, int nthreads)
+{
+    assert(view);
+
+    if (!__check_bpp(view) || (op != BMPmini_FLIP_H && op != BMPmini_FLIP_V && op != BMPmini_ROTATE_180)) {
+        return BMPmini_FORMAT_ERR;
+    }
+
+    size_t bpp = view->bitsperpixel / BMP_BITS_PER_BYTE;
+    size_t row_bytes = (size_t) view->width * bpp;
+    struct __transform_job job = {view, view, bpp};
+    if (op != BMPmini_FLIP_H) {
+        __run_bands(view->height / 2, 2 * row_bytes, nthreads, __swap_band, &job);
+    }
+    if (op != BMPmini_FLIP_V) {
+        __run_bands(view->height, row_bytes, nthreads, __reverse_band, &job);
+    }
+    return BMPmini_SUCCESS;
+}
+
+//-------------------------------------
+// Images
+//-------------------------------------
+int BMPmini_flip(BMPmini_image *img, int op)
+{
+    assert(img);
+
+    if (op != BMPmini_FLIP_H && op != BMPmini_FLIP_V && op != BMPmini_ROTATE_180) {
+        return BMPmini_FORMAT_ERR;
+    }
+
+    /* Rows only have to be stored in the other order, which every pixel
+     * format allows once decoded */
+    if (op == BMPmini_FLIP_V) {
+        img->header.height_px = -img->header.height_px;
+        return BMPmini_SUCCESS;
+    }
+
+    BMPmini_view view;
+    BMPmini_get_view(img, &view);
+    if (!__check_bpp(&view)) {
+        return BMPmini_FORMAT_ERR;
+    }
+    if (img->flags & _BMP_IMG_RDONLY) {
+        return BMPmini_BUFFER_ERR;
+    }
+    if (op == BMPmini_ROTATE_180) {
+        img->header.height_px = -img->header.height_px;
+    }
+    return BMPmini_flip_view(&view, BMPmini_FLIP_H, 0);
+}
+
+BMPmini_image *BMPmini_transform(BMPmini_image *img, int op)
+{
+    return BMPmini_transform_with(img, op, NULL);
+}
+
+BMPmini_image *BMPmini_transform_with(BMPmini_image *img, int op, const BMPmini_allocator *allocator)
+{
+    assert(img);
+
+    BMPmini_view view;
+    BMPmini_get_view(img, &view);
+    if (!__check_bpp(&view) || op < BMPmini_ROTATE_90 || op > BMPmini_TRANSPOSE) {
+        BMPmini_PERROR(__func__, BMPmini_FORMAT_ERR, "[ERROR]: unsupported pixel format or operation\n", 0);
+        return NULL;
+    }
+
+    /* Same header and color table, keeping the row order */
+    BMPmini_header newheader = img->header;
+    if (__swaps_sides(op)) {
+        newheader.width_px = view.height;
+        newheader.height_px = img->header.height_px < 0 ? -view.width : view.width;
+        newheader.x_res_ppm = img->header.y_res_ppm;
+        newheader.y_res_ppm = img->header.x_res_ppm;
+    }
+    uint32_t extra = newheader.offset - BMP_HEADER_SIZE;
+    uint64_t imgsz = __get_row_bytes(newheader.width_px, newheader.bitsperpixel);
+    imgsz = (imgsz + 3) / 4 * 4 * __get_abs_height(&newheader);
+    if (imgsz > UINT32_MAX - newheader.offset) {
+        BMPmini_PERROR(__func__, BMPmini_OVERFLOW_ERR, "[OVERFLOW]: BMP image size overflow encountered\n", 0);
+        return NULL;
+    }
+    newheader.image_size_bytes = __get_image_size_bytes(&newheader);
+    newheader.size = newheader.offset + newheader.image_size_bytes;
+
+    BMPmini_image *newimg = __alloc_image(&newheader, (size_t) newheader.image_size_bytes + extra, allocator);
+    if (!newimg) {
+        BMPmini_PERROR(__func__, BMPmini_NOMEM_ERR, "[ERROR]: malloc", 1);
+        return NULL;
+    }
+    memcpy(newimg->data, img->data, extra);
+
+    /* Padding bytes are zeroed once, kernels only write pixels */
+    BMPmini_view newview;
+    BMPmini_get_view(newimg, &newview);
+    uint32_t row_size = __get_image_row_size_bytes(&newheader);
+    size_t row_bytes = (size_t) newview.width * view.bitsperpixel / BMP_BITS_PER_BYTE;
+    if (row_size > row_bytes) {
+        for (int32_t i = 0; i < newview.height; i++) {
+            memset(newview.base + i * newview.stride + row_bytes, 0, row_size - row_bytes);
+        }
+    }
+    BMPmini_transform_view(&view, &newview, op, 0);
+    return newimg;
+}
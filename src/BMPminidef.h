@@ -14,13 +14,22 @@
 
 #define _BMP_FTELL_ERR -1L
 #define _BMP_FSEEK_ERR -2L
+#define _BMP_FSTAT_ERR -3L
+#define _BMP_SIZE_TRUSTED -4L  // File size not probed, trusted input
 
 #define BMP_HEADER_SIZE 54U
+#define BMP_FILE_HEADER_SIZE 14U  // Bytes before the DIB header
 #define DIB_HEADER_SIZE 40U
+#define DIB_V3_HEADER_SIZE 56U    // Smallest DIB header holding an alpha mask
+#define BMP_MASKS_SIZE 12U        // Red, green and blue masks of BI_BITFIELDS images
+#define BMP_MAX_PALETTE 256U
 // Values for the header
 #define BMP_MAGIC_VALUE      0x4D42
 #define BMP_NUM_PLANES       1
-#define BMP_COMPRESSION      0
+#define BMP_COMPRESSION      0  // BI_RGB
+#define BMP_BI_RLE8          1  // Run-length encoded, 8 bpp only
+#define BMP_BI_RLE4          2  // Run-length encoded, 4 bpp only
+#define BMP_BI_BITFIELDS     3  // Channels given by masks, 32 bpp only
 #define BMP_NUM_COLORS       0
 #define BMP_IMPORTANT_COLORS 0
 
@@ -60,9 +69,60 @@ struct _BMPmini_header {
 #endif
 #endif
 
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+  #define BMP_HAVE_MMAP 1
+  #define BMP_HAVE_PTHREAD 1
+  #define BMP_HAVE_PWRITE 1
+  #include <sys/stat.h>
+#endif
+
+// SIMD kernels are picked at run time on x86, NEON is always there on AArch64
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define BMP_HAVE_X86_SIMD 1
+#endif
+#if defined(__aarch64__) || (defined(__ARM_NEON) && defined(__ARM_NEON__))
+  #define BMP_HAVE_NEON 1
+#endif
+
+#if defined(__linux__) && defined(__GNUC__)
+  #if defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+      #define BMP_HAVE_IO_URING 1
+    #endif
+  #endif
+#endif
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+  #define BMP_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+  #define BMP_THREAD_LOCAL __thread
+#else
+  #define BMP_THREAD_LOCAL  // Single threaded use only
+#endif
+
+#define BMP_MAX_THREADS      256
+#define BMP_MIN_BAND_BYTES   (64U * 1024U)  // Smaller bands are not worth a thread
+#define BMP_BANDS_PER_THREAD 4
+#define BMP_STATS_BAND_BYTES (1024U * 1024U)  // Pixels read at once by BMPmini_read_stats and BMPmini_read_region
+#define BMP_REGION_MAX_GAP   (8U * 1024U)  // Bytes between rows read rather than skipped by BMPmini_read_region
+
+// Pixels of heap allocated images start on this boundary, so 32 bpp pixels
+// can be used in place as 4-byte words
+#define BMP_PIXEL_ALIGN 4
+
+// Values for BMPmini_image 'flags'
+#define _BMP_IMG_MAPPED 0x1U  // 'data' points into a file mapping
+#define _BMP_IMG_RDONLY 0x2U  // 'data' must not be written to
+
 struct _BMPmini_image {
     BMPmini_header header;
-    uint8_t data[FLEX_ARRAY];
+    uint8_t *data;             // Bytes following the BMP header (extra header bytes and pixels)
+    void *map_addr;            // Base address of the file mapping (mapped images only)
+    size_t map_len;            // Length of the file mapping (mapped images only)
+    uint32_t flags;            // _BMP_IMG_* flags
+    BMPmini_allocator alloc;   // Allocator this image was allocated with (heap allocated images only)
+    size_t alloc_size;         // Size of the allocation (heap allocated images only)
+    uint8_t buf[FLEX_ARRAY];   // Storage for 'data' on heap allocated images
 };
 
 //--------------------------------------------------------
@@ -72,19 +132,21 @@ struct _BMPmini_image {
 #define BMP_BITS_PER_BYTE    8
 #define BMP_BYTES_PER_PIXEL  (BMP_BITS_PER_PIXEL / BMP_BITS_PER_BYTE);
 
-#define BMPmini_PERROR(func, msg, flag)                           \
-    fprintf(stderr, "%s:%s:%lu: ", __FILE__, func, __LINE__+0UL); \
-    BMPmini_perror(msg, flag)
+// Reports an error with its BMPmini status code: to the handler set by
+// BMPmini_set_error_handler if any, to stderr otherwise. 'flag' tells errno
+// is meaningful, messages tagged "[WARN]" are warnings.
+#define BMPmini_PERROR(func, status, msg, flag) \
+    __report_error(__FILE__, func, __LINE__+0UL, status, msg, flag)
 
-static inline void BMPmini_perror(const char *restrict msg, bool flag)
-{
-    if (flag) {
-        perror(msg);
-    }
-    else {
-        fputs(msg, stderr);
-    }
-}
+void __report_error(const char *file, const char *func, unsigned long line, int status, const char *restrict msg,
+                    bool syserr);
+
+// Reports a failed status code with its BMPmini_strerror text, errno being
+// meaningful only for the failures of file operations
+#define __perror_status(func, status) \
+    __report_status(__FILE__, func, __LINE__+0UL, status)
+
+void __report_status(const char *file, const char *func, unsigned long line, int status);
 
 static inline bool __st_overflow(size_t a, size_t b)
 {
@@ -107,51 +169,230 @@ static inline bool __int32_overflow(int32_t a, int32_t b)
 //-----------------------------------
 static inline long __get_file_size(FILE *imgfp)
 {
+#if defined(BMP_HAVE_MMAP)
+    /* A single fstat instead of seeking to the end and back */
+    struct stat st;
+    if (fstat(fileno(imgfp), &st) == -1) {
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[ERROR]: an error occurred in fstat: ", 1);
+        return _BMP_FSTAT_ERR;
+    }
+    if ((uintmax_t) st.st_size > LONG_MAX) {
+        return _BMP_FSTAT_ERR;
+    }
+    return (long) st.st_size;
+#else
     long curr_pos = ftell(imgfp); // Store original file position
     if (curr_pos == -1L) {
-        BMPmini_PERROR(__func__, "[ERROR]: an error occurred in ftell: ", 1);
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[ERROR]: an error occurred in ftell: ", 1);
         return _BMP_FTELL_ERR;
     }
 
     if (fseek(imgfp, 0, SEEK_END)) {
-        BMPmini_PERROR(__func__, "[ERROR]: an error occurred in fseek: ", 1);
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[ERROR]: an error occurred in fseek: ", 1);
         return _BMP_FSEEK_ERR;
     }
 
     long file_size = ftell(imgfp);
     if (file_size == -1L) {
-        BMPmini_PERROR(__func__, "[ERROR]: an error occurred in ftell: ", 1);
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[ERROR]: an error occurred in ftell: ", 1);
         return _BMP_FTELL_ERR;
     }
 
     if (fseek(imgfp, curr_pos, SEEK_SET)) {
-        BMPmini_PERROR(__func__, "[ERROR]: an error occurred in fseek: ", 1);
+        BMPmini_PERROR(__func__, BMPmini_FREAD_ERR, "[ERROR]: an error occurred in fseek: ", 1);
         return _BMP_FSEEK_ERR;
     }
 
     return file_size;
+#endif
 }
 
-static inline uint32_t __get_bytes_per_pixel(BMPmini_header *restrict header)
+static inline uint64_t __get_row_bytes(int32_t width, uint32_t bitsperpixel)
 {
-    return header->bitsperpixel / BMP_BITS_PER_BYTE;
+    // Pixel bytes of a row, a partly used last byte included
+    return ((uint64_t) (uint32_t) width * bitsperpixel + BMP_BITS_PER_BYTE - 1) / BMP_BITS_PER_BYTE;
+}
+
+static inline uint32_t __get_image_row_size_bytes(BMPmini_header *restrict header)
+{
+    // BMP rows are padded to a multiple of 4 bytes
+    return (uint32_t) ((__get_row_bytes(header->width_px, header->bitsperpixel) + 3) & ~(uint64_t) 3);
 }
 
 static inline uint32_t __get_padding(BMPmini_header *restrict header)
 {
-    // BMP padding is (4 - <byte width> % 4) % 4
-    return (4 - header->width_px * __get_bytes_per_pixel(header) % 4) % 4;
+    return __get_image_row_size_bytes(header) - (uint32_t) __get_row_bytes(header->width_px, header->bitsperpixel);
 }
 
-static inline uint32_t __get_image_row_size_bytes(BMPmini_header *restrict header)
+static inline uint32_t __get_abs_height(BMPmini_header *restrict header)
 {
-    uint32_t bytes_per_row_no_padding = header->width_px * __get_bytes_per_pixel(header);
-    return bytes_per_row_no_padding + __get_padding(header);
+    // Negative heights describe Top-Down DIBs
+    return header->height_px < 0 ? 0U - (uint32_t) header->height_px : (uint32_t) header->height_px;
 }
 
 static inline uint32_t __get_image_size_bytes(BMPmini_header *restrict header)
 {
-    return __get_image_row_size_bytes(header) * header->height_px;
+    return __get_image_row_size_bytes(header) * __get_abs_height(header);
+}
+
+static inline uint32_t __get_palette_entries(BMPmini_header *restrict header)
+{
+    // Paletted images without a color count use every possible index
+    if (header->bitsperpixel <= BMP_BITS_PER_BYTE && header->num_colors == 0) {
+        return 1U << header->bitsperpixel;
+    }
+    return header->num_colors;
+}
+
+static inline bool __is_rle(BMPmini_header *restrict header)
+{
+    return header->compression == BMP_BI_RLE8 || header->compression == BMP_BI_RLE4;
+}
+
+static inline uint32_t __get_palette_offset(BMPmini_header *restrict header)
+{
+    // Masks of BI_BITFIELDS images follow a 40 byte DIB header, bigger ones hold them
+    uint32_t offset = BMP_FILE_HEADER_SIZE + header->dib_header_size;
+    if (header->compression == BMP_BI_BITFIELDS && header->dib_header_size < DIB_HEADER_SIZE + BMP_MASKS_SIZE) {
+        offset += BMP_MASKS_SIZE;
+    }
+    return offset;
+}
+
+//-----------------------------------
+// Shared between translation units
+//-----------------------------------
+void __parse_bytes2hdr(BMPmini_header *header, unsigned char *hdrdata);
+void __parse_hdr2bytes(BMPmini_header header, unsigned char *hdrdata);
+void __init_header(BMPmini_header *header, int32_t width, int32_t height, uint16_t bitsperpixel);
+bool __check_header(BMPmini_header *restrict header, long file_size);
+void __fill_info(BMPmini_header *restrict header, BMPmini_info *info);
+const BMPmini_allocator *__get_allocator(const BMPmini_allocator *allocator);
+BMPmini_image *__alloc_image(BMPmini_header *restrict header, size_t datasz, const BMPmini_allocator *allocator);
+void __free_image(BMPmini_image *img);
+// Reads an image without printing anything, returns a BMPmini status code
+int __read_image(const char *restrict filename, BMPmini_image **out, const BMPmini_allocator *allocator);
+
+// Reads the region of an open BMP file starting in (x, y), of the size of
+// 'dst', into 'dst' and zeroes 'padding' bytes after each row. The region
+// must fit in the image and start on a byte boundary. Can be called from
+// several threads at once. Returns a BMPmini status code.
+int __read_region_into(FILE *imgfp, BMPmini_header *header, int32_t x, int32_t y, const BMPmini_view *dst,
+                       uint32_t padding);
+
+// Decodes a 'len' bytes RLE4/RLE8 stream, read from 'fp' or from 'data' if
+// 'fp' is NULL, into the Bottom-Up rows of 'pixels'. 'header' describes the
+// decoded image. Returns a BMPmini status code.
+int __rle_decode(FILE *fp, const uint8_t *data, size_t len, BMPmini_header *header, uint8_t *pixels);
+// Turns the header of an RLE image into that of the decoded image
+void __rle_decoded_header(BMPmini_header *header);
+// Decodes an RLE image whose bytes following the BMP header are in 'data'
+int __rle_decode_image(BMPmini_header *header, const uint8_t *data, BMPmini_image **out,
+                       const BMPmini_allocator *allocator);
+// Writes the pixels of a 4 or 8 bpp image RLE compressed, their size goes to 'size'
+int __rle_encode(FILE *fp, BMPmini_image *img, uint32_t *size);
+
+// SIMD instruction sets kernels may use, none once disabled by BMPmini_set_simd
+#define BMP_SIMD_SSSE3 0x1U
+#define BMP_SIMD_AVX2  0x2U
+#define BMP_SIMD_NEON  0x4U
+unsigned __simd_caps(void);
+
+// Resampling of 24 bpp pixels along one dimension, see BMPmini_resize.c
+struct __coeffs {
+    int32_t *start;    // First source pixel of each output pixel
+    int16_t *weights;  // 'ksize' weights per output pixel, 0 past the last tap
+    int ksize;         // A multiple of 4, so kernels can take taps 4 or 2 at a time
+};
+bool __compute_coeffs(struct __coeffs *c, int filter, int32_t src_n, int32_t dst_n);
+void __free_coeffs(struct __coeffs *c);
+
+// Vertical passes compute bytes [k, n) of a row, horizontal ones 'n' pixels
+typedef void (*__vpass_fn)(const uint8_t *const *rows, const int16_t *weights, int ksize, uint8_t *dst, size_t k, size_t n);
+typedef void (*__hpass_fn)(const uint8_t *src, size_t src_bytes, const struct __coeffs *c, uint8_t *dst, int32_t n);
+// Picks the kernels of both passes for this CPU
+void __resize_kernels(__vpass_fn *vpass, __hpass_fn *hpass);
+
+// Adds the rows of a view to statistics, before the rows added so far if
+// 'prepend', see BMPmini_stats.c
+int __stats_update(BMPmini_stats *stats, const BMPmini_view *view, int nthreads, bool prepend);
+
+// Phase timing of BMPmini_set_metrics, see BMPmini_diag.c. A phase started
+// while metrics are off is not counted.
+extern bool __metrics_on;
+uint64_t __metrics_now(void);
+void __metrics_add(int phase, uint64_t start, uint64_t bytes);
+void __metrics_error(void);
+#define BMP_PHASE_START(t) uint64_t t = __metrics_on ? __metrics_now() : 0
+#define BMP_PHASE_STOP(t, phase, bytes)        \
+    do {                                       \
+        if (t) {                               \
+            __metrics_add(phase, t, bytes);    \
+        }                                      \
+    } while (0)
+
+// fopen and fclose timed as BMPmini_PHASE_OPEN
+static inline FILE *__open_file(const char *restrict filename, const char *restrict mode)
+{
+    BMP_PHASE_START(t);
+    FILE *fp = fopen(filename, mode);
+    BMP_PHASE_STOP(t, BMPmini_PHASE_OPEN, 0);
+    return fp;
+}
+
+static inline int __close_file(FILE *fp)
+{
+    BMP_PHASE_START(t);
+    int res = fclose(fp);
+    BMP_PHASE_STOP(t, BMPmini_PHASE_OPEN, 0);
+    return res;
+}
+
+// Processes rows [first, last) of a job
+typedef void (*__band_fn)(void *arg, int32_t first, int32_t last);
+int __resolve_threads(int nthreads);
+void __run_bands(int32_t rows, size_t row_bytes, int nthreads, __band_fn fn, void *arg);
+
+// Status shared by the bands of a job: the first error is kept, later ones
+// are dropped, and bands may poll it to stop early
+static inline void __fail_status(int *status, int res)
+{
+#if defined(__GNUC__)
+    int expected = BMPmini_SUCCESS;
+    __atomic_compare_exchange_n(status, &expected, res, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+#else
+    if (*status == BMPmini_SUCCESS) {
+        *status = res;
+    }
+#endif
+}
+
+static inline int __get_status(const int *status)
+{
+#if defined(__GNUC__)
+    return __atomic_load_n(status, __ATOMIC_RELAXED);
+#else
+    return *status;
+#endif
+}
+
+// Flag read and changed by the bands of a job
+static inline bool __get_flag(const bool *flag)
+{
+#if defined(__GNUC__)
+    return __atomic_load_n(flag, __ATOMIC_RELAXED);
+#else
+    return *flag;
+#endif
+}
+
+static inline void __set_flag(bool *flag, bool value)
+{
+#if defined(__GNUC__)
+    __atomic_store_n(flag, value, __ATOMIC_RELAXED);
+#else
+    *flag = value;
+#endif
 }
 
 #endif
@@ -0,0 +1,46 @@
+//-----------------------------------------------------------------------------
+// C Header file:
+//              BMP_bench.h
+//
+// Helpers shared by the benchmarks of BMPmini library, included first by
+// each of them
+//-----------------------------------------------------------------------------
+#ifndef _BMP_BENCH_H_
+#define _BMP_BENCH_H_ 1
+
+#define _POSIX_C_SOURCE 200809L
+#include <BMPmini.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Seconds on a monotonic clock, only meaningful as differences
+static inline double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Stops the benchmark, telling what failed and the last system error
+static inline void die(const char *msg)
+{
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+// Runs the statements after 'per_run' again and again for at least 'seconds',
+// then sets 'per_run' to the mean seconds of a run
+#define BENCH_REPEAT(seconds, per_run, ...)    \
+    do {                                       \
+        unsigned iters_ = 0;                   \
+        double start_ = now(), elapsed_;       \
+        do {                                   \
+            __VA_ARGS__;                       \
+            iters_++;                          \
+            elapsed_ = now() - start_;         \
+        } while (elapsed_ < (seconds));        \
+        (per_run) = elapsed_ / iters_;         \
+    } while (0)
+
+#endif
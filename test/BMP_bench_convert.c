@@ -0,0 +1,77 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_convert.c
+//
+// Measures the throughput of BMPmini_convert with the SIMD kernels picked
+// for this CPU against the scalar reference, and checks they agree.
+// Usage: BMP_bench_convert [width] [height]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <string.h>
+
+#define BMP_BYTES_PER_PIXEL 3U  // RGB
+#define BENCH_MIN_SECONDS 0.25
+
+static const struct {
+    int format;
+    const char *name;
+    size_t bytes_per_pixel;
+} formats[] = {
+    {BMPmini_FMT_RGBA32, "BGR24 -> RGBA32", 4},
+    {BMPmini_FMT_GRAY8, "BGR24 -> GRAY8", 1},
+    {BMPmini_FMT_PLANAR_F32, "BGR24 -> PLANAR_F32", 3 * sizeof(float)},
+};
+
+static double bench(const BMPmini_view *view, int format, void *dst)
+{
+    double seconds;
+    BENCH_REPEAT(BENCH_MIN_SECONDS, seconds, BMPmini_convert(view, format, dst, 0, 1));
+    return (double) view->width * view->height * BMP_BYTES_PER_PIXEL / seconds / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Odd sizes exercise the scalar tails of the SIMD kernels */
+    int32_t width = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 4093;
+    int32_t height = argc > 2 ? (int32_t) strtol(argv[2], NULL, 10) : 2047;
+
+    size_t npixels = (size_t) width * height;
+    uint8_t *pixels = malloc(npixels * BMP_BYTES_PER_PIXEL);
+    uint8_t *ref = malloc(npixels * 3 * sizeof(float));
+    uint8_t *out = malloc(npixels * 3 * sizeof(float));
+    if (!pixels || !ref || !out) {
+        die("malloc failed");
+    }
+    srand(1);
+    for (size_t i = 0; i < npixels * BMP_BYTES_PER_PIXEL; i++) {
+        pixels[i] = (uint8_t) rand();
+    }
+    BMPmini_view view = {pixels, (ptrdiff_t) width * BMP_BYTES_PER_PIXEL, width, height, BMP_BYTES_PER_PIXEL * 8};
+
+    printf("%"PRId32"x%"PRId32", single thread, MB/s of BGR24 input\n", width, height);
+    int res = EXIT_SUCCESS;
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        size_t outsz = npixels * formats[f].bytes_per_pixel;
+
+        BMPmini_set_simd(false);
+        BMPmini_convert(&view, formats[f].format, ref, 0, 1);
+        double scalar = bench(&view, formats[f].format, out);
+
+        BMPmini_set_simd(true);
+        memset(out, 0, outsz);
+        BMPmini_convert(&view, formats[f].format, out, 0, 1);
+        bool same = !memcmp(ref, out, outsz);
+        double simd = bench(&view, formats[f].format, out);
+
+        printf("%-20s scalar %9.1f  %-6s %9.1f  x%.2f  %s\n", formats[f].name, scalar,
+               BMPmini_simd_name(), simd, simd / scalar, same ? "ok" : "MISMATCH");
+        if (!same) {
+            res = EXIT_FAILURE;
+        }
+    }
+
+    free(pixels);
+    free(ref);
+    free(out);
+    return res;
+}
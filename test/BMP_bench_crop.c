@@ -0,0 +1,64 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_crop.c
+//
+// Measures the throughput of BMPmini_crop for square images from 64x64 up to
+// 16k x 16k (or the size given as the first argument), using the number of
+// threads given as the second argument (0 for one per CPU).
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+
+#define BMP_BYTES_PER_PIXEL 3U  // RGB
+#define BENCH_MIN_SECONDS 0.25
+
+static void bench_crop(int32_t size)
+{
+    size_t stride = (size_t) size * BMP_BYTES_PER_PIXEL;
+    uint8_t *pixels = malloc(stride * size);
+    if (!pixels) {
+        die("malloc failed");
+    }
+    for (size_t i = 0; i < stride * size; i++) {
+        pixels[i] = (uint8_t) i;
+    }
+
+    BMPmini_view view = {pixels, (ptrdiff_t) stride, size, size, BMP_BYTES_PER_PIXEL * 8};
+    BMPmini_image *img = BMPmini_image_from_view(&view);
+    free(pixels);
+    if (!img) {
+        fprintf(stderr, "[ERROR]: failed to create a %"PRId32"x%"PRId32" image\n", size, size);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Crop all but a one pixel border, so rows start unaligned */
+    int32_t w = size - 2;
+    size_t bytes = 0;
+    unsigned iters = 0;
+    double start = now(), elapsed;
+    do {
+        BMPmini_image *newimg = BMPmini_crop(img, 1, 1, w, w);
+        if (!newimg) {
+            fprintf(stderr, "[ERROR]: crop failed\n");
+            exit(EXIT_FAILURE);
+        }
+        BMPmini_free(newimg);
+        bytes += (size_t) w * w * BMP_BYTES_PER_PIXEL;
+        iters++;
+        elapsed = now() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+
+    printf("%6"PRId32" x %-6"PRId32" %8u crops  %10.3f ms/crop  %8.2f GB/s\n",
+           size, size, iters, elapsed * 1e3 / iters, bytes / elapsed / 1e9);
+    BMPmini_free(img);
+}
+
+int main(int argc, char *argv[])
+{
+    int32_t max_size = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 16384;
+    BMPmini_set_threads(argc > 2 ? (int) strtol(argv[2], NULL, 10) : 1);
+    printf("threads: %d\n", BMPmini_get_threads());
+    for (int32_t size = 64; size <= max_size; size *= 2) {
+        bench_crop(size);
+    }
+    return 0;
+}
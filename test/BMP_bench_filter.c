@@ -0,0 +1,83 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_filter.c
+//
+// Measures the throughput of the neighborhood filters with the SIMD kernels
+// picked for this CPU against the scalar reference, and checks they agree.
+// Box blurs of growing radius show their cost does not depend on it.
+// Usage: BMP_bench_filter [width] [height]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <string.h>
+
+#define BENCH_MIN_SECONDS 0.25
+
+static const struct {
+    int op;
+    float param;
+    const char *name;
+} filters[] = {
+    {BMPmini_BLUR_BOX, 1.0f, "box r=1"},
+    {BMPmini_BLUR_BOX, 8.0f, "box r=8"},
+    {BMPmini_BLUR_BOX, 64.0f, "box r=64"},
+    {BMPmini_BLUR_GAUSSIAN, 1.0f, "gaussian 1"},
+    {BMPmini_BLUR_GAUSSIAN, 3.0f, "gaussian 3"},
+    {BMPmini_SHARPEN, 1.5f, "sharpen"},
+    {BMPmini_EDGES_SOBEL, 0.0f, "sobel"},
+};
+
+static double bench(const BMPmini_view *src, const BMPmini_view *dst, int op, float param)
+{
+    double seconds;
+    BENCH_REPEAT(BENCH_MIN_SECONDS, seconds, BMPmini_filter_view(src, dst, op, param, BMPmini_BORDER_MIRROR, 1));
+    return (double) src->width * src->height * (src->bitsperpixel / 8) / seconds / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Odd sizes exercise the scalar tails of the SIMD kernels */
+    int32_t width = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 2045;
+    int32_t height = argc > 2 ? (int32_t) strtol(argv[2], NULL, 10) : 1023;
+
+    size_t size = (size_t) width * height * 4;
+    uint8_t *pixels = malloc(size);
+    uint8_t *ref = malloc(size);
+    uint8_t *out = malloc(size);
+    if (!pixels || !ref || !out) {
+        die("malloc failed");
+    }
+    srand(1);
+    for (size_t i = 0; i < size; i++) {
+        pixels[i] = (uint8_t) rand();
+    }
+
+    printf("%"PRId32"x%"PRId32", single thread, MB/s of pixels\n", width, height);
+    int res = EXIT_SUCCESS;
+    for (uint16_t bpp = 24; bpp <= 32; bpp += 8) {
+        ptrdiff_t stride = (ptrdiff_t) width * (bpp / 8);
+        BMPmini_view src = {pixels, stride, width, height, bpp};
+        BMPmini_view dst_ref = {ref, stride, width, height, bpp};
+        BMPmini_view dst = {out, stride, width, height, bpp};
+        for (size_t f = 0; f < sizeof(filters) / sizeof(filters[0]); f++) {
+            BMPmini_set_simd(false);
+            BMPmini_filter_view(&src, &dst_ref, filters[f].op, filters[f].param, BMPmini_BORDER_MIRROR, 1);
+            double scalar = bench(&src, &dst_ref, filters[f].op, filters[f].param);
+
+            BMPmini_set_simd(true);
+            BMPmini_filter_view(&src, &dst, filters[f].op, filters[f].param, BMPmini_BORDER_MIRROR, 1);
+            bool same = !memcmp(ref, out, (size_t) stride * height);
+            double simd = bench(&src, &dst, filters[f].op, filters[f].param);
+
+            printf("%2u bpp %-11s scalar %8.1f  %-6s %8.1f  x%.2f  %s\n", bpp, filters[f].name, scalar,
+                   BMPmini_simd_name(), simd, simd / scalar, same ? "ok" : "MISMATCH");
+            if (!same) {
+                res = EXIT_FAILURE;
+            }
+        }
+    }
+
+    free(pixels);
+    free(ref);
+    free(out);
+    return res;
+}
@@ -0,0 +1,212 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_hash.c
+//
+// Measures the throughput of content hashes against a plain FNV-1a loop and
+// hashing a whole file, with and without the SIMD kernels, and of image
+// differences against a plain pixel by pixel loop.
+// Usage: BMP_bench_hash [width] [height]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <string.h>
+
+#define BENCH_MIN_SECONDS 0.25
+#define BENCH_FILE "BMP_bench_hash.bmp"
+#define BENCH_CHANGED 64  // Side of the square changed in the middle for diffs
+
+enum { RUN_FNV, RUN_FNV_FILE, RUN_HASH, RUN_READ_HASH, RUN_STREAM_HASH, RUN_PLAIN_DIFF, RUN_DIFF };
+
+static uint64_t hash;
+static BMPmini_rect box;
+
+// FNV-1a over the rows, the usual byte at a time hash
+static uint64_t fnv1a(uint64_t h, const uint8_t *p, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ p[i]) * UINT64_C(0x100000001B3);
+    }
+    return h;
+}
+
+// The whole file, header included, as hashed outside of the library
+static uint64_t fnv1a_file(void)
+{
+    static uint8_t buf[1 << 16];
+    uint64_t h = UINT64_C(0xCBF29CE484222325);
+    FILE *fp = fopen(BENCH_FILE, "rb");
+    size_t n;
+    while (fp && (n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        h = fnv1a(h, buf, n);
+    }
+    if (fp) {
+        fclose(fp);
+    }
+    return h;
+}
+
+// Hash of the file read a band of rows at a time
+static uint64_t stream_hash(void)
+{
+    BMPmini_reader *reader = BMPmini_reader_open(BENCH_FILE);
+    if (!reader) {
+        return 0;
+    }
+    BMPmini_info info;
+    BMPmini_reader_info(reader, &info);
+    size_t batch = info.row_size < 65536 ? 65536 / info.row_size : 1;
+    uint8_t *rows = malloc(batch * info.row_size);
+    BMPmini_hash_state state;
+    BMPmini_hash_init(&state);
+    size_t n;
+    while (rows && (n = BMPmini_reader_read_rows(reader, rows, batch)) > 0) {
+        BMPmini_view band = {rows, (ptrdiff_t) info.row_size, info.width, (int32_t) n, info.bitsperpixel};
+        BMPmini_hash_update(&state, &band);
+    }
+    BMPmini_reader_close(reader);
+    free(rows);
+    return BMPmini_hash_final(&state);
+}
+
+// Bounding box of the pixels that differ, comparing them one by one
+static void plain_diff(const BMPmini_view *a, const BMPmini_view *b)
+{
+    int32_t x0 = a->width, y0 = a->height, x1 = -1, y1 = -1;
+    for (int32_t i = 0; i < a->height; i++) {
+        const uint8_t *p = a->base + i * a->stride, *q = b->base + i * b->stride;
+        for (int32_t j = 0; j < a->width; j++, p += 3, q += 3) {
+            if (p[0] != q[0] || p[1] != q[1] || p[2] != q[2]) {
+                x0 = j < x0 ? j : x0;
+                x1 = j > x1 ? j : x1;
+                y0 = i < y0 ? i : y0;
+                y1 = i;
+            }
+        }
+    }
+    box = (BMPmini_rect) {0, 0, 0, 0};
+    if (y1 >= 0) {
+        box = (BMPmini_rect) {x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+    }
+}
+
+static void run(const BMPmini_view *view, const BMPmini_view *other, int what, int nthreads)
+{
+    BMPmini_image *img;
+    switch (what) {
+    case RUN_FNV:
+        hash = UINT64_C(0xCBF29CE484222325);
+        for (int32_t i = 0; i < view->height; i++) {
+            hash = fnv1a(hash, view->base + i * view->stride, (size_t) view->width * 3);
+        }
+        break;
+    case RUN_FNV_FILE:
+        hash = fnv1a_file();
+        break;
+    case RUN_HASH:
+        BMPmini_hash_view(view, &hash);
+        break;
+    case RUN_READ_HASH:
+        img = BMPmini_read(BENCH_FILE);
+        BMPmini_hash(img, &hash);
+        BMPmini_free(img);
+        break;
+    case RUN_STREAM_HASH:
+        hash = stream_hash();
+        break;
+    case RUN_PLAIN_DIFF:
+        plain_diff(view, other);
+        break;
+    default:
+        BMPmini_diff_view(view, other, &box, nthreads);
+        break;
+    }
+}
+
+static double bench(const BMPmini_view *view, const BMPmini_view *other, int what, int nthreads)
+{
+    double seconds;
+    BENCH_REPEAT(BENCH_MIN_SECONDS, seconds, run(view, other, what, nthreads));
+    return (double) view->width * view->height * 3 / seconds / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Odd sizes exercise the scalar tails of the SIMD kernels */
+    int32_t width = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 4093;
+    int32_t height = argc > 2 ? (int32_t) strtol(argv[2], NULL, 10) : 2047;
+
+    size_t size = (size_t) width * height * 3;
+    uint8_t *pixels = malloc(size), *copy = malloc(size);
+    if (!pixels || !copy) {
+        die("malloc failed");
+    }
+    srand(1);
+    for (size_t i = 0; i < size; i++) {
+        pixels[i] = (uint8_t) rand();
+    }
+    BMPmini_view view = {pixels, (ptrdiff_t) width * 3, width, height, 24};
+    /* Bottom-Up files store their last row first, the hash must not see it */
+    if (BMPmini_write_view(BENCH_FILE, &view) != BMPmini_SUCCESS) {
+        fprintf(stderr, "cannot write %s\n", BENCH_FILE);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Hashes have to agree whichever kernels and whichever path compute them */
+    uint64_t ref;
+    BMPmini_set_simd(false);
+    BMPmini_hash_view(&view, &ref);
+    BMPmini_set_simd(true);
+    bool same = true;
+    for (int what = RUN_HASH; what <= RUN_STREAM_HASH; what++) {
+        run(&view, NULL, what, 0);
+        same = same && hash == ref;
+    }
+
+    printf("%"PRId32"x%"PRId32", MB/s of pixels\n", width, height);
+    double fnv = bench(&view, NULL, RUN_FNV, 1);
+    double simd = bench(&view, NULL, RUN_HASH, 1);
+    BMPmini_set_simd(false);
+    double scalar = bench(&view, NULL, RUN_HASH, 1);
+    BMPmini_set_simd(true);
+    printf("hash        fnv-1a %8.1f  scalar %9.1f  %-6s %9.1f  x%.1f  %s\n", fnv, scalar, BMPmini_simd_name(), simd,
+           simd / fnv, same ? "ok" : "MISMATCH");
+
+    double file = bench(&view, NULL, RUN_FNV_FILE, 1);
+    double read = bench(&view, NULL, RUN_READ_HASH, 1);
+    double stream = bench(&view, NULL, RUN_STREAM_HASH, 1);
+    printf("file hash   fnv-1a %8.1f  read+hash %6.1f  streamed %7.1f  x%.1f\n", file, read, stream, stream / file);
+
+    /* A square changed in the middle, and no change at all */
+    BMPmini_view other = {copy, (ptrdiff_t) width * 3, width, height, 24};
+    int32_t side = BENCH_CHANGED < width && BENCH_CHANGED < height ? BENCH_CHANGED : 1;
+    BMPmini_rect expected = {(width - side) / 2, (height - side) / 2, side, side};
+    for (int changed = 1; changed >= 0; changed--) {
+        memcpy(copy, pixels, size);
+        if (changed) {
+            for (int32_t i = 0; i < side; i++) {
+                uint8_t *p = copy + (size_t) (expected.y + i) * width * 3 + (size_t) expected.x * 3;
+                for (int32_t j = 0; j < side * 3; j++) {
+                    p[j] ^= (uint8_t) (i == 0 || j == 0 || i == side - 1 || j == side * 3 - 1 ? 0xFF : 0);
+                }
+            }
+        }
+        else {
+            expected = (BMPmini_rect) {0, 0, 0, 0};
+        }
+        run(&view, &other, RUN_PLAIN_DIFF, 1);
+        bool ok = !memcmp(&box, &expected, sizeof(box));
+        run(&view, &other, RUN_DIFF, 1);
+        ok = ok && !memcmp(&box, &expected, sizeof(box));
+
+        double plain = bench(&view, &other, RUN_PLAIN_DIFF, 1);
+        double diff = bench(&view, &other, RUN_DIFF, 1);
+        double threaded = bench(&view, &other, RUN_DIFF, 0);
+        printf("diff %-7s plain %9.1f  %-6s %9.1f  x%.1f  threads %9.1f  %s\n", changed ? "square" : "none", plain,
+               BMPmini_simd_name(), diff, diff / plain, threaded, ok ? "ok" : "MISMATCH");
+        same = same && ok;
+    }
+
+    remove(BENCH_FILE);
+    free(pixels);
+    free(copy);
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,107 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_metrics.c
+//
+// Measures what BMPmini_set_metrics costs on small reads, writes and crops,
+// where phases are shortest, and prints where the time of each went.
+// Usage: BMP_bench_metrics [size] [directory]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <unistd.h>
+
+#define BENCH_MIN_SECONDS 0.5
+#define BENCH_ROUNDS 5
+#define PATH_SIZE 4096
+
+enum { RUN_READ, RUN_WRITE, RUN_CROP, RUNS };
+
+static const char *const run_names[RUNS] = {"read", "write", "crop"};
+
+static BMPmini_image *img;
+static int32_t size;
+static char path[PATH_SIZE];
+
+static void run(int what)
+{
+    BMPmini_image *out;
+    switch (what) {
+    case RUN_READ:
+        out = BMPmini_read(path);
+        if (!out) {
+            die("read failed");
+        }
+        BMPmini_free(out);
+        break;
+    case RUN_WRITE:
+        if (BMPmini_write(path, img) != BMPmini_SUCCESS) {
+            die("write failed");
+        }
+        break;
+    default:
+        out = BMPmini_crop(img, 1, 1, size - 2, size - 2);
+        if (!out) {
+            die("crop failed");
+        }
+        BMPmini_free(out);
+        break;
+    }
+}
+
+// Best of a few rounds, in microseconds per call
+static double bench(int what)
+{
+    double best = 0;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        double seconds;
+        BENCH_REPEAT(BENCH_MIN_SECONDS / BENCH_ROUNDS, seconds, run(what));
+        double us = seconds * 1e6;
+        best = round == 0 || us < best ? us : best;
+    }
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    size = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 64;
+    const char *dir = argc > 2 ? argv[2] : ".";
+    snprintf(path, sizeof(path), "%s/BMP_bench_metrics_%ld.bmp", dir, (long) getpid());
+
+    uint8_t *pixels = malloc((size_t) size * size * 3);
+    if (!pixels) {
+        die("malloc failed");
+    }
+    srand(1);
+    for (size_t i = 0; i < (size_t) size * size * 3; i++) {
+        pixels[i] = (uint8_t) rand();
+    }
+    BMPmini_view src = {pixels, (ptrdiff_t) size * 3, size, size, 24};
+    img = BMPmini_image_from_view(&src);
+    if (!img) {
+        die("image failed");
+    }
+    run(RUN_WRITE);
+
+    printf("%"PRId32"x%"PRId32", us per call\n", size, size);
+    for (int what = 0; what < RUNS; what++) {
+        BMPmini_set_metrics(false);
+        double off = bench(what);
+        BMPmini_set_metrics(true);
+        BMPmini_reset_metrics();
+        double on = bench(what);
+
+        BMPmini_metrics m;
+        BMPmini_get_metrics(&m);
+        printf("%-6s off %8.2f  on %8.2f  %+5.1f%% |", run_names[what], off, on, (on - off) / off * 100);
+        for (int phase = 0; phase < BMPmini_PHASES; phase++) {
+            if (m.count[phase]) {
+                printf("  %s %.2f", BMPmini_phase_name(phase), (double) m.ns[phase] / m.count[phase] / 1e3);
+            }
+        }
+        putchar('\n');
+    }
+
+    remove(path);
+    BMPmini_free(img);
+    free(pixels);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_pipeline.c
+//
+// Measures a thumbnailer, reading a BMP file, cropping, resizing and writing
+// it, done with a BMPmini_pipeline against the same operations on full
+// intermediate images, and checks both give the same file.
+// Usage: BMP_bench_pipeline [width] [height]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <string.h>
+#include <unistd.h>
+
+#define BMP_BYTES_PER_PIXEL 3U  // RGB
+#define BENCH_MIN_SECONDS 0.5
+#define PATH_SIZE 64
+
+static char dir[] = "/tmp/BMPmini_pipelineXXXXXX";
+
+static int32_t width, height;
+
+static void thumb_images(const char *src, const char *dst)
+{
+    BMPmini_image *img = BMPmini_read(src);
+    BMPmini_image *cropped = img ? BMPmini_crop(img, width / 8, height / 8, width * 3 / 4, height * 3 / 4) : NULL;
+    BMPmini_image *thumb = cropped ? BMPmini_resize(cropped, 320, 180, BMPmini_FILTER_BILINEAR) : NULL;
+    if (!thumb || BMPmini_write(dst, thumb) != BMPmini_SUCCESS) {
+        die("thumbnail failed");
+    }
+    BMPmini_free(thumb);
+    BMPmini_free(cropped);
+    BMPmini_free(img);
+}
+
+static void thumb_pipeline(const char *src, const char *dst)
+{
+    BMPmini_pipeline *p = BMPmini_pipeline_new();
+    if (!p || BMPmini_pipeline_source_file(p, src) != BMPmini_SUCCESS) {
+        die("pipeline failed");
+    }
+    BMPmini_pipeline_crop(p, width / 8, height / 8, width * 3 / 4, height * 3 / 4);
+    BMPmini_pipeline_resize(p, 320, 180, BMPmini_FILTER_BILINEAR);
+    BMPmini_pipeline_sink_file(p, dst);
+    if (BMPmini_pipeline_run(p, 1) != BMPmini_SUCCESS) {
+        die("pipeline failed");
+    }
+    BMPmini_pipeline_free(p);
+}
+
+static double bench(void (*thumb)(const char *, const char *), const char *src, const char *dst)
+{
+    double seconds;
+    BENCH_REPEAT(BENCH_MIN_SECONDS, seconds, thumb(src, dst));
+    return seconds * 1e3;
+}
+
+int main(int argc, char *argv[])
+{
+    width = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 3840;
+    height = argc > 2 ? (int32_t) strtol(argv[2], NULL, 10) : 2160;
+    if (!mkdtemp(dir)) {
+        die("mkdtemp failed");
+    }
+    char src[PATH_SIZE], dst_images[PATH_SIZE], dst_pipeline[PATH_SIZE];
+    snprintf(src, PATH_SIZE, "%s/src.bmp", dir);
+    snprintf(dst_images, PATH_SIZE, "%s/images.bmp", dir);
+    snprintf(dst_pipeline, PATH_SIZE, "%s/pipeline.bmp", dir);
+
+    uint8_t *pixels = malloc((size_t) width * height * BMP_BYTES_PER_PIXEL);
+    if (!pixels) {
+        die("malloc failed");
+    }
+    for (int32_t i = 0; i < height; i++) {
+        for (size_t j = 0; j < (size_t) width * BMP_BYTES_PER_PIXEL; j++) {
+            pixels[i * (size_t) width * BMP_BYTES_PER_PIXEL + j] = (uint8_t) ((i + j / 3) / 16 + j % 3 * 64);
+        }
+    }
+    BMPmini_view view = {pixels, (ptrdiff_t) width * BMP_BYTES_PER_PIXEL, width, height, BMP_BYTES_PER_PIXEL * 8};
+    if (BMPmini_write_view(src, &view) != BMPmini_SUCCESS) {
+        die("failed to write the source");
+    }
+    free(pixels);
+
+    double images = bench(thumb_images, src, dst_images);
+    double pipeline = bench(thumb_pipeline, src, dst_pipeline);
+
+    /* Both files hold the same pixels, in a different row order */
+    BMPmini_image *a = BMPmini_read(dst_images);
+    BMPmini_image *b = BMPmini_read(dst_pipeline);
+    BMPmini_view va, vb;
+    BMPmini_get_view(a, &va);
+    BMPmini_get_view(b, &vb);
+    bool same = va.width == vb.width && va.height == vb.height;
+    for (int32_t i = 0; same && i < va.height; i++) {
+        same = !memcmp(va.base + i * va.stride, vb.base + i * vb.stride, (size_t) va.width * BMP_BYTES_PER_PIXEL);
+    }
+
+    printf("%"PRId32"x%"PRId32" -> crop 3/4 -> 320x180 bilinear, single thread\n", width, height);
+    printf("full images  %8.2f ms\n", images);
+    printf("pipeline     %8.2f ms  x%.2f  %s\n", pipeline, images / pipeline, same ? "ok" : "MISMATCH");
+
+    BMPmini_free(a);
+    BMPmini_free(b);
+    unlink(src);
+    unlink(dst_images);
+    unlink(dst_pipeline);
+    rmdir(dir);
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
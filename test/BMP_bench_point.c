@@ -0,0 +1,101 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_point.c
+//
+// Measures the throughput of the point operations with the SIMD kernels
+// picked for this CPU against the scalar reference, and checks they agree.
+// Usage: BMP_bench_point [width] [height]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <string.h>
+
+#define BENCH_MIN_SECONDS 0.25
+
+enum { OP_LUT, OP_ADJUST, OP_THRESHOLD, OP_INVERT };
+
+static const struct {
+    int op;
+    const char *name;
+} ops[] = {
+    {OP_LUT, "lut"},
+    {OP_ADJUST, "adjust"},
+    {OP_THRESHOLD, "threshold"},
+    {OP_INVERT, "invert"},
+};
+
+static uint8_t lut[3][256];
+
+static void run(const BMPmini_view *view, int op)
+{
+    switch (op) {
+    case OP_LUT:       BMPmini_apply_lut(view, (const uint8_t (*)[256]) lut, 1); break;
+    case OP_ADJUST:    BMPmini_adjust(view, 10.0f, 1.2f, 1); break;
+    case OP_THRESHOLD: BMPmini_threshold(view, 128, 1); break;
+    default:           BMPmini_invert(view, 1); break;
+    }
+}
+
+static double bench(const BMPmini_view *view, int op)
+{
+    double seconds;
+    BENCH_REPEAT(BENCH_MIN_SECONDS, seconds, run(view, op));
+    return (double) view->width * view->height * (view->bitsperpixel / 8) / seconds / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Odd sizes exercise the scalar tails of the SIMD kernels */
+    int32_t width = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 4093;
+    int32_t height = argc > 2 ? (int32_t) strtol(argv[2], NULL, 10) : 2047;
+
+    size_t size = (size_t) width * height * 4;
+    uint8_t *pixels = malloc(size);
+    uint8_t *ref = malloc(size);
+    uint8_t *out = malloc(size);
+    if (!pixels || !ref || !out) {
+        die("malloc failed");
+    }
+    srand(1);
+    for (size_t i = 0; i < size; i++) {
+        pixels[i] = (uint8_t) rand();
+    }
+    for (int k = 0; k < 256; k++) {
+        lut[0][k] = (uint8_t) (255 - k);
+        lut[1][k] = (uint8_t) (k * k / 255);
+        lut[2][k] = (uint8_t) k;
+    }
+
+    printf("%"PRId32"x%"PRId32", single thread, MB/s of pixels\n", width, height);
+    int res = EXIT_SUCCESS;
+    for (uint16_t bpp = 24; bpp <= 32; bpp += 8) {
+        for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+            /* Operations are not idempotent, results are compared after one run */
+            BMPmini_view view = {ref, (ptrdiff_t) width * (bpp / 8), width, height, bpp};
+            memcpy(ref, pixels, size);
+            BMPmini_set_simd(false);
+            run(&view, ops[o].op);
+
+            BMPmini_set_simd(true);
+            view.base = out;
+            memcpy(out, pixels, size);
+            run(&view, ops[o].op);
+            bool same = !memcmp(ref, out, size);
+            double simd = bench(&view, ops[o].op);
+
+            BMPmini_set_simd(false);
+            double scalar = bench(&view, ops[o].op);
+            BMPmini_set_simd(true);
+
+            printf("%2u bpp %-10s scalar %9.1f  %-6s %9.1f  x%.2f  %s\n", bpp, ops[o].name, scalar,
+                   BMPmini_simd_name(), simd, simd / scalar, same ? "ok" : "MISMATCH");
+            if (!same) {
+                res = EXIT_FAILURE;
+            }
+        }
+    }
+
+    free(pixels);
+    free(ref);
+    free(out);
+    return res;
+}
@@ -0,0 +1,148 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_pyramid.c
+//
+// Measures serving zoomed out tiles of a big BMP image: cut and resized from
+// the file for every request, made by a pyramid, taken from its memory cache
+// and from its sidecar file by a pyramid opened later.
+// Usage: BMP_bench_pyramid [width] [height] [tile size] [directory]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <unistd.h>
+
+#define BENCH_MIN_SECONDS 0.5
+#define BENCH_LEVEL 3  // Tiles of 8x8 tiles of the image
+#define PATH_SIZE 4096
+
+static int32_t width, height, tile;
+static char path[PATH_SIZE], sidecar[PATH_SIZE + 8];
+static uint8_t *buf;
+static size_t bufsize;
+
+// A tile of BENCH_LEVEL the way it is done without a pyramid
+static void from_file(int32_t tx, int32_t ty)
+{
+    int32_t size = tile << BENCH_LEVEL;
+    int32_t x = tx * size, y = ty * size;
+    int32_t w = width - x < size ? width - x : size;
+    int32_t h = height - y < size ? height - y : size;
+    BMPmini_image *region = BMPmini_read_region(path, x, y, w, h);
+    int32_t round = (1 << BENCH_LEVEL) - 1;
+    BMPmini_image *out = region ? BMPmini_resize(region, (w + round) >> BENCH_LEVEL, (h + round) >> BENCH_LEVEL,
+                                                 BMPmini_FILTER_BOX) : NULL;
+    if (!out) {
+        die("resize failed");
+    }
+    BMPmini_free(region);
+    BMPmini_free(out);
+}
+
+static void from_pyramid(BMPmini_pyramid *p, int level, int32_t tx, int32_t ty)
+{
+    if (BMPmini_pyramid_tile(p, level, tx, ty, buf, bufsize, 0, NULL) != BMPmini_SUCCESS) {
+        die("tile failed");
+    }
+}
+
+// Microseconds per tile of BENCH_LEVEL, tiles taken at random places
+static double bench(BMPmini_pyramid *p)
+{
+    int32_t w, h;
+    if (p) {
+        BMPmini_pyramid_size(p, BENCH_LEVEL, &w, &h);
+    }
+    else {
+        w = (width + (1 << BENCH_LEVEL) - 1) >> BENCH_LEVEL;
+        h = (height + (1 << BENCH_LEVEL) - 1) >> BENCH_LEVEL;
+    }
+    int32_t nx = (w + tile - 1) / tile, ny = (h + tile - 1) / tile;
+    double seconds;
+    srand(1);
+    BENCH_REPEAT(BENCH_MIN_SECONDS, seconds, {
+        int32_t tx = rand() % nx, ty = rand() % ny;
+        if (p) {
+            from_pyramid(p, BENCH_LEVEL, tx, ty);
+        }
+        else {
+            from_file(tx, ty);
+        }
+    });
+    return seconds * 1e6;
+}
+
+// Microseconds to make every tile of BENCH_LEVEL once
+static double build(BMPmini_pyramid *p, unsigned *ntiles)
+{
+    int32_t w, h;
+    BMPmini_pyramid_size(p, BENCH_LEVEL, &w, &h);
+    double start = now();
+    *ntiles = 0;
+    for (int32_t ty = 0; ty < (h + tile - 1) / tile; ty++) {
+        for (int32_t tx = 0; tx < (w + tile - 1) / tile; tx++) {
+            from_pyramid(p, BENCH_LEVEL, tx, ty);
+            (*ntiles)++;
+        }
+    }
+    return (now() - start) * 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    width = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 12000;
+    height = argc > 2 ? (int32_t) strtol(argv[2], NULL, 10) : 8000;
+    tile = argc > 3 ? (int32_t) strtol(argv[3], NULL, 10) : 256;
+    const char *dir = argc > 4 ? argv[4] : ".";
+    snprintf(path, sizeof(path), "%s/BMP_bench_pyramid_%ld.bmp", dir, (long) getpid());
+    snprintf(sidecar, sizeof(sidecar), "%s.tiles", path);
+    bufsize = (size_t) tile * tile * 3;
+    buf = malloc(bufsize);
+
+    BMPmini_writer *writer = BMPmini_writer_open(path, width, BMPmini_STREAM_BOTTOM_UP);
+    uint8_t *row = malloc((size_t) width * 3);
+    if (!writer || !row || !buf) {
+        die("writer failed");
+    }
+    for (int32_t i = 0; i < height; i++) {
+        for (size_t j = 0; j < (size_t) width * 3; j++) {
+            row[j] = (uint8_t) (i * 7 + j);
+        }
+        if (BMPmini_writer_write_rows(writer, row, 1, 0) != BMPmini_SUCCESS) {
+            die("write failed");
+        }
+    }
+    if (BMPmini_writer_close(writer) != BMPmini_SUCCESS) {
+        die("close failed");
+    }
+    free(row);
+
+    printf("%"PRId32"x%"PRId32" image, %"PRId32"x%"PRId32" tiles of level %d, us per tile\n", width, height, tile,
+           tile, BENCH_LEVEL);
+    double file = bench(NULL);
+
+    /* The budget holds every tile of the level and those below it are let go */
+    size_t budget = (size_t) 64 << 20;
+    remove(sidecar);
+    BMPmini_pyramid *p = BMPmini_pyramid_open(path, tile, budget, sidecar);
+    if (!p) {
+        die("pyramid failed");
+    }
+    unsigned ntiles;
+    double miss = build(p, &ntiles) / ntiles;
+    double hit = bench(p);
+    BMPmini_pyramid_close(p);
+
+    p = BMPmini_pyramid_open(path, tile, budget, sidecar);
+    if (!p) {
+        die("pyramid failed");
+    }
+    double stored = build(p, &ntiles) / ntiles;
+    BMPmini_pyramid_close(p);
+
+    printf("read_region+resize %9.1f  pyramid: made %9.1f  cached %6.1f  x%.0f  from sidecar %6.1f  x%.0f\n",
+           file, miss, hit, file / hit, stored, file / stored);
+
+    remove(path);
+    remove(sidecar);
+    free(buf);
+    return EXIT_SUCCESS;
+}
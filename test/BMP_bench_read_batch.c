@@ -0,0 +1,125 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_read_batch.c
+//
+// Compares reading many small BMP images with a BMPmini_read loop against
+// BMPmini_read_batch and a BMPmini_async queue, checking that every image
+// starts its pixels on a 4-byte boundary.
+// Usage: BMP_bench_read_batch [files] [size] [threads]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <string.h>
+#include <unistd.h>
+
+#define BMP_BYTES_PER_PIXEL 3U  // RGB
+#define PATH_SIZE 64
+#define ASYNC_DEPTH 32
+
+static size_t nasync, misaligned;
+
+static void check_alignment(BMPmini_image *img)
+{
+    if (img && (uintptr_t) BMPmini_pixels(img) % 4) {
+        misaligned++;
+    }
+}
+
+static void async_done(const char *filename, BMPmini_image *img, int status, void *ctx)
+{
+    (void) ctx;
+    if (status != BMPmini_SUCCESS) {
+        fprintf(stderr, "%s: %s\n", filename, BMPmini_strerror(status));
+    }
+    nasync += img != NULL;
+    check_alignment(img);
+    BMPmini_free(img);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t nfiles = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+    int32_t size = argc > 2 ? (int32_t) strtol(argv[2], NULL, 10) : 128;
+    int nthreads = argc > 3 ? (int) strtol(argv[3], NULL, 10) : 0;
+    BMPmini_set_threads(nthreads);
+
+    char dir[] = "/tmp/BMPmini_benchXXXXXX";
+    if (!mkdtemp(dir)) {
+        die("mkdtemp failed");
+    }
+
+    char (*paths)[PATH_SIZE] = malloc(nfiles * sizeof(*paths));
+    const char **ptrs = malloc(nfiles * sizeof(*ptrs));
+    BMPmini_image **images = malloc(nfiles * sizeof(*images));
+    int *status = malloc(nfiles * sizeof(*status));
+    uint8_t *pixels = malloc((size_t) size * size * BMP_BYTES_PER_PIXEL);
+    if (!paths || !ptrs || !images || !status || !pixels) {
+        die("malloc failed");
+    }
+
+    /* Synthetic corpus */
+    for (size_t i = 0; i < (size_t) size * size * BMP_BYTES_PER_PIXEL; i++) {
+        pixels[i] = (uint8_t) (i * 31);
+    }
+    BMPmini_view view = {pixels, (ptrdiff_t) size * BMP_BYTES_PER_PIXEL, size, size, BMP_BYTES_PER_PIXEL * 8};
+    for (size_t i = 0; i < nfiles; i++) {
+        snprintf(paths[i], PATH_SIZE, "%s/%zu.bmp", dir, i);
+        ptrs[i] = paths[i];
+        if (BMPmini_write_view(paths[i], &view) != BMPmini_SUCCESS) {
+            die("failed to write the corpus");
+        }
+    }
+
+    double start = now();
+    for (size_t i = 0; i < nfiles; i++) {
+        images[i] = BMPmini_read(paths[i]);
+    }
+    double serial = now() - start;
+    for (size_t i = 0; i < nfiles; i++) {
+        check_alignment(images[i]);
+        BMPmini_free(images[i]);
+    }
+
+    start = now();
+    size_t nread = BMPmini_read_batch(ptrs, nfiles, images, status, 0);
+    double batch = now() - start;
+    for (size_t i = 0; i < nfiles; i++) {
+        if (status[i] != BMPmini_SUCCESS) {
+            fprintf(stderr, "%s: %s\n", paths[i], BMPmini_strerror(status[i]));
+        }
+        check_alignment(images[i]);
+        BMPmini_free(images[i]);
+    }
+
+    start = now();
+    BMPmini_async *as = BMPmini_async_create(ASYNC_DEPTH);
+    if (!as) {
+        die("BMPmini_async_create failed");
+    }
+    for (size_t i = 0; i < nfiles; i++) {
+        if (BMPmini_async_read(as, paths[i], async_done, NULL) != BMPmini_SUCCESS) {
+            die("BMPmini_async_read failed");
+        }
+    }
+    while (BMPmini_async_pending(as)) {
+        BMPmini_async_poll(as, true);
+    }
+    BMPmini_async_destroy(as);
+    double async = now() - start;
+
+    printf("%zu files of %"PRId32"x%"PRId32", %d threads\n", nfiles, size, size, BMPmini_get_threads());
+    printf("BMPmini_read loop:  %10.3f ms  %10.0f files/s\n", serial * 1e3, nfiles / serial);
+    printf("BMPmini_read_batch: %10.3f ms  %10.0f files/s  (%zu read)\n", batch * 1e3, nfiles / batch, nread);
+    printf("BMPmini_async:      %10.3f ms  %10.0f files/s  (%zu read)\n", async * 1e3, nfiles / async, nasync);
+    printf("pixels not on a 4-byte boundary: %zu images  %s\n", misaligned, misaligned ? "MISALIGNED" : "ok");
+
+    for (size_t i = 0; i < nfiles; i++) {
+        unlink(paths[i]);
+    }
+    rmdir(dir);
+    free(paths);
+    free(ptrs);
+    free(images);
+    free(status);
+    free(pixels);
+    return misaligned ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_region.c
+//
+// Compares cutting tiles out of a big BMP image with BMPmini_read_region
+// against reading or mapping the whole image and cropping it, with the file
+// in the page cache and dropped from it before every tile.
+// Usage: BMP_bench_region [width] [height] [tile size] [directory]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_MIN_SECONDS 0.5
+#define PATH_SIZE 4096
+
+enum { RUN_READ_CROP, RUN_MAP_CROP, RUN_REGION };
+
+static int32_t width, height, tile;
+static char path[PATH_SIZE];
+
+static void drop_cache(void)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) || close(fd)) {
+        die("posix_fadvise failed");
+    }
+}
+
+static BMPmini_image *cut(int what, int32_t x, int32_t y)
+{
+    BMPmini_image *img, *out;
+    switch (what) {
+    case RUN_READ_CROP:
+        img = BMPmini_read(path);
+        out = img ? BMPmini_crop(img, x, y, tile, tile) : NULL;
+        BMPmini_free(img);
+        break;
+    case RUN_MAP_CROP:
+        img = BMPmini_map(path, BMPmini_MAP_RDONLY);
+        out = img ? BMPmini_crop(img, x, y, tile, tile) : NULL;
+        BMPmini_unmap(img);
+        break;
+    default:
+        out = BMPmini_read_region(path, x, y, tile, tile);
+        break;
+    }
+    if (!out) {
+        die("tile failed");
+    }
+    return out;
+}
+
+// Milliseconds per tile, tiles taken at random places
+static double bench(int what, bool cold)
+{
+    unsigned iters = 0;
+    double elapsed = 0;
+    srand(1);
+    do {
+        int32_t x = rand() % (width - tile + 1);
+        int32_t y = rand() % (height - tile + 1);
+        if (cold) {
+            drop_cache();
+        }
+        double start = now();
+        BMPmini_free(cut(what, x, y));
+        elapsed += now() - start;
+        iters++;
+    } while (elapsed < BENCH_MIN_SECONDS);
+    return elapsed / iters * 1e3;
+}
+
+// Whether every way gives the same tile at a few places
+static bool same(void)
+{
+    for (int k = 0; k < 8; k++) {
+        int32_t x = rand() % (width - tile + 1);
+        int32_t y = rand() % (height - tile + 1);
+        BMPmini_image *a = cut(RUN_READ_CROP, x, y);
+        BMPmini_image *b = cut(RUN_REGION, x, y);
+        BMPmini_view va, vb;
+        BMPmini_get_view(a, &va);
+        BMPmini_get_view(b, &vb);
+        bool ok = true;
+        for (int32_t i = 0; i < tile && ok; i++) {
+            ok = !memcmp(va.base + i * va.stride, vb.base + i * vb.stride, (size_t) tile * 3);
+        }
+        BMPmini_free(a);
+        BMPmini_free(b);
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    width = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 12000;
+    height = argc > 2 ? (int32_t) strtol(argv[2], NULL, 10) : 8000;
+    tile = argc > 3 ? (int32_t) strtol(argv[3], NULL, 10) : 256;
+    /* Not /tmp by default, which may be a tmpfs where nothing is cold */
+    const char *dir = argc > 4 ? argv[4] : ".";
+    snprintf(path, sizeof(path), "%s/BMP_bench_region_%ld.bmp", dir, (long) getpid());
+
+    /* Written by rows, the whole image never needs to be in memory */
+    BMPmini_writer *writer = BMPmini_writer_open(path, width, BMPmini_STREAM_BOTTOM_UP);
+    uint8_t *row = malloc((size_t) width * 3);
+    if (!writer || !row) {
+        die("writer failed");
+    }
+    for (int32_t i = 0; i < height; i++) {
+        for (size_t j = 0; j < (size_t) width * 3; j++) {
+            row[j] = (uint8_t) (i * 7 + j);
+        }
+        if (BMPmini_writer_write_rows(writer, row, 1, 0) != BMPmini_SUCCESS) {
+            die("write failed");
+        }
+    }
+    if (BMPmini_writer_close(writer) != BMPmini_SUCCESS) {
+        die("close failed");
+    }
+    free(row);
+
+    bool ok = same();
+    printf("%"PRId32"x%"PRId32" image, %"PRId32"x%"PRId32" tiles, ms per tile\n", width, height, tile, tile);
+    for (int cold = 0; cold <= 1; cold++) {
+        double read_crop = bench(RUN_READ_CROP, cold);
+        double map_crop = bench(RUN_MAP_CROP, cold);
+        double region = bench(RUN_REGION, cold);
+        printf("%-5s  read+crop %9.3f  map+crop %9.3f  read_region %7.3f  x%.1f  x%.1f  %s\n",
+               cold ? "cold" : "warm", read_crop, map_crop, region, read_crop / region, map_crop / region,
+               ok ? "ok" : "MISMATCH");
+    }
+
+    remove(path);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,89 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_resize.c
+//
+// Measures the throughput of BMPmini_resize_view for each filter, with the
+// SIMD kernels picked for this CPU against the scalar reference, and checks
+// they agree.
+// Usage: BMP_bench_resize [width] [height]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <string.h>
+
+#define BMP_BYTES_PER_PIXEL 3U  // RGB
+#define BENCH_MIN_SECONDS 0.25
+
+static const struct {
+    int filter;
+    const char *name;
+} filters[] = {
+    {BMPmini_FILTER_BOX, "box"},
+    {BMPmini_FILTER_BILINEAR, "bilinear"},
+    {BMPmini_FILTER_LANCZOS, "lanczos"},
+};
+
+// Output sizes, in eighths of the input size
+static const int scales[] = {1, 4, 7, 12};
+
+static double bench(const BMPmini_view *src, const BMPmini_view *dst, int filter)
+{
+    double seconds;
+    BENCH_REPEAT(BENCH_MIN_SECONDS, seconds, BMPmini_resize_view(src, dst, filter, 1));
+    return (double) src->width * src->height * BMP_BYTES_PER_PIXEL / seconds / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Odd sizes exercise the scalar tails of the SIMD kernels */
+    int32_t width = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 1921;
+    int32_t height = argc > 2 ? (int32_t) strtol(argv[2], NULL, 10) : 1081;
+
+    size_t npixels = (size_t) width * height;
+    size_t maxout = (size_t) (width * 12 / 8 + 1) * (height * 12 / 8 + 1) * BMP_BYTES_PER_PIXEL;
+    uint8_t *pixels = malloc(npixels * BMP_BYTES_PER_PIXEL);
+    uint8_t *ref = malloc(maxout);
+    uint8_t *out = malloc(maxout);
+    if (!pixels || !ref || !out) {
+        die("malloc failed");
+    }
+    /* Smooth gradients with some noise, as in photos */
+    srand(1);
+    for (int32_t i = 0; i < height; i++) {
+        for (size_t j = 0; j < (size_t) width * BMP_BYTES_PER_PIXEL; j++) {
+            pixels[i * (size_t) width * BMP_BYTES_PER_PIXEL + j] = (uint8_t) ((i + j / 3) / 8 + rand() % 16);
+        }
+    }
+    BMPmini_view src = {pixels, (ptrdiff_t) width * BMP_BYTES_PER_PIXEL, width, height, BMP_BYTES_PER_PIXEL * 8};
+
+    printf("%"PRId32"x%"PRId32", single thread, MB/s of BGR24 input\n", width, height);
+    int res = EXIT_SUCCESS;
+    for (size_t s = 0; s < sizeof(scales) / sizeof(scales[0]); s++) {
+        int32_t w = width * scales[s] / 8 + 1, h = height * scales[s] / 8 + 1;
+        size_t outsz = (size_t) w * h * BMP_BYTES_PER_PIXEL;
+        for (size_t f = 0; f < sizeof(filters) / sizeof(filters[0]); f++) {
+            BMPmini_view dst = {ref, (ptrdiff_t) w * BMP_BYTES_PER_PIXEL, w, h, BMP_BYTES_PER_PIXEL * 8};
+
+            BMPmini_set_simd(false);
+            BMPmini_resize_view(&src, &dst, filters[f].filter, 1);
+            double scalar = bench(&src, &dst, filters[f].filter);
+
+            BMPmini_set_simd(true);
+            dst.base = out;
+            memset(out, 0, outsz);
+            BMPmini_resize_view(&src, &dst, filters[f].filter, 1);
+            bool same = !memcmp(ref, out, outsz);
+            double simd = bench(&src, &dst, filters[f].filter);
+
+            printf("%5"PRId32"x%-5"PRId32" %-9s scalar %8.1f  %-6s %8.1f  x%.2f  %s\n", w, h, filters[f].name,
+                   scalar, BMPmini_simd_name(), simd, simd / scalar, same ? "ok" : "MISMATCH");
+            if (!same) {
+                res = EXIT_FAILURE;
+            }
+        }
+    }
+
+    free(pixels);
+    free(ref);
+    free(out);
+    return res;
+}
@@ -0,0 +1,199 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_rle.c
+//
+// Measures RLE encoding and decoding in MB/s of decoded pixels, and the
+// compression ratio, on synthetic 8 and 4 bpp images. 24 bpp files given on
+// the command line, such as the one made by BMP_generate, are benchmarked
+// too once turned into 8 bpp gray levels.
+// Usage: BMP_bench_rle [file.bmp ...]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BENCH_MIN_SECONDS 0.25
+#define BENCH_WIDTH  1920
+#define BENCH_HEIGHT 1080
+#define PATH_SIZE 64
+
+static char dir[] = "/tmp/BMPmini_rleXXXXXX";
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+// Writes Top-Down gray levels as a Bottom-Up paletted image, 'bpp' being 8 or 4
+static void write_paletted(const char *path, const uint8_t *levels, int32_t width, int32_t height, unsigned bpp)
+{
+    uint32_t ncolors = 1U << bpp;
+    uint32_t row_size = (uint32_t) (((size_t) width * bpp + 31) / 32 * 4);
+    uint32_t offset = 54 + 4 * ncolors;
+    uint32_t image_size = row_size * (uint32_t) height;
+
+    uint8_t hdr[54] = {'B', 'M'};
+    put32(hdr + 2, offset + image_size);
+    put32(hdr + 10, offset);
+    put32(hdr + 14, 40);
+    put32(hdr + 18, (uint32_t) width);
+    put32(hdr + 22, (uint32_t) height);
+    hdr[26] = 1;
+    hdr[28] = (uint8_t) bpp;
+    put32(hdr + 34, image_size);
+
+    FILE *fp = fopen(path, "wb");
+    uint8_t *row = calloc(row_size, 1);
+    if (!fp || !row || fwrite(hdr, sizeof(hdr), 1, fp) != 1) {
+        die("failed to write an image");
+    }
+    for (uint32_t k = 0; k < ncolors; k++) {
+        uint8_t gray = (uint8_t) (k * 255 / (ncolors - 1));
+        uint8_t quad[4] = {gray, gray, gray, 0};
+        fwrite(quad, sizeof(quad), 1, fp);
+    }
+    for (int32_t i = height - 1; i >= 0; i--) {
+        for (int32_t j = 0; j < width; j++) {
+            uint8_t v = levels[(size_t) i * width + j] >> (8 - bpp);
+            if (bpp == 8) {
+                row[j] = v;
+            }
+            else {
+                row[j / 2] = (uint8_t) (j & 1 ? row[j / 2] | v : v << 4);
+            }
+        }
+        fwrite(row, row_size, 1, fp);
+    }
+    if (fclose(fp) == EOF) {
+        die("failed to write an image");
+    }
+    free(row);
+}
+
+// Flat panels with a few lines of "text", as in screen captures
+static void synth_screen(uint8_t *levels, int32_t width, int32_t height)
+{
+    for (int32_t i = 0; i < height; i++) {
+        for (int32_t j = 0; j < width; j++) {
+            uint8_t v = j < width / 5 ? 0x40 : i < height / 12 ? 0x90 : 0xF0;
+            bool text = i % 24 > 6 && i % 24 < 18 && j % 9 < 6 && (i * 7 + j * 13) % 5 < 2 && (j / 180) % 3 != 2;
+            levels[(size_t) i * width + j] = text ? 0x10 : v;
+        }
+    }
+}
+
+static void synth_noise(uint8_t *levels, int32_t width, int32_t height)
+{
+    uint32_t x = 2463534242U;
+    for (size_t i = 0; i < (size_t) width * height; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        levels[i] = (uint8_t) x;
+    }
+}
+
+static long file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (long) st.st_size : -1;
+}
+
+static void bench(const char *name, const char *path)
+{
+    char rle_path[PATH_SIZE];
+    snprintf(rle_path, PATH_SIZE, "%s/rle.bmp", dir);
+
+    BMPmini_image *img = BMPmini_read(path);
+    if (!img) {
+        die("failed to read an image");
+    }
+    BMPmini_info info;
+    BMPmini_get_info(img, &info);
+    double mbytes = (double) info.row_size * info.height / 1e6;
+
+    double enc;
+    BENCH_REPEAT(BENCH_MIN_SECONDS, enc, {
+        if (BMPmini_write_opts(rle_path, img, BMPmini_WRITE_RLE) != BMPmini_SUCCESS) {
+            die("failed to encode an image");
+        }
+    });
+
+    BMPmini_image *decoded = NULL;
+    double dec;
+    BENCH_REPEAT(BENCH_MIN_SECONDS, dec, {
+        BMPmini_free(decoded);
+        decoded = BMPmini_read(rle_path);
+        if (!decoded) {
+            die("failed to decode an image");
+        }
+    });
+
+    /* Reading the uncompressed file, for reference */
+    double raw;
+    BENCH_REPEAT(BENCH_MIN_SECONDS, raw, BMPmini_free(BMPmini_read(path)));
+
+    bool same = memcmp(BMPmini_pixels(img), BMPmini_pixels(decoded), (size_t) info.row_size * info.height) == 0;
+    printf("%-14s %2u bpp  x%6.2f  encode %8.1f MB/s  decode %8.1f MB/s  (raw read %8.1f MB/s)  %s\n",
+           name, info.bitsperpixel, (double) file_size(path) / file_size(rle_path),
+           mbytes / enc, mbytes / dec, mbytes / raw, same ? "ok" : "MISMATCH");
+
+    BMPmini_free(decoded);
+    BMPmini_free(img);
+    unlink(rle_path);
+}
+
+int main(int argc, char *argv[])
+{
+    if (!mkdtemp(dir)) {
+        die("mkdtemp failed");
+    }
+    char path[PATH_SIZE];
+    snprintf(path, PATH_SIZE, "%s/src.bmp", dir);
+
+    uint8_t *levels = malloc((size_t) BENCH_WIDTH * BENCH_HEIGHT);
+    if (!levels) {
+        die("malloc failed");
+    }
+
+    synth_screen(levels, BENCH_WIDTH, BENCH_HEIGHT);
+    write_paletted(path, levels, BENCH_WIDTH, BENCH_HEIGHT, 8);
+    bench("screen", path);
+    write_paletted(path, levels, BENCH_WIDTH, BENCH_HEIGHT, 4);
+    bench("screen", path);
+
+    synth_noise(levels, BENCH_WIDTH, BENCH_HEIGHT);
+    write_paletted(path, levels, BENCH_WIDTH, BENCH_HEIGHT, 8);
+    bench("noise", path);
+    write_paletted(path, levels, BENCH_WIDTH, BENCH_HEIGHT, 4);
+    bench("noise", path);
+    free(levels);
+
+    /* 24 bpp files go through gray levels */
+    for (int k = 1; k < argc; k++) {
+        BMPmini_image *img = BMPmini_read(argv[k]);
+        if (!img) {
+            continue;
+        }
+        BMPmini_info info;
+        BMPmini_get_info(img, &info);
+        levels = malloc((size_t) info.width * info.height);
+        if (!levels || BMPmini_decode(img, BMPmini_FMT_GRAY8, levels, 0, 0) != BMPmini_SUCCESS) {
+            die("failed to convert an image");
+        }
+        write_paletted(path, levels, info.width, info.height, 8);
+        bench(argv[k], path);
+        write_paletted(path, levels, info.width, info.height, 4);
+        bench(argv[k], path);
+        free(levels);
+        BMPmini_free(img);
+    }
+
+    unlink(path);
+    rmdir(dir);
+    return 0;
+}
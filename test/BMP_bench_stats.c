@@ -0,0 +1,131 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_stats.c
+//
+// Measures the throughput of histograms and statistics against a plain
+// histogram loop, with and without the SIMD checksum kernels, and the time
+// saved computing statistics while reading an image.
+// Usage: BMP_bench_stats [width] [height]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <string.h>
+
+#define BENCH_MIN_SECONDS 0.25
+#define BENCH_FILE "BMP_bench_stats.bmp"
+
+enum { RUN_PLAIN, RUN_HISTOGRAM, RUN_STATS, RUN_READ_THEN_STATS, RUN_READ_STATS };
+
+static uint64_t hist[3][256];
+static BMPmini_stats stats;
+
+// One histogram per channel, each pixel incrementing bins right after the
+// previous one did
+static void plain_histogram(const BMPmini_view *view)
+{
+    memset(hist, 0, sizeof(hist));
+    for (int32_t i = 0; i < view->height; i++) {
+        const uint8_t *p = view->base + i * view->stride;
+        for (int32_t j = 0; j < view->width; j++, p += 3) {
+            hist[0][p[0]]++;
+            hist[1][p[1]]++;
+            hist[2][p[2]]++;
+        }
+    }
+}
+
+static void run(const BMPmini_view *view, int what, int nthreads)
+{
+    BMPmini_image *img;
+    BMPmini_view read_view;
+    switch (what) {
+    case RUN_PLAIN:
+        plain_histogram(view);
+        break;
+    case RUN_HISTOGRAM:
+        BMPmini_histogram(view, hist, nthreads);
+        break;
+    case RUN_STATS:
+        BMPmini_get_stats(view, &stats, nthreads);
+        break;
+    case RUN_READ_THEN_STATS:
+        img = BMPmini_read(BENCH_FILE);
+        BMPmini_get_view(img, &read_view);
+        BMPmini_get_stats(&read_view, &stats, 0);
+        BMPmini_free(img);
+        break;
+    default:
+        BMPmini_free(BMPmini_read_stats(BENCH_FILE, NULL, &stats));
+        break;
+    }
+}
+
+static double bench(const BMPmini_view *view, int what, int nthreads)
+{
+    double seconds;
+    BENCH_REPEAT(BENCH_MIN_SECONDS, seconds, run(view, what, nthreads));
+    return (double) view->width * view->height * 3 / seconds / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Odd sizes exercise the scalar tails of the SIMD kernels */
+    int32_t width = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 4093;
+    int32_t height = argc > 2 ? (int32_t) strtol(argv[2], NULL, 10) : 2047;
+
+    size_t size = (size_t) width * height * 3;
+    uint8_t *pixels = malloc(size);
+    if (!pixels) {
+        die("malloc failed");
+    }
+    /* Smooth gradients with little noise, where neighbours often share bins */
+    srand(1);
+    for (int32_t i = 0; i < height; i++) {
+        for (int32_t j = 0; j < width; j++) {
+            uint8_t *p = pixels + ((size_t) i * width + j) * 3;
+            p[0] = (uint8_t) (j * 64 / width + rand() % 4);
+            p[1] = (uint8_t) (i * 64 / height + rand() % 4);
+            p[2] = (uint8_t) (128 + rand() % 2);
+        }
+    }
+    BMPmini_view view = {pixels, (ptrdiff_t) width * 3, width, height, 24};
+
+    BMPmini_image *img = BMPmini_image_from_view(&view);
+    if (!img || BMPmini_write(BENCH_FILE, img) != BMPmini_SUCCESS) {
+        fprintf(stderr, "cannot write %s\n", BENCH_FILE);
+        exit(EXIT_FAILURE);
+    }
+    BMPmini_free(img);
+
+    /* Results have to agree whichever kernels compute them */
+    BMPmini_stats ref;
+    BMPmini_set_simd(false);
+    BMPmini_get_stats(&view, &ref, 1);
+    BMPmini_set_simd(true);
+    BMPmini_get_stats(&view, &stats, 4);
+    plain_histogram(&view);
+    bool same = !memcmp(&ref, &stats, sizeof(stats)) && !memcmp(hist, ref.hist, sizeof(hist));
+    BMPmini_free(BMPmini_read_stats(BENCH_FILE, NULL, &stats));
+    same = same && !memcmp(&ref, &stats, sizeof(stats));
+
+    printf("%"PRId32"x%"PRId32", MB/s of pixels\n", width, height);
+    double plain = bench(&view, RUN_PLAIN, 1);
+    double histogram = bench(&view, RUN_HISTOGRAM, 1);
+    printf("histogram   plain %9.1f  sub-histograms %9.1f  x%.2f  %s\n", plain, histogram, histogram / plain,
+           same ? "ok" : "MISMATCH");
+
+    double simd = bench(&view, RUN_STATS, 1);
+    BMPmini_set_simd(false);
+    double scalar = bench(&view, RUN_STATS, 1);
+    BMPmini_set_simd(true);
+    double threaded = bench(&view, RUN_STATS, 0);
+    printf("stats       scalar %8.1f  %-14s %9.1f  x%.2f  threads %9.1f\n", scalar, BMPmini_simd_name(), simd,
+           simd / scalar, threaded);
+
+    double two_pass = bench(&view, RUN_READ_THEN_STATS, 0);
+    double one_pass = bench(&view, RUN_READ_STATS, 0);
+    printf("read+stats  two passes %4.1f  while reading %8.1f  x%.2f\n", two_pass, one_pass, one_pass / two_pass);
+
+    remove(BENCH_FILE);
+    free(pixels);
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
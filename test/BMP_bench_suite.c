@@ -0,0 +1,436 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_suite.c
+//
+// Times every operation of BMPmini on each image of a corpus made by
+// BMP_generate, and prints the throughput, latency percentiles and peak
+// memory of each as JSON. Given the JSON of an earlier run, fails when the
+// fastest run of an operation got slower by more than a tolerance: the
+// fastest run is the one the rest of the system disturbed the least.
+// Usage: BMP_bench_suite [--seconds S] [--threads N] [--baseline FILE]
+//                        [--tolerance PERCENT] corpus_directory
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+#include <math.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#define PATH_SIZE 4096
+#define NAME_SIZE 64
+#define CORPUS_INDEX "index.txt"
+#define MIN_ITERATIONS 5
+#define MAX_ITERATIONS 10000
+// Runs shorter than this are mostly system call noise, not worth gating on
+#define GATE_MIN_MICROSECONDS 100.0
+
+// What an operation works on
+struct input {
+    const char *path;     // The image file
+    const char *out;      // Scratch file for operations writing one
+    BMPmini_image *img;   // The image, read once
+    BMPmini_view view;
+    BMPmini_info info;
+    void *buf;            // Scratch memory, large enough for any operation
+};
+
+typedef bool (*op_fn)(struct input *in);
+
+static int nthreads;
+static BMPmini_stats stats;
+
+//-------------------------------------
+// Operations
+//-------------------------------------
+static bool op_read(struct input *in)
+{
+    BMPmini_image *img = BMPmini_read(in->path);
+    BMPmini_free(img);
+    return img != NULL;
+}
+
+static bool op_read_into(struct input *in)
+{
+    BMPmini_info info;
+    size_t size = (size_t) in->info.row_size * in->info.height;
+    return BMPmini_read_into(in->path, &info, in->buf, size) == BMPmini_SUCCESS;
+}
+
+static bool op_read_stats(struct input *in)
+{
+    BMPmini_image *img = BMPmini_read_stats(in->path, NULL, &stats);
+    BMPmini_free(img);
+    return img != NULL;
+}
+
+static bool op_map(struct input *in)
+{
+    /* Touching every pixel, a mapping alone costs next to nothing */
+    BMPmini_image *img = BMPmini_map(in->path, BMPmini_MAP_RDONLY);
+    if (!img) {
+        return false;
+    }
+    BMPmini_view view;
+    BMPmini_get_view(img, &view);
+    bool ok = BMPmini_get_stats(&view, &stats, nthreads) == BMPmini_SUCCESS;
+    BMPmini_unmap(img);
+    return ok;
+}
+
+static bool op_reader(struct input *in)
+{
+    BMPmini_reader *reader = BMPmini_reader_open(in->path);
+    if (!reader) {
+        return false;
+    }
+    size_t rows = 0, n;
+    size_t batch = in->info.row_size < 65536 ? 65536 / in->info.row_size : 1;
+    while ((n = BMPmini_reader_read_rows(reader, in->buf, batch)) > 0) {
+        rows += n;
+    }
+    BMPmini_reader_close(reader);
+    return rows == (size_t) in->info.height;
+}
+
+static bool op_write(struct input *in)
+{
+    return BMPmini_write(in->out, in->img) == BMPmini_SUCCESS;
+}
+
+static bool op_write_parallel(struct input *in)
+{
+    return BMPmini_write_parallel(in->out, in->img, 0, nthreads) == BMPmini_SUCCESS;
+}
+
+static bool op_crop(struct input *in)
+{
+    int32_t w = in->info.width, h = in->info.height;
+    BMPmini_image *img = BMPmini_crop_threads(in->img, w / 4, h / 4, (w + 1) / 2, (h + 1) / 2, nthreads);
+    BMPmini_free(img);
+    return img != NULL;
+}
+
+static bool op_decode_rgba(struct input *in)
+{
+    return BMPmini_decode(in->img, BMPmini_FMT_RGBA32, in->buf, 0, nthreads) == BMPmini_SUCCESS;
+}
+
+static bool op_resize_half(struct input *in)
+{
+    BMPmini_view dst = {in->buf, (ptrdiff_t) ((in->info.width + 1) / 2 * 3), (in->info.width + 1) / 2,
+                        (in->info.height + 1) / 2, 24};
+    return BMPmini_resize_view(&in->view, &dst, BMPmini_FILTER_BILINEAR, nthreads) == BMPmini_SUCCESS;
+}
+
+static bool op_rotate_90(struct input *in)
+{
+    size_t bpp = in->info.bitsperpixel / 8;
+    BMPmini_view dst = {in->buf, (ptrdiff_t) (in->info.height * bpp), in->info.height, in->info.width,
+                        in->info.bitsperpixel};
+    return BMPmini_transform_view(&in->view, &dst, BMPmini_ROTATE_90, nthreads) == BMPmini_SUCCESS;
+}
+
+static bool op_gaussian(struct input *in)
+{
+    BMPmini_view dst = in->view;
+    dst.base = in->buf;
+    dst.stride = (ptrdiff_t) in->info.row_size;
+    return BMPmini_filter_view(&in->view, &dst, BMPmini_BLUR_GAUSSIAN, 2.0f, BMPmini_BORDER_CLAMP, nthreads)
+           == BMPmini_SUCCESS;
+}
+
+static bool op_stats(struct input *in)
+{
+    return BMPmini_get_stats(&in->view, &stats, nthreads) == BMPmini_SUCCESS;
+}
+
+static bool op_pipeline(struct input *in)
+{
+    /* A thumbnail of the middle of the image, from file to file */
+    int32_t w = in->info.width, h = in->info.height;
+    BMPmini_pipeline *p = BMPmini_pipeline_new();
+    if (!p) {
+        return false;
+    }
+    int res = BMPmini_pipeline_source_file(p, in->path);
+    BMPmini_pipeline_crop(p, w / 8, h / 8, w - w / 4, h - h / 4);
+    if (res == BMPmini_SUCCESS) {
+        res = BMPmini_pipeline_resize(p, (w + 7) / 8, (h + 7) / 8, BMPmini_FILTER_BILINEAR);
+    }
+    if (res == BMPmini_SUCCESS) {
+        res = BMPmini_pipeline_sink_file(p, in->out);
+    }
+    if (res == BMPmini_SUCCESS) {
+        res = BMPmini_pipeline_run(p, nthreads);
+    }
+    BMPmini_pipeline_free(p);
+    return res == BMPmini_SUCCESS;
+}
+
+static const struct {
+    const char *name;
+    op_fn fn;
+    bool rgb_only;  // Only for 24 bpp images
+} ops[] = {
+    {"read", op_read, false},
+    {"read_into", op_read_into, false},
+    {"read_stats", op_read_stats, false},
+    {"map_stats", op_map, false},
+    {"reader_rows", op_reader, false},
+    {"write", op_write, false},
+    {"write_parallel", op_write_parallel, false},
+    {"crop", op_crop, false},
+    {"decode_rgba", op_decode_rgba, false},
+    {"resize_half", op_resize_half, true},
+    {"rotate_90", op_rotate_90, false},
+    {"gaussian", op_gaussian, false},
+    {"stats", op_stats, false},
+    {"pipeline_thumb", op_pipeline, true},
+};
+
+//-------------------------------------
+// Measures
+//-------------------------------------
+// Restarts the peak memory count of the process, where the system allows it
+static void reset_peak_rss(void)
+{
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+    if (fp) {
+        fputs("5", fp);
+        fclose(fp);
+    }
+}
+
+// Peak resident memory in KiB since the last reset, or since the start
+static long peak_rss_kb(void)
+{
+    char line[128];
+    long kb = -1;
+    FILE *fp = fopen("/proc/self/status", "r");
+    while (fp && kb < 0 && fgets(line, sizeof(line), fp)) {
+        sscanf(line, "VmHWM: %ld", &kb);
+    }
+    if (fp) {
+        fclose(fp);
+    }
+    if (kb < 0) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        kb = ru.ru_maxrss;
+    }
+    return kb;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentile of sorted values
+static double percentile(const double *sorted, unsigned n, double p)
+{
+    unsigned rank = (unsigned) ceil(p / 100.0 * n);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+struct result {
+    char op[NAME_SIZE];
+    char image[NAME_SIZE];
+    double mb_s;
+    double min_us;
+};
+
+//-------------------------------------
+// Baselines
+//-------------------------------------
+// Results of an earlier run, one per line as printed by this program
+static struct result *load_baseline(const char *path, size_t *n)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        die(path);
+    }
+    struct result *res = NULL;
+    size_t cap = 0;
+    char line[1024];
+    *n = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        struct result r;
+        const char *mb = strstr(line, "\"mb_s\": ");
+        const char *min = strstr(line, "\"min_us\": ");
+        if (sscanf(line, " {\"op\": \"%63[^\"]\", \"image\": \"%63[^\"]\"", r.op, r.image) != 2 || !mb || !min) {
+            continue;
+        }
+        r.mb_s = strtod(mb + strlen("\"mb_s\": "), NULL);
+        r.min_us = strtod(min + strlen("\"min_us\": "), NULL);
+        if (*n == cap) {
+            cap = cap ? 2 * cap : 64;
+            res = realloc(res, cap * sizeof(*res));
+            if (!res) {
+                die("realloc");
+            }
+        }
+        res[(*n)++] = r;
+    }
+    fclose(fp);
+    return res;
+}
+
+// Whether the fastest run of 'r' got slower by more than 'tolerance' percent
+static bool regressed(const struct result *r, const struct result *base, size_t nbase, double tolerance)
+{
+    for (size_t i = 0; i < nbase; i++) {
+        if (strcmp(base[i].op, r->op) || strcmp(base[i].image, r->image)) {
+            continue;
+        }
+        if (base[i].min_us < GATE_MIN_MICROSECONDS || r->min_us <= base[i].min_us * (1.0 + tolerance / 100.0)) {
+            return false;
+        }
+        fprintf(stderr, "regression: %s on %s, %.1f us up from %.1f\n", r->op, r->image, r->min_us,
+                base[i].min_us);
+        return true;
+    }
+    return false;
+}
+
+//-------------------------------------
+// Running
+//-------------------------------------
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--seconds S] [--threads N] [--baseline FILE] [--tolerance PERCENT] corpus\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    double min_seconds = 0.2, tolerance = 10.0;
+    const char *baseline = NULL, *dir = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            min_seconds = strtod(argv[++i], NULL);
+        }
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            nthreads = (int) strtol(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) {
+            baseline = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc) {
+            tolerance = strtod(argv[++i], NULL);
+        }
+        else if (argv[i][0] != '-' && !dir) {
+            dir = argv[i];
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+    if (!dir) {
+        usage(argv[0]);
+    }
+    /* 0 is one thread per CPU, as everywhere in BMPmini */
+    BMPmini_set_threads(nthreads);
+
+    size_t nbase = 0;
+    struct result *base = baseline ? load_baseline(baseline, &nbase) : NULL;
+
+    char path[PATH_SIZE], out[PATH_SIZE], name[NAME_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", dir, CORPUS_INDEX);
+    FILE *index = fopen(path, "r");
+    if (!index) {
+        die(path);
+    }
+    snprintf(out, sizeof(out), "%s/BMP_bench_suite.out.bmp", dir);
+
+    double *lat = malloc(MAX_ITERATIONS * sizeof(*lat));
+    if (!lat) {
+        die("malloc");
+    }
+
+    printf("{\n  \"library\": \"BMPmini\",\n  \"simd\": \"%s\",\n  \"threads\": %d,\n  \"min_seconds\": %g,\n"
+           "  \"results\": [\n", BMPmini_simd_name(), BMPmini_get_threads(), min_seconds);
+    bool first = true, failed = false;
+    unsigned regressions = 0;
+    while (fgets(name, sizeof(name), index)) {
+        name[strcspn(name, "\n")] = '\0';
+        if (!name[0]) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+        struct input in = {path, out, NULL, {NULL, 0, 0, 0, 0}, {0, 0, false, 0, 0}, NULL};
+        in.img = BMPmini_read(path);
+        if (!in.img) {
+            fprintf(stderr, "cannot read %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+        BMPmini_get_view(in.img, &in.view);
+        BMPmini_get_info(in.img, &in.info);
+        /* The largest output of any operation is the RGBA decoding */
+        size_t pixels = (size_t) in.info.width * in.info.height;
+        size_t scratch = pixels * 4 > (size_t) in.info.row_size * in.info.height
+                         ? pixels * 4 : (size_t) in.info.row_size * in.info.height;
+        in.buf = malloc(scratch);
+        if (!in.buf) {
+            die("malloc");
+        }
+        double mbytes = (double) pixels * in.info.bitsperpixel / 8 / 1e6;
+
+        for (size_t k = 0; k < sizeof(ops) / sizeof(ops[0]); k++) {
+            if (ops[k].rgb_only && in.info.bitsperpixel != 24) {
+                continue;
+            }
+            /* A first untimed run warms up the caches */
+            reset_peak_rss();
+            bool ok = ops[k].fn(&in);
+            unsigned iters = 0;
+            double start = now(), elapsed;
+            while (ok) {
+                double t = now();
+                ok = ops[k].fn(&in);
+                lat[iters++] = (now() - t) * 1e6;
+                elapsed = now() - start;
+                if (iters == MAX_ITERATIONS || (iters >= MIN_ITERATIONS && elapsed >= min_seconds)) {
+                    break;
+                }
+            }
+            if (!ok) {
+                fprintf(stderr, "%s failed on %s\n", ops[k].name, name);
+                failed = true;
+                continue;
+            }
+
+            double total = 0;
+            for (unsigned i = 0; i < iters; i++) {
+                total += lat[i];
+            }
+            qsort(lat, iters, sizeof(*lat), cmp_double);
+            struct result r;
+            snprintf(r.op, sizeof(r.op), "%s", ops[k].name);
+            snprintf(r.image, sizeof(r.image), "%s", name);
+            r.mb_s = mbytes * iters / (total * 1e-6);
+            r.min_us = lat[0];
+            regressions += base && regressed(&r, base, nbase, tolerance);
+
+            /* One result per line, which is what baselines are read from */
+            printf("%s    {\"op\": \"%s\", \"image\": \"%s\", \"width\": %"PRId32", \"height\": %"PRId32
+                   ", \"bpp\": %u, \"top_down\": %s, \"iterations\": %u, \"mb_s\": %.2f, \"min_us\": %.1f"
+                   ", \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, \"peak_rss_kb\": %ld}",
+                   first ? "" : ",\n", r.op, r.image, in.info.width, in.info.height,
+                   (unsigned) in.info.bitsperpixel, in.info.top_down ? "true" : "false", iters, r.mb_s, r.min_us,
+                   percentile(lat, iters, 50), percentile(lat, iters, 90), percentile(lat, iters, 99), lat[iters - 1], peak_rss_kb());
+            fflush(stdout);
+            first = false;
+        }
+        free(in.buf);
+        BMPmini_free(in.img);
+    }
+    printf("\n  ],\n  \"regressions\": %u\n}\n", regressions);
+
+    remove(out);
+    fclose(index);
+    free(lat);
+    free(base);
+    return failed || regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
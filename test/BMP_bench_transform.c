@@ -0,0 +1,82 @@
+//-----------------------------------------------------------------------------
+// C file:
+//       BMP_bench_transform.c
+//
+// Measures the throughput of BMPmini_transform_view and BMPmini_flip_view
+// for 8, 24 and 32 bpp pixels, against a plain BMPmini_copy_view.
+// Usage: BMP_bench_transform [width] [height]
+//-----------------------------------------------------------------------------
+#include "BMP_bench.h"
+
+#define BENCH_MIN_SECONDS 0.25
+#define BENCH_COPY -1
+#define BENCH_FLIP_IN_PLACE 0x100
+
+static const struct {
+    int op;
+    const char *name;
+} ops[] = {
+    {BENCH_COPY, "copy"},
+    {BMPmini_ROTATE_90, "rotate 90"},
+    {BMPmini_ROTATE_180, "rotate 180"},
+    {BMPmini_ROTATE_270, "rotate 270"},
+    {BMPmini_FLIP_H, "flip h"},
+    {BMPmini_FLIP_V, "flip v"},
+    {BMPmini_TRANSPOSE, "transpose"},
+    {BENCH_FLIP_IN_PLACE | BMPmini_FLIP_H, "flip h in place"},
+    {BENCH_FLIP_IN_PLACE | BMPmini_FLIP_V, "flip v in place"},
+};
+
+static void run(const BMPmini_view *src, int op, uint8_t *out)
+{
+    BMPmini_view dst = *src;
+    dst.base = out;
+    if (op == BMPmini_ROTATE_90 || op == BMPmini_ROTATE_270 || op == BMPmini_TRANSPOSE) {
+        dst.width = src->height;
+        dst.height = src->width;
+        dst.stride = (ptrdiff_t) dst.width * (src->bitsperpixel / 8);
+    }
+    if (op == BENCH_COPY) {
+        BMPmini_copy_view(src, &dst, 1);
+    }
+    else if (op & BENCH_FLIP_IN_PLACE) {
+        BMPmini_flip_view(src, op & ~BENCH_FLIP_IN_PLACE, 1);
+    }
+    else {
+        BMPmini_transform_view(src, &dst, op, 1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int32_t width = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 4093;
+    int32_t height = argc > 2 ? (int32_t) strtol(argv[2], NULL, 10) : 2047;
+
+    size_t npixels = (size_t) width * height;
+    uint8_t *pixels = malloc(npixels * 4);
+    uint8_t *out = malloc(npixels * 4);
+    if (!pixels || !out) {
+        die("malloc failed");
+    }
+    srand(1);
+    for (size_t i = 0; i < npixels * 4; i++) {
+        pixels[i] = (uint8_t) rand();
+    }
+
+    printf("%"PRId32"x%"PRId32", single thread, MB/s of input\n", width, height);
+    printf("%-16s %10s %10s %10s\n", "", "8 bpp", "24 bpp", "32 bpp");
+    for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+        printf("%-16s", ops[o].name);
+        for (uint16_t bpp = 8; bpp <= 32; bpp += bpp == 8 ? 16 : 8) {
+            BMPmini_view src = {pixels, (ptrdiff_t) width * (bpp / 8), width, height, bpp};
+            double seconds;
+            BENCH_REPEAT(BENCH_MIN_SECONDS, seconds, run(&src, ops[o].op, out));
+            printf(" %10.1f", (double) npixels * (bpp / 8) / seconds / 1e6);
+        }
+        printf("\n");
+    }
+
+    free(pixels);
+    free(out);
+    return 0;
+}
@@ -2,16 +2,22 @@
 // C file:
 //       BMP_generate.c
 //
-// Generates a new BMP image.
+// Generates a new BMP image, or a corpus of images of many sizes and
+// orientations for BMP_bench_suite. Images are written without BMPmini, so
+// a bug in the library cannot hide in its own inputs.
+// Usage: BMP_generate [corpus directory]
 //-----------------------------------------------------------------------------
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <inttypes.h>
 #include <limits.h>
 
 #define BMP_BYTES_PER_PIXEL 3U  // RGB
 #define BMP_FILE_HEADER_SIZE 14U
 #define BMP_INFO_HEADER_SIZE 40U
+#define PATH_SIZE 4096
+#define CORPUS_INDEX "index.txt"
 
 #define BYTE CHAR_BIT
 
@@ -19,125 +25,156 @@
     fprintf(stderr, "%s:%s:%lu: " msg, __FILE__, func, __LINE__+0UL, __VA_ARGS__); \
     exit(EXIT_FAILURE)
 
-static unsigned char *BMP_info_header(size_t height, size_t width);
-static unsigned char *BMP_file_header(size_t height, size_t stride);
-static void BMP_generate(unsigned char *img, size_t height, size_t width, const char *restrict filename);
-
-static unsigned char *BMP_info_header(size_t height, size_t width)
+// Images of the corpus: odd widths leave 1 to 3 bytes of padding per row,
+// extremes go from a single pixel to 32k wide and 8k tall
+static const struct {
+    uint32_t width, height;
+    uint16_t bitsperpixel;
+} corpus[] = {
+    {1, 1, 24}, {3, 2, 24}, {17, 9, 24},
+    {1023, 767, 24}, {1025, 769, 24}, {1026, 768, 24},
+    {1920, 1080, 24}, {1920, 1080, 32},
+    {4093, 2047, 24}, {4093, 2047, 32},
+    {32767, 33, 24}, {32768, 64, 24}, {33, 8191, 24},
+};
+
+static void put_le32(unsigned char *p, uint32_t v)
 {
-    static unsigned char info_header[] = {
-        0,0,0,0,   // header size
-        0,0,0,0,   // image width
-        0,0,0,0,   // image height
-        0,0,       // number of color planes
-        0,0,       // bits per pixel
-        0,0,0,0,   // compression
-        0,0,0,0,   // image size
-        0,0,0,0,   // horizontal resolution
-        0,0,0,0,   // vertical resolution
-        0,0,0,0,   // colors in color table
-        0,0,0,0,   // important color count
-    };
-
-    size_t imagesizebytes = height * width * BMP_BYTES_PER_PIXEL;
-
-    info_header[0] = (unsigned char) BMP_INFO_HEADER_SIZE;
-    info_header[4] = (unsigned char) width;
-    info_header[5] = (unsigned char) (width >> BYTE);
-    info_header[6] = (unsigned char) (width >> (2*BYTE));
-    info_header[7] = (unsigned char) (width >> (3*BYTE));
-    info_header[8] = (unsigned char) height;
-    info_header[9] = (unsigned char) (height >> BYTE);
-    info_header[10] = (unsigned char) (height >> (2*BYTE));
-    info_header[11] = (unsigned char) (height >> (3*BYTE));
-    info_header[12] = (unsigned char) 1;
-    info_header[14] = (unsigned char) (BMP_BYTES_PER_PIXEL * CHAR_BIT);
-    info_header[20] = (unsigned char) imagesizebytes;
-    info_header[21] = (unsigned char) (imagesizebytes >> BYTE);
-    info_header[22] = (unsigned char) (imagesizebytes >> (2*BYTE));
-    info_header[23] = (unsigned char) (imagesizebytes >> (3*BYTE));
-
-    return info_header;
+    p[0] = (unsigned char) v;
+    p[1] = (unsigned char) (v >> BYTE);
+    p[2] = (unsigned char) (v >> (2*BYTE));
+    p[3] = (unsigned char) (v >> (3*BYTE));
 }
 
-static unsigned char *BMP_file_header(size_t height, size_t stride)
+// A negative height gives a Top-Down image
+static void BMP_info_header(unsigned char info_header[BMP_INFO_HEADER_SIZE], int32_t height, uint32_t width,
+                            uint16_t bitsperpixel, uint32_t stride)
 {
-    uintmax_t filesz = BMP_FILE_HEADER_SIZE  + BMP_INFO_HEADER_SIZE + (stride * height);
+    for (size_t i = 0; i < BMP_INFO_HEADER_SIZE; i++) {
+        info_header[i] = 0;
+    }
+    put_le32(info_header, BMP_INFO_HEADER_SIZE);  // header size
+    put_le32(info_header + 4, width);             // image width
+    put_le32(info_header + 8, (uint32_t) height); // image height
+    info_header[12] = (unsigned char) 1;          // number of color planes
+    info_header[14] = (unsigned char) bitsperpixel;
+    /* compression, resolutions and colors stay 0 */
+    uint32_t abs_height = height < 0 ? 0U - (uint32_t) height : (uint32_t) height;
+    put_le32(info_header + 20, stride * abs_height);  // image size
+}
 
-    static unsigned char file_header[] = {
-        0,0,      // signature
-        0,0,0,0,  // image file size in bytes
-        0,0,0,0,  // reserved
-        0,0,0,0,  // start of pixel array
-    };
+static void BMP_file_header(unsigned char file_header[BMP_FILE_HEADER_SIZE], uint32_t height, uint32_t stride)
+{
+    uint32_t filesz = BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE + (stride * height);
 
-    file_header[0] = (unsigned char) 'B';
+    for (size_t i = 0; i < BMP_FILE_HEADER_SIZE; i++) {
+        file_header[i] = 0;
+    }
+    file_header[0] = (unsigned char) 'B';  // signature
     file_header[1] = (unsigned char) 'M';
-    file_header[2] = (unsigned char) filesz;
-    file_header[3] = (unsigned char) (filesz >> BYTE);
-    file_header[4] = (unsigned char) (filesz >> (2*BYTE));
-    file_header[5] = (unsigned char) (filesz >> (3*BYTE));
-    file_header[10] = (unsigned char) (BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE);
-
-    return file_header;
+    put_le32(file_header + 2, filesz);     // image file size in bytes
+    put_le32(file_header + 10, BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE);  // start of pixel array
 }
 
-void BMP_generate(unsigned char *img, size_t height, size_t width, const char *restrict filename)
+// Smooth gradients, pixel (i, j) counting from the top. 32 bpp pixels are
+// opaque.
+static void BMP_pixel(unsigned char *p, size_t i, size_t j, size_t height, size_t width, size_t bytes)
 {
-    size_t byte_width = width * BMP_BYTES_PER_PIXEL;
+    p[2] = (unsigned char) (i * 255 / height);
+    p[1] = (unsigned char) (j * 255 / width);
+    p[0] = (unsigned char) ((i+j) * 255 / (width+height));
+    if (bytes == 4) {
+        p[3] = 255;
+    }
+}
 
-    unsigned char padding[3] = {0, 0, 0};
+// Writes an image of generated pixels a row at a time, rows in file order
+static void BMP_generate(size_t height, size_t width, uint16_t bitsperpixel, bool top_down,
+                         const char *restrict filename)
+{
+    size_t bytes = bitsperpixel / BYTE;
+    size_t byte_width = width * bytes;
     size_t paddingsz = (4 - byte_width % 4) % 4;
     size_t stride = byte_width + paddingsz;
 
+    unsigned char *row = calloc(stride, 1);
+    if (!row) {
+        ERROR_MSG(__func__, "[ERROR]: no memory for %s\nexiting...\n", filename);
+    }
+
     FILE *imgfp = fopen(filename, "wb");
     if (!imgfp) {
         ERROR_MSG(__func__, "[ERROR]: opening %s\nexiting...\n", filename);
     }
 
-    unsigned char *file_header = BMP_file_header(height, stride);
+    unsigned char file_header[BMP_FILE_HEADER_SIZE];
+    BMP_file_header(file_header, (uint32_t) height, (uint32_t) stride);
     size_t nmemb = fwrite(file_header, 1, BMP_FILE_HEADER_SIZE, imgfp);
     if (nmemb != BMP_FILE_HEADER_SIZE) {
         ERROR_MSG(__func__, "[ERROR]: writing to %s\nexiting...\n", filename);
     }
 
-    unsigned char *info_header = BMP_info_header(height, width);
+    unsigned char info_header[BMP_INFO_HEADER_SIZE];
+    BMP_info_header(info_header, top_down ? -(int32_t) height : (int32_t) height, (uint32_t) width, bitsperpixel,
+                    (uint32_t) stride);
     nmemb = fwrite(info_header, 1, BMP_INFO_HEADER_SIZE, imgfp);
     if (nmemb != BMP_INFO_HEADER_SIZE) {
         ERROR_MSG(__func__, "[ERROR]: writing to %s\nexiting...\n", filename);
     }
 
-    for (size_t i = 0; i < height; i++) {
-        fwrite(img + i * byte_width, BMP_BYTES_PER_PIXEL, width, imgfp);
-        fwrite(padding, 1, paddingsz, imgfp);
+    /* Both orientations hold the same picture */
+    for (size_t k = 0; k < height; k++) {
+        size_t i = top_down ? k : height - 1 - k;
+        for (size_t j = 0; j < width; j++) {
+            BMP_pixel(row + j * bytes, i, j, height, width, bytes);
+        }
+        if (fwrite(row, stride, 1, imgfp) != 1) {
+            ERROR_MSG(__func__, "[ERROR]: writing to %s\nexiting...\n", filename);
+        }
     }
 
     if (fclose(imgfp) == EOF) {
         ERROR_MSG(__func__, "[WARN]: failed to close %s\nexiting...\n", filename);
     }
+    free(row);
 }
 
-int main(void)
+// Writes every image of the corpus in both orientations, and their names
+// to the index
+static void BMP_generate_corpus(const char *restrict dir)
 {
-    const size_t height = 2500;//420;
-    const size_t width = 3600;//860;
-    unsigned char *img = malloc(sizeof(*img) * height * width *BMP_BYTES_PER_PIXEL);
-    if (!img) {
-        perror("malloc failed");
-        exit(EXIT_FAILURE);
+    char path[PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", dir, CORPUS_INDEX);
+    FILE *index = fopen(path, "w");
+    if (!index) {
+        ERROR_MSG(__func__, "[ERROR]: opening %s\nexiting...\n", path);
     }
-    const char *filename = "BMP_testimg.bmp";
 
-    for (size_t i = 0; i < height; i++) {
-        for (size_t j = 0; j < width; j++) {
-            size_t offset = j + width * i;
-            unsigned char *pixeloffset = img + offset * BMP_BYTES_PER_PIXEL;
-            pixeloffset[2] = (unsigned char) (i * 255 / height);
-            pixeloffset[1] = (unsigned char) (j * 255 / width);
-            pixeloffset[0] = (unsigned char) ((i+j) * 255 / (width+height));
+    for (size_t k = 0; k < sizeof(corpus) / sizeof(corpus[0]); k++) {
+        for (int top_down = 0; top_down <= 1; top_down++) {
+            char name[64];
+            snprintf(name, sizeof(name), "%"PRIu32"x%"PRIu32"_%s_%u.bmp", corpus[k].width, corpus[k].height,
+                     top_down ? "td" : "bu", (unsigned) corpus[k].bitsperpixel);
+            snprintf(path, sizeof(path), "%s/%s", dir, name);
+            BMP_generate(corpus[k].height, corpus[k].width, corpus[k].bitsperpixel, top_down, path);
+            fprintf(index, "%s\n", name);
         }
     }
 
-    BMP_generate((unsigned char *) img, height, width, filename);
+    if (fclose(index) == EOF) {
+        ERROR_MSG(__func__, "[WARN]: failed to close %s\nexiting...\n", CORPUS_INDEX);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1) {
+        BMP_generate_corpus(argv[1]);
+        return 0;
+    }
+
+    const size_t height = 2500;//420;
+    const size_t width = 3600;//860;
+    BMP_generate(height, width, BMP_BYTES_PER_PIXEL * BYTE, false, "BMP_testimg.bmp");
     return 0;
 }